@@ -0,0 +1,770 @@
+/*
+ * Host benchmark for the NF chain. Frames come from a pcap file or one of
+ * the synthetic profiles below and are pushed through the same entry point
+ * the guest uses: the capture hook installed on a fake netif, with the
+ * tcpip flush callback run after every RX burst. Alternatively the chain
+ * can be driven directly, batched or one packet at a time.
+ */
+#include "pcap.h"
+#include "shim.h"
+#include "loom/capture.h"
+#include "loom/classify.h"
+#include "loom/clock.h"
+#include "loom/flow_export.h"
+#include "loom/mempool.h"
+#include "loom/nf_acl.h"
+#include "loom/nf_chain.h"
+#include "loom/nf_conntrack.h"
+#include "loom/nf_src_limiter.h"
+#include "loom/nf_synproxy.h"
+#include "loom/packet.h"
+#include "loom/sampler.h"
+#include "lwip/netif.h"
+#include "lwip/sys.h"
+#include "lwip/prot/ethernet.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+#include "lwip/prot/udp.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#define BENCH_CONTROL_PORT 9000
+#define BENCH_SERVER_IP    0xc0a8010a  /* 192.168.1.10 */
+#define BENCH_CLIENT_NET   0x0a000000  /* 10.0.0.0/8 */
+#define BENCH_MIN_FRAME    (SIZEOF_ETH_HDR + IP_HLEN + TCP_HLEN)
+
+typedef enum {
+    MODE_CAPTURE,
+    MODE_BATCH,
+    MODE_SINGLE,
+} bench_mode_t;
+
+typedef struct {
+    uint16_t len;
+    uint8_t *data;
+} frame_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t capacity;
+    frame_t *frames;
+} frame_set_t;
+
+typedef struct {
+    const char *pcap_path;
+    const char *profile;
+    bench_mode_t mode;
+    uint64_t packets;
+    uint32_t flows;
+    uint16_t frame_size;
+    uint16_t burst;
+    uint32_t seed;
+    uint32_t conntrack_capacity;
+    uint32_t src_limit;
+    uint32_t acl_rules;
+    int allow_first;
+    int allow_last;
+    int limit_port;
+    uint32_t limit_rate;
+    int synproxy_port;
+    bool scalar;
+    int sample_port;
+    uint32_t sample_every;
+    int flow_port;
+    uint32_t check_bursts;
+} bench_opts_t;
+
+static struct netif bench_netif;
+static uint64_t delivered = 0;
+static uint64_t transmitted = 0;
+
+static uint32_t rng_state;
+
+static uint32_t bench_rand(void)
+{
+    /* xorshift32, enough to spread addresses and stay reproducible */
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static err_t bench_sink_input(struct pbuf *p, struct netif *inp)
+{
+    delivered++;
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+static err_t bench_sink_output(struct netif *netif, struct pbuf *p)
+{
+    transmitted++;
+    return ERR_OK;
+}
+
+static int frame_set_push(frame_set_t *set, const uint8_t *data, uint16_t len)
+{
+    if (set->count == set->capacity) {
+        uint32_t capacity = set->capacity ? set->capacity * 2 : 256;
+        frame_t *frames = realloc(set->frames, capacity * sizeof(*frames));
+        if (!frames) {
+            return -1;
+        }
+        set->frames = frames;
+        set->capacity = capacity;
+    }
+
+    uint8_t *copy = malloc(len);
+    if (!copy) {
+        return -1;
+    }
+    memcpy(copy, data, len);
+
+    set->frames[set->count].len = len;
+    set->frames[set->count].data = copy;
+    set->count++;
+    return 0;
+}
+
+static void frame_set_free(frame_set_t *set)
+{
+    for (uint32_t i = 0; i < set->count; i++) {
+        free(set->frames[i].data);
+    }
+    free(set->frames);
+    memset(set, 0, sizeof(*set));
+}
+
+/* Addresses in host byte order */
+static int build_frame(frame_set_t *set, uint16_t size, uint8_t proto,
+                       uint32_t src, uint32_t dst, uint16_t sport,
+                       uint16_t dport, uint8_t tcp_flags)
+{
+    uint8_t buf[PBUF_POOL_BUFSIZE];
+
+    if (size < BENCH_MIN_FRAME) {
+        size = BENCH_MIN_FRAME;
+    }
+    memset(buf, 0, size);
+
+    struct eth_hdr *eth = (struct eth_hdr *)buf;
+    memcpy(eth->dest.addr, "\x52\x54\x00\x12\x34\x56", ETH_HWADDR_LEN);
+    memcpy(eth->src.addr, "\x52\x54\x00\x65\x43\x21", ETH_HWADDR_LEN);
+    eth->type = lwip_htons(ETHTYPE_IP);
+
+    struct ip_hdr *ip = (struct ip_hdr *)(buf + SIZEOF_ETH_HDR);
+    IPH_VHL_SET(ip, 4, IP_HLEN / 4);
+    IPH_LEN(ip) = lwip_htons(size - SIZEOF_ETH_HDR);
+    IPH_TTL(ip) = 64;
+    IPH_PROTO(ip) = proto;
+    ip->src.addr = lwip_htonl(src);
+    ip->dest.addr = lwip_htonl(dst);
+
+    uint8_t *l4 = buf + SIZEOF_ETH_HDR + IP_HLEN;
+    if (proto == IP_PROTO_TCP) {
+        struct tcp_hdr *tcp = (struct tcp_hdr *)l4;
+        tcp->src = lwip_htons(sport);
+        tcp->dest = lwip_htons(dport);
+        TCPH_HDRLEN_FLAGS_SET(tcp, TCP_HLEN / 4, tcp_flags);
+        tcp->wnd = lwip_htons(65535);
+    } else {
+        struct udp_hdr *udp = (struct udp_hdr *)l4;
+        udp->src = lwip_htons(sport);
+        udp->dest = lwip_htons(dport);
+        udp->len = lwip_htons(size - SIZEOF_ETH_HDR - IP_HLEN);
+    }
+
+    return frame_set_push(set, buf, size);
+}
+
+static uint32_t random_client(void)
+{
+    return BENCH_CLIENT_NET | (bench_rand() & 0x00ffffff);
+}
+
+/*
+ * Every profile fills a setup set, replayed once before timing starts (e.g.
+ * TCP handshakes so conntrack sees established flows), and the steady set
+ * that the measured run cycles through.
+ */
+static int build_profile(const bench_opts_t *opts, frame_set_t *setup,
+                         frame_set_t *steady)
+{
+    const char *profile = opts->profile;
+    uint16_t size = opts->frame_size;
+    int ret = 0;
+
+    if (strcmp(profile, "tcp-flows") == 0) {
+        for (uint32_t f = 0; f < opts->flows && ret == 0; f++) {
+            uint32_t client = random_client();
+            uint16_t sport = 1024 + (bench_rand() % 60000);
+            uint16_t dport = 80 + (f % 4);
+
+            ret |= build_frame(setup, size, IP_PROTO_TCP, client, BENCH_SERVER_IP,
+                               sport, dport, TCP_SYN);
+            ret |= build_frame(setup, size, IP_PROTO_TCP, BENCH_SERVER_IP, client,
+                               dport, sport, TCP_SYN | TCP_ACK);
+            ret |= build_frame(setup, size, IP_PROTO_TCP, client, BENCH_SERVER_IP,
+                               sport, dport, TCP_ACK);
+            ret |= build_frame(steady, size, IP_PROTO_TCP, client, BENCH_SERVER_IP,
+                               sport, dport, TCP_ACK | TCP_PSH);
+            ret |= build_frame(steady, size, IP_PROTO_TCP, BENCH_SERVER_IP, client,
+                               dport, sport, TCP_ACK);
+        }
+    } else if (strcmp(profile, "udp-flood") == 0) {
+        for (uint32_t f = 0; f < opts->flows && ret == 0; f++) {
+            ret |= build_frame(steady, size, IP_PROTO_UDP, random_client(),
+                               BENCH_SERVER_IP, 1024 + (bench_rand() % 60000),
+                               53, 0);
+        }
+    } else if (strcmp(profile, "syn-flood") == 0) {
+        for (uint32_t f = 0; f < opts->flows && ret == 0; f++) {
+            ret |= build_frame(steady, size, IP_PROTO_TCP, random_client(),
+                               BENCH_SERVER_IP, 1024 + (bench_rand() % 60000),
+                               80, TCP_SYN);
+        }
+    } else {
+        printf("[BENCH] ERROR: Unknown profile %s\n", profile);
+        return -1;
+    }
+
+    return ret;
+}
+
+static int load_pcap(const char *path, frame_set_t *steady)
+{
+    pcap_trace_t trace;
+
+    if (pcap_load(path, PBUF_POOL_BUFSIZE, &trace) < 0) {
+        return -1;
+    }
+
+    if (trace.count == 0) {
+        printf("[BENCH] ERROR: %s contains no frames\n", path);
+        pcap_free(&trace);
+        return -1;
+    }
+
+    /* Take ownership of the frame buffers rather than copying them again */
+    steady->frames = malloc(trace.count * sizeof(frame_t));
+    if (!steady->frames) {
+        pcap_free(&trace);
+        return -1;
+    }
+    for (uint32_t i = 0; i < trace.count; i++) {
+        steady->frames[i].len = trace.frames[i].len;
+        steady->frames[i].data = trace.frames[i].data;
+    }
+    steady->count = steady->capacity = trace.count;
+
+    printf("[BENCH] Loaded %u frames from %s", trace.count, path);
+    if (trace.truncated) {
+        printf(" (%u truncated to %u bytes)", trace.truncated, PBUF_POOL_BUFSIZE);
+    }
+    printf("\n");
+
+    free(trace.frames);
+    return 0;
+}
+
+static struct pbuf *frame_to_pbuf(const frame_t *frame)
+{
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, frame->len, PBUF_POOL);
+    if (p) {
+        memcpy(p->payload, frame->data, frame->len);
+    }
+    return p;
+}
+
+/* Returns how many packets the chain let through */
+static uint64_t run(const frame_set_t *set, uint64_t packets, bench_mode_t mode,
+                    uint16_t burst)
+{
+    struct pbuf *pkts[NF_BATCH_MAX];
+    pkt_meta_t meta[NF_BATCH_MAX];
+    classify_burst_t frames;
+    uint64_t passed = 0;
+    uint64_t start_delivered = delivered;
+    uint32_t next = 0;
+    uint64_t done = 0;
+
+    while (done < packets) {
+        uint16_t n = burst;
+        if (packets - done < n) {
+            n = (uint16_t)(packets - done);
+        }
+
+        for (uint16_t i = 0; i < n; i++) {
+            pkts[i] = frame_to_pbuf(&set->frames[next]);
+            if (++next == set->count) {
+                next = 0;
+            }
+        }
+
+        switch (mode) {
+        case MODE_CAPTURE:
+            for (uint16_t i = 0; i < n; i++) {
+                if (pkts[i]) {
+                    bench_netif.input(pkts[i], &bench_netif);
+                }
+            }
+            host_tcpip_poll();
+            break;
+
+        case MODE_BATCH: {
+            frames.count = n;
+            for (uint16_t i = 0; i < n; i++) {
+                frames.data[i] = (const uint8_t *)pkts[i]->payload;
+                frames.len[i] = pkts[i]->len;
+                frames.tot_len[i] = pkts[i]->tot_len;
+            }
+            classify_burst(&frames, meta, NULL, 0);
+            uint64_t mask = nf_chain_process_batch(pkts, meta, n);
+            passed += __builtin_popcountll(mask);
+            for (uint16_t i = 0; i < n; i++) {
+                pbuf_free(pkts[i]);
+            }
+            break;
+        }
+
+        case MODE_SINGLE:
+            for (uint16_t i = 0; i < n; i++) {
+                pkt_parse(pkts[i], &meta[i]);
+                if (nf_chain_process(pkts[i], &meta[i])) {
+                    passed++;
+                }
+                pbuf_free(pkts[i]);
+            }
+            break;
+        }
+
+        done += n;
+    }
+
+    if (mode == MODE_CAPTURE) {
+        passed = delivered - start_delivered;
+    }
+    return passed;
+}
+
+static void configure_acl(const bench_opts_t *opts)
+{
+    /* Deny rules on random client prefixes, none covering the whole /8 */
+    for (uint32_t i = 0; i < opts->acl_rules; i++) {
+        acl_rule_t rule = {0};
+        rule.depth = 9 + bench_rand() % 24;
+        rule.prefix = random_client() & ~((1ULL << (32 - rule.depth)) - 1);
+        rule.match = ACL_MATCH_SRC;
+        rule.action = ACL_DENY;
+        rule.port_hi = 0xffff;
+        if (nf_acl_stage_add(&rule) < 0) {
+            printf("[BENCH] WARN: Only staged %u ACL rules\n", i);
+            break;
+        }
+    }
+
+    if (opts->acl_rules && nf_acl_commit() < 0) {
+        printf("[BENCH] WARN: ACL commit failed\n");
+    }
+}
+
+static void print_nf_costs(double cycles_per_ns)
+{
+    const char *name;
+    nf_stats_t stats;
+
+    printf("[BENCH] %-14s %12s %12s %10s %10s\n",
+           "NF", "in", "dropped", "cyc/pkt", "ns/pkt");
+
+    for (int i = 0; nf_chain_get_stats(i, &name, &stats) == 0; i++) {
+        double cycles = stats.packets_in ?
+                        (double)stats.cycles / stats.packets_in : 0.0;
+        printf("[BENCH] %-14s %12llu %12llu %10.1f %10.2f\n",
+               name,
+               (unsigned long long)stats.packets_in,
+               (unsigned long long)stats.packets_dropped,
+               cycles, cycles / cycles_per_ns);
+    }
+}
+
+#define CHECK_FRAME_MAX 128
+
+static bool meta_equal(const pkt_meta_t *a, const pkt_meta_t *b)
+{
+    return a->ethertype == b->ethertype && a->pkt_len == b->pkt_len &&
+           a->l3_offset == b->l3_offset && a->l4_offset == b->l4_offset &&
+           a->l4_len == b->l4_len && a->proto == b->proto &&
+           a->flags == b->flags && a->tcp_flags == b->tcp_flags &&
+           a->src_ip == b->src_ip && a->dst_ip == b->dst_ip &&
+           a->src_port == b->src_port && a->dst_port == b->dst_port;
+}
+
+/*
+ * Random bursts of mostly-IPv4 frames with corrupted fields, short reads
+ * and fragments, classified by both implementations. Returns the number
+ * of bursts on which they disagree.
+ */
+static uint32_t check_classify(uint32_t bursts)
+{
+    static uint8_t frames[NF_BATCH_MAX][CHECK_FRAME_MAX];
+    static uint64_t bitmap[2 * 65536 / 64];
+    static const uint16_t ports[] = { BENCH_CONTROL_PORT, 9002, 9100 };
+    uint32_t mismatches = 0;
+
+    if (!classify_select(true)) {
+        printf("[BENCH] AVX2 classification not usable here, nothing to compare\n");
+        return 0;
+    }
+
+    for (size_t i = 0; i < sizeof(bitmap) / sizeof(bitmap[0]); i++) {
+        bitmap[i] = ((uint64_t)bench_rand() << 32) | bench_rand();
+    }
+
+    for (uint32_t n = 0; n < bursts; n++) {
+        classify_burst_t burst;
+        pkt_meta_t scalar[NF_BATCH_MAX], simd[NF_BATCH_MAX];
+
+        memset(scalar, 0xaa, sizeof(scalar));
+        memset(simd, 0x55, sizeof(simd));
+        burst.count = 1 + bench_rand() % NF_BATCH_MAX;
+
+        for (uint16_t i = 0; i < burst.count; i++) {
+            uint8_t *f = frames[i];
+
+            for (int j = 0; j < CHECK_FRAME_MAX; j++) {
+                f[j] = (uint8_t)bench_rand();
+            }
+            f[12] = 0x08;
+            f[13] = bench_rand() % 8 ? 0x00 : 0x06;
+            f[14] = bench_rand() % 8 ? 0x45 : 0x46;
+            f[16] = 0;
+            f[17] = bench_rand() % 100;
+            f[20] = bench_rand() % 4 ? 0x40 : (bench_rand() % 2 ? 0x20 : 0x00);
+            f[21] = bench_rand() % 4 ? 0 : 1;
+            f[23] = bench_rand() % 3 == 0 ? IP_PROTO_TCP
+                    : (bench_rand() % 2 ? IP_PROTO_UDP : IP_PROTO_ICMP);
+            if (bench_rand() % 3 == 0) {
+                f[36] = BENCH_CONTROL_PORT >> 8;
+                f[37] = BENCH_CONTROL_PORT & 0xff;
+            }
+
+            burst.data[i] = f;
+            burst.len[i] = bench_rand() % 4 ? 60 + bench_rand() % (CHECK_FRAME_MAX - 59)
+                                            : bench_rand() % 70;
+            burst.tot_len[i] = burst.len[i] + (bench_rand() % 2) * 100;
+        }
+
+        uint64_t all = (burst.count == NF_BATCH_MAX) ? ~0ULL
+                                                     : (1ULL << burst.count) - 1;
+        uint64_t mask = (((uint64_t)bench_rand() << 32) | bench_rand()) & all;
+
+        classify_select(false);
+        uint64_t tcp_scalar = classify_burst(&burst, scalar, ports, 3);
+        uint64_t hit_scalar = classify_port_lookup(scalar, burst.count, mask, bitmap);
+
+        classify_select(true);
+        uint64_t tcp_simd = classify_burst(&burst, simd, ports, 3);
+        uint64_t hit_simd = classify_port_lookup(scalar, burst.count, mask, bitmap);
+
+        bool same = tcp_scalar == tcp_simd && hit_scalar == hit_simd;
+        for (uint16_t i = 0; same && i < burst.count; i++) {
+            same = meta_equal(&scalar[i], &simd[i]);
+        }
+        if (!same) {
+            mismatches++;
+        }
+    }
+
+    printf("[BENCH] Classification check: %u random bursts, %u mismatches\n",
+           bursts, mismatches);
+    return mismatches;
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [options]\n"
+           "  -r FILE          replay a pcap file instead of a synthetic profile\n"
+           "  -p PROFILE       tcp-flows (default), udp-flood or syn-flood\n"
+           "  -f FLOWS         flows/sources in the synthetic profile (1024)\n"
+           "  -s BYTES         synthetic frame size (64)\n"
+           "  -n PACKETS       packets in the measured run (10000000)\n"
+           "  -m MODE          capture (default), batch or single\n"
+           "  -b BURST         packets per RX burst, at most %d (32)\n"
+           "  -c CAPACITY      conntrack capacity, 0 disables it (%d)\n"
+           "  -a FIRST[-LAST]  allowlist a TCP/UDP port range\n"
+           "  -l PORT:PPS      rate limit a destination port\n"
+           "  -S PPS           per-source packet limit\n"
+           "  -k PORT          answer SYNs to PORT with cookies (SYN proxy)\n"
+           "  -A RULES         commit RULES random source-prefix deny rules\n"
+           "  -V               scalar header classification, even with AVX2\n"
+           "  -C BURSTS        compare AVX2 and scalar classification on BURSTS\n"
+           "                   random bursts, then exit (1 on any mismatch)\n"
+           "  -P PORT[:N]      wait for a client on 127.0.0.1:PORT, stream 1 in N\n"
+           "                   frames to it as pcap\n"
+           "  -F PORT          export flow records to 127.0.0.1:PORT over UDP\n"
+           "  -x SEED          seed for the synthetic generator (1)\n",
+           prog, NF_BATCH_MAX, CONNTRACK_DEFAULT_CAPACITY);
+}
+
+static int parse_opts(int argc, char **argv, bench_opts_t *opts)
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "r:p:f:s:n:m:b:c:a:l:S:k:A:x:VC:P:F:h")) != -1) {
+        switch (c) {
+        case 'r': opts->pcap_path = optarg; break;
+        case 'p': opts->profile = optarg; break;
+        case 'f': opts->flows = strtoul(optarg, NULL, 0); break;
+        case 's': opts->frame_size = strtoul(optarg, NULL, 0); break;
+        case 'n': opts->packets = strtoull(optarg, NULL, 0); break;
+        case 'b': opts->burst = strtoul(optarg, NULL, 0); break;
+        case 'c': opts->conntrack_capacity = strtoul(optarg, NULL, 0); break;
+        case 'S': opts->src_limit = strtoul(optarg, NULL, 0); break;
+        case 'A': opts->acl_rules = strtoul(optarg, NULL, 0); break;
+        case 'x': opts->seed = strtoul(optarg, NULL, 0); break;
+        case 'V': opts->scalar = true; break;
+        case 'C': opts->check_bursts = strtoul(optarg, NULL, 0); break;
+        case 'P':
+            if (sscanf(optarg, "%d:%u", &opts->sample_port, &opts->sample_every) < 1 ||
+                opts->sample_port <= 0 || opts->sample_port > 65535) {
+                return -1;
+            }
+            break;
+        case 'F':
+            opts->flow_port = strtol(optarg, NULL, 0);
+            if (opts->flow_port <= 0 || opts->flow_port > 65535) {
+                return -1;
+            }
+            break;
+        case 'm':
+            if (strcasecmp(optarg, "capture") == 0) {
+                opts->mode = MODE_CAPTURE;
+            } else if (strcasecmp(optarg, "batch") == 0) {
+                opts->mode = MODE_BATCH;
+            } else if (strcasecmp(optarg, "single") == 0) {
+                opts->mode = MODE_SINGLE;
+            } else {
+                return -1;
+            }
+            break;
+        case 'a':
+            if (sscanf(optarg, "%d-%d", &opts->allow_first, &opts->allow_last) == 1) {
+                opts->allow_last = opts->allow_first;
+            }
+            if (opts->allow_first < 0 || opts->allow_last > 65535 ||
+                opts->allow_first > opts->allow_last) {
+                return -1;
+            }
+            break;
+        case 'l':
+            if (sscanf(optarg, "%d:%u", &opts->limit_port, &opts->limit_rate) != 2 ||
+                opts->limit_port < 0 || opts->limit_port > 65535) {
+                return -1;
+            }
+            break;
+        case 'k':
+            opts->synproxy_port = atoi(optarg);
+            if (opts->synproxy_port <= 0 || opts->synproxy_port > 65535) {
+                return -1;
+            }
+            break;
+        default:
+            return -1;
+        }
+    }
+
+    if (opts->burst == 0 || opts->burst > NF_BATCH_MAX ||
+        opts->flows == 0 || opts->packets == 0 ||
+        opts->frame_size > PBUF_POOL_BUFSIZE) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static const char *mode_name(bench_mode_t mode)
+{
+    switch (mode) {
+    case MODE_CAPTURE: return "capture";
+    case MODE_BATCH:   return "batch";
+    default:           return "single";
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bench_opts_t opts = {
+        .profile = "tcp-flows",
+        .mode = MODE_CAPTURE,
+        .packets = 10000000,
+        .flows = 1024,
+        .frame_size = 64,
+        .burst = 32,
+        .seed = 1,
+        .conntrack_capacity = CONNTRACK_DEFAULT_CAPACITY,
+        .allow_first = -1,
+        .limit_port = -1,
+        .synproxy_port = -1,
+        .sample_every = 1,
+    };
+    frame_set_t setup = {0};
+    frame_set_t steady = {0};
+
+    if (parse_opts(argc, argv, &opts) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    rng_state = opts.seed ? opts.seed : 1;
+
+    if (opts.check_bursts) {
+        return check_classify(opts.check_bursts) ? 1 : 0;
+    }
+
+    if (opts.pcap_path) {
+        if (load_pcap(opts.pcap_path, &steady) < 0) {
+            return 1;
+        }
+    } else if (build_profile(&opts, &setup, &steady) < 0) {
+        return 1;
+    }
+
+    /* Conntrack rounds up to a power of two of 32 B entries */
+    if (mem_arena_init(LOOM_ARENA_SIZE + (size_t)opts.conntrack_capacity * 64) < 0) {
+        return 1;
+    }
+
+    if (opts.conntrack_capacity && nf_conntrack_init(opts.conntrack_capacity) < 0) {
+        printf("[BENCH] WARN: Connection tracking disabled\n");
+    }
+
+    classify_init(!opts.scalar);
+    nf_chain_init();
+
+    if (opts.allow_first >= 0) {
+        nf_allowlist_add_range(opts.allow_first, opts.allow_last, ALLOW_PROTO_ANY);
+    }
+    if (opts.limit_port >= 0) {
+        nf_rate_limiter_set_limit(opts.limit_port, opts.limit_rate,
+                                  opts.limit_rate, RATE_LIMIT_PPS);
+    }
+    if (opts.src_limit) {
+        nf_src_limiter_set_limit(opts.src_limit);
+    }
+    configure_acl(&opts);
+
+    bench_netif.name[0] = 'b';
+    bench_netif.name[1] = 'n';
+    bench_netif.input = bench_sink_input;
+    if (capture_hook_init(&bench_netif, BENCH_CONTROL_PORT) < 0) {
+        return 1;
+    }
+
+    if (opts.synproxy_port > 0) {
+        bench_netif.ip_addr.addr = lwip_htonl(BENCH_SERVER_IP);
+        bench_netif.linkoutput = bench_sink_output;
+        if (nf_synproxy_init(&bench_netif, SYNPROXY_DEFAULT_CAPACITY) < 0) {
+            return 1;
+        }
+        nf_synproxy_protect(opts.synproxy_port, true);
+        nf_synproxy_set_enabled(true);
+    }
+
+    if (opts.sample_port > 0) {
+        sampler_filter_t filter = { .every = opts.sample_every };
+
+        if (sampler_init(opts.sample_port) < 0) {
+            return 1;
+        }
+        sampler_set_filter(&filter);
+        sampler_set_enabled(true);
+        while (!sampler_get_stats().streaming) {
+            sys_msleep(10);
+        }
+    }
+
+    if (opts.flow_port > 0) {
+        if (flow_export_init(FLOW_DEFAULT_CAPACITY) < 0) {
+            return 1;
+        }
+        flow_export_set_collector(htonl(INADDR_LOOPBACK), opts.flow_port);
+        flow_export_set_enabled(true);
+    }
+
+    /* Warm up caches and flow state, then measure from clean counters */
+    if (setup.count) {
+        run(&setup, setup.count, opts.mode, opts.burst);
+    }
+    run(&steady, steady.count, opts.mode, opts.burst);
+    nf_chain_reset_stats();
+
+    printf("[BENCH] %s: %u distinct frames, mode %s, burst %u, classify %s\n",
+           opts.pcap_path ? opts.pcap_path : opts.profile,
+           steady.count, mode_name(opts.mode), opts.burst,
+           classify_impl_name());
+
+    uint64_t start_ns = loom_now_ns();
+    uint64_t start_cycles = loom_cycles();
+
+    uint64_t passed = run(&steady, opts.packets, opts.mode, opts.burst);
+
+    uint64_t elapsed_cycles = loom_cycles() - start_cycles;
+    uint64_t elapsed_ns = loom_now_ns() - start_ns;
+
+    if (elapsed_ns == 0) {
+        elapsed_ns = 1;
+    }
+    double cycles_per_ns = (double)elapsed_cycles / elapsed_ns;
+
+    printf("[BENCH] %llu packets in %.3f s: %.3f Mpps, %.1f ns/pkt\n",
+           (unsigned long long)opts.packets, elapsed_ns / 1e9,
+           opts.packets * 1e3 / elapsed_ns, (double)elapsed_ns / opts.packets);
+    printf("[BENCH] Passed %llu, dropped %llu, cycle counter %.2f GHz\n",
+           (unsigned long long)passed,
+           (unsigned long long)(opts.packets - passed), cycles_per_ns);
+
+    print_nf_costs(cycles_per_ns);
+
+    if (opts.synproxy_port > 0) {
+        synproxy_stats_t sp = nf_synproxy_get_stats();
+        printf("[BENCH] SYN proxy: %llu cookies sent, %llu frames transmitted\n",
+               (unsigned long long)sp.syns, (unsigned long long)transmitted);
+    }
+
+    if (opts.sample_port > 0) {
+        sys_msleep(2 * 20);     /* Let the stream drain the ring */
+        sampler_stats_t st = sampler_get_stats();
+        printf("[BENCH] Sampler: %llu sampled, %llu streamed, %llu lost\n",
+               (unsigned long long)st.sampled, (unsigned long long)st.streamed,
+               (unsigned long long)st.lost);
+    }
+
+    if (opts.flow_port > 0) {
+        /* Turning export off flushes every flow still in the tables */
+        flow_export_set_enabled(false);
+        while (flow_export_get_stats().active > 0) {
+            sys_msleep(100);
+        }
+        sys_msleep(200);
+        flow_stats_t st = flow_export_get_stats();
+        printf("[BENCH] Flows: %llu created, %llu evicted, %llu records in "
+               "%llu datagrams, %llu lost, %llu send failures\n",
+               (unsigned long long)st.created, (unsigned long long)st.evicted,
+               (unsigned long long)st.exported, (unsigned long long)st.datagrams,
+               (unsigned long long)st.lost, (unsigned long long)st.send_failed);
+    }
+
+    if (host_pbuf_outstanding() != 0) {
+        printf("[BENCH] WARN: %llu pbufs still outstanding\n",
+               (unsigned long long)host_pbuf_outstanding());
+    }
+
+    frame_set_free(&setup);
+    frame_set_free(&steady);
+    return 0;
+}
@@ -0,0 +1,23 @@
+/* Host shim: the subset of lwIP the NF chain compiles against */
+#ifndef LWIP_HDR_ARCH_H
+#define LWIP_HDR_ARCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t u8_t;
+typedef int8_t s8_t;
+typedef uint16_t u16_t;
+typedef int16_t s16_t;
+typedef uint32_t u32_t;
+typedef int32_t s32_t;
+
+#define PACK_STRUCT_BEGIN
+#define PACK_STRUCT_END
+#define PACK_STRUCT_STRUCT __attribute__((packed))
+#define PACK_STRUCT_FIELD(x) x
+#define PACK_STRUCT_FLD_8(x) x
+#define PACK_STRUCT_FLD_S(x) x
+#define LWIP_UNUSED_ARG(x) (void)x
+
+#endif /* LWIP_HDR_ARCH_H */
@@ -0,0 +1,18 @@
+#ifndef LWIP_HDR_DEF_H
+#define LWIP_HDR_DEF_H
+
+#include "lwip/arch.h"
+#include <arpa/inet.h>
+
+#define lwip_htons(x) htons(x)
+#define lwip_ntohs(x) ntohs(x)
+#define lwip_htonl(x) htonl(x)
+#define lwip_ntohl(x) ntohl(x)
+
+#define PP_HTONS(x) ((u16_t)((((x) & 0xff) << 8) | (((x) & 0xff00) >> 8)))
+#define PP_NTOHS(x) PP_HTONS(x)
+
+#define LWIP_MIN(x, y) (((x) < (y)) ? (x) : (y))
+#define LWIP_MAX(x, y) (((x) > (y)) ? (x) : (y))
+
+#endif /* LWIP_HDR_DEF_H */
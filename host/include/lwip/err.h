@@ -0,0 +1,15 @@
+#ifndef LWIP_HDR_ERR_H
+#define LWIP_HDR_ERR_H
+
+#include "lwip/arch.h"
+
+typedef s8_t err_t;
+
+#define ERR_OK   0
+#define ERR_MEM  -1
+#define ERR_BUF  -2
+#define ERR_VAL  -6
+#define ERR_IF   -12
+#define ERR_ARG  -16
+
+#endif /* LWIP_HDR_ERR_H */
@@ -0,0 +1,42 @@
+#ifndef LWIP_HDR_NETIF_H
+#define LWIP_HDR_NETIF_H
+
+#include "lwip/arch.h"
+#include "lwip/def.h"
+#include "lwip/err.h"
+#include "lwip/pbuf.h"
+
+struct netif;
+
+typedef err_t (*netif_input_fn)(struct pbuf *p, struct netif *inp);
+typedef err_t (*netif_linkoutput_fn)(struct netif *netif, struct pbuf *p);
+
+typedef struct {
+    u32_t addr;
+} ip4_addr_t;
+
+struct netif {
+    struct netif *next;
+    ip4_addr_t ip_addr;
+    ip4_addr_t netmask;
+    ip4_addr_t gw;
+    netif_input_fn input;
+    netif_linkoutput_fn linkoutput;
+    void *state;
+    u16_t mtu;
+    u8_t hwaddr[6];
+    u8_t hwaddr_len;
+    u8_t flags;
+    char name[2];
+    u8_t num;
+};
+
+extern struct netif *netif_default;
+
+#define netif_ip4_addr(n)    (&(n)->ip_addr)
+#define netif_ip4_netmask(n) (&(n)->netmask)
+#define netif_ip4_gw(n)      (&(n)->gw)
+
+char *ip4addr_ntoa_r(const ip4_addr_t *addr, char *buf, int buflen);
+
+#endif /* LWIP_HDR_NETIF_H */
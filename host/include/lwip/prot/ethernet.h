@@ -0,0 +1,9 @@
+#ifndef LWIP_HDR_PROT_ETHERNET_H
+#define LWIP_HDR_PROT_ETHERNET_H
+#include "lwip/arch.h"
+#define ETH_HWADDR_LEN 6
+struct eth_addr { u8_t addr[ETH_HWADDR_LEN]; } __attribute__((packed));
+struct eth_hdr { struct eth_addr dest; struct eth_addr src; u16_t type; } __attribute__((packed));
+#define SIZEOF_ETH_HDR 14
+enum eth_type { ETHTYPE_IP = 0x0800U, ETHTYPE_ARP = 0x0806U, ETHTYPE_VLAN = 0x8100U, ETHTYPE_IPV6 = 0x86DDU };
+#endif
@@ -0,0 +1,6 @@
+#ifndef LWIP_HDR_PROT_UDP_H
+#define LWIP_HDR_PROT_UDP_H
+#include "lwip/arch.h"
+#define UDP_HLEN 8
+struct udp_hdr { u16_t src; u16_t dest; u16_t len; u16_t chksum; } __attribute__((packed));
+#endif
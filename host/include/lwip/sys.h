@@ -0,0 +1,27 @@
+#ifndef LWIP_HDR_SYS_H
+#define LWIP_HDR_SYS_H
+
+#include "lwip/arch.h"
+#include "lwip/err.h"
+#include <pthread.h>
+
+typedef void *sys_thread_t;
+typedef pthread_mutex_t sys_mutex_t;
+typedef void (*lwip_thread_fn)(void *arg);
+
+sys_thread_t sys_thread_new(const char *name, lwip_thread_fn thread, void *arg,
+                            int stacksize, int prio);
+
+err_t sys_mutex_new(sys_mutex_t *mutex);
+void sys_mutex_lock(sys_mutex_t *mutex);
+void sys_mutex_unlock(sys_mutex_t *mutex);
+
+void sys_msleep(u32_t ms);
+u32_t sys_now(void);
+
+/* The bench drives the RX path from a single thread */
+#define SYS_ARCH_DECL_PROTECT(lev) int lev
+#define SYS_ARCH_PROTECT(lev)      ((void)(lev = 0))
+#define SYS_ARCH_UNPROTECT(lev)    ((void)(lev))
+
+#endif /* LWIP_HDR_SYS_H */
@@ -0,0 +1,10 @@
+#ifndef LWIP_HDR_TCPIP_H
+#define LWIP_HDR_TCPIP_H
+
+#include "lwip/err.h"
+
+typedef void (*tcpip_callback_fn)(void *ctx);
+
+err_t tcpip_try_callback(tcpip_callback_fn function, void *ctx);
+
+#endif /* LWIP_HDR_TCPIP_H */
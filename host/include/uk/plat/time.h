@@ -0,0 +1,10 @@
+#ifndef UK_PLAT_TIME_H
+#define UK_PLAT_TIME_H
+
+#include <stdint.h>
+
+typedef uint64_t __nsec;
+
+__nsec ukplat_monotonic_clock(void);
+
+#endif /* UK_PLAT_TIME_H */
@@ -0,0 +1,6 @@
+#ifndef UK_SCHED_H
+#define UK_SCHED_H
+
+void uk_sched_yield(void);
+
+#endif /* UK_SCHED_H */
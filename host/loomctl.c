@@ -0,0 +1,364 @@
+/*
+ * Push a rule set to a running loom instance over the binary control
+ * protocol, as one transaction.
+ *
+ *   loomctl [-H host] [-p port] [-r] [rules-file]
+ *
+ * One rule per line, '#' starts a comment:
+ *   allow <port>[-<port>] [tcp|udp]
+ *   disallow <port>[-<port>] [tcp|udp]
+ *   acl <src|dst> <cidr|any> [tcp|udp|icmp] [port[-port]] <allow|deny>
+ *   acl default <allow|deny>
+ *
+ * With -r the rule set replaces the active ACL and allowlist instead of
+ * being applied on top of them.
+ */
+
+#include "loom/control_proto.h"
+#include "loom/nf_acl.h"
+#include "loom/nf_chain.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define LINE_MAX_LEN 256
+
+static uint8_t payload[CTL_MAX_PAYLOAD];
+static uint32_t payload_len = 0;
+static uint32_t seq = 0;
+
+static const char *status_names[] = {
+    [CTL_OK] = "ok",
+    [CTL_ERR_PROTO] = "protocol error",
+    [CTL_ERR_STATE] = "no transaction",
+    [CTL_ERR_RECORD] = "invalid record",
+    [CTL_ERR_LIMIT] = "transaction too large",
+    [CTL_ERR_APPLY] = "commit failed",
+};
+
+static int send_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int recv_all(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Send one message and wait for its reply */
+static int transact(int fd, uint8_t type, const void *data, uint32_t len,
+                    ctl_reply_t *reply)
+{
+    ctl_hdr_t hdr = {
+        .magic = htons(CTL_MAGIC),
+        .version = CTL_VERSION,
+        .type = type,
+        .seq = htonl(++seq),
+        .len = htonl(len),
+    };
+
+    if (send_all(fd, &hdr, sizeof(hdr)) < 0 ||
+        (len && send_all(fd, data, len) < 0) ||
+        recv_all(fd, &hdr, sizeof(hdr)) < 0 ||
+        ntohl(hdr.len) != sizeof(*reply) ||
+        recv_all(fd, reply, sizeof(*reply)) < 0) {
+        fprintf(stderr, "loomctl: connection lost\n");
+        return -1;
+    }
+
+    reply->status = ntohl(reply->status);
+    reply->count = ntohl(reply->count);
+
+    if (reply->status != CTL_OK) {
+        fprintf(stderr, "loomctl: %s (record %u)\n",
+                reply->status < sizeof(status_names) / sizeof(status_names[0]) ?
+                status_names[reply->status] : "unknown error", reply->count);
+        return -1;
+    }
+    return 0;
+}
+
+static int flush_records(int fd)
+{
+    ctl_reply_t reply;
+
+    if (payload_len == 0) {
+        return 0;
+    }
+    if (transact(fd, CTL_MSG_RULES, payload, payload_len, &reply) < 0) {
+        return -1;
+    }
+    payload_len = 0;
+    return 0;
+}
+
+static int add_record(int fd, uint8_t type, const void *value, uint16_t len)
+{
+    ctl_tlv_t tlv = { .type = type, .len = htons(len) };
+
+    if (payload_len + sizeof(tlv) + len > sizeof(payload) &&
+        flush_records(fd) < 0) {
+        return -1;
+    }
+
+    memcpy(payload + payload_len, &tlv, sizeof(tlv));
+    memcpy(payload + payload_len + sizeof(tlv), value, len);
+    payload_len += sizeof(tlv) + len;
+    return 0;
+}
+
+static int parse_ports(const char *arg, uint16_t *lo, uint16_t *hi)
+{
+    char *end;
+    unsigned long first = strtoul(arg, &end, 10);
+    unsigned long last = first;
+
+    if (end == arg || first > 65535) {
+        return -1;
+    }
+    if (*end == '-') {
+        const char *start = end + 1;
+        last = strtoul(start, &end, 10);
+        if (end == start || last > 65535 || last < first) {
+            return -1;
+        }
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+
+    *lo = (uint16_t)first;
+    *hi = (uint16_t)last;
+    return 0;
+}
+
+static int parse_allow(char **tok, int count, uint8_t type, int fd)
+{
+    ctl_rec_ports_t rec = {0};
+    uint16_t lo, hi;
+
+    if (count < 2 || count > 3 || parse_ports(tok[1], &lo, &hi) < 0) {
+        return -1;
+    }
+
+    rec.first = htons(lo);
+    rec.last = htons(hi);
+    rec.protos = ALLOW_PROTO_ANY;
+    if (count == 3) {
+        if (strcasecmp(tok[2], "tcp") == 0) {
+            rec.protos = ALLOW_PROTO_TCP;
+        } else if (strcasecmp(tok[2], "udp") == 0) {
+            rec.protos = ALLOW_PROTO_UDP;
+        } else {
+            return -1;
+        }
+    }
+
+    return add_record(fd, type, &rec, sizeof(rec));
+}
+
+static int parse_acl(char **tok, int count, int fd)
+{
+    if (count == 3 && strcasecmp(tok[1], "default") == 0) {
+        ctl_rec_acl_default_t rec = {0};
+
+        if (strcasecmp(tok[2], "allow") == 0) {
+            rec.action = ACL_ALLOW;
+        } else if (strcasecmp(tok[2], "deny") == 0) {
+            rec.action = ACL_DENY;
+        } else {
+            return -1;
+        }
+        return add_record(fd, CTL_REC_ACL_DEFAULT, &rec, sizeof(rec));
+    }
+
+    ctl_rec_acl_t rec = {0};
+    uint16_t lo = 0, hi = 0xffff;
+
+    if (count < 4 || count > 6) {
+        return -1;
+    }
+
+    if (strcasecmp(tok[1], "src") == 0) {
+        rec.match = ACL_MATCH_SRC;
+    } else if (strcasecmp(tok[1], "dst") == 0) {
+        rec.match = ACL_MATCH_DST;
+    } else {
+        return -1;
+    }
+
+    if (strcasecmp(tok[2], "any") != 0) {
+        char *slash = strchr(tok[2], '/');
+        unsigned long depth = 32;
+        struct in_addr addr;
+
+        if (slash) {
+            char *end;
+            *slash = '\0';
+            depth = strtoul(slash + 1, &end, 10);
+            if (*end != '\0' || end == slash + 1 || depth > 32) {
+                return -1;
+            }
+        }
+        if (inet_pton(AF_INET, tok[2], &addr) != 1) {
+            return -1;
+        }
+        rec.prefix = addr.s_addr;
+        rec.depth = (uint8_t)depth;
+    }
+
+    if (strcasecmp(tok[count - 1], "allow") == 0) {
+        rec.action = ACL_ALLOW;
+    } else if (strcasecmp(tok[count - 1], "deny") == 0) {
+        rec.action = ACL_DENY;
+    } else {
+        return -1;
+    }
+
+    for (int i = 3; i < count - 1; i++) {
+        if (strcasecmp(tok[i], "tcp") == 0) {
+            rec.proto = IPPROTO_TCP;
+        } else if (strcasecmp(tok[i], "udp") == 0) {
+            rec.proto = IPPROTO_UDP;
+        } else if (strcasecmp(tok[i], "icmp") == 0) {
+            rec.proto = IPPROTO_ICMP;
+        } else if (parse_ports(tok[i], &lo, &hi) < 0) {
+            return -1;
+        }
+    }
+
+    rec.port_lo = htons(lo);
+    rec.port_hi = htons(hi);
+    return add_record(fd, CTL_REC_ACL_ADD, &rec, sizeof(rec));
+}
+
+static int connect_to(const char *host, const char *port)
+{
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+    int fd;
+
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        fprintf(stderr, "loomctl: cannot resolve %s\n", host);
+        return -1;
+    }
+
+    fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (fd < 0) {
+        fprintf(stderr, "loomctl: cannot connect to %s:%s\n", host, port);
+    }
+    return fd;
+}
+
+int main(int argc, char **argv)
+{
+    const char *host = "127.0.0.1";
+    const char *port = "9002";
+    ctl_begin_t begin = {0};
+    ctl_reply_t reply;
+    FILE *in = stdin;
+    char line[LINE_MAX_LEN];
+    int lineno = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:p:rh")) != -1) {
+        switch (opt) {
+        case 'H': host = optarg; break;
+        case 'p': port = optarg; break;
+        case 'r': begin.flags = htonl(CTL_BEGIN_REPLACE); break;
+        default:
+            fprintf(stderr, "usage: %s [-H host] [-p port] [-r] [rules-file]\n",
+                    argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind < argc && !(in = fopen(argv[optind], "r"))) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    int fd = connect_to(host, port);
+    if (fd < 0 || transact(fd, CTL_MSG_BEGIN, &begin, sizeof(begin), &reply) < 0) {
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), in)) {
+        char *tok[8];
+        char *save = NULL;
+        int count = 0;
+        int ret;
+
+        lineno++;
+        char *hash = strchr(line, '#');
+        if (hash) {
+            *hash = '\0';
+        }
+
+        for (char *t = strtok_r(line, " \t\r\n", &save); t && count < 8;
+             t = strtok_r(NULL, " \t\r\n", &save)) {
+            tok[count++] = t;
+        }
+        if (count == 0) {
+            continue;
+        }
+
+        if (strcasecmp(tok[0], "allow") == 0) {
+            ret = parse_allow(tok, count, CTL_REC_ALLOW_ADD, fd);
+        } else if (strcasecmp(tok[0], "disallow") == 0) {
+            ret = parse_allow(tok, count, CTL_REC_ALLOW_REMOVE, fd);
+        } else if (strcasecmp(tok[0], "acl") == 0) {
+            ret = parse_acl(tok, count, fd);
+        } else {
+            ret = -1;
+        }
+
+        if (ret < 0) {
+            fprintf(stderr, "loomctl: line %d: invalid rule\n", lineno);
+            transact(fd, CTL_MSG_ABORT, NULL, 0, &reply);
+            return 1;
+        }
+    }
+
+    if (flush_records(fd) < 0 ||
+        transact(fd, CTL_MSG_COMMIT, NULL, 0, &reply) < 0) {
+        return 1;
+    }
+
+    printf("loomctl: committed %u record(s)\n", reply.count);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include "pcap.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PCAP_MAGIC_USEC    0xa1b2c3d4
+#define PCAP_MAGIC_NSEC    0xa1b23c4d
+#define PCAP_LINKTYPE_ETH  1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+} pcap_file_hdr_t;
+
+typedef struct {
+    uint32_t ts_sec;
+    uint32_t ts_frac;
+    uint32_t caplen;
+    uint32_t len;
+} pcap_rec_hdr_t;
+
+static uint32_t pcap_swap32(uint32_t v, int swap)
+{
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+int pcap_load(const char *path, uint16_t max_len, pcap_trace_t *trace)
+{
+    FILE *f = fopen(path, "rb");
+    pcap_file_hdr_t hdr;
+    uint32_t capacity = 0;
+    uint8_t *buf = NULL;
+    int swap;
+
+    memset(trace, 0, sizeof(*trace));
+
+    if (!f) {
+        printf("[PCAP] ERROR: Cannot open %s\n", path);
+        return -1;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1) {
+        printf("[PCAP] ERROR: %s is too short\n", path);
+        goto fail;
+    }
+
+    if (hdr.magic == PCAP_MAGIC_USEC || hdr.magic == PCAP_MAGIC_NSEC) {
+        swap = 0;
+    } else if (__builtin_bswap32(hdr.magic) == PCAP_MAGIC_USEC ||
+               __builtin_bswap32(hdr.magic) == PCAP_MAGIC_NSEC) {
+        swap = 1;
+    } else {
+        printf("[PCAP] ERROR: %s is not a pcap file (pcapng is not supported)\n",
+               path);
+        goto fail;
+    }
+
+    if (pcap_swap32(hdr.linktype, swap) != PCAP_LINKTYPE_ETH) {
+        printf("[PCAP] ERROR: Link type %u is not Ethernet\n",
+               pcap_swap32(hdr.linktype, swap));
+        goto fail;
+    }
+
+    for (;;) {
+        pcap_rec_hdr_t rec;
+
+        if (fread(&rec, sizeof(rec), 1, f) != 1) {
+            break;
+        }
+
+        uint32_t caplen = pcap_swap32(rec.caplen, swap);
+        if (caplen > 0x40000) {
+            printf("[PCAP] ERROR: Corrupt record after %u frames\n", trace->count);
+            goto fail;
+        }
+
+        uint8_t *tmp = realloc(buf, caplen ? caplen : 1);
+        if (!tmp) {
+            goto fail;
+        }
+        buf = tmp;
+
+        if (fread(buf, 1, caplen, f) != caplen) {
+            break;
+        }
+
+        if (trace->count == capacity) {
+            uint32_t new_capacity = capacity ? capacity * 2 : 1024;
+            pcap_frame_t *frames = realloc(trace->frames,
+                                           new_capacity * sizeof(*frames));
+            if (!frames) {
+                goto fail;
+            }
+            trace->frames = frames;
+            capacity = new_capacity;
+        }
+
+        uint16_t len = caplen > max_len ? max_len : (uint16_t)caplen;
+        if (caplen > max_len) {
+            trace->truncated++;
+        }
+
+        pcap_frame_t *frame = &trace->frames[trace->count];
+        frame->len = len;
+        frame->data = malloc(len ? len : 1);
+        if (!frame->data) {
+            goto fail;
+        }
+        memcpy(frame->data, buf, len);
+        trace->count++;
+    }
+
+    free(buf);
+    fclose(f);
+    return 0;
+
+fail:
+    free(buf);
+    fclose(f);
+    pcap_free(trace);
+    return -1;
+}
+
+void pcap_free(pcap_trace_t *trace)
+{
+    for (uint32_t i = 0; i < trace->count; i++) {
+        free(trace->frames[i].data);
+    }
+    free(trace->frames);
+    memset(trace, 0, sizeof(*trace));
+}
@@ -0,0 +1,22 @@
+#ifndef LOOM_HOST_PCAP_H
+#define LOOM_HOST_PCAP_H
+
+#include <stdint.h>
+
+typedef struct {
+    uint16_t len;
+    uint8_t *data;
+} pcap_frame_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t truncated;         /* frames clipped to the pbuf size */
+    pcap_frame_t *frames;
+} pcap_trace_t;
+
+/* Load every Ethernet frame of a classic (non-ng) pcap file into memory */
+int pcap_load(const char *path, uint16_t max_len, pcap_trace_t *trace);
+
+void pcap_free(pcap_trace_t *trace);
+
+#endif /* LOOM_HOST_PCAP_H */
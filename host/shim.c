@@ -0,0 +1,254 @@
+/*
+ * Userspace stand-ins for the lwIP and Unikraft services the NF chain uses.
+ * Only what the chain, capture hook and NFs need is provided: a pbuf pool,
+ * pthread-backed mutexes and threads, a tcpip callback queue that the bench
+ * drains explicitly, a monotonic clock and listening sockets on the host.
+ */
+#include "shim.h"
+#include "loom/control.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/sys.h"
+#include "lwip/tcpip.h"
+#include <uk/plat/time.h>
+#include <uk/sched.h>
+
+#include <netinet/in.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HOST_CALLBACK_QUEUE 256
+
+typedef struct pool_buf {
+    struct pbuf p;
+    struct pool_buf *next_free;
+    uint8_t data[PBUF_POOL_BUFSIZE];
+} pool_buf_t;
+
+static pool_buf_t *pool_free_list = NULL;
+static uint64_t pool_outstanding = 0;
+
+static struct {
+    tcpip_callback_fn fn;
+    void *ctx;
+} callbacks[HOST_CALLBACK_QUEUE];
+static int num_callbacks = 0;
+
+struct netif *netif_default = NULL;
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type)
+{
+    if (length > PBUF_POOL_BUFSIZE) {
+        return NULL;
+    }
+
+    pool_buf_t *buf = pool_free_list;
+    if (buf) {
+        pool_free_list = buf->next_free;
+    } else {
+        buf = malloc(sizeof(*buf));
+        if (!buf) {
+            return NULL;
+        }
+    }
+
+    memset(&buf->p, 0, sizeof(buf->p));
+    buf->p.payload = buf->data;
+    buf->p.len = length;
+    buf->p.tot_len = length;
+    buf->p.type_internal = (u8_t)type;
+    buf->p.ref = 1;
+    pool_outstanding++;
+
+    return &buf->p;
+}
+
+u8_t pbuf_free(struct pbuf *p)
+{
+    u8_t count = 0;
+
+    while (p) {
+        struct pbuf *next = p->next;
+
+        if (--p->ref > 0) {
+            break;
+        }
+
+        pool_buf_t *buf = (pool_buf_t *)p;
+        buf->next_free = pool_free_list;
+        pool_free_list = buf;
+        pool_outstanding--;
+        count++;
+        p = next;
+    }
+
+    return count;
+}
+
+void pbuf_ref(struct pbuf *p)
+{
+    if (p) {
+        p->ref++;
+    }
+}
+
+u16_t pbuf_copy_partial(const struct pbuf *p, void *dataptr, u16_t len,
+                        u16_t offset)
+{
+    u16_t copied = 0;
+
+    for (; p && copied < len; p = p->next) {
+        if (offset >= p->len) {
+            offset -= p->len;
+            continue;
+        }
+        u16_t chunk = p->len - offset;
+        if (chunk > len - copied) {
+            chunk = len - copied;
+        }
+        memcpy((uint8_t *)dataptr + copied, (const uint8_t *)p->payload + offset,
+               chunk);
+        copied += chunk;
+        offset = 0;
+    }
+
+    return copied;
+}
+
+uint64_t host_pbuf_outstanding(void)
+{
+    return pool_outstanding;
+}
+
+err_t tcpip_try_callback(tcpip_callback_fn function, void *ctx)
+{
+    if (num_callbacks == HOST_CALLBACK_QUEUE) {
+        return ERR_MEM;
+    }
+    callbacks[num_callbacks].fn = function;
+    callbacks[num_callbacks].ctx = ctx;
+    num_callbacks++;
+    return ERR_OK;
+}
+
+int host_tcpip_poll(void)
+{
+    int ran = 0;
+
+    /* Callbacks may queue further callbacks, keep going until it is empty */
+    while (ran < num_callbacks) {
+        callbacks[ran].fn(callbacks[ran].ctx);
+        ran++;
+    }
+    num_callbacks = 0;
+
+    return ran;
+}
+
+typedef struct {
+    lwip_thread_fn fn;
+    void *arg;
+} thread_start_t;
+
+static void *thread_trampoline(void *arg)
+{
+    thread_start_t start = *(thread_start_t *)arg;
+    free(arg);
+    start.fn(start.arg);
+    return NULL;
+}
+
+sys_thread_t sys_thread_new(const char *name, lwip_thread_fn thread, void *arg,
+                            int stacksize, int prio)
+{
+    pthread_t tid;
+    thread_start_t *start = malloc(sizeof(*start));
+
+    if (!start) {
+        return NULL;
+    }
+    start->fn = thread;
+    start->arg = arg;
+
+    if (pthread_create(&tid, NULL, thread_trampoline, start) != 0) {
+        printf("[HOST] ERROR: Failed to start thread %s\n", name);
+        free(start);
+        return NULL;
+    }
+    pthread_detach(tid);
+
+    return (sys_thread_t)(uintptr_t)tid;
+}
+
+err_t sys_mutex_new(sys_mutex_t *mutex)
+{
+    return pthread_mutex_init(mutex, NULL) == 0 ? ERR_OK : ERR_MEM;
+}
+
+void sys_mutex_lock(sys_mutex_t *mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+void sys_mutex_unlock(sys_mutex_t *mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+void sys_msleep(u32_t ms)
+{
+    usleep(ms * 1000);
+}
+
+u32_t sys_now(void)
+{
+    return (u32_t)(ukplat_monotonic_clock() / 1000000);
+}
+
+__nsec ukplat_monotonic_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (__nsec)ts.tv_sec * 1000000000ULL + (__nsec)ts.tv_nsec;
+}
+
+void uk_sched_yield(void)
+{
+    sched_yield();
+}
+
+char *ip4addr_ntoa_r(const ip4_addr_t *addr, char *buf, int buflen)
+{
+    const uint8_t *b = (const uint8_t *)&addr->addr;
+    snprintf(buf, buflen, "%u.%u.%u.%u", b[0], b[1], b[2], b[3]);
+    return buf;
+}
+
+int control_listen(int port)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+
+    if (fd < 0) {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, 5) < 0) {
+        printf("[HOST] ERROR: Could not listen on port %d\n", port);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
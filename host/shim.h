@@ -0,0 +1,12 @@
+#ifndef LOOM_HOST_SHIM_H
+#define LOOM_HOST_SHIM_H
+
+#include <stdint.h>
+
+/* Run every callback queued through tcpip_try_callback(), returns how many */
+int host_tcpip_poll(void);
+
+/* Pool buffers currently handed out, for leak checks after a run */
+uint64_t host_pbuf_outstanding(void);
+
+#endif /* LOOM_HOST_SHIM_H */
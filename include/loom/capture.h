@@ -11,12 +11,60 @@ typedef struct {
     uint64_t total_bytes;
     uint64_t passed_packets;
     uint64_t dropped_packets;
+    uint64_t forwarded_packets; /* Bounced back out instead of delivered */
 } capture_stats_t;
 
+#define CAPTURE_RATE_WINDOW_MS 1000
+
+/* Averaged over window_ns, which is 0 until the first window completes */
+typedef struct {
+    uint64_t window_ns;
+    uint64_t pps;
+    uint64_t bps;               /* Bits per second */
+    uint64_t passed_pps;
+    uint64_t dropped_pps;
+} capture_rates_t;
+
 int capture_hook_init(struct netif *netif, uint16_t control_port);
 
+/* Further TCP ports whose traffic skips the NF chain, up to four in all */
+void capture_add_control_port(uint16_t port);
+
+/*
+ * Run locally fabricated frames through the same parse and batch path as
+ * the RX hook. The frames are always consumed: those that pass the chain
+ * are freed instead of being handed to lwIP, and they are not counted in
+ * the capture statistics. Returns how many passed.
+ */
+uint16_t capture_inject_burst(struct pbuf **pkts, uint16_t count);
+
+/*
+ * Hand an already filtered frame to lwIP, skipping the hook. Takes
+ * ownership of p in all cases.
+ */
+err_t capture_deliver(struct pbuf *p);
+
 void capture_print_stats(void);
 
-capture_stats_t capture_get_stats();
+/*
+ * Counters summed over all workers. Each worker's block is copied under
+ * its sequence count, so every value is untorn and the passed/dropped
+ * split of a block always matches its total.
+ */
+capture_stats_t capture_get_stats(void);
+
+/*
+ * Rates between the two most recent samples at least CAPTURE_RATE_WINDOW_MS
+ * apart. Sampling happens on read, so with slower readers the window is
+ * their polling interval.
+ */
+capture_rates_t capture_get_rates(void);
+
+/*
+ * Add a delta to the calling worker's block, for RX paths other than the
+ * netif hook. Accumulate per burst and add once; never call it for a
+ * single counter per packet.
+ */
+void capture_stats_add(const capture_stats_t *delta);
 
 #endif /* LOOM_CAPTURE_H */
\ No newline at end of file
@@ -0,0 +1,43 @@
+#ifndef LOOM_CLASSIFY_H
+#define LOOM_CLASSIFY_H
+
+#include "loom/nf_chain.h"
+#include "loom/packet.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* One RX burst, filled by the caller before classify_burst() */
+typedef struct {
+    uint16_t count;
+    const uint8_t *data[NF_BATCH_MAX];
+    uint16_t len[NF_BATCH_MAX];         /* Readable bytes at data */
+    uint16_t tot_len[NF_BATCH_MAX];
+} classify_burst_t;
+
+/*
+ * Picks the AVX2 implementation when CPUID and XCR0 say it is usable and
+ * allow_simd is set, the scalar one otherwise. Safe to call again.
+ */
+void classify_init(bool allow_simd);
+
+/* classify_init() without the log line; returns whether AVX2 was picked */
+bool classify_select(bool allow_simd);
+
+const char *classify_impl_name(void);
+
+/*
+ * Fills meta[i] for every frame, exactly as pkt_parse_buf() would, and
+ * returns the mask of TCP frames to one of the num_ports ports.
+ */
+uint64_t classify_burst(const classify_burst_t *burst, pkt_meta_t *meta,
+                        const uint16_t *ports, int num_ports);
+
+/*
+ * Of the frames in mask, those that are TCP/UDP and whose destination
+ * port has its bit set in bitmap: 65536 bits for TCP followed by 65536
+ * bits for UDP.
+ */
+uint64_t classify_port_lookup(const pkt_meta_t *meta, uint16_t count,
+                              uint64_t mask, const uint64_t *bitmap);
+
+#endif /* LOOM_CLASSIFY_H */
@@ -0,0 +1,27 @@
+#ifndef LOOM_CLOCK_H
+#define LOOM_CLOCK_H
+
+#include <stdint.h>
+#include <uk/plat/time.h>
+
+#define LOOM_NSEC_PER_SEC 1000000000ULL
+
+/* Monotonic nanoseconds since boot, cheap enough to read once per batch */
+static inline uint64_t loom_now_ns(void)
+{
+    return (uint64_t)ukplat_monotonic_clock();
+}
+
+/* Raw cycle counter for cost accounting, falls back to ns off x86 */
+static inline uint64_t loom_cycles(void)
+{
+#if defined(__x86_64__)
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#else
+    return loom_now_ns();
+#endif
+}
+
+#endif /* LOOM_CLOCK_H */
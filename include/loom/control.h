@@ -1,7 +1,17 @@
-
 #ifndef LOOM_CONTROL_H
 #define LOOM_CONTROL_H
 
+/* Text console, one thread per client */
 int control_server_init(int port);
 
-#endif /* LOOM_CONTROL_H */
\ No newline at end of file
+/* Binary bulk update protocol (see control_proto.h), after the console */
+int control_bin_server_init(int port);
+
+/* Bound, listening TCP socket on port, or -1 */
+int control_listen(int port);
+
+/* Held while a command or transaction touches NF configuration */
+void control_lock(void);
+void control_unlock(void);
+
+#endif /* LOOM_CONTROL_H */
@@ -0,0 +1,93 @@
+#ifndef LOOM_CONTROL_PROTO_H
+#define LOOM_CONTROL_PROTO_H
+
+#include <stdint.h>
+
+/*
+ * Binary control protocol for bulk rule updates. Every message is a fixed
+ * header followed by len bytes of payload, all fields in network byte
+ * order. A transaction is BEGIN, any number of RULES messages and COMMIT
+ * (or ABORT); each message is answered with a REPLY carrying its seq.
+ * Records are validated as they arrive but only buffered; COMMIT applies
+ * them all and swaps every affected table at once.
+ */
+
+#define CTL_MAGIC 0x4c4d        /* "LM" */
+#define CTL_VERSION 1
+#define CTL_MAX_PAYLOAD 65536
+
+typedef enum {
+    CTL_MSG_BEGIN = 1,
+    CTL_MSG_RULES,
+    CTL_MSG_COMMIT,
+    CTL_MSG_ABORT,
+    CTL_MSG_REPLY,
+} ctl_msg_type_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t type;               /* ctl_msg_type_t */
+    uint32_t seq;
+    uint32_t len;
+} ctl_hdr_t;
+
+/* BEGIN payload */
+#define CTL_BEGIN_REPLACE 0x01  /* Start from empty tables, not the active ones */
+
+typedef struct __attribute__((packed)) {
+    uint32_t flags;
+} ctl_begin_t;
+
+/* RULES payload: a sequence of records, each a TLV header and its value */
+typedef enum {
+    CTL_REC_ALLOW_ADD = 1,      /* ctl_rec_ports_t */
+    CTL_REC_ALLOW_REMOVE,       /* ctl_rec_ports_t */
+    CTL_REC_ACL_ADD,            /* ctl_rec_acl_t */
+    CTL_REC_ACL_DEFAULT,        /* ctl_rec_acl_default_t */
+} ctl_rec_type_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;               /* ctl_rec_type_t */
+    uint8_t reserved;
+    uint16_t len;               /* Value bytes following this header */
+} ctl_tlv_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t first;
+    uint16_t last;
+    uint8_t protos;             /* ALLOW_PROTO_* */
+    uint8_t reserved[3];
+} ctl_rec_ports_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t prefix;
+    uint8_t depth;
+    uint8_t match;              /* acl_match_t */
+    uint8_t proto;
+    uint8_t action;             /* acl_action_t */
+    uint16_t port_lo;
+    uint16_t port_hi;
+} ctl_rec_acl_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t action;             /* acl_action_t */
+    uint8_t reserved[3];
+} ctl_rec_acl_default_t;
+
+/* REPLY payload */
+typedef enum {
+    CTL_OK = 0,
+    CTL_ERR_PROTO,              /* Bad header or payload, connection closes */
+    CTL_ERR_STATE,              /* RULES/COMMIT/ABORT outside a transaction */
+    CTL_ERR_RECORD,             /* Invalid record, index in reply count */
+    CTL_ERR_LIMIT,              /* Transaction too large */
+    CTL_ERR_APPLY,              /* Commit failed, active tables unchanged */
+} ctl_status_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t status;            /* ctl_status_t */
+    uint32_t count;             /* Records staged so far, or the bad one */
+} ctl_reply_t;
+
+#endif /* LOOM_CONTROL_PROTO_H */
@@ -0,0 +1,49 @@
+#ifndef LOOM_EVENT_LOG_H
+#define LOOM_EVENT_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    EVENT_DROP_NF = 0,          /* nf = NF name, arg0 = packets dropped */
+    EVENT_DROP_RATE_LIMIT,      /* arg0 = port, arg1 = configured rate */
+    EVENT_DROP_ALLOWLIST,       /* arg0 = port, arg1 = IP protocol */
+    EVENT_DROP_SRC_LIMIT,       /* arg1 = source address (network order) */
+    EVENT_DROP_ACL,             /* arg1 = deciding rule + 1, 0 = default */
+    EVENT_REASON_MAX
+} event_reason_t;
+
+/* Fixed-size record, formatted only when the log is drained */
+typedef struct {
+    uint64_t timestamp_ns;
+    const char *nf;
+    uint16_t reason;
+    uint16_t arg0;
+    uint32_t arg1;
+} event_record_t;
+
+typedef struct {
+    uint64_t recorded;
+    uint64_t suppressed;
+} event_counters_t;
+
+int event_log_init(void);
+
+/* Safe to call per packet: no formatting, no locks, no allocation */
+void event_log_record(event_reason_t reason, const char *nf,
+                      uint16_t arg0, uint32_t arg1);
+
+/*
+ * Format records starting at *cursor into buf and advance the cursor.
+ * Records overwritten before they were read are reported as lost.
+ */
+size_t event_log_format(uint64_t *cursor, char *buf, size_t len);
+
+/* Cursor pointing at the last `count` records in the ring */
+uint64_t event_log_tail(uint32_t count);
+
+event_counters_t event_log_counters(event_reason_t reason);
+
+const char *event_reason_name(event_reason_t reason);
+
+#endif /* LOOM_EVENT_LOG_H */
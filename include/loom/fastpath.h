@@ -0,0 +1,88 @@
+#ifndef LOOM_FASTPATH_H
+#define LOOM_FASTPATH_H
+
+#include "lwip/netif.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FASTPATH_BURST 32
+#define FASTPATH_MAX_PORTS 2
+#define FASTPATH_MAX_CONTROL_PORTS 4
+
+#define FASTPATH_DEFAULT_IDLE_US 200
+
+/*
+ * How a worker waits for traffic. Busy polling never gives up the queue
+ * (other than yielding to the cooperative scheduler), interrupt mode arms
+ * the RX interrupt as soon as a poll comes back empty, and adaptive mode
+ * keeps polling until the queues have been idle for idle_us.
+ */
+typedef enum {
+    FASTPATH_POLL_BUSY = 0,
+    FASTPATH_POLL_ADAPTIVE,
+    FASTPATH_POLL_INTERRUPT,
+} fastpath_poll_mode_t;
+
+/* Summed over all workers by fastpath_get_stats() */
+typedef struct {
+    bool running;
+    uint16_t num_ports;
+    uint16_t num_workers;
+    uint16_t netdev_id[FASTPATH_MAX_PORTS];
+    bool rx_intr;               /* All ports support RX interrupts */
+    fastpath_poll_mode_t poll_mode;
+    uint32_t idle_us;
+    uint64_t rx_packets;
+    uint64_t rx_bursts;
+    uint64_t passed;
+    uint64_t dropped;
+    uint64_t local;             /* Copied up to lwIP */
+    uint64_t transit;           /* Passed, not local and not forwarded */
+    uint64_t forwarded;
+    uint64_t tx_packets;
+    uint64_t tx_dropped;        /* TX ring full */
+    uint64_t tx_no_port;        /* Cross-connect with a single port */
+    uint64_t ttl_expired;       /* Of transit, TTL ran out before forwarding */
+    uint64_t local_failed;
+    uint64_t alloc_failed;
+    uint64_t empty_polls;
+    uint64_t sleeps;            /* Switched to interrupt mode */
+    uint64_t wakeups;           /* Woken by an RX interrupt, not a timeout */
+} fastpath_stats_t;
+
+/*
+ * Take over up to two uknetdevs that lwIP left unconfigured and run the NF
+ * chain directly on their RX bursts. Only traffic for the local sockets
+ * registered with fastpath_add_local_port(), ICMP to our address and
+ * non-IPv4 frames (ARP) are copied into pbufs and handed to lwIP through
+ * the local netif. Other passing frames are forwarded in place according
+ * to the forward mode, or released. Returns -1 if no spare device exists,
+ * in which case the netif->input hook remains the only capture path.
+ *
+ * Each port gets one RX/TX queue pair per worker, bounded by max_workers
+ * (0 for LOOM_MAX_WORKERS) and what the devices offer. How flows are
+ * spread over the RX queues is up to the device.
+ */
+int fastpath_init(struct netif *local, uint16_t control_port,
+                  unsigned int max_workers);
+
+/*
+ * Run worker 0 on the calling thread; the other workers get their own
+ * threads from fastpath_init(). Only returns (-1) when the fast path is
+ * not running.
+ */
+int fastpath_run(void);
+
+void fastpath_add_local_port(uint16_t port);
+
+/* Local TCP port whose traffic skips the NF chain, like control_port */
+void fastpath_add_control_port(uint16_t port);
+
+/* Takes effect on the next poll; idle_us only matters in adaptive mode */
+void fastpath_set_poll_mode(fastpath_poll_mode_t mode, uint32_t idle_us);
+
+const char *fastpath_poll_mode_name(fastpath_poll_mode_t mode);
+
+fastpath_stats_t fastpath_get_stats(void);
+
+#endif /* LOOM_FASTPATH_H */
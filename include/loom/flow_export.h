@@ -0,0 +1,97 @@
+#ifndef LOOM_FLOW_EXPORT_H
+#define LOOM_FLOW_EXPORT_H
+
+#include "loom/packet.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FLOW_EXPORT_VERSION 1
+#define FLOW_EXPORT_DEFAULT_PORT 2055
+
+#define FLOW_DEFAULT_CAPACITY 4096      /* Per worker */
+#define FLOW_DEFAULT_ACTIVE_S 60
+#define FLOW_DEFAULT_IDLE_S 15
+
+/* Why a record was exported */
+typedef enum {
+    FLOW_END_IDLE = 1,
+    FLOW_END_ACTIVE,            /* Long-lived flow, its counters restart */
+    FLOW_END_EVICTED,           /* Table full, least recently seen flow */
+    FLOW_END_FLUSH,             /* Export turned off */
+} flow_end_t;
+
+/*
+ * Wire format: each UDP datagram is a header followed by count records.
+ * Multi-byte fields are big endian, addresses as they were on the wire,
+ * times are milliseconds since boot.
+ */
+typedef struct __attribute__((packed)) {
+    uint16_t version;
+    uint16_t count;
+    uint32_t sequence;          /* Records sent before this datagram */
+    uint32_t uptime_ms;
+    uint32_t lost;              /* Records dropped so far, exporter behind */
+} flow_dgram_hdr_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t src_ip;
+    uint32_t dst_ip;
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t proto;
+    uint8_t tcp_flags;          /* OR of every packet's */
+    uint8_t drop_reason;        /* pkt_drop_t of the last dropped packet */
+    uint8_t end_reason;         /* flow_end_t */
+    uint64_t packets;
+    uint64_t bytes;
+    uint32_t dropped;           /* Packets of the flow the chain dropped */
+    uint32_t first_ms;
+    uint32_t last_ms;
+} flow_record_t;
+
+typedef struct {
+    bool enabled;
+    uint32_t collector_ip;      /* Network order, 0 when unset */
+    uint16_t collector_port;
+    uint32_t capacity;          /* Flows per worker */
+    uint32_t active;
+    uint32_t active_timeout_s;
+    uint32_t idle_timeout_s;
+    uint64_t created;
+    uint64_t evicted;
+    uint64_t exported;          /* Records sent */
+    uint64_t datagrams;
+    uint64_t lost;
+    uint64_t send_failed;       /* Datagrams */
+} flow_stats_t;
+
+/* Set while export is enabled and a collector is configured */
+extern bool flow_export_armed;
+
+/*
+ * Unidirectional flows keyed by addresses, ports and protocol, one table
+ * per worker reserved at boot. A full table evicts its least recently
+ * seen flow. Records are exported when a flow goes idle, every active
+ * timeout for long-lived flows and on eviction, by a thread that batches
+ * them into datagrams to the collector.
+ */
+int flow_export_init(uint32_t capacity);
+
+void flow_export_set_enabled(bool enabled);
+void flow_export_set_collector(uint32_t ip, uint16_t port);
+int flow_export_set_timeouts(uint32_t active_s, uint32_t idle_s);
+flow_stats_t flow_export_get_stats(void);
+
+/* A batch after the chain, with its verdicts */
+void flow_export_account_batch(const pkt_meta_t *meta, uint16_t count,
+                               uint64_t pass_mask);
+
+static inline void flow_export_account(const pkt_meta_t *meta, uint16_t count,
+                                       uint64_t pass_mask)
+{
+    if (__atomic_load_n(&flow_export_armed, __ATOMIC_RELAXED)) {
+        flow_export_account_batch(meta, count, pass_mask);
+    }
+}
+
+#endif /* LOOM_FLOW_EXPORT_H */
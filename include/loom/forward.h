@@ -0,0 +1,77 @@
+#ifndef LOOM_FORWARD_H
+#define LOOM_FORWARD_H
+
+#include "loom/packet.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * What happens to packets that pass the chain but are not addressed to a
+ * local socket ("transit" packets).
+ */
+typedef enum {
+    FORWARD_OFF = 0,            /* Terminate locally, as before */
+    FORWARD_BOUNCE,             /* Send back out the ingress port */
+    FORWARD_CROSS,              /* Send out the other fast path port */
+} forward_mode_t;
+
+typedef struct {
+    forward_mode_t mode;
+    bool has_next_hop;
+    uint8_t next_hop[6];
+} forward_config_t;
+
+extern forward_config_t forward_config;
+
+void forward_set_mode(forward_mode_t mode);
+
+/* Destination MAC for forwarded frames, NULL goes back to the default */
+void forward_set_next_hop(const uint8_t *mac);
+
+const char *forward_mode_name(forward_mode_t mode);
+
+/*
+ * Rewrite the Ethernet header of a frame about to leave through a port
+ * whose own address is egress_mac. With a next hop configured the frame
+ * is addressed to it. Without one, bounced frames go back to their sender
+ * and cross-connected frames keep their addresses (transparent bridge).
+ */
+static inline void forward_rewrite_eth(uint8_t *frame, const uint8_t *egress_mac,
+                                       bool bounce)
+{
+    if (forward_config.has_next_hop) {
+        memcpy(frame, forward_config.next_hop, 6);
+        memcpy(frame + 6, egress_mac, 6);
+    } else if (bounce) {
+        memcpy(frame, frame + 6, 6);
+        memcpy(frame + 6, egress_mac, 6);
+    }
+}
+
+/*
+ * Decrement the IPv4 TTL of a frame about to be forwarded, updating the
+ * header checksum incrementally (RFC 1624). Returns false when the TTL
+ * has run out and the frame must not leave; other frames are untouched.
+ */
+static inline bool forward_decrement_ttl(uint8_t *frame, const pkt_meta_t *meta)
+{
+    if (!(meta->flags & PKT_F_IPV4)) {
+        return true;
+    }
+
+    uint8_t *ip = frame + meta->l3_offset;
+    if (ip[8] <= 1) {
+        return false;
+    }
+    ip[8]--;
+
+    /* The TTL is the high byte of its checksum word */
+    uint32_t check = ((uint32_t)ip[10] << 8 | ip[11]) + 0x0100;
+    check = (check + (check >= 0xffff)) & 0xffff;
+    ip[10] = (uint8_t)(check >> 8);
+    ip[11] = (uint8_t)check;
+    return true;
+}
+
+#endif /* LOOM_FORWARD_H */
@@ -0,0 +1,50 @@
+#ifndef LOOM_LPM_H
+#define LOOM_LPM_H
+
+#include <stdint.h>
+
+/*
+ * IPv4 longest-prefix-match table in DIR-16-8-8 layout: a 64K-entry first
+ * level indexed by the top 16 bits, extended on demand by 256-entry groups
+ * for /17-/24 and /25-/32 prefixes. A lookup is at most three dependent
+ * loads. Values are 15-bit, 0 means no match.
+ *
+ * Tables are built once and then only read: prefixes have to be added in
+ * ascending prefix length order (equal lengths: last one wins).
+ */
+#define LPM_EXT 0x8000
+#define LPM_VALUE_MAX 0x7fff
+#define LPM_MAX_GROUPS 0x7fff
+
+typedef struct {
+    uint16_t tbl16[65536];
+    uint16_t (*groups)[256];
+    uint32_t num_groups;
+    uint32_t max_groups;
+} lpm_t;
+
+void lpm_init(lpm_t *lpm);
+
+void lpm_free(lpm_t *lpm);
+
+/*
+ * Insert prefix/depth (host byte order) with value. Returns the value that
+ * covered the prefix before, i.e. the next less specific match, or -1 when
+ * out of memory or groups.
+ */
+int lpm_add(lpm_t *lpm, uint32_t prefix, uint8_t depth, uint16_t value);
+
+static inline uint16_t lpm_lookup(const lpm_t *lpm, uint32_t ip)
+{
+    uint16_t entry = lpm->tbl16[ip >> 16];
+
+    if (entry & LPM_EXT) {
+        entry = lpm->groups[entry & ~LPM_EXT][(ip >> 8) & 0xff];
+        if (entry & LPM_EXT) {
+            entry = lpm->groups[entry & ~LPM_EXT][ip & 0xff];
+        }
+    }
+    return entry;
+}
+
+#endif /* LOOM_LPM_H */
@@ -0,0 +1,100 @@
+#ifndef LOOM_MEMPOOL_H
+#define LOOM_MEMPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef CONFIG_APPLOOM_ARENA_SIZE_MB
+#define LOOM_ARENA_SIZE ((size_t)CONFIG_APPLOOM_ARENA_SIZE_MB << 20)
+#else
+#define LOOM_ARENA_SIZE ((size_t)16 << 20)
+#endif
+
+#define MEM_ARENA_ALIGN (2UL << 20)     /* Large page boundary */
+#define MEM_MAX_REGIONS 16
+
+/*
+ * Fixed-size object pool carved from the boot arena. Free objects form a
+ * lock-free stack linked through their first word; the head carries a tag
+ * in its upper half so a pop racing with pop+push cannot succeed on a
+ * stale next index.
+ */
+typedef struct {
+    const char *name;
+    uint8_t *base;
+    size_t obj_size;
+    uint32_t capacity;
+    uint64_t free_head;         /* tag << 32 | (index + 1), 0 when empty */
+    uint32_t in_use;
+    uint32_t peak;
+    uint64_t allocs;
+    uint64_t failed;
+} mempool_t;
+
+/*
+ * Reserve one contiguous, large-page aligned arena for everything below.
+ * Called once at boot, before any NF is initialized.
+ */
+int mem_arena_init(size_t size);
+
+/* Fixed block for a table that lives as long as the system, 64 B aligned */
+void *mem_reserve(const char *name, size_t size);
+
+/* Object size is rounded up to a cache line; NULL if the arena is full */
+mempool_t *mempool_create(const char *name, size_t obj_size, uint32_t count);
+
+int mem_format_stats(char *buf, size_t len);
+
+/* Copy of the index'th pool's descriptor and counters, -1 past the end */
+int mempool_get_stats(int index, mempool_t *out);
+
+void mem_arena_usage(size_t *used, size_t *size);
+
+static inline void *mempool_get(mempool_t *pool)
+{
+    uint64_t head = __atomic_load_n(&pool->free_head, __ATOMIC_ACQUIRE);
+
+    while (1) {
+        uint32_t index = (uint32_t)head;
+
+        if (index == 0) {
+            __atomic_fetch_add(&pool->failed, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+
+        uint8_t *obj = pool->base + (size_t)(index - 1) * pool->obj_size;
+        uint64_t next = ((head >> 32) + 1) << 32 | *(volatile uint32_t *)obj;
+
+        if (__atomic_compare_exchange_n(&pool->free_head, &head, next, true,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            uint32_t used = __atomic_add_fetch(&pool->in_use, 1,
+                                               __ATOMIC_RELAXED);
+            if (used > pool->peak) {
+                pool->peak = used;
+            }
+            __atomic_fetch_add(&pool->allocs, 1, __ATOMIC_RELAXED);
+            return obj;
+        }
+    }
+}
+
+/* ptr may point anywhere inside the object */
+static inline void mempool_put(mempool_t *pool, void *ptr)
+{
+    uint32_t index = (uint32_t)(((uint8_t *)ptr - pool->base) / pool->obj_size);
+    uint32_t *obj = (uint32_t *)(pool->base + (size_t)index * pool->obj_size);
+    uint64_t head = __atomic_load_n(&pool->free_head, __ATOMIC_RELAXED);
+
+    /* Before the push, so in_use never counts an object twice */
+    __atomic_fetch_sub(&pool->in_use, 1, __ATOMIC_RELAXED);
+
+    do {
+        *obj = (uint32_t)head;
+    } while (!__atomic_compare_exchange_n(&pool->free_head, &head,
+                                          ((head >> 32) + 1) << 32 | (index + 1),
+                                          true, __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+}
+
+#endif /* LOOM_MEMPOOL_H */
@@ -0,0 +1,66 @@
+#ifndef LOOM_NF_ACL_H
+#define LOOM_NF_ACL_H
+
+#include "lwip/pbuf.h"
+#include "loom/packet.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ACL_MAX_RULES 32767
+
+typedef enum {
+    ACL_ALLOW = 0,
+    ACL_DENY,
+} acl_action_t;
+
+typedef enum {
+    ACL_MATCH_SRC = 0,
+    ACL_MATCH_DST,
+} acl_match_t;
+
+/*
+ * A rule matches packets whose source (or destination) address falls in
+ * prefix/depth, optionally narrowed to one IP protocol (0 = any) and a
+ * destination port range. Per address the most specific prefix is tried
+ * first, falling back to less specific ones; source rules are evaluated
+ * before destination rules.
+ */
+typedef struct {
+    uint32_t prefix;            /* Host byte order */
+    uint8_t depth;
+    uint8_t match;              /* acl_match_t */
+    uint8_t proto;
+    uint8_t action;             /* acl_action_t */
+    uint16_t port_lo;
+    uint16_t port_hi;
+} acl_rule_t;
+
+void nf_acl_init(void);
+
+bool nf_acl(struct pbuf *p, pkt_meta_t *meta);
+void nf_acl_batch(struct pbuf **pkts, pkt_meta_t *meta,
+                  uint16_t count, uint64_t *pass_mask);
+
+/*
+ * Rules are staged by the control plane and only take effect on
+ * nf_acl_commit(), which compiles them into fresh lookup tables and swaps
+ * them in atomically.
+ */
+int nf_acl_stage_add(const acl_rule_t *rule);
+void nf_acl_stage_clear(void);
+int nf_acl_commit(void);
+
+/*
+ * Installs rules without touching the staging area, after the active
+ * rules unless replace. Nothing changes when it fails.
+ */
+int nf_acl_commit_rules(const acl_rule_t *rules, uint32_t count, bool replace);
+
+void nf_acl_set_default(acl_action_t action);
+acl_action_t nf_acl_get_default(void);
+
+uint32_t nf_acl_active_rules(void);
+uint32_t nf_acl_staged_rules(void);
+
+#endif /* LOOM_NF_ACL_H */
@@ -2,42 +2,171 @@
 #define LOOM_NF_CHAIN_H
 
 #include "lwip/pbuf.h"
+#include "loom/packet.h"
 #include <stdbool.h>
 #include <stdint.h>
 
-typedef bool (*nf_func_t)(struct pbuf *p);
+#define NF_BATCH_MAX 64
 
-typedef struct nf_node {
+/*
+ * NFs may annotate the metadata (e.g. conntrack state flags) for the NFs
+ * that follow them in the chain.
+ */
+typedef bool (*nf_func_t)(struct pbuf *p, pkt_meta_t *meta);
+
+/*
+ * Batch variant of nf_func_t. Bit i of *pass_mask is set for every packet
+ * still alive in the chain; the NF only looks at those and clears the bit
+ * of each packet it drops.
+ */
+typedef void (*nf_batch_func_t)(struct pbuf **pkts, pkt_meta_t *meta,
+                                uint16_t count, uint64_t *pass_mask);
+
+#define NF_CHAIN_MAX 16
+
+#define NF_HIST_BUCKETS 32
+
+/*
+ * Per-NF counters, one cache line aligned block per registered NF and
+ * worker so the data path never shares a line between two NFs or two
+ * workers. cycles_hist[i] counts invocations that took [2^i, 2^(i+1)) TSC
+ * cycles.
+ */
+typedef struct {
+    uint64_t packets_in;
+    uint64_t packets_dropped;
+    uint64_t invocations;
+    uint64_t cycles;
+    uint64_t cycles_hist[NF_HIST_BUCKETS];
+} __attribute__((aligned(64))) nf_stats_t;
+
+typedef enum {
+    RATE_LIMIT_PPS = 0,
+    RATE_LIMIT_BPS,
+} rate_limit_mode_t;
+
+#define MAX_RATE_LIMITS 64
+
+typedef struct {
+    uint16_t port;
+    rate_limit_mode_t mode;
+    uint32_t rate;
+    uint32_t burst;
+    uint64_t tokens;            /* Summed over workers */
+} rate_limit_info_t;
+
+/* Control-plane registration of an NF, owned by nf_chain.c */
+typedef struct {
     const char *name;
     nf_func_t func;
+    nf_batch_func_t batch_func;
+    nf_stats_t *stats;          /* LOOM_MAX_WORKERS shards */
+    uint8_t drop_reason;        /* pkt_drop_t, from the name */
     bool enabled;
-    struct nf_node *next;
 } nf_node_t;
 
+/* Read-only snapshot of the enabled NFs, walked by the data path */
+typedef struct {
+    const char *name;
+    nf_func_t func;
+    nf_batch_func_t batch_func;
+    nf_stats_t *stats;          /* LOOM_MAX_WORKERS shards */
+    uint8_t drop_reason;
+} nf_entry_t;
+
+typedef struct {
+    uint16_t count;
+    bool specialized;           /* Entries match LOOM_STATIC_CHAIN exactly */
+    nf_entry_t entries[];
+} nf_chain_t;
+
 void nf_chain_init(void);
 
-bool nf_chain_process(struct pbuf *p);
+bool nf_chain_process(struct pbuf *p, pkt_meta_t *meta);
+
+uint64_t nf_chain_process_batch(struct pbuf **pkts, pkt_meta_t *meta,
+                                uint16_t count);
 
 int nf_chain_add(const char *name, nf_func_t func);
 
+int nf_chain_add_batch(const char *name, nf_func_t func,
+                       nf_batch_func_t batch_func);
+
 int nf_chain_remove(const char *name);
 
 int nf_chain_set_enabled(const char *name, bool enabled);
 
-void nf_chain_list(void);
+int nf_chain_format_list(char *buf, size_t len);
+
+/* Whether the build-time chain (CONFIG_APPLOOM_STATIC_CHAIN) is running */
+bool nf_chain_is_specialized(void);
+
+int nf_chain_format_stats(char *buf, size_t len);
+
+/* Counters of the index'th registered NF summed over workers, -1 past the end */
+int nf_chain_get_stats(int index, const char **name, nf_stats_t *out);
+
+int nf_chain_get_info(int index, const char **name, bool *enabled);
+
+void nf_chain_reset_stats(void);
+
+/* Packets dropped, by pkt_drop_t; for drops outside the chain */
+void nf_chain_count_drops(pkt_drop_t reason, uint32_t packets);
+
+/* Summed over workers */
+void nf_chain_get_drops(uint64_t out[PKT_DROP_MAX]);
 
 void nf_chain_clear(void);
 
-bool nf_rate_limiter(struct pbuf *p);
-bool nf_allowlist(struct pbuf *p);
+bool nf_rate_limiter(struct pbuf *p, pkt_meta_t *meta);
+bool nf_allowlist(struct pbuf *p, pkt_meta_t *meta);
 
-int nf_rate_limiter_set_limit(uint16_t port, uint32_t packets_per_sec);
+void nf_rate_limiter_batch(struct pbuf **pkts, pkt_meta_t *meta,
+                           uint16_t count, uint64_t *pass_mask);
+void nf_allowlist_batch(struct pbuf **pkts, pkt_meta_t *meta,
+                        uint16_t count, uint64_t *pass_mask);
+
+int nf_rate_limiter_set_limit(uint16_t port, uint32_t rate, uint32_t burst,
+                              rate_limit_mode_t mode);
 int nf_rate_limiter_remove_limit(uint16_t port);
-void nf_rate_limiter_list(void);
 
-int nf_allowlist_add_port(uint16_t port);
-int nf_allowlist_remove_port(uint16_t port);
-void nf_allowlist_list(void);
+/* Re-split every limit after the number of workers changed */
+void nf_rate_limiter_rebalance(void);
+
+/* Copies up to max limits, returns how many are configured */
+int nf_rate_limiter_snapshot(rate_limit_info_t *out, int max);
+int nf_rate_limiter_format(char *buf, size_t len);
+
+#define ALLOW_PROTO_TCP 0x01
+#define ALLOW_PROTO_UDP 0x02
+#define ALLOW_PROTO_ANY (ALLOW_PROTO_TCP | ALLOW_PROTO_UDP)
+
+typedef struct {
+    uint16_t first;
+    uint16_t last;
+    uint8_t protos;             /* ALLOW_PROTO_TCP or ALLOW_PROTO_UDP */
+} allow_range_t;
+
+int nf_allowlist_add_range(uint16_t first, uint16_t last, uint8_t protos);
+int nf_allowlist_remove_range(uint16_t first, uint16_t last, uint8_t protos);
 void nf_allowlist_clear(void);
+uint32_t nf_allowlist_active_ports(void);
+
+/*
+ * Copies up to max runs of allowed ports from the active table, TCP runs
+ * first. Returns the total number of runs.
+ */
+int nf_allowlist_snapshot(allow_range_t *out, int max);
+int nf_allowlist_format(char *buf, size_t len);
+
+/*
+ * Staged edits for applying a whole rule set at once: reset the staging
+ * table (empty, or a copy of the active one), edit it, then commit, which
+ * swaps it in atomically. Control plane only; callers serialize.
+ */
+void nf_allowlist_stage_reset(bool from_active);
+int nf_allowlist_stage_add(uint16_t first, uint16_t last, uint8_t protos);
+int nf_allowlist_stage_remove(uint16_t first, uint16_t last, uint8_t protos);
+void nf_allowlist_commit(void);
 
 #endif /* LOOM_NF_CHAIN_H */
\ No newline at end of file
@@ -0,0 +1,59 @@
+#ifndef LOOM_NF_CONNTRACK_H
+#define LOOM_NF_CONNTRACK_H
+
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "loom/packet.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CONNTRACK_DEFAULT_CAPACITY 16384
+
+typedef enum {
+    CT_TIMEOUT_TCP_EST = 0,     /* Established TCP flows */
+    CT_TIMEOUT_UDP,             /* UDP flows that have seen a reply */
+    CT_TIMEOUT_MAX
+} ct_timeout_t;
+
+typedef struct {
+    uint32_t capacity;
+    uint32_t active;
+    uint64_t created;
+    uint64_t expired;
+    uint64_t table_full;
+    uint64_t invalid;
+} ct_stats_t;
+
+/* Pre-allocates the table, capacity is rounded up to a power of two */
+int nf_conntrack_init(uint32_t capacity);
+
+/*
+ * Wraps the netif's linkoutput so lwIP's own segments are tracked too;
+ * without it flows to local ports never see their reply direction. Call
+ * after anything else that wraps linkoutput, the SYN proxy swallows
+ * lwIP's SYN-ACK to a replayed SYN.
+ */
+int nf_conntrack_attach(struct netif *netif);
+
+bool nf_conntrack(struct pbuf *p, pkt_meta_t *meta);
+void nf_conntrack_batch(struct pbuf **pkts, pkt_meta_t *meta,
+                        uint16_t count, uint64_t *pass_mask);
+
+/*
+ * Creates the entry of a PKT_F_CT_NEW packet; called by the chain once
+ * every NF has passed it, so dropped packets never take a slot.
+ */
+void nf_conntrack_confirm(const pkt_meta_t *meta);
+void nf_conntrack_confirm_batch(const pkt_meta_t *meta, uint64_t pass_mask);
+
+int nf_conntrack_set_timeout(ct_timeout_t which, uint32_t seconds);
+
+/* Strict mode drops TCP packets that don't belong to a tracked flow */
+void nf_conntrack_set_strict(bool strict);
+
+void nf_conntrack_flush(void);
+
+ct_stats_t nf_conntrack_get_stats(void);
+
+#endif /* LOOM_NF_CONNTRACK_H */
@@ -0,0 +1,35 @@
+#ifndef LOOM_NF_SRC_LIMITER_H
+#define LOOM_NF_SRC_LIMITER_H
+
+#include "lwip/pbuf.h"
+#include "loom/packet.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SRC_LIMITER_TOPK 16
+
+typedef struct {
+    uint32_t ip;                /* Network byte order */
+    uint32_t estimate;          /* Packets in the window */
+} src_heavy_hitter_t;
+
+void nf_src_limiter_init(void);
+
+bool nf_src_limiter(struct pbuf *p, pkt_meta_t *meta);
+void nf_src_limiter_batch(struct pbuf **pkts, pkt_meta_t *meta,
+                          uint16_t count, uint64_t *pass_mask);
+
+/* Per-source packets/sec allowed, 0 disables the limiter */
+void nf_src_limiter_set_limit(uint32_t packets_per_sec);
+
+/*
+ * Copy the heavy hitters of the last complete window, largest first.
+ * Returns the number of entries written.
+ */
+int nf_src_limiter_top(src_heavy_hitter_t *out, int max);
+
+uint32_t nf_src_limiter_get_limit(void);
+uint64_t nf_src_limiter_dropped(void);
+
+#endif /* LOOM_NF_SRC_LIMITER_H */
@@ -0,0 +1,53 @@
+#ifndef LOOM_NF_SYNPROXY_H
+#define LOOM_NF_SYNPROXY_H
+
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "loom/packet.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SYNPROXY_DEFAULT_CAPACITY 4096
+
+typedef struct {
+    bool enabled;
+    uint32_t ports;             /* Protected ports */
+    uint32_t capacity;
+    uint32_t active;
+    uint64_t syns;              /* SYNs answered with a cookie */
+    uint64_t valid;             /* ACKs carrying a valid cookie, replayed to lwIP */
+    uint64_t invalid;           /* ACKs with neither a flow nor a valid cookie */
+    uint64_t established;       /* Replayed handshakes lwIP answered */
+    uint64_t table_full;
+    uint64_t tx_failed;
+} synproxy_stats_t;
+
+/*
+ * SYN proxy for TCP ports served by lwIP on our own address. SYNs to a
+ * protected port are answered from the data path with a SYN-ACK whose
+ * sequence number is a cookie, and never reach lwIP. Only an ACK that
+ * returns a valid cookie makes lwIP see the handshake: it is replayed as
+ * a SYN, lwIP's SYN-ACK is swallowed and the connection continues with
+ * sequence numbers translated between the cookie and lwIP's ISN.
+ *
+ * Wraps netif->linkoutput, so it must run after the netif is up.
+ */
+int nf_synproxy_init(struct netif *netif, uint32_t capacity);
+
+bool nf_synproxy(struct pbuf *p, pkt_meta_t *meta);
+void nf_synproxy_batch(struct pbuf **pkts, pkt_meta_t *meta,
+                       uint16_t count, uint64_t *pass_mask);
+
+/* New handshakes only; flows already proxied keep being translated */
+void nf_synproxy_set_enabled(bool enabled);
+int nf_synproxy_protect(uint16_t port, bool protect);
+
+/* Whether a bare SYN like this one gets a cookie instead of reaching lwIP */
+bool nf_synproxy_answers(const pkt_meta_t *meta);
+
+/* Protected ports in ascending order, returns how many there are in total */
+int nf_synproxy_ports(uint16_t *out, int max);
+
+synproxy_stats_t nf_synproxy_get_stats(void);
+
+#endif /* LOOM_NF_SYNPROXY_H */
@@ -0,0 +1,60 @@
+#ifndef LOOM_PACKET_H
+#define LOOM_PACKET_H
+
+#include "lwip/pbuf.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* pkt_meta_t flags */
+#define PKT_F_IPV4      0x01    /* Valid IPv4 header, addresses/proto are set */
+#define PKT_F_L4        0x02    /* TCP/UDP header present, ports are set */
+#define PKT_F_FRAG      0x04    /* IPv4 fragment (MF set or non-zero offset) */
+#define PKT_F_CT_NEW    0x08    /* Conntrack: no entry yet, created if the chain passes it */
+#define PKT_F_CT_EST    0x10    /* Conntrack: flow has seen both directions */
+#define PKT_F_CT_REPLY  0x20    /* Conntrack: packet travels in reply direction */
+#define PKT_F_PROXIED   0x40    /* SYN proxy: flow opened by a cookie handshake */
+#define PKT_F_GENERATED 0x80    /* Traffic generator: NFs must not transmit for it */
+
+/* pkt_meta_t drop_reason: the NF that dropped the packet */
+typedef enum {
+    PKT_DROP_NONE = 0,
+    PKT_DROP_ACL,
+    PKT_DROP_SYNPROXY,
+    PKT_DROP_CONNTRACK,
+    PKT_DROP_SRC_LIMIT,
+    PKT_DROP_RATE_LIMIT,
+    PKT_DROP_ALLOWLIST,
+    PKT_DROP_OTHER,             /* Any NF not listed above */
+    PKT_DROP_MAX,
+} pkt_drop_t;
+
+/*
+ * Per-packet metadata, filled once by pkt_parse() in the capture hook and
+ * handed to every NF so that none of them has to touch raw headers.
+ * Addresses are kept in network byte order, ports in host byte order.
+ */
+typedef struct {
+    uint16_t ethertype;
+    uint16_t pkt_len;
+    uint16_t l3_offset;
+    uint16_t l4_offset;
+    uint16_t l4_len;
+    uint8_t proto;
+    uint8_t flags;
+    uint8_t tcp_flags;
+    uint8_t drop_reason;        /* Set by the chain when an NF drops it */
+    uint32_t src_ip;
+    uint32_t dst_ip;
+    uint16_t src_port;
+    uint16_t dst_port;
+} pkt_meta_t;
+
+void pkt_parse(const struct pbuf *p, pkt_meta_t *meta);
+
+/* Same as pkt_parse() for a raw frame, len bytes of headers are readable */
+void pkt_parse_buf(const uint8_t *data, uint16_t len, uint16_t tot_len,
+                   pkt_meta_t *meta);
+
+const char *pkt_drop_name(pkt_drop_t reason);
+
+#endif /* LOOM_PACKET_H */
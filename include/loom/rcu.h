@@ -0,0 +1,32 @@
+#ifndef LOOM_RCU_H
+#define LOOM_RCU_H
+
+/*
+ * Minimal epoch-based RCU for data published by the control plane and read
+ * on the packet path. Readers bracket their accesses with rcu_read_lock() /
+ * rcu_read_unlock() and must not block inside; writers publish a new
+ * version with rcu_assign_pointer() and call rcu_synchronize() before
+ * freeing the old one.
+ */
+
+extern unsigned int rcu_epoch;
+extern unsigned long rcu_readers[2];
+
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_SEQ_CST)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_SEQ_CST)
+
+static inline unsigned int rcu_read_lock(void)
+{
+    unsigned int epoch = __atomic_load_n(&rcu_epoch, __ATOMIC_SEQ_CST) & 1;
+    __atomic_fetch_add(&rcu_readers[epoch], 1, __ATOMIC_SEQ_CST);
+    return epoch;
+}
+
+static inline void rcu_read_unlock(unsigned int epoch)
+{
+    __atomic_fetch_sub(&rcu_readers[epoch], 1, __ATOMIC_RELEASE);
+}
+
+void rcu_synchronize(void);
+
+#endif /* LOOM_RCU_H */
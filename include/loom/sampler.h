@@ -0,0 +1,61 @@
+#ifndef LOOM_SAMPLER_H
+#define LOOM_SAMPLER_H
+
+#include "lwip/pbuf.h"
+#include "loom/packet.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Bytes kept of every sampled frame, enough for the headers */
+#define SAMPLER_SNAPLEN 128
+
+/* Every field has to match; zero matches anything */
+typedef struct {
+    uint32_t every;             /* Keep 1 in N matching frames, 0 or 1 keeps all */
+    bool drops_only;
+    uint8_t proto;
+    uint16_t port;              /* Source or destination */
+    uint32_t host;              /* Source or destination, network order */
+} sampler_filter_t;
+
+typedef struct {
+    bool enabled;
+    bool streaming;             /* A client is connected */
+    sampler_filter_t filter;
+    uint32_t ring_size;
+    uint64_t sampled;           /* Frames copied into the ring */
+    uint64_t streamed;          /* Frames sent to a client */
+    uint64_t lost;              /* Overwritten before the client read them */
+} sampler_stats_t;
+
+/*
+ * Set while sampling is enabled and a client is streaming. The data path
+ * tests only this, so nothing is matched or copied otherwise.
+ */
+extern bool sampler_armed;
+
+/*
+ * Sampled frames are copied, up to SAMPLER_SNAPLEN bytes, into a ring
+ * reserved at boot and streamed as pcap to one TCP client at a time on
+ * port. The ring is written without locks from every worker; a client
+ * that falls more than a ring behind loses the oldest frames.
+ */
+int sampler_init(uint16_t port);
+
+void sampler_set_enabled(bool enabled);
+void sampler_set_filter(const sampler_filter_t *filter);
+sampler_stats_t sampler_get_stats(void);
+
+/* Frames of a batch that has been through the chain, with its verdicts */
+void sampler_offer_batch(struct pbuf **pkts, const pkt_meta_t *meta,
+                         uint16_t count, uint64_t pass_mask);
+
+static inline void sampler_offer(struct pbuf **pkts, const pkt_meta_t *meta,
+                                 uint16_t count, uint64_t pass_mask)
+{
+    if (__atomic_load_n(&sampler_armed, __ATOMIC_RELAXED)) {
+        sampler_offer_batch(pkts, meta, count, pass_mask);
+    }
+}
+
+#endif /* LOOM_SAMPLER_H */
@@ -0,0 +1,25 @@
+#ifndef LOOM_STATS_EXPORT_H
+#define LOOM_STATS_EXPORT_H
+
+#include <stddef.h>
+
+#define STATS_EXPORT_BUF_SIZE (64 * 1024)
+
+/* Allowlist runs included in the JSON document, the rest is only counted */
+#define STATS_EXPORT_MAX_RANGES 1024
+
+/*
+ * Every counter, the per-NF statistics and the contents of the control
+ * tables as one line of JSON. Counters are merged from the per-worker
+ * shards and tables are read through RCU, so nothing here waits on or
+ * stalls the data path. Returns the length, or -1 if buf is too small.
+ */
+int stats_format_json(char *buf, size_t len);
+
+/* The counters in the Prometheus text exposition format */
+int stats_format_prometheus(char *buf, size_t len);
+
+/* Plain HTTP/1.0: GET /metrics for Prometheus, GET /stats for JSON */
+int stats_http_init(int port);
+
+#endif /* LOOM_STATS_EXPORT_H */
@@ -0,0 +1,52 @@
+#ifndef LOOM_TRAFFIC_GEN_H
+#define LOOM_TRAFFIC_GEN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRAFFIC_GEN_MAX_FLOWS (1 << 18)
+
+typedef enum {
+    GEN_DIST_UNIFORM = 0,       /* Round-robin over all flows */
+    GEN_DIST_HOT,               /* 80% of packets go to 20% of the flows */
+} gen_dist_t;
+
+typedef struct {
+    uint32_t flows;
+    uint16_t pkt_size;          /* Ethernet frame size without FCS */
+    uint8_t proto;              /* IP_PROTO_TCP, IP_PROTO_UDP or 0 for a mix */
+    uint16_t port_lo;           /* Destination ports, spread over the flows */
+    uint16_t port_hi;
+    uint32_t src_net;           /* Source prefix, host byte order */
+    uint8_t src_depth;
+    uint32_t dst_ip;            /* Network byte order */
+    gen_dist_t dist;
+    uint16_t burst;
+    uint32_t rate_pps;          /* 0 runs as fast as the chain allows */
+    uint32_t duration_ms;       /* 0 runs until traffic_gen_stop() */
+} traffic_gen_config_t;
+
+typedef struct {
+    bool running;
+    uint64_t sent;
+    uint64_t passed;
+    uint64_t bytes;
+    uint64_t alloc_failed;
+    uint64_t elapsed_ns;
+} traffic_gen_stats_t;
+
+/* Defaults: 1024 UDP flows of 64 B frames to the default netif address */
+void traffic_gen_default_config(traffic_gen_config_t *cfg);
+
+/*
+ * Fabricate frames according to cfg and push them through
+ * capture_inject_burst() from a dedicated thread. Fails if a run is
+ * already in progress.
+ */
+int traffic_gen_start(const traffic_gen_config_t *cfg);
+
+void traffic_gen_stop(void);
+
+traffic_gen_stats_t traffic_gen_get_stats(void);
+
+#endif /* LOOM_TRAFFIC_GEN_H */
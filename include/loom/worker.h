@@ -0,0 +1,29 @@
+#ifndef LOOM_WORKER_H
+#define LOOM_WORKER_H
+
+#ifndef LOOM_MAX_WORKERS
+#define LOOM_MAX_WORKERS 4
+#endif
+
+/*
+ * Data path state that is written per packet (counters, token buckets) is
+ * kept once per worker and merged on read. Each polling worker tags its
+ * thread with its index; every other thread (lwIP, the netif hook, the
+ * traffic generator) runs as worker 0. Sharing worker 0's state relies on
+ * the cooperative scheduler: none of them is switched out mid-update.
+ */
+extern __thread unsigned int loom_worker_id;
+extern unsigned int loom_num_workers;
+
+static inline unsigned int loom_worker(void)
+{
+    return loom_worker_id;
+}
+
+/* Called first thing in a worker thread */
+void loom_worker_register(unsigned int id);
+
+/* Number of workers sharing the data path, at least 1 */
+void loom_set_num_workers(unsigned int count);
+
+#endif /* LOOM_WORKER_H */
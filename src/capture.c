@@ -1,39 +1,307 @@
 #include "loom/capture.h"
+#include "loom/classify.h"
+#include "loom/clock.h"
+#include "loom/forward.h"
 #include "loom/nf_chain.h"
+#include "loom/nf_synproxy.h"
+#include "loom/packet.h"
+#include "loom/sampler.h"
+#include "loom/flow_export.h"
+#include "loom/worker.h"
 #include <stdio.h>
-#include "lwip/prot/ethernet.h"
-#include "lwip/prot/ip4.h"
-#include "lwip/prot/tcp.h"
+#include "lwip/prot/ip.h"
+#include "lwip/sys.h"
+#include "lwip/tcpip.h"
+
+#define CAPTURE_BATCH_SIZE NF_BATCH_MAX
+
+typedef struct {
+    uint16_t count;
+    bool busy;                  /* Being run, the RX side must not reuse it */
+    struct pbuf *pkts[CAPTURE_BATCH_SIZE];
+    pkt_meta_t meta[CAPTURE_BATCH_SIZE];
+    classify_burst_t burst;
+} capture_batch_t;
 
 static err_t (*original_input_fn)(struct pbuf *p, struct netif *inp) = NULL;
 
-static uint16_t control_port = 0;
+static struct netif *capture_netif = NULL;
+
+/*
+ * Packets handed to us by the uknetdev RX loop are accumulated in the
+ * pending batch and run through the NF chain either when the batch fills up
+ * or from a tcpip callback once the RX burst has been drained. Two buffers
+ * let the RX side keep filling one while the other is being processed.
+ * A run can yield, so the buffer being run stays busy until it is done;
+ * whoever finishes it runs what the RX side queued in the meantime.
+ */
+static capture_batch_t batches[2];
+static capture_batch_t *pending = &batches[0];
+static bool flush_scheduled = false;
+
+#define CAPTURE_MAX_CONTROL_PORTS 4
+
+static uint16_t control_ports[CAPTURE_MAX_CONTROL_PORTS];
+static int num_control_ports = 0;
+
+/* Scratch state for capture_inject_burst(), only the generator calls it */
+static pkt_meta_t inject_meta[CAPTURE_BATCH_SIZE];
+static classify_burst_t inject_burst;
+
+/*
+ * One block per worker, summed by capture_get_stats(). seq is odd while
+ * the owning worker is updating the block; readers retry until they copy
+ * it between two identical even values.
+ *
+ * The seqlock needs a single writer per block, and block 0 has several:
+ * fastpath worker 0, the tcpip thread, the RX hook's tail drops and the
+ * traffic generator all run as worker 0. That is only safe because the
+ * cooperative scheduler never switches threads inside capture_stats_add();
+ * with a preemptive one those contexts need blocks of their own.
+ */
+typedef struct {
+    uint32_t seq;
+    capture_stats_t stats;
+} __attribute__((aligned(64))) capture_shard_t;
+
+static capture_shard_t shards[LOOM_MAX_WORKERS];
 
-static capture_stats_t stats = {0};
+typedef struct {
+    capture_stats_t stats;
+    uint64_t timestamp_ns;
+} capture_sample_t;
 
-static bool is_control_packet(struct pbuf *p)
+/* Start of the current rate window and the result of the last one */
+static capture_sample_t rate_sample;
+static capture_rates_t last_rates;
+
+void capture_stats_add(const capture_stats_t *delta)
 {
-    if (p->tot_len < sizeof(struct eth_hdr) + sizeof(struct ip_hdr)) {
+    capture_shard_t *shard = &shards[loom_worker()];
+    capture_stats_t *s = &shard->stats;
+
+    __atomic_store_n(&shard->seq, shard->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+#define CAPTURE_STATS_ADD(field) \
+    __atomic_store_n(&s->field, s->field + delta->field, __ATOMIC_RELAXED)
+
+    CAPTURE_STATS_ADD(total_packets);
+    CAPTURE_STATS_ADD(total_bytes);
+    CAPTURE_STATS_ADD(passed_packets);
+    CAPTURE_STATS_ADD(dropped_packets);
+    CAPTURE_STATS_ADD(forwarded_packets);
+
+#undef CAPTURE_STATS_ADD
+
+    __atomic_store_n(&shard->seq, shard->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void capture_shard_read(const capture_shard_t *shard, capture_stats_t *out)
+{
+    const capture_stats_t *s = &shard->stats;
+    uint32_t seq;
+
+    do {
+        seq = __atomic_load_n(&shard->seq, __ATOMIC_ACQUIRE);
+        out->total_packets = __atomic_load_n(&s->total_packets, __ATOMIC_RELAXED);
+        out->total_bytes = __atomic_load_n(&s->total_bytes, __ATOMIC_RELAXED);
+        out->passed_packets = __atomic_load_n(&s->passed_packets, __ATOMIC_RELAXED);
+        out->dropped_packets = __atomic_load_n(&s->dropped_packets, __ATOMIC_RELAXED);
+        out->forwarded_packets = __atomic_load_n(&s->forwarded_packets,
+                                                 __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&shard->seq, __ATOMIC_RELAXED));
+}
+
+void capture_add_control_port(uint16_t port)
+{
+    if (num_control_ports < CAPTURE_MAX_CONTROL_PORTS) {
+        control_ports[num_control_ports++] = port;
+        }
+}
+
+/* Unicast IPv4 not addressed to us, lwIP would only discard it */
+static bool is_transit_packet(const pkt_meta_t *meta)
+{
+    uint32_t dst = lwip_ntohl(meta->dst_ip);
+
+    return (meta->flags & PKT_F_IPV4) &&
+           meta->dst_ip != netif_ip4_addr(capture_netif)->addr &&
+           dst != 0xffffffffU && (dst & 0xf0000000U) != 0xe0000000U;
+}
+
+/*
+ * The netif hook only has the one interface, so bounce is the only
+ * forwarding mode it can honour. The frame goes back out in place; the
+ * driver takes its own reference while the frame is queued.
+ */
+static bool capture_forward(struct pbuf *p, const pkt_meta_t *meta,
+                            capture_stats_t *delta)
+{
+    if (forward_config.mode != FORWARD_BOUNCE || !is_transit_packet(meta) ||
+        !capture_netif->linkoutput) {
         return false;
     }
 
-    struct eth_hdr *eth = (struct eth_hdr *)p->payload;
-    uint16_t eth_type = lwip_ntohs(eth->type);
-    
-    if (eth_type != ETHTYPE_IP) {
-        return false;
+    /* lwIP would only discard it too */
+    if (!forward_decrement_ttl((uint8_t *)p->payload, meta)) {
+        pbuf_free(p);
+        return true;
     }
 
-    struct ip_hdr *ip = (struct ip_hdr *)((uint8_t *)p->payload + sizeof(struct eth_hdr));
-    
-    if (IPH_PROTO(ip) != 6) { // 6 is TCP
-        return false;
+    forward_rewrite_eth((uint8_t *)p->payload, capture_netif->hwaddr, true);
+
+    if (capture_netif->linkoutput(capture_netif, p) == ERR_OK) {
+        delta->forwarded_packets++;
+    }
+    pbuf_free(p);
+    return true;
+}
+
+/* NULL while the other buffer is still being run; under protection */
+static capture_batch_t *capture_batch_swap(void)
+{
+    capture_batch_t *batch = pending;
+    capture_batch_t *next = (batch == &batches[0]) ? &batches[1] : &batches[0];
+
+    if (next->busy) {
+        return NULL;
+    }
+
+    batch->busy = true;
+    pending = next;
+    pending->count = 0;
+    flush_scheduled = false;
+    return batch;
+}
+
+static capture_batch_t *capture_batch_take(void)
+{
+    SYS_ARCH_DECL_PROTECT(lev);
+    SYS_ARCH_PROTECT(lev);
+    capture_batch_t *batch = capture_batch_swap();
+    SYS_ARCH_UNPROTECT(lev);
+    return batch;
+}
+
+/* Releases a run batch, returns the pending one if it has packets */
+static capture_batch_t *capture_batch_done(capture_batch_t *batch)
+{
+    SYS_ARCH_DECL_PROTECT(lev);
+    SYS_ARCH_PROTECT(lev);
+
+    batch->busy = false;
+    capture_batch_t *next = pending->count ? capture_batch_swap() : NULL;
+
+    SYS_ARCH_UNPROTECT(lev);
+    return next;
+}
+
+static void capture_burst_fill(classify_burst_t *burst, struct pbuf **pkts,
+                               uint16_t count)
+{
+    burst->count = count;
+    for (uint16_t i = 0; i < count; i++) {
+        burst->data[i] = (const uint8_t *)pkts[i]->payload;
+        burst->len[i] = pkts[i]->len;
+        burst->tot_len[i] = pkts[i]->tot_len;
+    }
+}
+
+/*
+ * Control traffic skips the chain but not the SYN proxy, which shields
+ * it from floods. It is pulled out of the batch here and the rest is
+ * compacted in place for the chain.
+ */
+static uint16_t capture_batch_control(capture_batch_t *batch, uint64_t control,
+                                      capture_stats_t *delta)
+{
+    uint16_t kept = 0;
+
+    for (uint16_t i = 0; i < batch->count; i++) {
+        struct pbuf *p = batch->pkts[i];
+
+        if (!(control & (1ULL << i))) {
+            batch->pkts[kept] = p;
+            batch->meta[kept] = batch->meta[i];
+            kept++;
+            continue;
+        }
+
+        delta->total_packets++;
+        delta->total_bytes += p->tot_len;
+
+        if (!nf_synproxy(p, &batch->meta[i])) {
+            nf_chain_count_drops(PKT_DROP_SYNPROXY, 1);
+            delta->dropped_packets++;
+            pbuf_free(p);
+            continue;
+        }
+        delta->passed_packets++;
+        if (original_input_fn(p, capture_netif) != ERR_OK) {
+            pbuf_free(p);
+        }
+    }
+
+    return kept;
+}
+
+static void capture_batch_run(capture_batch_t *batch)
+{
+    if (batch->count == 0) {
+        return;
+    }
+
+    capture_stats_t delta = {0};
+
+    capture_burst_fill(&batch->burst, batch->pkts, batch->count);
+    uint64_t control = classify_burst(&batch->burst, batch->meta,
+                                      control_ports, num_control_ports);
+    if (control) {
+        batch->count = capture_batch_control(batch, control, &delta);
+    }
+
+    uint64_t pass_mask = nf_chain_process_batch(batch->pkts, batch->meta,
+                                                batch->count);
+    sampler_offer(batch->pkts, batch->meta, batch->count, pass_mask);
+    flow_export_account(batch->meta, batch->count, pass_mask);
+
+    for (uint16_t i = 0; i < batch->count; i++) {
+        struct pbuf *p = batch->pkts[i];
+
+        delta.total_packets++;
+        delta.total_bytes += p->tot_len;
+
+        if (pass_mask & (1ULL << i)) {
+            delta.passed_packets++;
+            if (capture_forward(p, &batch->meta[i], &delta)) {
+                continue;
+            }
+            if (original_input_fn(p, capture_netif) != ERR_OK) {
+                pbuf_free(p);
+            }
+        } else {
+            delta.dropped_packets++;
+            pbuf_free(p);
+        }
     }
 
-    struct tcp_hdr *tcp = (struct tcp_hdr *)((uint8_t *)ip + (IPH_HL(ip) * 4));
-    uint16_t dst_port = lwip_ntohs(tcp->dest);
+    capture_stats_add(&delta);
+    batch->count = 0;
+}
+
+static void capture_batch_run_all(capture_batch_t *batch)
+{
+    while (batch) {
+        capture_batch_run(batch);
+        batch = capture_batch_done(batch);
+    }
+}
 
-    return (dst_port == control_port);
+static void capture_flush_cb(void *arg)
+{
+    capture_batch_run_all(capture_batch_take());
 }
 
 static err_t capture_input_hook(struct pbuf *p, struct netif *inp)
@@ -42,25 +310,82 @@ static err_t capture_input_hook(struct pbuf *p, struct netif *inp)
         return ERR_OK;
     }
 
-    stats.total_packets++;
-    stats.total_bytes += p->tot_len;
+    /* Packets are classified and counted when their batch runs */
+    SYS_ARCH_DECL_PROTECT(lev);
+    SYS_ARCH_PROTECT(lev);
 
-    if (is_control_packet(p)) {
-        stats.passed_packets++;
-        return original_input_fn(p, inp);
-    }
+    capture_batch_t *batch = pending;
+
+    /* Full and the other buffer still running: tail drop, like a full ring */
+    if (batch->count == CAPTURE_BATCH_SIZE) {
+        SYS_ARCH_UNPROTECT(lev);
 
-    bool allow = nf_chain_process(p);
-    
-    if (allow) {
-        stats.passed_packets++;
-        return original_input_fn(p, inp);
-    } else {
-        stats.dropped_packets++;
-        printf("[CAPTURE] Packet dropped by NF chain\n");
+        capture_stats_t delta = {
+            .total_packets = 1,
+            .total_bytes = p->tot_len,
+            .dropped_packets = 1,
+        };
+        capture_stats_add(&delta);
         pbuf_free(p);
         return ERR_OK;
     }
+
+    batch->pkts[batch->count++] = p;
+
+    bool full = (batch->count == CAPTURE_BATCH_SIZE);
+    bool schedule = !full && !flush_scheduled;
+    if (schedule) {
+        flush_scheduled = true;
+    }
+
+    SYS_ARCH_UNPROTECT(lev);
+
+    /* take() fails only while a run is under way, which picks these up */
+    if (full) {
+        capture_batch_run_all(capture_batch_take());
+    } else if (schedule && tcpip_try_callback(capture_flush_cb, NULL) != ERR_OK) {
+        /* tcpip mbox is full, don't leave the batch stranded */
+        capture_batch_run_all(capture_batch_take());
+    }
+
+    return ERR_OK;
+}
+
+uint16_t capture_inject_burst(struct pbuf **pkts, uint16_t count)
+{
+    if (count > CAPTURE_BATCH_SIZE) {
+        count = CAPTURE_BATCH_SIZE;
+    }
+
+    capture_burst_fill(&inject_burst, pkts, count);
+    classify_burst(&inject_burst, inject_meta, NULL, 0);
+
+    /* Spoofed sources, anything sent back would leave through the NIC */
+    for (uint16_t i = 0; i < count; i++) {
+        inject_meta[i].flags |= PKT_F_GENERATED;
+    }
+
+    uint64_t pass_mask = nf_chain_process_batch(pkts, inject_meta, count);
+
+    for (uint16_t i = 0; i < count; i++) {
+        pbuf_free(pkts[i]);
+    }
+
+    return (uint16_t)__builtin_popcountll(pass_mask);
+}
+
+err_t capture_deliver(struct pbuf *p)
+{
+    if (!original_input_fn) {
+        pbuf_free(p);
+        return ERR_IF;
+    }
+
+    err_t err = original_input_fn(p, capture_netif);
+    if (err != ERR_OK) {
+        pbuf_free(p);
+    }
+    return err;
 }
 
 int capture_hook_init(struct netif *netif, uint16_t port)
@@ -75,7 +400,9 @@ int capture_hook_init(struct netif *netif, uint16_t port)
         return -1;
     }
 
-    control_port = port;
+    capture_add_control_port(port);
+    capture_netif = netif;
+    rate_sample.timestamp_ns = loom_now_ns();
 
     original_input_fn = netif->input;
 
@@ -90,14 +417,66 @@ int capture_hook_init(struct netif *netif, uint16_t port)
 
 void capture_print_stats(void)
 {
+    capture_stats_t stats = capture_get_stats();
+
     printf("\n=== Capture Statistics ===\n");
     printf("Total Packets:   %llu\n", (unsigned long long)stats.total_packets);
     printf("Total Bytes:     %llu\n", (unsigned long long)stats.total_bytes);
     printf("Passed Packets:  %llu\n", (unsigned long long)stats.passed_packets);
     printf("Dropped Packets: %llu\n", (unsigned long long)stats.dropped_packets);
+    printf("Forwarded:       %llu\n", (unsigned long long)stats.forwarded_packets);
     printf("=========================\n\n");
 }
 
-capture_stats_t capture_get_stats() {
-    return stats;
-}
\ No newline at end of file
+capture_stats_t capture_get_stats(void)
+{
+    capture_stats_t total = {0};
+
+    for (int w = 0; w < LOOM_MAX_WORKERS; w++) {
+        capture_stats_t s;
+        capture_shard_read(&shards[w], &s);
+        total.total_packets += s.total_packets;
+        total.total_bytes += s.total_bytes;
+        total.passed_packets += s.passed_packets;
+        total.dropped_packets += s.dropped_packets;
+        total.forwarded_packets += s.forwarded_packets;
+    }
+
+    return total;
+}
+
+static uint64_t capture_rate(uint64_t count, uint64_t elapsed_ns)
+{
+    return (uint64_t)((double)count * LOOM_NSEC_PER_SEC / elapsed_ns);
+}
+
+capture_rates_t capture_get_rates(void)
+{
+    capture_sample_t now = { capture_get_stats(), loom_now_ns() };
+    capture_rates_t rates;
+
+    SYS_ARCH_DECL_PROTECT(lev);
+    SYS_ARCH_PROTECT(lev);
+
+    const capture_sample_t *prev = &rate_sample;
+    uint64_t elapsed = now.timestamp_ns - prev->timestamp_ns;
+
+    /* A concurrent reader may have closed the window with a later sample */
+    if (now.timestamp_ns > prev->timestamp_ns &&
+        elapsed >= CAPTURE_RATE_WINDOW_MS * 1000000ULL) {
+        last_rates.window_ns = elapsed;
+        last_rates.pps = capture_rate(now.stats.total_packets -
+                                      prev->stats.total_packets, elapsed);
+        last_rates.bps = capture_rate((now.stats.total_bytes -
+                                       prev->stats.total_bytes) * 8, elapsed);
+        last_rates.passed_pps = capture_rate(now.stats.passed_packets -
+                                             prev->stats.passed_packets, elapsed);
+        last_rates.dropped_pps = capture_rate(now.stats.dropped_packets -
+                                              prev->stats.dropped_packets, elapsed);
+        rate_sample = now;
+    }
+    rates = last_rates;
+
+    SYS_ARCH_UNPROTECT(lev);
+    return rates;
+}
@@ -0,0 +1,334 @@
+#include "loom/classify.h"
+#include <stddef.h>
+#include <stdio.h>
+#include "lwip/def.h"
+#include "lwip/prot/ethernet.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#define CLASSIFY_PORT_WORDS (65536 / 64)
+
+typedef uint64_t (*classify_burst_fn)(const classify_burst_t *burst,
+                                      pkt_meta_t *meta,
+                                      const uint16_t *ports, int num_ports);
+typedef uint64_t (*classify_lookup_fn)(const pkt_meta_t *meta, uint16_t count,
+                                       uint64_t mask, const uint64_t *bitmap);
+
+static inline bool port_in(uint16_t port, const uint16_t *ports, int num_ports)
+{
+    for (int i = 0; i < num_ports; i++) {
+        if (port == ports[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline bool is_control(const pkt_meta_t *meta, const uint16_t *ports,
+                              int num_ports)
+{
+    return (meta->flags & PKT_F_L4) && meta->proto == IP_PROTO_TCP &&
+           port_in(meta->dst_port, ports, num_ports);
+}
+
+static uint64_t classify_burst_scalar(const classify_burst_t *burst,
+                                      pkt_meta_t *meta,
+                                      const uint16_t *ports, int num_ports)
+{
+    uint64_t control = 0;
+
+    for (uint16_t i = 0; i < burst->count; i++) {
+        pkt_parse_buf(burst->data[i], burst->len[i], burst->tot_len[i], &meta[i]);
+        if (is_control(&meta[i], ports, num_ports)) {
+            control |= 1ULL << i;
+        }
+    }
+    return control;
+}
+
+static uint64_t classify_port_lookup_scalar(const pkt_meta_t *meta,
+                                            uint16_t count, uint64_t mask,
+                                            const uint64_t *bitmap)
+{
+    uint64_t hits = 0;
+    uint64_t todo = mask;
+
+    while (todo) {
+        int i = __builtin_ctzll(todo);
+        todo &= todo - 1;
+
+        if (!(meta[i].flags & PKT_F_L4)) {
+            continue;
+        }
+
+        const uint64_t *map = bitmap +
+                              (meta[i].proto == IP_PROTO_UDP) * CLASSIFY_PORT_WORDS;
+        uint16_t port = meta[i].dst_port;
+
+        if ((map[port >> 6] >> (port & 63)) & 1) {
+            hits |= 1ULL << i;
+        }
+    }
+    return hits;
+}
+
+#if defined(__x86_64__)
+
+/*
+ * The common case, Ethernet + IPv4 without options + TCP/UDP, is parsed
+ * four frames at a time from five 64-bit gathers per frame at fixed
+ * offsets. Any other frame (options, fragments, short, not IPv4) drops
+ * out of the vector path and goes through pkt_parse_buf().
+ */
+#define CLASSIFY_GATHER_LEN 48  /* Bytes the gathers read from a frame */
+#define CLASSIFY_TCP_LEN (SIZEOF_ETH_HDR + IP_HLEN + TCP_HLEN)
+
+/* Offsets of the gathered words and of fields within them */
+#define OFF_ETH_TYPE    12      /* type, IP v/hl, tos, total length */
+#define OFF_IP_FRAG     20      /* frag offset, ttl, proto */
+#define OFF_IP_ADDR     26      /* source and destination address */
+#define OFF_L4_PORTS    34      /* source and destination port */
+#define OFF_TCP_FLAGS   40      /* TCP flags in the top byte */
+
+#define LANES 4
+
+__attribute__((target("avx2")))
+static uint64_t classify_burst_avx2(const classify_burst_t *burst,
+                                    pkt_meta_t *meta,
+                                    const uint16_t *ports, int num_ports)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i lane_id = _mm256_setr_epi64x(0, 1, 2, 3);
+    uint64_t control = 0;
+
+    for (uint16_t i = 0; i < burst->count; i += LANES) {
+        __m256i ptr = _mm256_loadu_si256((const __m256i *)&burst->data[i]);
+        __m256i len = _mm256_cvtepu16_epi64(
+            _mm_loadl_epi64((const __m128i *)&burst->len[i]));
+
+        /* Lanes past count and frames too short to gather are not touched */
+        __m256i ok = _mm256_and_si256(
+            _mm256_cmpgt_epi64(_mm256_set1_epi64x(burst->count - i), lane_id),
+            _mm256_cmpgt_epi64(len, _mm256_set1_epi64x(CLASSIFY_GATHER_LEN - 1)));
+
+#define GATHER(off) _mm256_mask_i64gather_epi64(zero, NULL,                 \
+            _mm256_add_epi64(ptr, _mm256_set1_epi64x(off)), ok, 1)
+
+        __m256i w_eth = GATHER(OFF_ETH_TYPE);
+        __m256i w_frag = GATHER(OFF_IP_FRAG);
+        __m256i w_addr = GATHER(OFF_IP_ADDR);
+        __m256i w_ports = GATHER(OFF_L4_PORTS);
+        __m256i w_flags = GATHER(OFF_TCP_FLAGS);
+
+#undef GATHER
+
+        /* Ethertype 0x0800 and v/hl 0x45, as stored little endian */
+        __m256i fast = _mm256_and_si256(ok, _mm256_cmpeq_epi64(
+            _mm256_and_si256(w_eth, _mm256_set1_epi64x(0xffffff)),
+            _mm256_set1_epi64x(0x450008)));
+
+        /* Neither MF nor a fragment offset */
+        fast = _mm256_and_si256(fast, _mm256_cmpeq_epi64(
+            _mm256_and_si256(w_frag, _mm256_set1_epi64x(0xff3f)), zero));
+
+        __m256i proto = _mm256_and_si256(_mm256_srli_epi64(w_frag, 24),
+                                         _mm256_set1_epi64x(0xff));
+        __m256i is_tcp = _mm256_and_si256(
+            _mm256_cmpeq_epi64(proto, _mm256_set1_epi64x(IP_PROTO_TCP)),
+            _mm256_cmpgt_epi64(len, _mm256_set1_epi64x(CLASSIFY_TCP_LEN - 1)));
+        __m256i is_udp = _mm256_cmpeq_epi64(proto, _mm256_set1_epi64x(IP_PROTO_UDP));
+
+        fast = _mm256_and_si256(fast, _mm256_or_si256(is_tcp, is_udp));
+
+        /* Destination port to host order, compared against every port */
+        __m256i dport = _mm256_srli_epi64(w_ports, 16);
+        dport = _mm256_or_si256(
+            _mm256_slli_epi64(_mm256_and_si256(dport, _mm256_set1_epi64x(0xff)), 8),
+            _mm256_and_si256(_mm256_srli_epi64(dport, 8), _mm256_set1_epi64x(0xff)));
+
+        __m256i hit = zero;
+        for (int p = 0; p < num_ports; p++) {
+            hit = _mm256_or_si256(hit, _mm256_cmpeq_epi64(
+                dport, _mm256_set1_epi64x(ports[p])));
+        }
+        hit = _mm256_and_si256(hit, _mm256_and_si256(fast, is_tcp));
+
+        unsigned int fast_bits = _mm256_movemask_pd(_mm256_castsi256_pd(fast));
+        control |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(hit)) << i;
+
+        uint64_t eth[LANES], frag[LANES], addr[LANES], l4[LANES], flags[LANES];
+        _mm256_storeu_si256((__m256i *)eth, w_eth);
+        _mm256_storeu_si256((__m256i *)frag, w_frag);
+        _mm256_storeu_si256((__m256i *)addr, w_addr);
+        _mm256_storeu_si256((__m256i *)l4, w_ports);
+        _mm256_storeu_si256((__m256i *)flags, w_flags);
+
+        for (int j = 0; j < LANES && i + j < burst->count; j++) {
+            pkt_meta_t *m = &meta[i + j];
+
+            if (!(fast_bits & (1U << j))) {
+                pkt_parse_buf(burst->data[i + j], burst->len[i + j],
+                              burst->tot_len[i + j], m);
+                if (is_control(m, ports, num_ports)) {
+                    control |= 1ULL << (i + j);
+                }
+                continue;
+            }
+
+            uint16_t ip_len = (uint16_t)(((eth[j] >> 24) & 0xff00) |
+                                         ((eth[j] >> 40) & 0xff));
+
+            m->ethertype = ETHTYPE_IP;
+            m->pkt_len = burst->tot_len[i + j];
+            m->l3_offset = SIZEOF_ETH_HDR;
+            m->l4_offset = SIZEOF_ETH_HDR + IP_HLEN;
+            m->l4_len = ip_len > IP_HLEN ? ip_len - IP_HLEN : 0;
+            m->proto = (uint8_t)(frag[j] >> 24);
+            m->flags = PKT_F_IPV4 | PKT_F_L4;
+            m->tcp_flags = m->proto == IP_PROTO_TCP ?
+                           (uint8_t)(flags[j] >> 56) & TCP_FLAGS : 0;
+            m->drop_reason = PKT_DROP_NONE;
+            m->src_ip = (uint32_t)addr[j];
+            m->dst_ip = (uint32_t)(addr[j] >> 32);
+            m->src_port = lwip_ntohs((uint16_t)l4[j]);
+            m->dst_port = lwip_ntohs((uint16_t)(l4[j] >> 16));
+        }
+    }
+
+    return control;
+}
+
+/* Where a pkt_meta_t field sits within its aligned 32-bit word */
+#define META_WORD(field) (offsetof(pkt_meta_t, field) & ~(size_t)3)
+#define META_SHIFT(field) ((int)(offsetof(pkt_meta_t, field) & 3) * 8)
+
+_Static_assert((offsetof(pkt_meta_t, dst_port) & 3) <= 2 &&
+               META_WORD(proto) == META_WORD(flags),
+               "pkt_meta_t layout does not suit the port lookup gathers");
+
+__attribute__((target("avx2")))
+static uint64_t classify_port_lookup_avx2(const pkt_meta_t *meta,
+                                          uint16_t count, uint64_t mask,
+                                          const uint64_t *bitmap)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lane_id = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i stride = _mm_set1_epi32(sizeof(pkt_meta_t));
+    const uint8_t *base = (const uint8_t *)meta;
+    uint64_t hits = 0;
+
+    for (uint16_t i = 0; i < count; i += LANES) {
+        if (!((mask >> i) & 0xf)) {
+            continue;
+        }
+
+        __m128i lane = _mm_add_epi32(lane_id, _mm_set1_epi32(i));
+        __m128i idx = _mm_mullo_epi32(lane, stride);
+        __m128i valid = _mm_cmpgt_epi32(_mm_set1_epi32(count), lane);
+
+        __m128i w_port = _mm_mask_i32gather_epi32(zero,
+            (const int *)(base + META_WORD(dst_port)), idx, valid, 1);
+        __m128i w_proto = _mm_mask_i32gather_epi32(zero,
+            (const int *)(base + META_WORD(proto)), idx, valid, 1);
+
+        __m128i port = _mm_and_si128(_mm_srli_epi32(w_port, META_SHIFT(dst_port)),
+                                     _mm_set1_epi32(0xffff));
+        __m128i proto = _mm_and_si128(_mm_srli_epi32(w_proto, META_SHIFT(proto)),
+                                      _mm_set1_epi32(0xff));
+        __m128i l4 = _mm_and_si128(_mm_srli_epi32(w_proto, META_SHIFT(flags)),
+                                   _mm_set1_epi32(PKT_F_L4));
+        __m128i is_l4 = _mm_and_si128(valid,
+                                      _mm_cmpeq_epi32(l4, _mm_set1_epi32(PKT_F_L4)));
+
+        /* Word index into the TCP half, or the UDP half after it */
+        __m128i word = _mm_add_epi32(_mm_srli_epi32(port, 6), _mm_and_si128(
+            _mm_cmpeq_epi32(proto, _mm_set1_epi32(IP_PROTO_UDP)),
+            _mm_set1_epi32(CLASSIFY_PORT_WORDS)));
+
+        __m256i words = _mm256_mask_i32gather_epi64(_mm256_setzero_si256(),
+            (const long long *)bitmap, word, _mm256_cvtepi32_epi64(is_l4), 8);
+        __m256i bit = _mm256_and_si256(
+            _mm256_srlv_epi64(words, _mm256_cvtepu32_epi64(
+                _mm_and_si128(port, _mm_set1_epi32(63)))),
+            _mm256_set1_epi64x(1));
+        __m256i hit = _mm256_and_si256(_mm256_cvtepi32_epi64(is_l4),
+            _mm256_cmpeq_epi64(bit, _mm256_set1_epi64x(1)));
+
+        hits |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(hit)) << i;
+    }
+
+    return hits & mask;
+}
+
+#undef LANES
+
+/* AVX2 in CPUID and YMM state enabled by whoever set up XCR0 */
+static bool cpu_has_avx2(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) ||
+        !(ecx & bit_OSXSAVE) || !(ecx & bit_AVX)) {
+        return false;
+    }
+
+    uint32_t xcr0_lo, xcr0_hi;
+    __asm__ __volatile__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0_lo & 0x6) != 0x6) {
+        return false;
+    }
+
+    return __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_AVX2);
+}
+
+#endif /* __x86_64__ */
+
+static classify_burst_fn burst_fn = classify_burst_scalar;
+static classify_lookup_fn lookup_fn = classify_port_lookup_scalar;
+static const char *impl_name = "scalar";
+
+bool classify_select(bool allow_simd)
+{
+    burst_fn = classify_burst_scalar;
+    lookup_fn = classify_port_lookup_scalar;
+    impl_name = "scalar";
+
+#if defined(__x86_64__)
+    if (allow_simd && cpu_has_avx2()) {
+        burst_fn = classify_burst_avx2;
+        lookup_fn = classify_port_lookup_avx2;
+        impl_name = "avx2";
+    }
+#endif
+
+    return burst_fn != classify_burst_scalar;
+}
+
+void classify_init(bool allow_simd)
+{
+    classify_select(allow_simd);
+    printf("[CLASSIFY] Header classification: %s\n", impl_name);
+}
+
+const char *classify_impl_name(void)
+{
+    return impl_name;
+}
+
+uint64_t classify_burst(const classify_burst_t *burst, pkt_meta_t *meta,
+                        const uint16_t *ports, int num_ports)
+{
+    return burst_fn(burst, meta, ports, num_ports);
+}
+
+uint64_t classify_port_lookup(const pkt_meta_t *meta, uint16_t count,
+                              uint64_t mask, const uint64_t *bitmap)
+{
+    return lookup_fn(meta, count, mask, bitmap);
+}
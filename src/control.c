@@ -1,15 +1,80 @@
 #include "loom/control.h"
 #include "loom/capture.h"
 #include "loom/nf_chain.h"
+#include "loom/nf_conntrack.h"
+#include "loom/nf_src_limiter.h"
+#include "loom/nf_acl.h"
+#include "loom/nf_synproxy.h"
+#include "loom/sampler.h"
+#include "loom/flow_export.h"
+#include "loom/event_log.h"
+#include "loom/traffic_gen.h"
+#include "loom/fastpath.h"
+#include "loom/forward.h"
+#include "loom/mempool.h"
+#include "loom/stats_export.h"
 
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include "lwip/sys.h"
 
+#define LOG_TAIL_RECORDS 16
+#define CONTROL_LINE_MAX 256
+#define CONTROL_MAX_CLIENTS 4
+
+/* Serializes commands from all clients of both servers */
+static sys_mutex_t control_mutex;
+static int num_clients = 0;
+
+/*
+ * A command's reply, built while holding the control lock and sent after
+ * it is released, so a client that stops reading blocks only itself.
+ */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} control_reply_t;
+
+/* Drops what does not fit when memory runs out, like a short send would */
+static void reply_add(control_reply_t *reply, const void *data, size_t len)
+{
+    if (reply->len + len > reply->cap) {
+        size_t cap = reply->cap ? reply->cap : 1024;
+        while (cap < reply->len + len) {
+            cap *= 2;
+        }
+        char *grown = realloc(reply->data, cap);
+        if (!grown) {
+            return;
+        }
+        reply->data = grown;
+        reply->cap = cap;
+    }
+    memcpy(reply->data + reply->len, data, len);
+    reply->len += len;
+}
+
+static void reply_flush(int client_fd, control_reply_t *reply)
+{
+    size_t sent = 0;
+
+    while (sent < reply->len) {
+        ssize_t n = send(client_fd, reply->data + sent, reply->len - sent, 0);
+        if (n <= 0) {
+            break;
+        }
+        sent += (size_t)n;
+    }
+    reply->len = 0;
+}
+
 static const char welcome_msg[] = 
     "\n"
     "================================\n"
@@ -17,193 +82,1122 @@ static const char welcome_msg[] =
     "================================\n"
     "Commands:\n"
     "  STATS  - Show packet statistics\n"
+    "  STATS NF - Show per-NF counters and latency\n"
+    "  STATS FASTPATH - Show uknetdev fast path counters\n"
+    "  STATS MEM - Show boot arena and pool usage\n"
+    "  STATS JSON - All counters and tables as one line of JSON\n"
+    "  LOG    - Show recent drop events\n"
     "  LIST   - List NF chain\n"
     "  ENABLE <nf> / DISABLE <nf>\n"
     "  REMOVE <nf> / CLEAR\n"
     "\n"
     "Rate Limiter:\n"
-    "  RATELIMIT SET <port> <pps>\n"
+    "  RATELIMIT SET <port> <rate> [burst] [pps|bps]\n"
     "  RATELIMIT REMOVE <port>\n"
     "  RATELIMIT LIST\n"
     "\n"
+    "Source Limiter:\n"
+    "  SRCLIMIT SET <pps>  (0 disables)\n"
+    "  SRCLIMIT TOP\n"
+    "\n"
     "Allowlist:\n"
-    "  ALLOW ADD <port>\n"
-    "  ALLOW REMOVE <port>\n"
+    "  ALLOW ADD <port>[-<port>] [tcp|udp]\n"
+    "  ALLOW REMOVE <port>[-<port>] [tcp|udp]\n"
     "  ALLOW LIST\n"
     "  ALLOW CLEAR\n"
     "\n"
+    "ACL (staged, applied on COMMIT):\n"
+    "  ACL ADD <src|dst> <cidr|any> [tcp|udp|icmp] [port[-port]] <allow|deny>\n"
+    "  ACL COMMIT / ACL CLEAR / ACL STATUS\n"
+    "  ACL DEFAULT <allow|deny>\n"
+    "\n"
+    "Conntrack:\n"
+    "  CT STATS / CT FLUSH\n"
+    "  CT STRICT ON|OFF\n"
+    "  CT TIMEOUT <tcp|udp> <sec>\n"
+    "\n"
+    "SYN Proxy (cookies for local TCP ports):\n"
+    "  SYNPROXY ON|OFF\n"
+    "  SYNPROXY ADD <port> / SYNPROXY REMOVE <port>\n"
+    "  SYNPROXY STATUS\n"
+    "\n"
+    "Packet sampling (pcap stream on its own TCP port):\n"
+    "  SAMPLE ON|OFF\n"
+    "  SAMPLE EVERY <n>  (1 keeps every match)\n"
+    "  SAMPLE DROPS ON|OFF\n"
+    "  SAMPLE FILTER [tcp|udp|icmp] [port <p>] [host <a.b.c.d>]\n"
+    "  SAMPLE STATUS\n"
+    "\n"
+    "Flow export (binary records over UDP):\n"
+    "  FLOW ON|OFF\n"
+    "  FLOW COLLECTOR <a.b.c.d> [port] / FLOW COLLECTOR NONE\n"
+    "  FLOW TIMEOUT <active_s> <idle_s>\n"
+    "  FLOW STATUS\n"
+    "\n"
+    "Forwarding (transit packets that pass the chain):\n"
+    "  FORWARD <off|bounce|cross>\n"
+    "  FORWARD NEXTHOP <aa:bb:cc:dd:ee:ff|none>\n"
+    "  FORWARD STATUS\n"
+    "\n"
+    "Fast path RX mode:\n"
+    "  POLL <busy|adaptive|interrupt> [idle_us]\n"
+    "  POLL STATUS\n"
+    "\n"
+    "Traffic Generator (in-guest, frames never reach lwIP):\n"
+    "  GEN START [flows=N] [size=B] [proto=tcp|udp|mix] [ports=P[-P]]\n"
+    "            [src=a.b.c.d/len] [dist=uniform|hot] [rate=pps]\n"
+    "            [burst=N] [secs=S]\n"
+    "  GEN STOP / GEN STATUS\n"
+    "\n"
     "  HELP / EXIT\n"
     "================================\n"
     "> ";
 
-static void handle_client(int client_fd)
+/* <port> <rate> [burst] [pps|bps], burst 0 means one second of rate */
+static int parse_ratelimit_args(const char *args, uint16_t *port, uint32_t *rate,
+                                uint32_t *burst, rate_limit_mode_t *mode)
 {
-    char buffer[256];
-    ssize_t n;
+    char opt1[16], opt2[16];
+    int n = sscanf(args, "%hu %u %15s %15s", port, rate, opt1, opt2);
 
-    printf("[CONTROL] New client connected\n");
-    send(client_fd, welcome_msg, strlen(welcome_msg), 0);
+    if (n < 2) {
+        return -1;
+    }
+
+    *burst = 0;
+    *mode = RATE_LIMIT_PPS;
+
+    for (int i = 2; i < n; i++) {
+        const char *opt = (i == 2) ? opt1 : opt2;
+        char *end;
+
+        if (strcasecmp(opt, "pps") == 0) {
+            *mode = RATE_LIMIT_PPS;
+        } else if (strcasecmp(opt, "bps") == 0) {
+            *mode = RATE_LIMIT_BPS;
+        } else {
+            unsigned long value = strtoul(opt, &end, 10);
+            if (*end != '\0' || end == opt || value > UINT32_MAX) {
+                return -1;
+            }
+            *burst = (uint32_t)value;
+        }
+    }
+
+    return 0;
+}
+
+/* <port>[-<port>] [tcp|udp], both protocols when none is given */
+static int parse_port_range(const char *args, uint16_t *first, uint16_t *last,
+                            uint8_t *protos)
+{
+    char *end;
+    unsigned long lo = strtoul(args, &end, 10);
+    unsigned long hi = lo;
+
+    if (end == args || lo > 65535) {
+        return -1;
+    }
+
+    if (*end == '-') {
+        const char *start = end + 1;
+        hi = strtoul(start, &end, 10);
+        if (end == start || hi > 65535 || hi < lo) {
+            return -1;
+        }
+    }
+
+    while (*end == ' ') {
+        end++;
+    }
+
+    if (*end == '\0') {
+        *protos = ALLOW_PROTO_ANY;
+    } else if (strcasecmp(end, "tcp") == 0) {
+        *protos = ALLOW_PROTO_TCP;
+    } else if (strcasecmp(end, "udp") == 0) {
+        *protos = ALLOW_PROTO_UDP;
+    } else {
+        return -1;
+    }
+
+    *first = (uint16_t)lo;
+    *last = (uint16_t)hi;
+    return 0;
+}
+
+/* [tcp|udp|icmp] [port <p>] [host <a.b.c.d>], nothing matches everything */
+static int parse_sample_filter(const char *args, sampler_filter_t *filter)
+{
+    char copy[CONTROL_LINE_MAX];
+    char *save = NULL;
+
+    strncpy(copy, args, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+
+    filter->proto = 0;
+    filter->port = 0;
+    filter->host = 0;
+
+    for (char *tok = strtok_r(copy, " ", &save); tok != NULL;
+         tok = strtok_r(NULL, " ", &save)) {
+        if (strcasecmp(tok, "tcp") == 0) {
+            filter->proto = IPPROTO_TCP;
+        } else if (strcasecmp(tok, "udp") == 0) {
+            filter->proto = IPPROTO_UDP;
+        } else if (strcasecmp(tok, "icmp") == 0) {
+            filter->proto = IPPROTO_ICMP;
+        } else if (strcasecmp(tok, "port") == 0) {
+            char *value = strtok_r(NULL, " ", &save);
+            char *end;
+            unsigned long port = value ? strtoul(value, &end, 10) : 0;
+            if (!value || *end != '\0' || port == 0 || port > 65535) {
+                return -1;
+            }
+            filter->port = (uint16_t)port;
+        } else if (strcasecmp(tok, "host") == 0) {
+            char *value = strtok_r(NULL, " ", &save);
+            struct in_addr addr;
+            if (!value || inet_pton(AF_INET, value, &addr) != 1) {
+                return -1;
+            }
+            filter->host = addr.s_addr;
+        } else {
+            return -1;
+        }
+    }
 
-    while ((n = recv(client_fd, buffer, sizeof(buffer) - 1, 0)) > 0) {
-        buffer[n] = '\0';
+    return 0;
+}
 
-        char *newline = strchr(buffer, '\n');
-        if (newline) *newline = '\0';
-        newline = strchr(buffer, '\r');
-        if (newline) *newline = '\0';
+/* <src|dst> <cidr|any> [tcp|udp|icmp] [port[-port]] <allow|deny> */
+static int parse_acl_rule(const char *args, acl_rule_t *rule)
+{
+    char copy[CONTROL_LINE_MAX];
+    char *tokens[5];
+    char *save = NULL;
+    int count = 0;
+
+    strncpy(copy, args, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+
+    for (char *tok = strtok_r(copy, " ", &save); tok != NULL;
+         tok = strtok_r(NULL, " ", &save)) {
+        if (count == 5) {
+            return -1;
+        }
+        tokens[count++] = tok;
+    }
 
+    if (count < 3) {
+        return -1;
+    }
+
+    memset(rule, 0, sizeof(*rule));
+    rule->port_hi = 0xffff;
+
+    if (strcasecmp(tokens[0], "src") == 0) {
+        rule->match = ACL_MATCH_SRC;
+    } else if (strcasecmp(tokens[0], "dst") == 0) {
+        rule->match = ACL_MATCH_DST;
+    } else {
+        return -1;
+    }
+
+    if (strcasecmp(tokens[1], "any") != 0) {
+        char *slash = strchr(tokens[1], '/');
+        unsigned long depth = 32;
+        struct in_addr addr;
+
+        if (slash) {
+            char *end;
+            *slash = '\0';
+            depth = strtoul(slash + 1, &end, 10);
+            if (*end != '\0' || end == slash + 1 || depth > 32) {
+                return -1;
+            }
+        }
+        if (inet_pton(AF_INET, tokens[1], &addr) != 1) {
+            return -1;
+        }
+        rule->prefix = ntohl(addr.s_addr);
+        rule->depth = (uint8_t)depth;
+    }
+
+    if (strcasecmp(tokens[count - 1], "allow") == 0) {
+        rule->action = ACL_ALLOW;
+    } else if (strcasecmp(tokens[count - 1], "deny") == 0) {
+        rule->action = ACL_DENY;
+    } else {
+        return -1;
+    }
+
+    for (int i = 2; i < count - 1; i++) {
+        if (strcasecmp(tokens[i], "tcp") == 0) {
+            rule->proto = IPPROTO_TCP;
+        } else if (strcasecmp(tokens[i], "udp") == 0) {
+            rule->proto = IPPROTO_UDP;
+        } else if (strcasecmp(tokens[i], "icmp") == 0) {
+            rule->proto = IPPROTO_ICMP;
+        } else if (strcasecmp(tokens[i], "any") == 0) {
+            rule->proto = 0;
+        } else {
+            uint8_t protos;
+            if (parse_port_range(tokens[i], &rule->port_lo, &rule->port_hi,
+                                 &protos) < 0) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Space separated key=value pairs on top of traffic_gen_default_config() */
+static int parse_gen_args(const char *args, traffic_gen_config_t *cfg)
+{
+    char copy[CONTROL_LINE_MAX];
+    char *save = NULL;
+
+    strncpy(copy, args, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+
+    traffic_gen_default_config(cfg);
+
+    for (char *tok = strtok_r(copy, " ", &save); tok != NULL;
+         tok = strtok_r(NULL, " ", &save)) {
+        char *value = strchr(tok, '=');
+        if (!value) {
+            return -1;
+        }
+        *value++ = '\0';
+
+        if (strcasecmp(tok, "flows") == 0) {
+            cfg->flows = strtoul(value, NULL, 10);
+        } else if (strcasecmp(tok, "size") == 0) {
+            cfg->pkt_size = (uint16_t)strtoul(value, NULL, 10);
+        } else if (strcasecmp(tok, "burst") == 0) {
+            cfg->burst = (uint16_t)strtoul(value, NULL, 10);
+        } else if (strcasecmp(tok, "rate") == 0) {
+            cfg->rate_pps = strtoul(value, NULL, 10);
+        } else if (strcasecmp(tok, "secs") == 0) {
+            cfg->duration_ms = strtoul(value, NULL, 10) * 1000;
+        } else if (strcasecmp(tok, "proto") == 0) {
+            if (strcasecmp(value, "tcp") == 0) {
+                cfg->proto = IPPROTO_TCP;
+            } else if (strcasecmp(value, "udp") == 0) {
+                cfg->proto = IPPROTO_UDP;
+            } else if (strcasecmp(value, "mix") == 0) {
+                cfg->proto = 0;
+            } else {
+                return -1;
+            }
+        } else if (strcasecmp(tok, "dist") == 0) {
+            if (strcasecmp(value, "uniform") == 0) {
+                cfg->dist = GEN_DIST_UNIFORM;
+            } else if (strcasecmp(value, "hot") == 0) {
+                cfg->dist = GEN_DIST_HOT;
+            } else {
+                return -1;
+            }
+        } else if (strcasecmp(tok, "ports") == 0) {
+            uint8_t protos;
+            if (parse_port_range(value, &cfg->port_lo, &cfg->port_hi,
+                                 &protos) < 0) {
+                return -1;
+            }
+        } else if (strcasecmp(tok, "src") == 0) {
+            char *slash = strchr(value, '/');
+            struct in_addr addr;
+            unsigned long depth = 32;
+
+            if (slash) {
+                *slash = '\0';
+                depth = strtoul(slash + 1, NULL, 10);
+            }
+            if (depth > 32 || inet_pton(AF_INET, value, &addr) != 1) {
+                return -1;
+            }
+            cfg->src_net = ntohl(addr.s_addr);
+            cfg->src_depth = (uint8_t)depth;
+        } else {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Returns 1 when the client asked to disconnect */
+static int handle_command(control_reply_t *reply, char *buffer)
+{
+    /* Bulk ACL loads would otherwise flood the console */
+    if (strncmp(buffer, "ACL ADD ", 8) != 0) {
         printf("[CONTROL] Received command: '%s'\n", buffer);
+    }
 
-        if (strcmp(buffer, "EXIT") == 0 || strcmp(buffer, "exit") == 0) {
-            const char *bye = "Goodbye!\n";
-            send(client_fd, bye, strlen(bye), 0);
-            break;
-        } 
-        else if (strcmp(buffer, "HELP") == 0 || strcmp(buffer, "help") == 0) {
-            send(client_fd, welcome_msg, strlen(welcome_msg), 0);
+    if (strcmp(buffer, "EXIT") == 0 || strcmp(buffer, "exit") == 0) {
+        const char *bye = "Goodbye!\n";
+        reply_add(reply, bye, strlen(bye));
+        return 1;
+    } 
+    else if (strcmp(buffer, "HELP") == 0 || strcmp(buffer, "help") == 0) {
+        reply_add(reply, welcome_msg, strlen(welcome_msg));
+    }
+    else if (strcmp(buffer, "STATS") == 0 || strcmp(buffer, "stats") == 0) {
+        capture_stats_t stats = capture_get_stats();
+        capture_rates_t rates = capture_get_rates();
+        char response[640];
+        snprintf(response, sizeof(response),
+                "\n=== Statistics ===\n"
+                "Total:   %llu packets (%llu bytes)\n"
+                "Passed:  %llu\n"
+                "Dropped: %llu\n"
+                "Forwarded: %llu\n"
+                "Rate:    %llu pps, %.3f Mbps (passed %llu pps, dropped %llu pps)"
+                " over %.1f s\n"
+                "==================\n> ",
+                (unsigned long long)stats.total_packets,
+                (unsigned long long)stats.total_bytes,
+                (unsigned long long)stats.passed_packets,
+                (unsigned long long)stats.dropped_packets,
+                (unsigned long long)stats.forwarded_packets,
+                (unsigned long long)rates.pps,
+                rates.bps / 1e6,
+                (unsigned long long)rates.passed_pps,
+                (unsigned long long)rates.dropped_pps,
+                rates.window_ns / 1e9);
+        reply_add(reply, response, strlen(response));
+    }
+    else if (strcmp(buffer, "STATS NF") == 0 || strcmp(buffer, "stats nf") == 0) {
+        char response[2048];
+        int used = nf_chain_format_stats(response, sizeof(response) - 3);
+        snprintf(response + used, sizeof(response) - used, "> ");
+        reply_add(reply, response, strlen(response));
+    }
+    else if (strcmp(buffer, "STATS MEM") == 0) {
+        char response[1024];
+        int used = mem_format_stats(response, sizeof(response) - 3);
+        snprintf(response + used, sizeof(response) - used, "> ");
+        reply_add(reply, response, strlen(response));
+    }
+    else if (strcmp(buffer, "STATS JSON") == 0 || strcmp(buffer, "stats json") == 0) {
+        char *response = malloc(STATS_EXPORT_BUF_SIZE);
+        int used = response ? stats_format_json(response, STATS_EXPORT_BUF_SIZE - 3) : -1;
+        if (used < 0) {
+            const char *msg = "ERROR: Statistics unavailable\n> ";
+            reply_add(reply, msg, strlen(msg));
+        } else {
+            snprintf(response + used, STATS_EXPORT_BUF_SIZE - used, "\n> ");
+            reply_add(reply, response, used + 3);
         }
-        else if (strcmp(buffer, "STATS") == 0 || strcmp(buffer, "stats") == 0) {
-            capture_stats_t stats = capture_get_stats();
-            char response[512];
+        free(response);
+    }
+    else if (strcmp(buffer, "STATS FASTPATH") == 0) {
+        fastpath_stats_t fp = fastpath_get_stats();
+        char response[1024];
+        if (!fp.running) {
             snprintf(response, sizeof(response),
-                    "\n=== Statistics ===\n"
-                    "Total:   %llu packets (%llu bytes)\n"
-                    "Passed:  %llu\n"
-                    "Dropped: %llu\n"
-                    "==================\n> ",
-                    (unsigned long long)stats.total_packets,
-                    (unsigned long long)stats.total_bytes,
-                    (unsigned long long)stats.passed_packets,
-                    (unsigned long long)stats.dropped_packets);
-            send(client_fd, response, strlen(response), 0);
-        }
-        else if (strcmp(buffer, "LIST") == 0 || strcmp(buffer, "list") == 0) {
-            nf_chain_list();
-            const char *msg = "Chain listed (check console)\n> ";
-            send(client_fd, msg, strlen(msg), 0);
+                     "Fast path not running (no spare netdev)\n> ");
+        } else {
+            snprintf(response, sizeof(response),
+                     "\n=== Fast Path (%u port(s), netdev %u%s, %u worker(s)) ===\n"
+                     "RX packets:   %llu in %llu bursts\n"
+                     "Passed:       %llu\n"
+                     "Dropped:      %llu\n"
+                     "To lwIP:      %llu (%llu failed)\n"
+                     "Forwarded:    %llu (%s)\n"
+                     "TX:           %llu sent, %llu ring full, %llu no port\n"
+                     "Transit:      %llu (%llu TTL expired)\n"
+                     "RX no buffer: %llu\n"
+                     "Poll mode:    %s, idle %u us%s\n"
+                     "Empty polls:  %llu\n"
+                     "Sleeps:       %llu (%llu woken by RX)\n"
+                     "=============================\n> ",
+                     fp.num_ports, fp.netdev_id[0],
+                     fp.num_ports > 1 ? " <-> peer" : "",
+                     fp.num_workers,
+                     (unsigned long long)fp.rx_packets,
+                     (unsigned long long)fp.rx_bursts,
+                     (unsigned long long)fp.passed,
+                     (unsigned long long)fp.dropped,
+                     (unsigned long long)fp.local,
+                     (unsigned long long)fp.local_failed,
+                     (unsigned long long)fp.forwarded,
+                     forward_mode_name(forward_config.mode),
+                     (unsigned long long)fp.tx_packets,
+                     (unsigned long long)fp.tx_dropped,
+                     (unsigned long long)fp.tx_no_port,
+                     (unsigned long long)fp.transit,
+                     (unsigned long long)fp.ttl_expired,
+                     (unsigned long long)fp.alloc_failed,
+                     fastpath_poll_mode_name(fp.poll_mode), fp.idle_us,
+                     fp.rx_intr ? "" : " (no RX interrupts)",
+                     (unsigned long long)fp.empty_polls,
+                     (unsigned long long)fp.sleeps,
+                     (unsigned long long)fp.wakeups);
         }
-        else if (strncmp(buffer, "ENABLE ", 7) == 0) {
-            if (nf_chain_set_enabled(buffer + 7, true) == 0) {
-                const char *msg = "OK\n> ";
-                send(client_fd, msg, strlen(msg), 0);
-            } else {
-                const char *msg = "ERROR: NF not found\n> ";
-                send(client_fd, msg, strlen(msg), 0);
+        reply_add(reply, response, strlen(response));
+    }
+    else if (strcmp(buffer, "LOG") == 0 || strcmp(buffer, "log") == 0) {
+        char response[2048];
+        uint64_t cursor = event_log_tail(LOG_TAIL_RECORDS);
+        size_t used = event_log_format(&cursor, response, sizeof(response));
+
+        for (int r = 0; r < EVENT_REASON_MAX; r++) {
+            event_counters_t counters = event_log_counters(r);
+            int n = snprintf(response + used, sizeof(response) - used,
+                             "%s: %llu logged, %llu suppressed\n",
+                             event_reason_name(r),
+                             (unsigned long long)counters.recorded,
+                             (unsigned long long)counters.suppressed);
+            if (n < 0 || (size_t)n >= sizeof(response) - used) {
+                break;
             }
+            used += n;
         }
-        else if (strncmp(buffer, "DISABLE ", 8) == 0) {
-            if (nf_chain_set_enabled(buffer + 8, false) == 0) {
+        snprintf(response + used, sizeof(response) - used, "> ");
+        reply_add(reply, response, strlen(response));
+    }
+    else if (strcmp(buffer, "LIST") == 0 || strcmp(buffer, "list") == 0) {
+        char response[1024];
+        int used = nf_chain_format_list(response, sizeof(response) - 3);
+        snprintf(response + used, sizeof(response) - used, "> ");
+        reply_add(reply, response, strlen(response));
+    }
+    else if (strncmp(buffer, "ENABLE ", 7) == 0) {
+        if (nf_chain_set_enabled(buffer + 7, true) == 0) {
+            const char *msg = "OK\n> ";
+            reply_add(reply, msg, strlen(msg));
+        } else {
+            const char *msg = "ERROR: NF not found\n> ";
+            reply_add(reply, msg, strlen(msg));
+        }
+    }
+    else if (strncmp(buffer, "DISABLE ", 8) == 0) {
+        if (nf_chain_set_enabled(buffer + 8, false) == 0) {
+            const char *msg = "OK\n> ";
+            reply_add(reply, msg, strlen(msg));
+        } else {
+            const char *msg = "ERROR: NF not found\n> ";
+            reply_add(reply, msg, strlen(msg));
+        }
+    }
+    else if (strncmp(buffer, "REMOVE ", 7) == 0) {
+        if (nf_chain_remove(buffer + 7) == 0) {
+            const char *msg = "OK\n> ";
+            reply_add(reply, msg, strlen(msg));
+        } else {
+            const char *msg = "ERROR\n> ";
+            reply_add(reply, msg, strlen(msg));
+        }
+    }
+    else if (strcmp(buffer, "CLEAR") == 0) {
+        nf_chain_clear();
+        const char *msg = "OK\n> ";
+        reply_add(reply, msg, strlen(msg));
+    }
+    else if (strncmp(buffer, "RATELIMIT SET ", 14) == 0) {
+        uint16_t port;
+        uint32_t rate, burst;
+        rate_limit_mode_t mode;
+        if (parse_ratelimit_args(buffer + 14, &port, &rate, &burst, &mode) == 0) {
+            if (nf_rate_limiter_set_limit(port, rate, burst, mode) == 0) {
                 const char *msg = "OK\n> ";
-                send(client_fd, msg, strlen(msg), 0);
+                reply_add(reply, msg, strlen(msg));
             } else {
-                const char *msg = "ERROR: NF not found\n> ";
-                send(client_fd, msg, strlen(msg), 0);
+                const char *msg = "ERROR\n> ";
+                reply_add(reply, msg, strlen(msg));
             }
+        } else {
+            const char *msg = "ERROR: Usage: RATELIMIT SET <port> <rate> [burst] [pps|bps]\n> ";
+            reply_add(reply, msg, strlen(msg));
         }
-        else if (strncmp(buffer, "REMOVE ", 7) == 0) {
-            if (nf_chain_remove(buffer + 7) == 0) {
+    }
+    else if (strncmp(buffer, "RATELIMIT REMOVE ", 17) == 0) {
+        uint16_t port;
+        if (sscanf(buffer + 17, "%hu", &port) == 1) {
+            nf_rate_limiter_remove_limit(port);
+            const char *msg = "OK\n> ";
+            reply_add(reply, msg, strlen(msg));
+        } else {
+            const char *msg = "ERROR: Usage: RATELIMIT REMOVE <port>\n> ";
+            reply_add(reply, msg, strlen(msg));
+        }
+    }
+    else if (strcmp(buffer, "RATELIMIT LIST") == 0) {
+        char response[4096];
+        int used = nf_rate_limiter_format(response, sizeof(response) - 3);
+        snprintf(response + used, sizeof(response) - used, "> ");
+        reply_add(reply, response, strlen(response));
+    }
+    else if (strncmp(buffer, "ALLOW ADD ", 10) == 0) {
+        uint16_t first, last;
+        uint8_t protos;
+        if (parse_port_range(buffer + 10, &first, &last, &protos) == 0) {
+            if (nf_allowlist_add_range(first, last, protos) == 0) {
                 const char *msg = "OK\n> ";
-                send(client_fd, msg, strlen(msg), 0);
+                reply_add(reply, msg, strlen(msg));
             } else {
                 const char *msg = "ERROR\n> ";
-                send(client_fd, msg, strlen(msg), 0);
+                reply_add(reply, msg, strlen(msg));
             }
+        } else {
+            const char *msg = "ERROR: Usage: ALLOW ADD <port>[-<port>] [tcp|udp]\n> ";
+            reply_add(reply, msg, strlen(msg));
         }
-        else if (strcmp(buffer, "CLEAR") == 0) {
-            nf_chain_clear();
+    }
+    else if (strncmp(buffer, "ALLOW REMOVE ", 13) == 0) {
+        uint16_t first, last;
+        uint8_t protos;
+        if (parse_port_range(buffer + 13, &first, &last, &protos) == 0) {
+            nf_allowlist_remove_range(first, last, protos);
             const char *msg = "OK\n> ";
-            send(client_fd, msg, strlen(msg), 0);
+            reply_add(reply, msg, strlen(msg));
+        } else {
+            const char *msg = "ERROR: Usage: ALLOW REMOVE <port>[-<port>] [tcp|udp]\n> ";
+            reply_add(reply, msg, strlen(msg));
         }
-        else if (strncmp(buffer, "RATELIMIT SET ", 14) == 0) {
-            uint16_t port;
-            uint32_t pps;
-            if (sscanf(buffer + 14, "%hu %u", &port, &pps) == 2) {
-                if (nf_rate_limiter_set_limit(port, pps) == 0) {
-                    const char *msg = "OK\n> ";
-                    send(client_fd, msg, strlen(msg), 0);
-                } else {
-                    const char *msg = "ERROR\n> ";
-                    send(client_fd, msg, strlen(msg), 0);
-                }
-            } else {
-                const char *msg = "ERROR: Usage: RATELIMIT SET <port> <pps>\n> ";
-                send(client_fd, msg, strlen(msg), 0);
+    }
+    else if (strcmp(buffer, "ALLOW LIST") == 0) {
+        char response[4096];
+        int used = nf_allowlist_format(response, sizeof(response) - 3);
+        snprintf(response + used, sizeof(response) - used, "> ");
+        reply_add(reply, response, strlen(response));
+    }
+    else if (strcmp(buffer, "ALLOW CLEAR") == 0) {
+        nf_allowlist_clear();
+        const char *msg = "OK\n> ";
+        reply_add(reply, msg, strlen(msg));
+    }
+    else if (strncmp(buffer, "SRCLIMIT SET ", 13) == 0) {
+        uint32_t pps;
+        if (sscanf(buffer + 13, "%u", &pps) == 1) {
+            nf_src_limiter_set_limit(pps);
+            const char *msg = "OK\n> ";
+            reply_add(reply, msg, strlen(msg));
+        } else {
+            const char *msg = "ERROR: Usage: SRCLIMIT SET <pps>\n> ";
+            reply_add(reply, msg, strlen(msg));
+        }
+    }
+    else if (strcmp(buffer, "SRCLIMIT TOP") == 0) {
+        src_heavy_hitter_t top[SRC_LIMITER_TOPK];
+        int n = nf_src_limiter_top(top, SRC_LIMITER_TOPK);
+        char response[1024];
+        size_t used = snprintf(response, sizeof(response),
+                               "\n=== Top Sources (last second) ===\n"
+                               "Limit: %u pps, dropped: %llu\n",
+                               nf_src_limiter_get_limit(),
+                               (unsigned long long)nf_src_limiter_dropped());
+        for (int i = 0; i < n && used < sizeof(response); i++) {
+            const uint8_t *ip = (const uint8_t *)&top[i].ip;
+            used += snprintf(response + used, sizeof(response) - used,
+                             "%2d. %u.%u.%u.%u  ~%u pkts\n",
+                             i + 1, ip[0], ip[1], ip[2], ip[3],
+                             top[i].estimate);
+        }
+        if (used < sizeof(response)) {
+            snprintf(response + used, sizeof(response) - used,
+                     "=================================\n> ");
+        }
+        reply_add(reply, response, strlen(response));
+    }
+    else if (strcmp(buffer, "POLL STATUS") == 0) {
+        fastpath_stats_t fp = fastpath_get_stats();
+        char response[160];
+        snprintf(response, sizeof(response),
+                 "Poll mode: %s, idle %u us%s\n> ",
+                 fastpath_poll_mode_name(fp.poll_mode), fp.idle_us,
+                 fp.rx_intr ? "" : " (no RX interrupts, busy polling)");
+        reply_add(reply, response, strlen(response));
+    }
+    else if (strncmp(buffer, "POLL ", 5) == 0) {
+        char mode_str[16];
+        unsigned int idle_us = FASTPATH_DEFAULT_IDLE_US;
+        fastpath_poll_mode_t mode;
+        int n = sscanf(buffer + 5, "%15s %u", mode_str, &idle_us);
+
+        if (n >= 1 && strcasecmp(mode_str, "busy") == 0) {
+            mode = FASTPATH_POLL_BUSY;
+        } else if (n >= 1 && strcasecmp(mode_str, "adaptive") == 0) {
+            mode = FASTPATH_POLL_ADAPTIVE;
+        } else if (n >= 1 && strcasecmp(mode_str, "interrupt") == 0) {
+            mode = FASTPATH_POLL_INTERRUPT;
+        } else {
+            const char *msg = "ERROR: Usage: POLL <busy|adaptive|interrupt> [idle_us]\n> ";
+            reply_add(reply, msg, strlen(msg));
+            return 0;
+        }
+
+        fastpath_set_poll_mode(mode, idle_us);
+        const char *msg = "OK\n> ";
+        reply_add(reply, msg, strlen(msg));
+    }
+    else if (strcmp(buffer, "FORWARD STATUS") == 0) {
+        char response[160];
+        const uint8_t *mac = forward_config.next_hop;
+        if (forward_config.has_next_hop) {
+            snprintf(response, sizeof(response),
+                     "Forward mode: %s, next hop %02x:%02x:%02x:%02x:%02x:%02x\n> ",
+                     forward_mode_name(forward_config.mode),
+                     mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+        } else {
+            snprintf(response, sizeof(response),
+                     "Forward mode: %s, no next hop\n> ",
+                     forward_mode_name(forward_config.mode));
+        }
+        reply_add(reply, response, strlen(response));
+    }
+    else if (strncmp(buffer, "FORWARD NEXTHOP ", 16) == 0) {
+        unsigned int b[6];
+        const char *arg = buffer + 16;
+        if (strcasecmp(arg, "none") == 0) {
+            forward_set_next_hop(NULL);
+            const char *msg = "OK\n> ";
+            reply_add(reply, msg, strlen(msg));
+        } else if (sscanf(arg, "%2x:%2x:%2x:%2x:%2x:%2x",
+                          &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) == 6) {
+            uint8_t mac[6];
+            for (int i = 0; i < 6; i++) {
+                mac[i] = (uint8_t)b[i];
             }
+            forward_set_next_hop(mac);
+            const char *msg = "OK\n> ";
+            reply_add(reply, msg, strlen(msg));
+        } else {
+            const char *msg = "ERROR: Usage: FORWARD NEXTHOP <aa:bb:cc:dd:ee:ff|none>\n> ";
+            reply_add(reply, msg, strlen(msg));
         }
-        else if (strncmp(buffer, "RATELIMIT REMOVE ", 17) == 0) {
-            uint16_t port;
-            if (sscanf(buffer + 17, "%hu", &port) == 1) {
-                nf_rate_limiter_remove_limit(port);
+    }
+    else if (strncmp(buffer, "FORWARD ", 8) == 0) {
+        const char *arg = buffer + 8;
+        if (strcasecmp(arg, "off") == 0) {
+            forward_set_mode(FORWARD_OFF);
+        } else if (strcasecmp(arg, "bounce") == 0) {
+            forward_set_mode(FORWARD_BOUNCE);
+        } else if (strcasecmp(arg, "cross") == 0) {
+            forward_set_mode(FORWARD_CROSS);
+        } else {
+            const char *msg = "ERROR: Usage: FORWARD <off|bounce|cross>\n> ";
+            reply_add(reply, msg, strlen(msg));
+            return 0;
+        }
+        const char *msg = "OK\n> ";
+        reply_add(reply, msg, strlen(msg));
+    }
+    else if (strcmp(buffer, "GEN START") == 0 || strncmp(buffer, "GEN START ", 10) == 0) {
+        traffic_gen_config_t cfg;
+        if (parse_gen_args(buffer + 9, &cfg) < 0) {
+            const char *msg = "ERROR: Usage: GEN START [key=value ...], see HELP\n> ";
+            reply_add(reply, msg, strlen(msg));
+        } else if (traffic_gen_start(&cfg) < 0) {
+            const char *msg = "ERROR: Generator busy or invalid configuration\n> ";
+            reply_add(reply, msg, strlen(msg));
+        } else {
+            const char *msg = "OK\n> ";
+            reply_add(reply, msg, strlen(msg));
+        }
+    }
+    else if (strcmp(buffer, "GEN STOP") == 0) {
+        traffic_gen_stop();
+        const char *msg = "OK\n> ";
+        reply_add(reply, msg, strlen(msg));
+    }
+    else if (strcmp(buffer, "GEN STATUS") == 0) {
+        traffic_gen_stats_t gen = traffic_gen_get_stats();
+        double secs = gen.elapsed_ns / 1e9;
+        char response[384];
+        snprintf(response, sizeof(response),
+                 "\n=== Traffic Generator ===\n"
+                 "State:   %s\n"
+                 "Sent:    %llu packets, %llu bytes\n"
+                 "Passed:  %llu\n"
+                 "Dropped: %llu\n"
+                 "No pbuf: %llu\n"
+                 "Elapsed: %.3f s\n"
+                 "Rate:    %.3f Mpps, %.3f Gbps\n"
+                 "=========================\n> ",
+                 gen.running ? "running" : "idle",
+                 (unsigned long long)gen.sent,
+                 (unsigned long long)gen.bytes,
+                 (unsigned long long)gen.passed,
+                 (unsigned long long)(gen.sent - gen.passed),
+                 (unsigned long long)gen.alloc_failed,
+                 secs,
+                 secs > 0 ? gen.sent / secs / 1e6 : 0.0,
+                 secs > 0 ? gen.bytes * 8 / secs / 1e9 : 0.0);
+        reply_add(reply, response, strlen(response));
+    }
+    else if (strncmp(buffer, "ACL ADD ", 8) == 0) {
+        acl_rule_t rule;
+        if (parse_acl_rule(buffer + 8, &rule) == 0) {
+            if (nf_acl_stage_add(&rule) == 0) {
                 const char *msg = "OK\n> ";
-                send(client_fd, msg, strlen(msg), 0);
+                reply_add(reply, msg, strlen(msg));
             } else {
-                const char *msg = "ERROR: Usage: RATELIMIT REMOVE <port>\n> ";
-                send(client_fd, msg, strlen(msg), 0);
+                const char *msg = "ERROR\n> ";
+                reply_add(reply, msg, strlen(msg));
             }
+        } else {
+            const char *msg = "ERROR: Usage: ACL ADD <src|dst> <cidr|any> [tcp|udp|icmp] [port[-port]] <allow|deny>\n> ";
+            reply_add(reply, msg, strlen(msg));
         }
-        else if (strcmp(buffer, "RATELIMIT LIST") == 0) {
-            nf_rate_limiter_list();
-            const char *msg = "Listed (check console)\n> ";
-            send(client_fd, msg, strlen(msg), 0);
+    }
+    else if (strcmp(buffer, "ACL COMMIT") == 0) {
+        if (nf_acl_commit() == 0) {
+            const char *msg = "OK\n> ";
+            reply_add(reply, msg, strlen(msg));
+        } else {
+            const char *msg = "ERROR: Commit failed, previous ACL still active\n> ";
+            reply_add(reply, msg, strlen(msg));
         }
-        else if (strncmp(buffer, "ALLOW ADD ", 10) == 0) {
-            uint16_t port;
-            if (sscanf(buffer + 10, "%hu", &port) == 1) {
-                if (nf_allowlist_add_port(port) == 0) {
-                    const char *msg = "OK\n> ";
-                    send(client_fd, msg, strlen(msg), 0);
-                } else {
-                    const char *msg = "ERROR\n> ";
-                    send(client_fd, msg, strlen(msg), 0);
-                }
-            } else {
-                const char *msg = "ERROR: Usage: ALLOW ADD <port>\n> ";
-                send(client_fd, msg, strlen(msg), 0);
-            }
+    }
+    else if (strcmp(buffer, "ACL CLEAR") == 0) {
+        nf_acl_stage_clear();
+        const char *msg = "OK (commit to apply)\n> ";
+        reply_add(reply, msg, strlen(msg));
+    }
+    else if (strcmp(buffer, "ACL STATUS") == 0) {
+        char response[128];
+        snprintf(response, sizeof(response),
+                 "Active rules: %u, staged rules: %u\n> ",
+                 nf_acl_active_rules(), nf_acl_staged_rules());
+        reply_add(reply, response, strlen(response));
+    }
+    else if (strncmp(buffer, "ACL DEFAULT ", 12) == 0) {
+        if (strcasecmp(buffer + 12, "allow") == 0 || strcasecmp(buffer + 12, "deny") == 0) {
+            nf_acl_set_default(strcasecmp(buffer + 12, "deny") == 0 ? ACL_DENY : ACL_ALLOW);
+            const char *msg = "OK\n> ";
+            reply_add(reply, msg, strlen(msg));
+        } else {
+            const char *msg = "ERROR: Usage: ACL DEFAULT <allow|deny>\n> ";
+            reply_add(reply, msg, strlen(msg));
         }
-        else if (strncmp(buffer, "ALLOW REMOVE ", 13) == 0) {
-            uint16_t port;
-            if (sscanf(buffer + 13, "%hu", &port) == 1) {
-                nf_allowlist_remove_port(port);
-                const char *msg = "OK\n> ";
-                send(client_fd, msg, strlen(msg), 0);
-            } else {
-                const char *msg = "ERROR: Usage: ALLOW REMOVE <port>\n> ";
-                send(client_fd, msg, strlen(msg), 0);
+    }
+    else if (strcmp(buffer, "CT STATS") == 0) {
+        ct_stats_t ct = nf_conntrack_get_stats();
+        char response[512];
+        snprintf(response, sizeof(response),
+                "\n=== Conntrack ===\n"
+                "Active:     %u / %u\n"
+                "Created:    %llu\n"
+                "Expired:    %llu\n"
+                "Table full: %llu\n"
+                "Invalid:    %llu\n"
+                "=================\n> ",
+                ct.active, ct.capacity,
+                (unsigned long long)ct.created,
+                (unsigned long long)ct.expired,
+                (unsigned long long)ct.table_full,
+                (unsigned long long)ct.invalid);
+        reply_add(reply, response, strlen(response));
+    }
+    else if (strcmp(buffer, "CT FLUSH") == 0) {
+        nf_conntrack_flush();
+        const char *msg = "OK\n> ";
+        reply_add(reply, msg, strlen(msg));
+    }
+    else if (strcmp(buffer, "CT STRICT ON") == 0 || strcmp(buffer, "CT STRICT OFF") == 0) {
+        nf_conntrack_set_strict(strcmp(buffer + 10, "ON") == 0);
+        const char *msg = "OK\n> ";
+        reply_add(reply, msg, strlen(msg));
+    }
+    else if (strncmp(buffer, "CT TIMEOUT ", 11) == 0) {
+        char proto[8];
+        uint32_t seconds;
+        int ret = -1;
+        if (sscanf(buffer + 11, "%7s %u", proto, &seconds) == 2) {
+            if (strcasecmp(proto, "tcp") == 0) {
+                ret = nf_conntrack_set_timeout(CT_TIMEOUT_TCP_EST, seconds);
+            } else if (strcasecmp(proto, "udp") == 0) {
+                ret = nf_conntrack_set_timeout(CT_TIMEOUT_UDP, seconds);
             }
         }
-        else if (strcmp(buffer, "ALLOW LIST") == 0) {
-            nf_allowlist_list();
-            const char *msg = "Listed (check console)\n> ";
-            send(client_fd, msg, strlen(msg), 0);
+        if (ret == 0) {
+            const char *msg = "OK\n> ";
+            reply_add(reply, msg, strlen(msg));
+        } else {
+            const char *msg = "ERROR: Usage: CT TIMEOUT <tcp|udp> <sec>\n> ";
+            reply_add(reply, msg, strlen(msg));
         }
-        else if (strcmp(buffer, "ALLOW CLEAR") == 0) {
-            nf_allowlist_clear();
+    }
+    else if (strcmp(buffer, "SYNPROXY ON") == 0 || strcmp(buffer, "SYNPROXY OFF") == 0) {
+        nf_synproxy_set_enabled(strcmp(buffer + 9, "ON") == 0);
+        const char *msg = "OK\n> ";
+        reply_add(reply, msg, strlen(msg));
+    }
+    else if (strncmp(buffer, "SYNPROXY ADD ", 13) == 0 ||
+             strncmp(buffer, "SYNPROXY REMOVE ", 16) == 0) {
+        bool add = buffer[9] == 'A';
+        uint16_t port;
+        if (sscanf(buffer + (add ? 13 : 16), "%hu", &port) == 1 &&
+            nf_synproxy_protect(port, add) == 0) {
             const char *msg = "OK\n> ";
-            send(client_fd, msg, strlen(msg), 0);
+            reply_add(reply, msg, strlen(msg));
+        } else {
+            const char *msg = "ERROR: Usage: SYNPROXY ADD|REMOVE <port>\n> ";
+            reply_add(reply, msg, strlen(msg));
+        }
+    }
+    else if (strcmp(buffer, "SYNPROXY STATUS") == 0) {
+        synproxy_stats_t sp = nf_synproxy_get_stats();
+        uint16_t ports[32];
+        int n = nf_synproxy_ports(ports, 32);
+        char response[768];
+        size_t used = snprintf(response, sizeof(response),
+                               "\n=== SYN Proxy ===\n"
+                               "State:       %s\n"
+                               "Ports:      ",
+                               sp.enabled ? "on" : "off");
+        for (int i = 0; i < n && i < 32 && used < sizeof(response); i++) {
+            used += snprintf(response + used, sizeof(response) - used,
+                             " %u", ports[i]);
+        }
+        if (used < sizeof(response)) {
+            snprintf(response + used, sizeof(response) - used,
+                     "%s\n"
+                     "Flows:       %u / %u\n"
+                     "SYNs:        %llu\n"
+                     "Valid ACKs:  %llu\n"
+                     "Invalid:     %llu\n"
+                     "Established: %llu\n"
+                     "Table full:  %llu\n"
+                     "TX failed:   %llu\n"
+                     "=================\n> ",
+                     n > 32 ? " ..." : (n == 0 ? " none" : ""),
+                     sp.active, sp.capacity,
+                     (unsigned long long)sp.syns,
+                     (unsigned long long)sp.valid,
+                     (unsigned long long)sp.invalid,
+                     (unsigned long long)sp.established,
+                     (unsigned long long)sp.table_full,
+                     (unsigned long long)sp.tx_failed);
+        }
+        reply_add(reply, response, strlen(response));
+    }
+    else if (strcmp(buffer, "SAMPLE ON") == 0 || strcmp(buffer, "SAMPLE OFF") == 0) {
+        sampler_set_enabled(strcmp(buffer + 7, "ON") == 0);
+        const char *msg = "OK\n> ";
+        reply_add(reply, msg, strlen(msg));
+    }
+    else if (strncmp(buffer, "SAMPLE EVERY ", 13) == 0) {
+        sampler_filter_t filter = sampler_get_stats().filter;
+        if (sscanf(buffer + 13, "%u", &filter.every) == 1 && filter.every > 0) {
+            sampler_set_filter(&filter);
+            const char *msg = "OK\n> ";
+            reply_add(reply, msg, strlen(msg));
+        } else {
+            const char *msg = "ERROR: Usage: SAMPLE EVERY <n>\n> ";
+            reply_add(reply, msg, strlen(msg));
+        }
+    }
+    else if (strcmp(buffer, "SAMPLE DROPS ON") == 0 || strcmp(buffer, "SAMPLE DROPS OFF") == 0) {
+        sampler_filter_t filter = sampler_get_stats().filter;
+        filter.drops_only = strcmp(buffer + 13, "ON") == 0;
+        sampler_set_filter(&filter);
+        const char *msg = "OK\n> ";
+        reply_add(reply, msg, strlen(msg));
+    }
+    else if (strcmp(buffer, "SAMPLE FILTER") == 0 || strncmp(buffer, "SAMPLE FILTER ", 14) == 0) {
+        sampler_filter_t filter = sampler_get_stats().filter;
+        if (parse_sample_filter(buffer + 13, &filter) == 0) {
+            sampler_set_filter(&filter);
+            const char *msg = "OK\n> ";
+            reply_add(reply, msg, strlen(msg));
+        } else {
+            const char *msg = "ERROR: Usage: SAMPLE FILTER [tcp|udp|icmp] [port <p>] [host <a.b.c.d>]\n> ";
+            reply_add(reply, msg, strlen(msg));
+        }
+    }
+    else if (strcmp(buffer, "FLOW ON") == 0 || strcmp(buffer, "FLOW OFF") == 0) {
+        flow_export_set_enabled(strcmp(buffer + 5, "ON") == 0);
+        const char *msg = "OK\n> ";
+        reply_add(reply, msg, strlen(msg));
+    }
+    else if (strncmp(buffer, "FLOW COLLECTOR ", 15) == 0) {
+        char addr_str[16];
+        unsigned int port = FLOW_EXPORT_DEFAULT_PORT;
+        struct in_addr addr = { 0 };
+        int n = sscanf(buffer + 15, "%15s %u", addr_str, &port);
+
+        if (strcmp(buffer + 15, "NONE") == 0) {
+            flow_export_set_collector(0, 0);
+            const char *msg = "OK\n> ";
+            reply_add(reply, msg, strlen(msg));
+        } else if (n >= 1 && inet_pton(AF_INET, addr_str, &addr) == 1 &&
+                   addr.s_addr != 0 && port > 0 && port <= 65535) {
+            flow_export_set_collector(addr.s_addr, (uint16_t)port);
+            const char *msg = "OK\n> ";
+            reply_add(reply, msg, strlen(msg));
+        } else {
+            const char *msg = "ERROR: Usage: FLOW COLLECTOR <a.b.c.d> [port]\n> ";
+            reply_add(reply, msg, strlen(msg));
+        }
+    }
+    else if (strncmp(buffer, "FLOW TIMEOUT ", 13) == 0) {
+        unsigned int active_s, idle_s;
+
+        if (sscanf(buffer + 13, "%u %u", &active_s, &idle_s) == 2 &&
+            flow_export_set_timeouts(active_s, idle_s) == 0) {
+            const char *msg = "OK\n> ";
+            reply_add(reply, msg, strlen(msg));
+        } else {
+            const char *msg = "ERROR: Usage: FLOW TIMEOUT <active_s> <idle_s>, 1 to 86400\n> ";
+            reply_add(reply, msg, strlen(msg));
+        }
+    }
+    else if (strcmp(buffer, "FLOW STATUS") == 0) {
+        flow_stats_t st = flow_export_get_stats();
+        char collector[24] = "none";
+        char response[512];
+
+        if (st.collector_port) {
+            char ip[16];
+            inet_ntop(AF_INET, &st.collector_ip, ip, sizeof(ip));
+            snprintf(collector, sizeof(collector), "%s:%u", ip, st.collector_port);
         }
-        else {
-            char response[256];
-            snprintf(response, sizeof(response), "Unknown: %s\n> ", buffer);
-            send(client_fd, response, strlen(response), 0);
+        snprintf(response, sizeof(response),
+                 "\n=== Flow Export ===\n"
+                 "State:       %s\n"
+                 "Collector:   %s\n"
+                 "Timeouts:    active %us, idle %us\n"
+                 "Flows:       %u (%u per worker)\n"
+                 "Created:     %llu\n"
+                 "Evicted:     %llu\n"
+                 "Exported:    %llu records, %llu datagrams\n"
+                 "Lost:        %llu\n"
+                 "Send failed: %llu\n"
+                 "===================\n> ",
+                 st.enabled ? "on" : "off", collector,
+                 st.active_timeout_s, st.idle_timeout_s,
+                 st.active, st.capacity,
+                 (unsigned long long)st.created,
+                 (unsigned long long)st.evicted,
+                 (unsigned long long)st.exported,
+                 (unsigned long long)st.datagrams,
+                 (unsigned long long)st.lost,
+                 (unsigned long long)st.send_failed);
+        reply_add(reply, response, strlen(response));
+    }
+    else if (strcmp(buffer, "SAMPLE STATUS") == 0) {
+        sampler_stats_t st = sampler_get_stats();
+        const sampler_filter_t *f = &st.filter;
+        char host[16] = "any";
+        char port[8] = "any";
+        char response[512];
+
+        if (f->host) {
+            inet_ntop(AF_INET, &f->host, host, sizeof(host));
+        }
+        if (f->port) {
+            snprintf(port, sizeof(port), "%u", f->port);
+        }
+        snprintf(response, sizeof(response),
+                 "\n=== Sampling ===\n"
+                 "State:     %s, %s\n"
+                 "Every:     %u\n"
+                 "Verdict:   %s\n"
+                 "Proto:     %s\n"
+                 "Port:      %s\n"
+                 "Host:      %s\n"
+                 "Ring:      %u frames\n"
+                 "Sampled:   %llu\n"
+                 "Streamed:  %llu\n"
+                 "Lost:      %llu\n"
+                 "================\n> ",
+                 st.enabled ? "on" : "off",
+                 st.streaming ? "client connected" : "no client",
+                 f->every > 1 ? f->every : 1,
+                 f->drops_only ? "dropped" : "any",
+                 f->proto == IPPROTO_TCP ? "tcp" :
+                 f->proto == IPPROTO_UDP ? "udp" :
+                 f->proto == IPPROTO_ICMP ? "icmp" : "any",
+                 port, host, st.ring_size,
+                 (unsigned long long)st.sampled,
+                 (unsigned long long)st.streamed,
+                 (unsigned long long)st.lost);
+        reply_add(reply, response, strlen(response));
+    }
+    else {
+        char response[256];
+        snprintf(response, sizeof(response), "Unknown: %s\n> ", buffer);
+        reply_add(reply, response, strlen(response));
+    }
+
+    return 0;
+}
+
+void control_lock(void)
+{
+    sys_mutex_lock(&control_mutex);
+}
+
+void control_unlock(void)
+{
+    sys_mutex_unlock(&control_mutex);
+}
+
+static void handle_client(int client_fd)
+{
+    char buffer[CONTROL_LINE_MAX];
+    control_reply_t reply = { 0 };
+    size_t used = 0;
+    ssize_t n;
+    int done = 0;
+
+    printf("[CONTROL] New client connected\n");
+    send(client_fd, welcome_msg, strlen(welcome_msg), 0);
+
+    /* Line buffered so pipelined commands (bulk loads) are all handled */
+    while (!done && (n = recv(client_fd, buffer + used, sizeof(buffer) - 1 - used, 0)) > 0) {
+        used += n;
+        buffer[used] = '\0';
+
+        char *line = buffer;
+        char *newline;
+
+        while (!done && (newline = strchr(line, '\n')) != NULL) {
+            *newline = '\0';
+            char *cr = strchr(line, '\r');
+            if (cr) *cr = '\0';
+
+            control_lock();
+            done = handle_command(&reply, line);
+            control_unlock();
+            reply_flush(client_fd, &reply);
+            line = newline + 1;
+        }
+
+        used -= line - buffer;
+        memmove(buffer, line, used);
+
+        if (used == sizeof(buffer) - 1) {
+            const char *msg = "ERROR: Line too long\n> ";
+            send(client_fd, msg, strlen(msg), 0);
+            used = 0;
         }
     }
 
     printf("[CONTROL] Client disconnected\n");
+    free(reply.data);
     close(client_fd);
 }
 
-static void control_server_thread(void *arg)
+static void control_client_thread(void *arg)
 {
-    int port = (int)(intptr_t)arg;
-    int server_fd, client_fd;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_len;
+    handle_client((int)(intptr_t)arg);
+    __atomic_fetch_sub(&num_clients, 1, __ATOMIC_RELAXED);
+}
+
+int control_listen(int port)
+{
+    struct sockaddr_in server_addr;
+    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
 
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (server_fd < 0) {
         printf("[CONTROL] ERROR: Could not create socket\n");
-        return;
+        return -1;
     }
 
     int opt = 1;
@@ -217,12 +1211,27 @@ static void control_server_thread(void *arg)
     if (bind(server_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
         printf("[CONTROL] ERROR: Could not bind to port %d\n", port);
         close(server_fd);
-        return;
+        return -1;
     }
 
     if (listen(server_fd, 5) < 0) {
         printf("[CONTROL] ERROR: Could not listen on port %d\n", port);
         close(server_fd);
+        return -1;
+    }
+
+    return server_fd;
+}
+
+static void control_server_thread(void *arg)
+{
+    int port = (int)(intptr_t)arg;
+    int server_fd, client_fd;
+    struct sockaddr_in client_addr;
+    socklen_t client_len;
+
+    server_fd = control_listen(port);
+    if (server_fd < 0) {
         return;
     }
 
@@ -237,7 +1246,24 @@ static void control_server_thread(void *arg)
             continue;
         }
 
-        handle_client(client_fd);
+        if (__atomic_add_fetch(&num_clients, 1, __ATOMIC_RELAXED) > CONTROL_MAX_CLIENTS) {
+            const char *msg = "ERROR: Too many clients\n";
+            send(client_fd, msg, strlen(msg), 0);
+            close(client_fd);
+            __atomic_fetch_sub(&num_clients, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        sys_thread_t thread = sys_thread_new("control_cli",
+                                              control_client_thread,
+                                              (void *)(intptr_t)client_fd,
+                                              4096,
+                                              3);
+        if (thread == NULL) {
+            printf("[CONTROL] ERROR: Could not create client thread\n");
+            close(client_fd);
+            __atomic_fetch_sub(&num_clients, 1, __ATOMIC_RELAXED);
+        }
     }
 
     close(server_fd);
@@ -247,6 +1273,11 @@ int control_server_init(int port)
 {
     printf("[CONTROL] Initializing control server on port %d...\n", port);
 
+    if (sys_mutex_new(&control_mutex) != ERR_OK) {
+        printf("[CONTROL] ERROR: Could not create control lock\n");
+        return -1;
+    }
+
     sys_thread_t thread = sys_thread_new("control_srv", 
                                           control_server_thread, 
                                           (void*)(intptr_t)port,
@@ -260,4 +1291,4 @@ int control_server_init(int port)
 
     printf("[CONTROL] Control server thread started\n");
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,416 @@
+#include "loom/control.h"
+#include "loom/control_proto.h"
+#include "loom/nf_acl.h"
+#include "loom/nf_chain.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "lwip/sys.h"
+
+#define CTL_MAX_CLIENTS 4
+#define CTL_TXN_MAX_RECORDS (1 << 17)
+
+/* A validated record, host byte order */
+typedef struct {
+    uint8_t type;               /* ctl_rec_type_t */
+    union {
+        struct {
+            uint16_t first;
+            uint16_t last;
+            uint8_t protos;
+        } ports;
+        acl_rule_t acl;
+        uint8_t action;
+    };
+} ctl_rule_t;
+
+/* Records are buffered per client and only applied on COMMIT */
+typedef struct {
+    int fd;
+    bool in_txn;
+    uint32_t flags;
+    ctl_rule_t *rules;
+    uint32_t num_rules;
+    uint32_t max_rules;
+    uint8_t payload[CTL_MAX_PAYLOAD];
+} ctl_client_t;
+
+static int num_clients = 0;
+
+static int recv_all(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int send_reply(int fd, uint32_t seq, ctl_status_t status, uint32_t count)
+{
+    struct __attribute__((packed)) {
+        ctl_hdr_t hdr;
+        ctl_reply_t reply;
+    } msg;
+
+    msg.hdr.magic = htons(CTL_MAGIC);
+    msg.hdr.version = CTL_VERSION;
+    msg.hdr.type = CTL_MSG_REPLY;
+    msg.hdr.seq = htonl(seq);
+    msg.hdr.len = htonl(sizeof(msg.reply));
+    msg.reply.status = htonl(status);
+    msg.reply.count = htonl(count);
+
+    return send(fd, &msg, sizeof(msg), 0) == (ssize_t)sizeof(msg) ? 0 : -1;
+}
+
+static void txn_reset(ctl_client_t *c)
+{
+    c->in_txn = false;
+    c->flags = 0;
+    c->num_rules = 0;
+}
+
+static int parse_record(uint8_t type, const uint8_t *value, uint16_t len,
+                        ctl_rule_t *rule)
+{
+    rule->type = type;
+
+    switch (type) {
+    case CTL_REC_ALLOW_ADD:
+    case CTL_REC_ALLOW_REMOVE: {
+        ctl_rec_ports_t rec;
+        if (len != sizeof(rec)) {
+            return -1;
+        }
+        memcpy(&rec, value, sizeof(rec));
+        rule->ports.first = ntohs(rec.first);
+        rule->ports.last = ntohs(rec.last);
+        rule->ports.protos = rec.protos;
+        if (rule->ports.first > rule->ports.last ||
+            !(rec.protos & ALLOW_PROTO_ANY) || (rec.protos & ~ALLOW_PROTO_ANY)) {
+            return -1;
+        }
+        return 0;
+    }
+    case CTL_REC_ACL_ADD: {
+        ctl_rec_acl_t rec;
+        if (len != sizeof(rec)) {
+            return -1;
+        }
+        memcpy(&rec, value, sizeof(rec));
+        memset(&rule->acl, 0, sizeof(rule->acl));
+        rule->acl.prefix = ntohl(rec.prefix);
+        rule->acl.depth = rec.depth;
+        rule->acl.match = rec.match;
+        rule->acl.proto = rec.proto;
+        rule->acl.action = rec.action;
+        rule->acl.port_lo = ntohs(rec.port_lo);
+        rule->acl.port_hi = ntohs(rec.port_hi);
+        if (rec.depth > 32 || rec.match > ACL_MATCH_DST ||
+            rec.action > ACL_DENY || rule->acl.port_lo > rule->acl.port_hi) {
+            return -1;
+        }
+        return 0;
+    }
+    case CTL_REC_ACL_DEFAULT: {
+        ctl_rec_acl_default_t rec;
+        if (len != sizeof(rec)) {
+            return -1;
+        }
+        memcpy(&rec, value, sizeof(rec));
+        rule->action = rec.action;
+        return rec.action > ACL_DENY ? -1 : 0;
+    }
+    default:
+        return -1;
+    }
+}
+
+/* Stage a RULES payload; on a bad record *bad is its transaction index */
+static ctl_status_t txn_add_records(ctl_client_t *c, uint32_t len, uint32_t *bad)
+{
+    uint32_t pos = 0;
+
+    while (pos < len) {
+        ctl_tlv_t tlv;
+
+        *bad = c->num_rules;
+
+        if (len - pos < sizeof(tlv)) {
+            return CTL_ERR_RECORD;
+        }
+        memcpy(&tlv, c->payload + pos, sizeof(tlv));
+        pos += sizeof(tlv);
+
+        uint16_t value_len = ntohs(tlv.len);
+        if (len - pos < value_len) {
+            return CTL_ERR_RECORD;
+        }
+
+        if (c->num_rules == CTL_TXN_MAX_RECORDS) {
+            return CTL_ERR_LIMIT;
+        }
+
+        if (c->num_rules == c->max_rules) {
+            uint32_t max = c->max_rules ? c->max_rules * 2 : 1024;
+            ctl_rule_t *rules = realloc(c->rules, max * sizeof(*rules));
+            if (!rules) {
+                return CTL_ERR_LIMIT;
+            }
+            c->rules = rules;
+            c->max_rules = max;
+        }
+
+        if (parse_record(tlv.type, c->payload + pos, value_len,
+                         &c->rules[c->num_rules]) < 0) {
+            return CTL_ERR_RECORD;
+        }
+        c->num_rules++;
+        pos += value_len;
+    }
+
+    return CTL_OK;
+}
+
+/*
+ * The ACL is compiled from the transaction's own rules and swapped first
+ * (the only step that can fail), then the allowlist, so a failed commit
+ * leaves the data path and the console's ACL staging area untouched.
+ */
+static ctl_status_t txn_commit(ctl_client_t *c)
+{
+    bool replace = c->flags & CTL_BEGIN_REPLACE;
+    bool has_acl = replace;
+    bool has_allow = replace;
+    int acl_default = -1;
+    acl_rule_t *acl = NULL;
+    uint32_t num_acl = 0;
+
+    if (c->num_rules > 0) {
+        acl = malloc(c->num_rules * sizeof(*acl));
+        if (!acl) {
+            return CTL_ERR_APPLY;
+        }
+    }
+
+    control_lock();
+
+    nf_allowlist_stage_reset(!replace);
+
+    for (uint32_t i = 0; i < c->num_rules; i++) {
+        const ctl_rule_t *rule = &c->rules[i];
+
+        switch (rule->type) {
+        case CTL_REC_ALLOW_ADD:
+            nf_allowlist_stage_add(rule->ports.first, rule->ports.last,
+                                   rule->ports.protos);
+            has_allow = true;
+            break;
+        case CTL_REC_ALLOW_REMOVE:
+            nf_allowlist_stage_remove(rule->ports.first, rule->ports.last,
+                                      rule->ports.protos);
+            has_allow = true;
+            break;
+        case CTL_REC_ACL_ADD:
+            acl[num_acl++] = rule->acl;
+            has_acl = true;
+            break;
+        case CTL_REC_ACL_DEFAULT:
+            acl_default = rule->action;
+            break;
+        }
+    }
+
+    if (has_acl && nf_acl_commit_rules(acl, num_acl, replace) < 0) {
+        control_unlock();
+        free(acl);
+        return CTL_ERR_APPLY;
+    }
+    free(acl);
+    if (has_allow) {
+        nf_allowlist_commit();
+    }
+    if (acl_default >= 0) {
+        nf_acl_set_default((acl_action_t)acl_default);
+    }
+
+    control_unlock();
+
+    printf("[CONTROL] Transaction committed: %u record(s), %u ACL rule(s), "
+           "%u allowed port(s)\n", c->num_rules, nf_acl_active_rules(),
+           nf_allowlist_active_ports());
+    return CTL_OK;
+}
+
+/* Returns -1 when the connection has to be dropped */
+static int handle_message(ctl_client_t *c, const ctl_hdr_t *hdr, uint32_t len)
+{
+    uint32_t seq = ntohl(hdr->seq);
+    uint32_t count = 0;
+    ctl_status_t status = CTL_OK;
+
+    switch (hdr->type) {
+    case CTL_MSG_BEGIN: {
+        ctl_begin_t begin = {0};
+        if (len >= sizeof(begin)) {
+            memcpy(&begin, c->payload, sizeof(begin));
+        }
+        txn_reset(c);
+        c->in_txn = true;
+        c->flags = ntohl(begin.flags);
+        break;
+    }
+    case CTL_MSG_RULES:
+        if (!c->in_txn) {
+            status = CTL_ERR_STATE;
+            break;
+        }
+        status = txn_add_records(c, len, &count);
+        if (status != CTL_OK) {
+            /* One bad record voids the whole transaction */
+            txn_reset(c);
+        } else {
+            count = c->num_rules;
+        }
+        break;
+    case CTL_MSG_COMMIT:
+        if (!c->in_txn) {
+            status = CTL_ERR_STATE;
+            break;
+        }
+        status = txn_commit(c);
+        count = c->num_rules;
+        txn_reset(c);
+        break;
+    case CTL_MSG_ABORT:
+        if (!c->in_txn) {
+            status = CTL_ERR_STATE;
+        }
+        txn_reset(c);
+        break;
+    default:
+        send_reply(c->fd, seq, CTL_ERR_PROTO, 0);
+        return -1;
+    }
+
+    return send_reply(c->fd, seq, status, count);
+}
+
+static void handle_client(ctl_client_t *c)
+{
+    ctl_hdr_t hdr;
+
+    printf("[CONTROL] Binary client connected\n");
+
+    while (recv_all(c->fd, &hdr, sizeof(hdr)) == 0) {
+        uint32_t len = ntohl(hdr.len);
+
+        if (ntohs(hdr.magic) != CTL_MAGIC || hdr.version != CTL_VERSION ||
+            len > CTL_MAX_PAYLOAD) {
+            send_reply(c->fd, ntohl(hdr.seq), CTL_ERR_PROTO, 0);
+            break;
+        }
+
+        if (recv_all(c->fd, c->payload, len) < 0 ||
+            handle_message(c, &hdr, len) < 0) {
+            break;
+        }
+    }
+
+    if (c->in_txn) {
+        printf("[CONTROL] Binary client left, transaction discarded\n");
+    }
+    printf("[CONTROL] Binary client disconnected\n");
+}
+
+static void control_bin_client_thread(void *arg)
+{
+    ctl_client_t *c = arg;
+
+    handle_client(c);
+
+    close(c->fd);
+    free(c->rules);
+    free(c);
+    __atomic_fetch_sub(&num_clients, 1, __ATOMIC_RELAXED);
+}
+
+static void control_bin_server_thread(void *arg)
+{
+    int port = (int)(intptr_t)arg;
+    int server_fd = control_listen(port);
+
+    if (server_fd < 0) {
+        return;
+    }
+
+    printf("[CONTROL] Binary protocol listening on port %d\n", port);
+
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_fd = accept(server_fd, (struct sockaddr *)&client_addr,
+                               &client_len);
+
+        if (client_fd < 0) {
+            printf("[CONTROL] ERROR: Could not accept connection\n");
+            continue;
+        }
+
+        if (__atomic_add_fetch(&num_clients, 1, __ATOMIC_RELAXED) > CTL_MAX_CLIENTS) {
+            close(client_fd);
+            __atomic_fetch_sub(&num_clients, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        ctl_client_t *c = calloc(1, sizeof(*c));
+        if (!c) {
+            close(client_fd);
+            __atomic_fetch_sub(&num_clients, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        c->fd = client_fd;
+
+        sys_thread_t thread = sys_thread_new("control_bin",
+                                              control_bin_client_thread,
+                                              c,
+                                              4096,
+                                              3);
+        if (thread == NULL) {
+            printf("[CONTROL] ERROR: Could not create client thread\n");
+            close(client_fd);
+            free(c);
+            __atomic_fetch_sub(&num_clients, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    close(server_fd);
+}
+
+int control_bin_server_init(int port)
+{
+    sys_thread_t thread = sys_thread_new("control_bin_srv",
+                                          control_bin_server_thread,
+                                          (void *)(intptr_t)port,
+                                          4096,
+                                          3);
+
+    if (thread == NULL) {
+        printf("[CONTROL] ERROR: Could not create binary server thread\n");
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,241 @@
+#include "loom/event_log.h"
+#include "loom/clock.h"
+#include <stdio.h>
+#include <string.h>
+#include "lwip/sys.h"
+#include "lwip/prot/ip.h"
+
+#ifdef CONFIG_APPLOOM_EVENT_RING_SIZE
+#define EVENT_RING_SIZE CONFIG_APPLOOM_EVENT_RING_SIZE
+#else
+#define EVENT_RING_SIZE 1024
+#endif
+#define EVENT_RING_MASK (EVENT_RING_SIZE - 1)
+
+_Static_assert((EVENT_RING_SIZE & EVENT_RING_MASK) == 0,
+               "EVENT_RING_SIZE must be a power of two");
+
+/* Records kept per reason per second, the rest only bump a counter */
+#define EVENT_RATE_PER_SEC 64
+
+#define EVENT_DRAIN_INTERVAL_MS 1000
+
+typedef struct {
+    uint64_t seq;               /* position + 1 once the record is written */
+    event_record_t rec;
+} event_slot_t;
+
+typedef struct {
+    uint64_t window_start_ns;
+    uint32_t window_count;
+    uint64_t recorded;
+    uint64_t suppressed;
+} event_reason_state_t;
+
+static event_slot_t ring[EVENT_RING_SIZE];
+static uint64_t ring_head = 0;
+
+static event_reason_state_t reasons[EVENT_REASON_MAX];
+
+static const char *reason_names[EVENT_REASON_MAX] = {
+    [EVENT_DROP_NF] = "nf_drop",
+    [EVENT_DROP_RATE_LIMIT] = "rate_limit",
+    [EVENT_DROP_ALLOWLIST] = "allowlist",
+    [EVENT_DROP_SRC_LIMIT] = "src_limit",
+    [EVENT_DROP_ACL] = "acl",
+};
+
+const char *event_reason_name(event_reason_t reason)
+{
+    if (reason >= EVENT_REASON_MAX) {
+        return "unknown";
+    }
+    return reason_names[reason];
+}
+
+void event_log_record(event_reason_t reason, const char *nf,
+                      uint16_t arg0, uint32_t arg1)
+{
+    if (reason >= EVENT_REASON_MAX) {
+        return;
+    }
+
+    event_reason_state_t *state = &reasons[reason];
+    uint64_t now = loom_now_ns();
+
+    if (now - state->window_start_ns >= LOOM_NSEC_PER_SEC) {
+        state->window_start_ns = now;
+        state->window_count = 0;
+    }
+
+    if (state->window_count >= EVENT_RATE_PER_SEC) {
+        __atomic_fetch_add(&state->suppressed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    state->window_count++;
+    __atomic_fetch_add(&state->recorded, 1, __ATOMIC_RELAXED);
+
+    uint64_t pos = __atomic_fetch_add(&ring_head, 1, __ATOMIC_RELAXED);
+    event_slot_t *slot = &ring[pos & EVENT_RING_MASK];
+
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->rec.timestamp_ns = now;
+    slot->rec.nf = nf;
+    slot->rec.reason = reason;
+    slot->rec.arg0 = arg0;
+    slot->rec.arg1 = arg1;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+static int event_format_record(const event_record_t *rec, char *buf, size_t len)
+{
+    unsigned long long ms = rec->timestamp_ns / 1000000ULL;
+
+    switch (rec->reason) {
+    case EVENT_DROP_NF:
+        return snprintf(buf, len, "[%llu.%03llu] %s: %u packet(s) dropped\n",
+                        ms / 1000, ms % 1000, rec->nf ? rec->nf : "?",
+                        rec->arg0);
+    case EVENT_DROP_RATE_LIMIT:
+        return snprintf(buf, len, "[%llu.%03llu] rate_limiter: port %u exceeded limit (%u)\n",
+                        ms / 1000, ms % 1000, rec->arg0, rec->arg1);
+    case EVENT_DROP_ALLOWLIST:
+        return snprintf(buf, len, "[%llu.%03llu] allowlist: %s port %u not allowed\n",
+                        ms / 1000, ms % 1000, rec->arg1 == IP_PROTO_UDP ? "UDP" : "TCP",
+                        rec->arg0);
+    case EVENT_DROP_SRC_LIMIT: {
+        const uint8_t *ip = (const uint8_t *)&rec->arg1;
+        return snprintf(buf, len, "[%llu.%03llu] src_limiter: %u.%u.%u.%u over limit\n",
+                        ms / 1000, ms % 1000, ip[0], ip[1], ip[2], ip[3]);
+    }
+    case EVENT_DROP_ACL:
+        if (rec->arg1 == 0) {
+            return snprintf(buf, len, "[%llu.%03llu] acl: denied by default action\n",
+                            ms / 1000, ms % 1000);
+        }
+        return snprintf(buf, len, "[%llu.%03llu] acl: denied by rule %u\n",
+                        ms / 1000, ms % 1000, rec->arg1 - 1);
+    default:
+        return snprintf(buf, len, "[%llu.%03llu] event %u\n",
+                        ms / 1000, ms % 1000, rec->reason);
+    }
+}
+
+size_t event_log_format(uint64_t *cursor, char *buf, size_t len)
+{
+    uint64_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+    size_t used = 0;
+
+    if (len == 0) {
+        return 0;
+    }
+    buf[0] = '\0';
+
+    if (head - *cursor > EVENT_RING_SIZE) {
+        uint64_t lost = head - *cursor - EVENT_RING_SIZE;
+        int n = snprintf(buf, len, "(%llu event(s) lost)\n", (unsigned long long)lost);
+        if (n < 0 || (size_t)n >= len) {
+            return 0;
+        }
+        used = n;
+        *cursor = head - EVENT_RING_SIZE;
+    }
+
+    while (*cursor < head) {
+        event_slot_t *slot = &ring[*cursor & EVENT_RING_MASK];
+        event_record_t rec;
+
+        /* Copy and re-check so a concurrent overwrite is never formatted */
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != *cursor + 1) {
+            break;
+        }
+        rec = slot->rec;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != *cursor + 1) {
+            (*cursor)++;
+            continue;
+        }
+
+        int n = event_format_record(&rec, buf + used, len - used);
+        if (n < 0 || (size_t)n >= len - used) {
+            buf[used] = '\0';
+            break;
+        }
+        used += n;
+        (*cursor)++;
+    }
+
+    return used;
+}
+
+uint64_t event_log_tail(uint32_t count)
+{
+    uint64_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+
+    if (count > EVENT_RING_SIZE) {
+        count = EVENT_RING_SIZE;
+    }
+    return head > count ? head - count : 0;
+}
+
+event_counters_t event_log_counters(event_reason_t reason)
+{
+    event_counters_t counters = {0};
+
+    if (reason < EVENT_REASON_MAX) {
+        counters.recorded = __atomic_load_n(&reasons[reason].recorded, __ATOMIC_RELAXED);
+        counters.suppressed = __atomic_load_n(&reasons[reason].suppressed, __ATOMIC_RELAXED);
+    }
+    return counters;
+}
+
+static void event_log_thread(void *arg)
+{
+    static char buf[2048];
+    uint64_t cursor = 0;
+    uint64_t reported[EVENT_REASON_MAX] = {0};
+
+    while (1) {
+        sys_msleep(EVENT_DRAIN_INTERVAL_MS);
+
+        while (event_log_format(&cursor, buf, sizeof(buf)) > 0) {
+            char *save = NULL;
+            for (char *line = strtok_r(buf, "\n", &save); line != NULL;
+                 line = strtok_r(NULL, "\n", &save)) {
+                printf("[EVENT] %s\n", line);
+            }
+        }
+
+        for (int r = 0; r < EVENT_REASON_MAX; r++) {
+            uint64_t suppressed = event_log_counters(r).suppressed;
+            if (suppressed != reported[r]) {
+                printf("[EVENT] %s: %llu event(s) suppressed\n",
+                       reason_names[r],
+                       (unsigned long long)(suppressed - reported[r]));
+                reported[r] = suppressed;
+            }
+        }
+    }
+}
+
+int event_log_init(void)
+{
+    memset(ring, 0, sizeof(ring));
+    memset(reasons, 0, sizeof(reasons));
+    ring_head = 0;
+
+    sys_thread_t thread = sys_thread_new("event_log",
+                                          event_log_thread,
+                                          NULL,
+                                          4096,
+                                          1);
+
+    if (thread == NULL) {
+        printf("[EVENT] ERROR: Could not create event log thread\n");
+        return -1;
+    }
+
+    printf("[EVENT] Event log initialized (%d records)\n", EVENT_RING_SIZE);
+    return 0;
+}
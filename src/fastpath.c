@@ -0,0 +1,738 @@
+#include "loom/fastpath.h"
+#include "loom/capture.h"
+#include "loom/classify.h"
+#include "loom/clock.h"
+#include "loom/forward.h"
+#include "loom/mempool.h"
+#include "loom/nf_chain.h"
+#include "loom/nf_synproxy.h"
+#include "loom/packet.h"
+#include "loom/sampler.h"
+#include "loom/flow_export.h"
+#include "loom/worker.h"
+#include <stdio.h>
+#include <string.h>
+#include <uk/alloc.h>
+#include <uk/netbuf.h>
+#include <uk/netdev.h>
+#include <uk/sched.h>
+#include "lwip/pbuf.h"
+#include "lwip/sys.h"
+#include "lwip/prot/ethernet.h"
+#include "lwip/prot/ip.h"
+
+/*
+ * Large enough for a full frame, the driver's encapsulation headroom and
+ * the netbuf metadata, which uk_netbuf_prepare_buf() keeps in the buffer
+ */
+#define FASTPATH_BUFLEN 2048
+
+/* Every RX descriptor of every queue holds one, plus frames in flight */
+#ifdef CONFIG_APPLOOM_POOL_NETBUFS
+#define FASTPATH_POOL_SIZE CONFIG_APPLOOM_POOL_NETBUFS
+#else
+#define FASTPATH_POOL_SIZE 4096
+#endif
+
+#define LOCAL_PORT_WORDS (65536 / 64)
+
+/* Upper bound on a sleep, so mode changes and lost interrupts are noticed */
+#define FASTPATH_SLEEP_MS 10
+
+/*
+ * Bursts a worker drains back to back before yielding anyway. The
+ * scheduler is cooperative, so a worker that never yields under a flood
+ * starves lwIP, the control servers and the other workers.
+ */
+#define FASTPATH_YIELD_BURSTS 64
+
+typedef struct {
+    struct uk_netdev *dev;
+    uint16_t id;
+    uint8_t hwaddr[ETH_HWADDR_LEN];
+} fp_port_t;
+
+/* Frames queued for transmission on one port, flushed once per RX burst */
+typedef struct {
+    uint16_t count;
+    struct uk_netbuf *bufs[FASTPATH_BURST];
+} fp_txq_t;
+
+/*
+ * Worker w polls RX queue w of every port and transmits on TX queue w, so
+ * nothing below is shared between workers. The chain API is pbuf based but
+ * no NF frees or keeps the buffers it is handed, so each RX slot gets a
+ * pbuf header that only borrows the netbuf data for the chain walk.
+ */
+typedef struct {
+    uint16_t queue;
+    sys_sem_t wake;             /* Signalled from the RX queue callbacks */
+    uint64_t last_rx_ns;
+    struct uk_netbuf *rx_bufs[FASTPATH_BURST];
+    struct pbuf rx_shadow[FASTPATH_BURST];
+    struct pbuf *rx_pkts[FASTPATH_BURST];
+    pkt_meta_t rx_meta[FASTPATH_BURST];
+    classify_burst_t rx_burst;
+    fp_txq_t txq[FASTPATH_MAX_PORTS];
+    fastpath_stats_t stats;
+} __attribute__((aligned(64))) fp_worker_t;
+
+static fp_port_t ports[FASTPATH_MAX_PORTS];
+static int num_ports = 0;
+
+static fp_worker_t workers[LOOM_MAX_WORKERS];
+static unsigned int num_workers = 0;
+static bool running = false;
+static sys_sem_t start_sem;     /* Workers 1.. wait on it for their queues */
+static bool rx_intr = true;
+
+static volatile fastpath_poll_mode_t poll_mode = FASTPATH_POLL_ADAPTIVE;
+static volatile uint64_t idle_ns = FASTPATH_DEFAULT_IDLE_US * 1000ULL;
+
+static struct uk_alloc *rx_alloc = NULL;
+static mempool_t *rx_pool = NULL;
+static uint16_t rx_headroom = 0;
+static struct netif *local_netif = NULL;
+static uint16_t control_ports[FASTPATH_MAX_CONTROL_PORTS];
+static int num_control_ports = 0;
+
+static uint64_t local_ports[LOCAL_PORT_WORDS];
+
+/* RX refills run in the polling worker's context */
+static inline fastpath_stats_t *local_stats(void)
+{
+    return &workers[loom_worker()].stats;
+}
+
+void fastpath_add_local_port(uint16_t port)
+{
+    local_ports[port / 64] |= 1ULL << (port % 64);
+}
+
+void fastpath_set_poll_mode(fastpath_poll_mode_t mode, uint32_t idle_us)
+{
+    poll_mode = mode;
+    idle_ns = (uint64_t)idle_us * 1000ULL;
+    printf("[FASTPATH] Poll mode: %s (idle %u us)\n",
+           fastpath_poll_mode_name(mode), idle_us);
+}
+
+const char *fastpath_poll_mode_name(fastpath_poll_mode_t mode)
+{
+    switch (mode) {
+    case FASTPATH_POLL_BUSY:
+        return "busy";
+    case FASTPATH_POLL_ADAPTIVE:
+        return "adaptive";
+    case FASTPATH_POLL_INTERRUPT:
+        return "interrupt";
+    }
+    return "unknown";
+}
+
+void fastpath_add_control_port(uint16_t port)
+{
+    if (num_control_ports < FASTPATH_MAX_CONTROL_PORTS) {
+        control_ports[num_control_ports++] = port;
+        fastpath_add_local_port(port);
+    }
+}
+
+static inline bool is_local_port(uint16_t port)
+{
+    return (local_ports[port / 64] >> (port % 64)) & 1;
+}
+
+/* Called by uk_netbuf_free(), wherever the frame ended up */
+static void fastpath_netbuf_release(struct uk_netbuf *nb)
+{
+    mempool_put(rx_pool, nb);
+}
+
+static uint16_t fastpath_alloc_rxpkts(void *argp, struct uk_netbuf *nb[],
+                                      uint16_t count)
+{
+    uint16_t i;
+
+    for (i = 0; i < count; i++) {
+        void *mem = mempool_get(rx_pool);
+        if (!mem) {
+            local_stats()->alloc_failed++;
+            break;
+        }
+        nb[i] = uk_netbuf_prepare_buf(mem, FASTPATH_BUFLEN, rx_headroom, 0,
+                                      fastpath_netbuf_release);
+        if (!nb[i]) {
+            mempool_put(rx_pool, mem);
+            break;
+        }
+    }
+
+    return i;
+}
+
+static bool is_for_stack(const pkt_meta_t *meta)
+{
+    if (!(meta->flags & PKT_F_IPV4)) {
+        return true;
+    }
+
+    if (meta->dst_ip != netif_ip4_addr(local_netif)->addr) {
+        return false;
+    }
+
+    if (meta->proto == IP_PROTO_ICMP) {
+        return true;
+    }
+
+    return (meta->flags & PKT_F_L4) && is_local_port(meta->dst_port);
+}
+
+/* Copy a frame up to lwIP, the netbuf itself stays with the caller */
+static void fastpath_deliver(fp_worker_t *w, const struct uk_netbuf *nb)
+{
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, nb->len, PBUF_POOL);
+
+    if (!p) {
+        w->stats.local_failed++;
+        return;
+    }
+
+    pbuf_take(p, nb->data, nb->len);
+
+    if (capture_deliver(p) == ERR_OK) {
+        w->stats.local++;
+    } else {
+        w->stats.local_failed++;
+    }
+}
+
+/*
+ * Queue a transit frame on its egress port, reusing the RX netbuf. Returns
+ * false when forwarding is off, has nowhere to go or the TTL ran out, and
+ * the caller keeps the buffer.
+ */
+static bool fastpath_forward(fp_worker_t *w, int in, struct uk_netbuf *nb,
+                             const pkt_meta_t *meta)
+{
+    int out;
+
+    switch (forward_config.mode) {
+    case FORWARD_BOUNCE:
+        out = in;
+        break;
+    case FORWARD_CROSS:
+        if (num_ports < 2) {
+            w->stats.tx_no_port++;
+            return false;
+        }
+        out = in ^ 1;
+        break;
+    default:
+        return false;
+    }
+
+    if (!forward_decrement_ttl(nb->data, meta)) {
+        w->stats.ttl_expired++;
+        return false;
+    }
+
+    fp_txq_t *txq = &w->txq[out];
+    forward_rewrite_eth(nb->data, ports[out].hwaddr, out == in);
+    txq->bufs[txq->count++] = nb;
+    return true;
+}
+
+static void fastpath_flush_tx(fp_worker_t *w, int port)
+{
+    fp_txq_t *txq = &w->txq[port];
+    uint16_t sent = 0;
+
+    while (sent < txq->count) {
+        uint16_t count = txq->count - sent;
+        int ret = uk_netdev_tx_burst(ports[port].dev, w->queue,
+                                     &txq->bufs[sent], &count);
+
+        if (ret < 0 || count == 0) {
+            break;
+        }
+        sent += count;
+    }
+
+    w->stats.tx_packets += sent;
+
+    /* Ring full: the rest is dropped rather than stalling RX */
+    for (uint16_t i = sent; i < txq->count; i++) {
+        uk_netbuf_free(txq->bufs[i]);
+        w->stats.tx_dropped++;
+    }
+
+    txq->count = 0;
+}
+
+static void fastpath_run_burst(fp_worker_t *w, int in, uint16_t count)
+{
+    capture_stats_t totals = {0};
+    uint16_t n = 0;
+
+    w->rx_burst.count = count;
+    for (uint16_t i = 0; i < count; i++) {
+        w->rx_burst.data[i] = w->rx_bufs[i]->data;
+        w->rx_burst.len[i] = w->rx_bufs[i]->len;
+        w->rx_burst.tot_len[i] = w->rx_bufs[i]->len;
+    }
+
+    uint64_t control = classify_burst(&w->rx_burst, w->rx_meta,
+                                      control_ports, num_control_ports);
+
+    /* Control traffic is never subject to the chain, only to the SYN proxy */
+    for (uint16_t i = 0; i < count; i++) {
+        struct uk_netbuf *nb = w->rx_bufs[i];
+        pkt_meta_t *meta = &w->rx_meta[n];
+        struct pbuf *p = &w->rx_shadow[n];
+
+        if (n != i) {
+            *meta = w->rx_meta[i];
+        }
+        totals.total_packets++;
+        totals.total_bytes += nb->len;
+
+        p->payload = nb->data;
+        p->len = nb->len;
+        p->tot_len = nb->len;
+
+        if (control & (1ULL << i)) {
+            if (nf_synproxy(p, meta)) {
+                totals.passed_packets++;
+                fastpath_deliver(w, nb);
+            } else {
+                nf_chain_count_drops(PKT_DROP_SYNPROXY, 1);
+                totals.dropped_packets++;
+            }
+            uk_netbuf_free(nb);
+            continue;
+        }
+
+        w->rx_pkts[n] = p;
+        w->rx_bufs[n] = nb;
+        n++;
+    }
+
+    if (n == 0) {
+        capture_stats_add(&totals);
+        return;
+    }
+
+    uint64_t pass_mask = nf_chain_process_batch(w->rx_pkts, w->rx_meta, n);
+    sampler_offer(w->rx_pkts, w->rx_meta, n, pass_mask);
+    flow_export_account(w->rx_meta, n, pass_mask);
+
+    for (uint16_t i = 0; i < n; i++) {
+        struct uk_netbuf *nb = w->rx_bufs[i];
+
+        if (!(pass_mask & (1ULL << i))) {
+            w->stats.dropped++;
+            totals.dropped_packets++;
+            uk_netbuf_free(nb);
+            continue;
+        }
+
+        w->stats.passed++;
+        totals.passed_packets++;
+
+        if (is_for_stack(&w->rx_meta[i])) {
+            fastpath_deliver(w, nb);
+            /* Bridged L2 (e.g. ARP) must still reach the other side */
+            if (forward_config.mode == FORWARD_CROSS &&
+                !(w->rx_meta[i].flags & PKT_F_IPV4) &&
+                fastpath_forward(w, in, nb, &w->rx_meta[i])) {
+                w->stats.forwarded++;
+                totals.forwarded_packets++;
+                continue;
+            }
+            uk_netbuf_free(nb);
+        } else if (fastpath_forward(w, in, nb, &w->rx_meta[i])) {
+            w->stats.forwarded++;
+            totals.forwarded_packets++;
+        } else {
+            w->stats.transit++;
+            uk_netbuf_free(nb);
+        }
+    }
+
+    capture_stats_add(&totals);
+
+    for (int i = 0; i < num_ports; i++) {
+        if (w->txq[i].count) {
+            fastpath_flush_tx(w, i);
+        }
+    }
+}
+
+/* Runs in the netdev event dispatcher, only while the queue is armed */
+static void fastpath_rx_event(struct uk_netdev *dev, uint16_t queue, void *argp)
+{
+    fp_worker_t *w = argp;
+
+    sys_sem_signal(&w->wake);
+}
+
+/*
+ * Arm the RX interrupt on every queue of this worker and block until one
+ * fires. A queue that still holds frames refuses to arm, in which case
+ * the worker goes straight back to polling.
+ */
+static void fastpath_sleep(fp_worker_t *w)
+{
+    int armed = 0;
+
+    while (armed < num_ports) {
+        if (uk_netdev_rxq_intr_enable(ports[armed].dev, w->queue) != 0) {
+            break;
+        }
+        armed++;
+    }
+
+    if (armed == num_ports) {
+        w->stats.sleeps++;
+        if (sys_arch_sem_wait(&w->wake, FASTPATH_SLEEP_MS) != SYS_ARCH_TIMEOUT) {
+            w->stats.wakeups++;
+        }
+    }
+
+    for (int i = 0; i < armed; i++) {
+        uk_netdev_rxq_intr_disable(ports[i].dev, w->queue);
+    }
+}
+
+static void fastpath_poll_loop(fp_worker_t *w)
+{
+    loom_worker_register(w->queue);
+    printf("[FASTPATH] Worker %u polling queue %u of %d port(s)\n",
+           w->queue, w->queue, num_ports);
+
+    w->last_rx_ns = loom_now_ns();
+    uint32_t streak = 0;
+
+    while (running) {
+        uint32_t received = 0;
+        bool more = false;
+
+        for (int i = 0; i < num_ports; i++) {
+            uint16_t count = FASTPATH_BURST;
+            int ret = uk_netdev_rx_burst(ports[i].dev, w->queue, w->rx_bufs,
+                                         &count);
+
+            if (ret < 0) {
+                printf("[FASTPATH] ERROR: RX on netdev %u queue %u failed (%d), "
+                       "stopping\n", ports[i].id, w->queue, ret);
+                running = false;
+                return;
+            }
+
+            if (count > 0) {
+                w->stats.rx_packets += count;
+                w->stats.rx_bursts++;
+                received += count;
+                fastpath_run_burst(w, i, count);
+            }
+
+            if (uk_netdev_status_more(ret)) {
+                more = true;
+            }
+        }
+
+        /* Under load: keep draining without touching the clock */
+        if (more && ++streak < FASTPATH_YIELD_BURSTS) {
+            continue;
+        }
+        streak = 0;
+
+        if (received > 0) {
+            w->last_rx_ns = loom_now_ns();
+        } else {
+            w->stats.empty_polls++;
+
+            fastpath_poll_mode_t mode = poll_mode;
+            if (rx_intr && mode != FASTPATH_POLL_BUSY &&
+                (mode == FASTPATH_POLL_INTERRUPT ||
+                 loom_now_ns() - w->last_rx_ns >= idle_ns)) {
+                fastpath_sleep(w);
+                w->last_rx_ns = loom_now_ns();
+                continue;
+            }
+        }
+
+        /* Rings drained, give the other workers and lwIP a turn */
+        uk_sched_yield();
+    }
+}
+
+static void fastpath_thread(void *arg)
+{
+    sys_arch_sem_wait(&start_sem, 0);
+    if (running) {
+        fastpath_poll_loop(arg);
+    }
+}
+
+int fastpath_run(void)
+{
+    if (!running) {
+        return -1;
+    }
+
+    fastpath_poll_loop(&workers[0]);
+    return -1;
+}
+
+static int fastpath_setup_port(fp_port_t *port, struct uk_netdev *dev,
+                               unsigned int id, uint16_t queues)
+{
+    struct uk_netdev_conf dev_conf = {0};
+    struct uk_netdev_rxqueue_conf rxq_conf = {0};
+    struct uk_netdev_txqueue_conf txq_conf = {0};
+    int ret;
+
+    dev_conf.nb_rx_queues = queues;
+    dev_conf.nb_tx_queues = queues;
+    ret = uk_netdev_configure(dev, &dev_conf);
+    if (ret < 0) {
+        printf("[FASTPATH] ERROR: Could not configure netdev %u (%d)\n", id, ret);
+        return -1;
+    }
+
+    /* The callback only fires while a worker sleeps with the queue armed */
+    rxq_conf.a = rx_alloc;
+    rxq_conf.alloc_rxpkts = fastpath_alloc_rxpkts;
+    rxq_conf.alloc_rxpkts_argp = NULL;
+    if (rx_intr) {
+        rxq_conf.callback = fastpath_rx_event;
+#if CONFIG_LIBUKNETDEV_DISPATCHERTHREADS
+        rxq_conf.s = uk_sched_current();
+#endif
+    }
+    txq_conf.a = rx_alloc;
+
+    for (uint16_t q = 0; q < queues; q++) {
+        rxq_conf.callback_cookie = &workers[q];
+        ret = uk_netdev_rxq_configure(dev, q, 0, &rxq_conf);
+        if (ret < 0) {
+            printf("[FASTPATH] ERROR: Could not configure RX queue %u (%d)\n",
+                   q, ret);
+            return -1;
+        }
+
+        ret = uk_netdev_txq_configure(dev, q, 0, &txq_conf);
+        if (ret < 0) {
+            printf("[FASTPATH] ERROR: Could not configure TX queue %u (%d)\n",
+                   q, ret);
+            return -1;
+        }
+    }
+
+    ret = uk_netdev_start(dev);
+    if (ret < 0) {
+        printf("[FASTPATH] ERROR: Could not start netdev %u (%d)\n", id, ret);
+        return -1;
+    }
+
+    const struct uk_hwaddr *hwaddr = uk_netdev_hwaddr_get(dev);
+    if (hwaddr) {
+        memcpy(port->hwaddr, hwaddr->addr_bytes, ETH_HWADDR_LEN);
+    }
+
+    port->dev = dev;
+    port->id = (uint16_t)id;
+    return 0;
+}
+
+int fastpath_init(struct netif *local, uint16_t port, unsigned int max_workers)
+{
+    static char thread_names[LOOM_MAX_WORKERS][16];
+    struct uk_netdev *devs[FASTPATH_MAX_PORTS];
+    unsigned int ids[FASTPATH_MAX_PORTS];
+    unsigned int count = uk_netdev_count();
+    unsigned int queues;
+    int found = 0;
+
+    if (!local) {
+        printf("[FASTPATH] ERROR: netif is NULL\n");
+        return -1;
+    }
+
+    /* Every NIC the lwIP glue left unconfigured is ours, up to two */
+    for (unsigned int i = 0; i < count && found < FASTPATH_MAX_PORTS; i++) {
+        struct uk_netdev *candidate = uk_netdev_get(i);
+
+        if (candidate &&
+            uk_netdev_state_get(candidate) == UK_NETDEV_UNCONFIGURED) {
+            devs[found] = candidate;
+            ids[found] = i;
+            found++;
+        }
+    }
+
+    if (found == 0) {
+        printf("[FASTPATH] No spare netdev, using the netif input hook only\n");
+        return -1;
+    }
+
+    queues = (max_workers && max_workers < LOOM_MAX_WORKERS) ?
+             max_workers : LOOM_MAX_WORKERS;
+#ifdef CONFIG_LIBUKNETDEV_MAXNBQUEUES
+    if (queues > CONFIG_LIBUKNETDEV_MAXNBQUEUES) {
+        queues = CONFIG_LIBUKNETDEV_MAXNBQUEUES;
+    }
+#endif
+
+    /*
+     * One queue pair per worker, as many as every port supports. RX
+     * buffers are transmitted as-is when forwarding, so reserve enough
+     * headroom for whichever encapsulation is larger on any port.
+     */
+    rx_alloc = uk_alloc_get_default();
+    for (int i = 0; i < found; i++) {
+        struct uk_netdev_info info;
+        uk_netdev_info_get(devs[i], &info);
+        if (info.max_rx_queues < queues) {
+            queues = info.max_rx_queues;
+        }
+        if (info.max_tx_queues < queues) {
+            queues = info.max_tx_queues;
+        }
+        if (info.nb_encap_rx > rx_headroom) {
+            rx_headroom = info.nb_encap_rx;
+        }
+        if (info.nb_encap_tx > rx_headroom) {
+            rx_headroom = info.nb_encap_tx;
+        }
+        if (!(info.features & UK_NETDEV_F_RXQ_INTR)) {
+            rx_intr = false;
+        }
+    }
+    if (queues == 0) {
+        queues = 1;
+    }
+
+    /* Buffers come out cache line aligned, more than virtio asks for */
+    rx_pool = mempool_create("netbuf", FASTPATH_BUFLEN, FASTPATH_POOL_SIZE);
+    if (!rx_pool) {
+        printf("[FASTPATH] ERROR: No RX buffer pool\n");
+        return -1;
+    }
+
+    memset(workers, 0, sizeof(workers));
+    for (unsigned int w = 0; w < queues; w++) {
+        workers[w].queue = (uint16_t)w;
+        for (int i = 0; i < FASTPATH_BURST; i++) {
+            workers[w].rx_shadow[i].type_internal = PBUF_REF;
+            workers[w].rx_shadow[i].ref = 1;
+        }
+        if (rx_intr && sys_sem_new(&workers[w].wake, 0) != ERR_OK) {
+            rx_intr = false;
+        }
+    }
+
+    if (!rx_intr) {
+        printf("[FASTPATH] No RX interrupts, busy polling only\n");
+    }
+
+    /*
+     * Threads first, so only as many queues are configured as there are
+     * workers to poll them. They wait on start_sem until the ports are up.
+     * Worker 0 is the main thread, see fastpath_run().
+     */
+    num_workers = 1;
+    if (queues > 1 && sys_sem_new(&start_sem, 0) != ERR_OK) {
+        printf("[FASTPATH] ERROR: No worker start semaphore\n");
+        queues = 1;
+    }
+    for (unsigned int w = 1; w < queues; w++) {
+        snprintf(thread_names[w], sizeof(thread_names[w]), "fastpath%u", w);
+        sys_thread_t thread = sys_thread_new(thread_names[w],
+                                              fastpath_thread,
+                                              &workers[w],
+                                              4096,
+                                              2);
+
+        if (thread == NULL) {
+            printf("[FASTPATH] ERROR: Could not create worker %u\n", w);
+            break;
+        }
+        num_workers++;
+    }
+    queues = num_workers;
+
+    for (int i = 0; i < found; i++) {
+        if (fastpath_setup_port(&ports[num_ports], devs[i], ids[i],
+                                (uint16_t)queues) < 0) {
+            break;
+        }
+        num_ports++;
+    }
+
+    if (num_ports == 0) {
+        /* running is still false, the threads return as soon as released */
+        for (unsigned int w = 1; w < num_workers; w++) {
+            sys_sem_signal(&start_sem);
+        }
+        return -1;
+    }
+
+    local_netif = local;
+    fastpath_add_control_port(port);
+
+    /* Token buckets are split per worker, re-split existing limits */
+    loom_set_num_workers(num_workers);
+    nf_rate_limiter_rebalance();
+
+    running = true;
+    for (unsigned int w = 1; w < num_workers; w++) {
+        sys_sem_signal(&start_sem);
+    }
+
+    for (int i = 0; i < num_ports; i++) {
+        printf("[FASTPATH] NF chain attached to netdev %u, %u queue(s)\n",
+               ports[i].id, num_workers);
+    }
+    return 0;
+}
+
+fastpath_stats_t fastpath_get_stats(void)
+{
+    fastpath_stats_t total;
+
+    memset(&total, 0, sizeof(total));
+    total.running = running;
+    total.num_ports = (uint16_t)num_ports;
+    total.num_workers = (uint16_t)num_workers;
+    total.rx_intr = rx_intr;
+    total.poll_mode = poll_mode;
+    total.idle_us = (uint32_t)(idle_ns / 1000);
+    for (int i = 0; i < num_ports; i++) {
+        total.netdev_id[i] = ports[i].id;
+    }
+
+    for (unsigned int w = 0; w < num_workers; w++) {
+        const fastpath_stats_t *s = &workers[w].stats;
+        total.rx_packets += s->rx_packets;
+        total.rx_bursts += s->rx_bursts;
+        total.passed += s->passed;
+        total.dropped += s->dropped;
+        total.local += s->local;
+        total.transit += s->transit;
+        total.forwarded += s->forwarded;
+        total.tx_packets += s->tx_packets;
+        total.tx_dropped += s->tx_dropped;
+        total.tx_no_port += s->tx_no_port;
+        total.ttl_expired += s->ttl_expired;
+        total.local_failed += s->local_failed;
+        total.alloc_failed += s->alloc_failed;
+        total.empty_polls += s->empty_polls;
+        total.sleeps += s->sleeps;
+        total.wakeups += s->wakeups;
+    }
+
+    return total;
+}
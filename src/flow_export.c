@@ -0,0 +1,549 @@
+#include "loom/flow_export.h"
+#include "loom/clock.h"
+#include "loom/mempool.h"
+#include "loom/worker.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <uk/sched.h>
+#include "lwip/def.h"
+#include "lwip/sys.h"
+
+#define FLOW_NIL 0xffffffffU
+
+/* Records per worker waiting for the exporter */
+#define FLOW_QUEUE_SIZE 512
+#define FLOW_QUEUE_MASK (FLOW_QUEUE_SIZE - 1)
+
+#define FLOW_RECORDS_PER_DGRAM 32
+
+/* The exporter drains the queues this often and sweeps once a second */
+#define FLOW_POLL_MS 100
+#define FLOW_SWEEP_MS 1000
+
+/* Entries the sweep checks per lock hold */
+#define FLOW_SWEEP_SLICE 256
+
+_Static_assert(sizeof(flow_record_t) == 44, "flow_record_t is 44 bytes on the wire");
+_Static_assert(sizeof(flow_dgram_hdr_t) + FLOW_RECORDS_PER_DGRAM * sizeof(flow_record_t) <= 1472,
+               "a datagram must fit an unfragmented Ethernet frame");
+
+typedef struct {
+    uint32_t src_ip;
+    uint32_t dst_ip;
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t proto;
+    uint8_t tcp_flags;
+    uint8_t drop_reason;
+    uint8_t in_use;
+    uint32_t hnext;             /* Hash chain */
+    uint32_t prev;              /* LRU list, most recently seen first */
+    uint32_t next;              /* Also links the free list */
+    uint32_t dropped;
+    uint32_t first_ms;
+    uint32_t last_ms;
+    uint32_t hash;
+    uint64_t packets;
+    uint64_t bytes;
+} __attribute__((aligned(64))) flow_entry_t;
+
+/*
+ * Only the owning worker touches its table on the data path. The lock is
+ * there for the exporter's sweep, so the worker takes it once per batch
+ * and almost never finds it held.
+ */
+typedef struct {
+    uint32_t lock;
+    uint32_t count;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t free;
+    uint32_t sweep;             /* Exporter's position */
+    flow_entry_t *entries;
+    uint32_t *buckets;
+    flow_record_t *queue;
+    uint32_t q_head;            /* Written under lock */
+    uint32_t q_tail;            /* Written by the exporter */
+    uint64_t created;
+    uint64_t evicted;
+    uint64_t lost;
+} __attribute__((aligned(64))) flow_table_t;
+
+bool flow_export_armed = false;
+
+static flow_table_t tables[LOOM_MAX_WORKERS];
+static uint32_t capacity = 0;
+static uint32_t bucket_mask = 0;
+
+static bool enabled = false;
+static uint32_t collector_ip = 0;
+static uint16_t collector_port = 0;
+static uint32_t active_ms = FLOW_DEFAULT_ACTIVE_S * 1000;
+static uint32_t idle_ms = FLOW_DEFAULT_IDLE_S * 1000;
+
+static int export_fd = -1;
+static uint8_t dgram[sizeof(flow_dgram_hdr_t) +
+                     FLOW_RECORDS_PER_DGRAM * sizeof(flow_record_t)];
+
+static uint64_t exported = 0;
+static uint64_t datagrams = 0;
+static uint64_t send_failed = 0;
+
+static inline uint32_t flow_now_ms(void)
+{
+    return (uint32_t)(loom_now_ns() / 1000000ULL);
+}
+
+static void flow_update_armed(void)
+{
+    __atomic_store_n(&flow_export_armed,
+                     capacity && enabled && collector_port != 0,
+                     __ATOMIC_RELEASE);
+}
+
+static inline void flow_lock(flow_table_t *t)
+{
+    while (__atomic_exchange_n(&t->lock, 1, __ATOMIC_ACQUIRE)) {
+        uk_sched_yield();
+    }
+}
+
+static inline void flow_unlock(flow_table_t *t)
+{
+    __atomic_store_n(&t->lock, 0, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t flow_hash(const pkt_meta_t *m)
+{
+    uint32_t h = (m->src_ip ^ (m->dst_ip << 16 | m->dst_ip >> 16)) * 0x9e3779b1U;
+
+    h ^= ((uint32_t)m->src_port << 16 | m->dst_port) * 0x85ebca77U;
+    h ^= m->proto;
+    return h ^ (h >> 15);
+}
+
+static inline bool flow_key_eq(const flow_entry_t *e, const pkt_meta_t *m)
+{
+    return e->src_ip == m->src_ip && e->dst_ip == m->dst_ip &&
+           e->src_port == m->src_port && e->dst_port == m->dst_port &&
+           e->proto == m->proto;
+}
+
+/* Queues the flow's counters for export; under the table lock */
+static void flow_emit(flow_table_t *t, const flow_entry_t *e, flow_end_t why)
+{
+    uint32_t tail = __atomic_load_n(&t->q_tail, __ATOMIC_ACQUIRE);
+
+    if (t->q_head - tail >= FLOW_QUEUE_SIZE) {
+        t->lost++;
+        return;
+    }
+
+    flow_record_t *r = &t->queue[t->q_head & FLOW_QUEUE_MASK];
+    r->src_ip = e->src_ip;
+    r->dst_ip = e->dst_ip;
+    r->src_port = lwip_htons(e->src_port);
+    r->dst_port = lwip_htons(e->dst_port);
+    r->proto = e->proto;
+    r->tcp_flags = e->tcp_flags;
+    r->drop_reason = e->drop_reason;
+    r->end_reason = why;
+    r->packets = ((uint64_t)lwip_htonl((uint32_t)e->packets) << 32) |
+                 lwip_htonl((uint32_t)(e->packets >> 32));
+    r->bytes = ((uint64_t)lwip_htonl((uint32_t)e->bytes) << 32) |
+               lwip_htonl((uint32_t)(e->bytes >> 32));
+    r->dropped = lwip_htonl(e->dropped);
+    r->first_ms = lwip_htonl(e->first_ms);
+    r->last_ms = lwip_htonl(e->last_ms);
+
+    __atomic_store_n(&t->q_head, t->q_head + 1, __ATOMIC_RELEASE);
+}
+
+static void flow_lru_unlink(flow_table_t *t, uint32_t idx)
+{
+    flow_entry_t *e = &t->entries[idx];
+
+    if (e->prev != FLOW_NIL) {
+        t->entries[e->prev].next = e->next;
+    } else {
+        t->head = e->next;
+    }
+    if (e->next != FLOW_NIL) {
+        t->entries[e->next].prev = e->prev;
+    } else {
+        t->tail = e->prev;
+    }
+}
+
+static void flow_lru_push(flow_table_t *t, uint32_t idx)
+{
+    flow_entry_t *e = &t->entries[idx];
+
+    e->prev = FLOW_NIL;
+    e->next = t->head;
+    if (t->head != FLOW_NIL) {
+        t->entries[t->head].prev = idx;
+    } else {
+        t->tail = idx;
+    }
+    t->head = idx;
+}
+
+static void flow_remove(flow_table_t *t, uint32_t idx)
+{
+    flow_entry_t *e = &t->entries[idx];
+    uint32_t *link = &t->buckets[e->hash & bucket_mask];
+
+    while (*link != idx) {
+        link = &t->entries[*link].hnext;
+    }
+    *link = e->hnext;
+
+    flow_lru_unlink(t, idx);
+    e->in_use = 0;
+    e->next = t->free;
+    t->free = idx;
+    t->count--;
+}
+
+static flow_entry_t *flow_find_or_add(flow_table_t *t, const pkt_meta_t *m,
+                                      uint32_t hash, uint32_t now)
+{
+    uint32_t *bucket = &t->buckets[hash & bucket_mask];
+
+    for (uint32_t idx = *bucket; idx != FLOW_NIL; idx = t->entries[idx].hnext) {
+        flow_entry_t *e = &t->entries[idx];
+        if (e->hash == hash && flow_key_eq(e, m)) {
+            /* Relinked at most once a millisecond, close enough for LRU */
+            if (e->last_ms != now && t->head != idx) {
+                flow_lru_unlink(t, idx);
+                flow_lru_push(t, idx);
+            }
+            return e;
+        }
+    }
+
+    if (t->free == FLOW_NIL) {
+        flow_emit(t, &t->entries[t->tail], FLOW_END_EVICTED);
+        flow_remove(t, t->tail);
+        t->evicted++;
+    }
+
+    uint32_t idx = t->free;
+    flow_entry_t *e = &t->entries[idx];
+    t->free = e->next;
+
+    e->src_ip = m->src_ip;
+    e->dst_ip = m->dst_ip;
+    e->src_port = m->src_port;
+    e->dst_port = m->dst_port;
+    e->proto = m->proto;
+    e->tcp_flags = 0;
+    e->drop_reason = PKT_DROP_NONE;
+    e->in_use = 1;
+    e->dropped = 0;
+    e->first_ms = now;
+    e->hash = hash;
+    e->packets = 0;
+    e->bytes = 0;
+
+    e->hnext = *bucket;
+    *bucket = idx;
+    flow_lru_push(t, idx);
+    t->count++;
+    t->created++;
+    return e;
+}
+
+void flow_export_account_batch(const pkt_meta_t *meta, uint16_t count,
+                               uint64_t pass_mask)
+{
+    flow_table_t *t = &tables[loom_worker()];
+    uint32_t now = flow_now_ms();
+    uint32_t hashes[64];
+
+    /* Start the bucket loads of the whole batch before walking any chain */
+    for (uint16_t i = 0; i < count && i < 64; i++) {
+        hashes[i] = flow_hash(&meta[i]);
+        __builtin_prefetch(&t->buckets[hashes[i] & bucket_mask]);
+    }
+
+    flow_lock(t);
+
+    for (uint16_t i = 0; i < count && i < 64; i++) {
+        uint32_t idx = t->buckets[hashes[i] & bucket_mask];
+        if (idx != FLOW_NIL) {
+            __builtin_prefetch(&t->entries[idx], 1);
+        }
+    }
+
+    for (uint16_t i = 0; i < count && i < 64; i++) {
+        const pkt_meta_t *m = &meta[i];
+
+        if (!(m->flags & PKT_F_IPV4)) {
+            continue;
+        }
+
+        flow_entry_t *e = flow_find_or_add(t, m, hashes[i], now);
+        e->packets++;
+        e->bytes += m->pkt_len;
+        e->last_ms = now;
+        e->tcp_flags |= m->tcp_flags;
+        if (!(pass_mask & (1ULL << i))) {
+            e->dropped++;
+            e->drop_reason = m->drop_reason;
+        }
+    }
+
+    flow_unlock(t);
+}
+
+static void flow_send(uint16_t records, uint64_t lost)
+{
+    flow_dgram_hdr_t *hdr = (flow_dgram_hdr_t *)dgram;
+    struct sockaddr_in to = {
+        .sin_family = AF_INET,
+        .sin_port = htons(collector_port),
+        .sin_addr.s_addr = collector_ip,
+    };
+
+    hdr->version = lwip_htons(FLOW_EXPORT_VERSION);
+    hdr->count = lwip_htons(records);
+    hdr->sequence = lwip_htonl((uint32_t)exported);
+    hdr->uptime_ms = lwip_htonl(flow_now_ms());
+    hdr->lost = lwip_htonl((uint32_t)lost);
+
+    size_t len = sizeof(*hdr) + (size_t)records * sizeof(flow_record_t);
+    if (collector_port == 0 ||
+        sendto(export_fd, dgram, len, 0, (struct sockaddr *)&to, sizeof(to)) != (ssize_t)len) {
+        __atomic_fetch_add(&send_failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_fetch_add(&exported, records, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&datagrams, 1, __ATOMIC_RELAXED);
+}
+
+/* Everything queued so far, packed into as few datagrams as possible */
+static void flow_drain(void)
+{
+    flow_record_t *out = (flow_record_t *)(dgram + sizeof(flow_dgram_hdr_t));
+    uint16_t n = 0;
+    uint64_t lost = 0;
+
+    for (unsigned int w = 0; w < LOOM_MAX_WORKERS; w++) {
+        lost += __atomic_load_n(&tables[w].lost, __ATOMIC_RELAXED);
+    }
+
+    for (unsigned int w = 0; w < LOOM_MAX_WORKERS; w++) {
+        flow_table_t *t = &tables[w];
+        uint32_t head = __atomic_load_n(&t->q_head, __ATOMIC_ACQUIRE);
+        uint32_t tail = t->q_tail;
+
+        while (tail != head) {
+            memcpy(&out[n++], &t->queue[tail & FLOW_QUEUE_MASK], sizeof(*out));
+            tail++;
+            if (n == FLOW_RECORDS_PER_DGRAM) {
+                __atomic_store_n(&t->q_tail, tail, __ATOMIC_RELEASE);
+                flow_send(n, lost);
+                n = 0;
+            }
+        }
+        __atomic_store_n(&t->q_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    if (n > 0) {
+        flow_send(n, lost);
+    }
+}
+
+/*
+ * Idle flows are exported and freed, long-lived ones exported with their
+ * counters restarted. flush exports and frees everything.
+ */
+static void flow_sweep(flow_table_t *t, uint32_t now, bool flush)
+{
+    for (uint32_t done = 0; done < capacity; done += FLOW_SWEEP_SLICE) {
+        /* Make room for a whole slice of records */
+        if (t->q_head - t->q_tail > FLOW_QUEUE_SIZE - FLOW_SWEEP_SLICE) {
+            flow_drain();
+        }
+
+        flow_lock(t);
+
+        for (uint32_t k = 0; k < FLOW_SWEEP_SLICE && t->count > 0; k++) {
+            uint32_t idx = t->sweep;
+            flow_entry_t *e = &t->entries[idx];
+
+            t->sweep = (t->sweep + 1) % capacity;
+            if (!e->in_use) {
+                continue;
+            }
+
+            /* Signed: workers may have stamped the entry after now was read */
+            if (flush || (int32_t)(now - e->last_ms) >= (int32_t)idle_ms) {
+                /* Empty when nothing arrived since the last active export */
+                if (e->packets) {
+                    flow_emit(t, e, flush ? FLOW_END_FLUSH : FLOW_END_IDLE);
+                }
+                flow_remove(t, idx);
+            } else if ((int32_t)(now - e->first_ms) >= (int32_t)active_ms &&
+                       e->packets) {
+                flow_emit(t, e, FLOW_END_ACTIVE);
+                e->packets = 0;
+                e->bytes = 0;
+                e->dropped = 0;
+                e->tcp_flags = 0;
+                e->drop_reason = PKT_DROP_NONE;
+                e->first_ms = now;
+            }
+        }
+
+        bool empty = t->count == 0;
+        flow_unlock(t);
+        if (empty) {
+            break;
+        }
+    }
+}
+
+static void flow_export_thread(void *arg)
+{
+    uint32_t last_sweep = flow_now_ms();
+
+    export_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (export_fd < 0) {
+        printf("[FLOW] ERROR: Could not create socket\n");
+        return;
+    }
+
+    while (1) {
+        sys_msleep(FLOW_POLL_MS);
+
+        uint32_t now = flow_now_ms();
+        bool armed = __atomic_load_n(&flow_export_armed, __ATOMIC_ACQUIRE);
+
+        if (!armed || now - last_sweep >= FLOW_SWEEP_MS) {
+            for (unsigned int w = 0; w < LOOM_MAX_WORKERS; w++) {
+                if (__atomic_load_n(&tables[w].count, __ATOMIC_RELAXED)) {
+                    flow_sweep(&tables[w], now, !armed);
+                }
+            }
+            last_sweep = now;
+        }
+
+        flow_drain();
+    }
+}
+
+int flow_export_init(uint32_t flows)
+{
+    uint32_t buckets = 1;
+
+    if (flows == 0) {
+        return -1;
+    }
+    while (buckets < flows) {
+        buckets <<= 1;
+    }
+
+    /* One region per array, split between the workers: regions are few */
+    flow_entry_t *entries = mem_reserve("flows", LOOM_MAX_WORKERS *
+                                        flows * sizeof(flow_entry_t));
+    uint32_t *heads = mem_reserve("flow_buckets", LOOM_MAX_WORKERS *
+                                  buckets * sizeof(uint32_t));
+    flow_record_t *queues = mem_reserve("flow_queue", LOOM_MAX_WORKERS *
+                                        FLOW_QUEUE_SIZE * sizeof(flow_record_t));
+
+    if (!entries || !heads || !queues) {
+        printf("[FLOW] ERROR: Could not reserve the flow tables\n");
+        return -1;
+    }
+
+    for (unsigned int w = 0; w < LOOM_MAX_WORKERS; w++) {
+        flow_table_t *t = &tables[w];
+
+        t->entries = entries + (size_t)w * flows;
+        t->buckets = heads + (size_t)w * buckets;
+        t->queue = queues + (size_t)w * FLOW_QUEUE_SIZE;
+
+        memset(t->entries, 0, flows * sizeof(flow_entry_t));
+        memset(t->buckets, 0xff, buckets * sizeof(uint32_t));
+        for (uint32_t i = 0; i < flows; i++) {
+            t->entries[i].next = i + 1 < flows ? i + 1 : FLOW_NIL;
+        }
+        t->free = 0;
+        t->head = FLOW_NIL;
+        t->tail = FLOW_NIL;
+    }
+
+    capacity = flows;
+    bucket_mask = buckets - 1;
+
+    sys_thread_t thread = sys_thread_new("flow_export",
+                                          flow_export_thread,
+                                          NULL,
+                                          4096,
+                                          3);
+
+    if (thread == NULL) {
+        printf("[FLOW] ERROR: Could not create export thread\n");
+        capacity = 0;
+        return -1;
+    }
+
+    printf("[FLOW] Initialized: %u flows per worker (%zu KiB)\n", flows,
+           LOOM_MAX_WORKERS * (flows * sizeof(flow_entry_t) +
+                               buckets * sizeof(uint32_t) +
+                               FLOW_QUEUE_SIZE * sizeof(flow_record_t)) / 1024);
+    return 0;
+}
+
+void flow_export_set_enabled(bool on)
+{
+    enabled = on;
+    flow_update_armed();
+    printf("[FLOW] %s\n", on ? "Enabled" : "Disabled");
+}
+
+void flow_export_set_collector(uint32_t ip, uint16_t port)
+{
+    collector_ip = ip;
+    collector_port = ip ? port : 0;
+    flow_update_armed();
+}
+
+int flow_export_set_timeouts(uint32_t active_s, uint32_t idle_s)
+{
+    if (active_s == 0 || idle_s == 0 || active_s > 86400 || idle_s > 86400) {
+        return -1;
+    }
+    active_ms = active_s * 1000;
+    idle_ms = idle_s * 1000;
+    return 0;
+}
+
+flow_stats_t flow_export_get_stats(void)
+{
+    flow_stats_t stats = {
+        .enabled = enabled,
+        .collector_ip = collector_ip,
+        .collector_port = collector_port,
+        .capacity = capacity,
+        .active_timeout_s = active_ms / 1000,
+        .idle_timeout_s = idle_ms / 1000,
+        .exported = __atomic_load_n(&exported, __ATOMIC_RELAXED),
+        .datagrams = __atomic_load_n(&datagrams, __ATOMIC_RELAXED),
+        .send_failed = __atomic_load_n(&send_failed, __ATOMIC_RELAXED),
+    };
+
+    for (unsigned int w = 0; w < LOOM_MAX_WORKERS; w++) {
+        stats.active += __atomic_load_n(&tables[w].count, __ATOMIC_RELAXED);
+        stats.created += __atomic_load_n(&tables[w].created, __ATOMIC_RELAXED);
+        stats.evicted += __atomic_load_n(&tables[w].evicted, __ATOMIC_RELAXED);
+        stats.lost += __atomic_load_n(&tables[w].lost, __ATOMIC_RELAXED);
+    }
+    return stats;
+}
@@ -0,0 +1,38 @@
+#include "loom/forward.h"
+#include <stdio.h>
+
+forward_config_t forward_config = { .mode = FORWARD_OFF };
+
+static const char *mode_names[] = {
+    [FORWARD_OFF] = "off",
+    [FORWARD_BOUNCE] = "bounce",
+    [FORWARD_CROSS] = "cross",
+};
+
+void forward_set_mode(forward_mode_t mode)
+{
+    forward_config.mode = mode;
+    printf("[FORWARD] Mode set to %s\n", forward_mode_name(mode));
+}
+
+void forward_set_next_hop(const uint8_t *mac)
+{
+    if (!mac) {
+        forward_config.has_next_hop = false;
+        printf("[FORWARD] Next hop cleared\n");
+        return;
+    }
+
+    memcpy(forward_config.next_hop, mac, 6);
+    forward_config.has_next_hop = true;
+    printf("[FORWARD] Next hop %02x:%02x:%02x:%02x:%02x:%02x\n",
+           mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+}
+
+const char *forward_mode_name(forward_mode_t mode)
+{
+    if (mode > FORWARD_CROSS) {
+        return "unknown";
+    }
+    return mode_names[mode];
+}
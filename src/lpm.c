@@ -0,0 +1,100 @@
+#include "loom/lpm.h"
+#include <stdlib.h>
+#include <string.h>
+
+void lpm_init(lpm_t *lpm)
+{
+    memset(lpm->tbl16, 0, sizeof(lpm->tbl16));
+    lpm->groups = NULL;
+    lpm->num_groups = 0;
+    lpm->max_groups = 0;
+}
+
+void lpm_free(lpm_t *lpm)
+{
+    free(lpm->groups);
+    lpm->groups = NULL;
+    lpm->num_groups = 0;
+    lpm->max_groups = 0;
+}
+
+/* Make room for `needed` more groups before any slot pointer is taken */
+static int lpm_reserve(lpm_t *lpm, uint32_t needed)
+{
+    if (lpm->num_groups + needed <= lpm->max_groups) {
+        return 0;
+    }
+
+    uint32_t max = lpm->max_groups ? lpm->max_groups * 2 : 64;
+    if (max > LPM_MAX_GROUPS) {
+        max = LPM_MAX_GROUPS;
+    }
+    if (lpm->num_groups + needed > max) {
+        return -1;
+    }
+
+    uint16_t (*groups)[256] = realloc(lpm->groups, max * sizeof(groups[0]));
+    if (!groups) {
+        return -1;
+    }
+
+    lpm->groups = groups;
+    lpm->max_groups = max;
+    return 0;
+}
+
+/* Turn *slot into a group pre-filled with its current value */
+static uint32_t lpm_extend(lpm_t *lpm, uint16_t *slot)
+{
+    if (*slot & LPM_EXT) {
+        return *slot & ~LPM_EXT;
+    }
+
+    uint32_t group = lpm->num_groups++;
+    for (int i = 0; i < 256; i++) {
+        lpm->groups[group][i] = *slot;
+    }
+    *slot = (uint16_t)(LPM_EXT | group);
+    return group;
+}
+
+static uint16_t lpm_fill(uint16_t *table, uint32_t start, uint32_t count,
+                         uint16_t value)
+{
+    uint16_t previous = table[start];
+
+    for (uint32_t i = 0; i < count; i++) {
+        table[start + i] = value;
+    }
+    return previous;
+}
+
+int lpm_add(lpm_t *lpm, uint32_t prefix, uint8_t depth, uint16_t value)
+{
+    if (depth > 32 || value == 0 || value > LPM_VALUE_MAX) {
+        return -1;
+    }
+
+    if (depth < 32) {
+        prefix &= ~(0xffffffffU >> depth);
+    }
+
+    if (depth <= 16) {
+        return lpm_fill(lpm->tbl16, prefix >> 16, 1U << (16 - depth), value);
+    }
+
+    if (lpm_reserve(lpm, 2) < 0) {
+        return -1;
+    }
+
+    uint32_t group = lpm_extend(lpm, &lpm->tbl16[prefix >> 16]);
+
+    if (depth <= 24) {
+        return lpm_fill(lpm->groups[group], (prefix >> 8) & 0xff,
+                        1U << (24 - depth), value);
+    }
+
+    uint32_t sub = lpm_extend(lpm, &lpm->groups[group][(prefix >> 8) & 0xff]);
+
+    return lpm_fill(lpm->groups[sub], prefix & 0xff, 1U << (32 - depth), value);
+}
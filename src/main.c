@@ -2,12 +2,36 @@
 #include <unistd.h>
 #include <uk/sched.h>
 #include "lwip/netif.h"
+#include "lwip/sys.h"
 #include "loom/capture.h"
+#include "loom/classify.h"
 #include "loom/control.h"
 #include "loom/nf_chain.h"
+#include "loom/nf_conntrack.h"
+#include "loom/nf_synproxy.h"
+#include "loom/sampler.h"
+#include "loom/flow_export.h"
 #include "loom/demo_server.h"
+#include "loom/event_log.h"
+#include "loom/fastpath.h"
+#include "loom/mempool.h"
+#include "loom/stats_export.h"
 
 #define CONTROL_PORT 9000
+#define DEMO_PORT 9001
+#define CONTROL_BIN_PORT 9002
+#define STATS_HTTP_PORT 9100
+#define SAMPLER_PORT 9003
+#ifdef CONFIG_APPLOOM_CONNTRACK_CAPACITY
+#define CONNTRACK_CAPACITY CONFIG_APPLOOM_CONNTRACK_CAPACITY
+#else
+#define CONNTRACK_CAPACITY CONNTRACK_DEFAULT_CAPACITY
+#endif
+#ifdef CONFIG_APPLOOM_FLOW_CAPACITY
+#define FLOW_CAPACITY CONFIG_APPLOOM_FLOW_CAPACITY
+#else
+#define FLOW_CAPACITY FLOW_DEFAULT_CAPACITY
+#endif
 
 int main(void)
 {
@@ -39,26 +63,90 @@ int main(void)
     printf("[NET] Gateway:    %s\n", gw_str);
     printf("[NET] ====================================\n\n");
 
+    /* Everything the data path allocates comes out of this */
+    if (mem_arena_init(LOOM_ARENA_SIZE) < 0) {
+        printf("[ERROR] Failed to reserve memory arena\n");
+        return -1;
+    }
+
+    event_log_init();
+
+    if (nf_conntrack_init(CONNTRACK_CAPACITY) < 0) {
+        printf("[WARN] Connection tracking disabled\n");
+    }
+
+#ifdef CONFIG_APPLOOM_CLASSIFY_SIMD
+    classify_init(true);
+#else
+    classify_init(false);
+#endif
     nf_chain_init();
 
     if (capture_hook_init(netif, CONTROL_PORT) < 0) {
         printf("[ERROR] Failed to initialize capture hook\n");
         return -1;
     }
+    capture_add_control_port(CONTROL_BIN_PORT);
+    capture_add_control_port(STATS_HTTP_PORT);
+    capture_add_control_port(SAMPLER_PORT);
+
+    /* Every port lwIP listens on gets SYN cookies */
+    if (nf_synproxy_init(netif, SYNPROXY_DEFAULT_CAPACITY) == 0) {
+        nf_synproxy_protect(CONTROL_PORT, true);
+        nf_synproxy_protect(DEMO_PORT, true);
+        nf_synproxy_protect(CONTROL_BIN_PORT, true);
+        nf_synproxy_protect(STATS_HTTP_PORT, true);
+        nf_synproxy_protect(SAMPLER_PORT, true);
+        nf_synproxy_set_enabled(true);
+    } else {
+        printf("[WARN] SYN proxy disabled\n");
+    }
+
+    /* After the SYN proxy: conntrack must see lwIP's output before it does */
+    if (nf_conntrack_attach(netif) < 0) {
+        printf("[WARN] Conntrack sees ingress only\n");
+    }
+
+    /* Optional: only when a second NIC was left for us by the lwIP glue */
+    if (fastpath_init(netif, CONTROL_PORT, 0) == 0) {
+        fastpath_add_control_port(CONTROL_BIN_PORT);
+        fastpath_add_control_port(STATS_HTTP_PORT);
+        fastpath_add_control_port(SAMPLER_PORT);
+        fastpath_add_local_port(DEMO_PORT);
+    }
 
     if (control_server_init(CONTROL_PORT) < 0) {
         printf("[ERROR] Failed to initialize control server\n");
         return -1;
     }
 
-    demo_server_init(9001);
+    if (control_bin_server_init(CONTROL_BIN_PORT) < 0) {
+        printf("[WARN] Binary control protocol unavailable\n");
+    }
+
+    if (stats_http_init(STATS_HTTP_PORT) < 0) {
+        printf("[WARN] Stats endpoint unavailable\n");
+    }
+
+    if (sampler_init(SAMPLER_PORT) < 0) {
+        printf("[WARN] Packet sampling unavailable\n");
+    }
+
+    if (flow_export_init(FLOW_CAPACITY) < 0) {
+        printf("[WARN] Flow export unavailable\n");
+    }
+
+    demo_server_init(DEMO_PORT);
 
     printf("\n====================================\n");
     printf("  System Ready!\n");
     printf("====================================\n\n");
 
+    /* With a fast path this thread becomes its first polling worker */
+    fastpath_run();
+
     while (1) {
-        uk_sched_yield();
+        sys_msleep(1000);
     }
 
     return 0;
@@ -0,0 +1,188 @@
+#include "loom/mempool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if !defined(__Unikraft__)
+#include <sys/mman.h>
+#endif
+
+#define MEM_CACHE_LINE 64
+
+typedef struct {
+    const char *name;
+    size_t size;
+    mempool_t *pool;            /* NULL for plain reservations */
+} mem_region_t;
+
+static uint8_t *arena = NULL;
+static size_t arena_size = 0;
+static size_t arena_used = 0;
+static bool arena_huge = false;
+
+static mem_region_t regions[MEM_MAX_REGIONS];
+static int num_regions = 0;
+static mempool_t pools[MEM_MAX_REGIONS];
+static int num_pools = 0;
+
+int mem_arena_init(size_t size)
+{
+    void *mem = NULL;
+
+    if (arena) {
+        printf("[MEM] ERROR: Arena already initialized\n");
+        return -1;
+    }
+
+    size = (size + MEM_ARENA_ALIGN - 1) & ~(MEM_ARENA_ALIGN - 1);
+    if (posix_memalign(&mem, MEM_ARENA_ALIGN, size) != 0) {
+        printf("[MEM] ERROR: Failed to reserve %zu MiB arena\n", size >> 20);
+        return -1;
+    }
+
+#if !defined(__Unikraft__) && defined(MADV_HUGEPAGE)
+    arena_huge = madvise(mem, size, MADV_HUGEPAGE) == 0;
+#endif
+
+    /* Touch every page now rather than on the first packet */
+    memset(mem, 0, size);
+
+    arena = (uint8_t *)mem;
+    arena_size = size;
+    arena_used = 0;
+
+    printf("[MEM] Arena: %zu MiB%s\n", size >> 20,
+           arena_huge ? " (huge pages)" : "");
+    return 0;
+}
+
+static void *mem_carve(const char *name, size_t size, mempool_t *pool)
+{
+    size = (size + MEM_CACHE_LINE - 1) & ~(size_t)(MEM_CACHE_LINE - 1);
+
+    if (!arena || num_regions == MEM_MAX_REGIONS ||
+        size > arena_size - arena_used) {
+        printf("[MEM] ERROR: No room for %s (%zu KiB, %zu KiB free)\n",
+               name, size >> 10, arena ? (arena_size - arena_used) >> 10 : 0);
+        return NULL;
+    }
+
+    void *mem = arena + arena_used;
+    arena_used += size;
+
+    mem_region_t *region = &regions[num_regions++];
+    region->name = name;
+    region->size = size;
+    region->pool = pool;
+    return mem;
+}
+
+void *mem_reserve(const char *name, size_t size)
+{
+    return mem_carve(name, size, NULL);
+}
+
+mempool_t *mempool_create(const char *name, size_t obj_size, uint32_t count)
+{
+    if (num_pools == MEM_MAX_REGIONS || count == 0) {
+        return NULL;
+    }
+
+    /* Room for the free list link, and no false sharing between objects */
+    if (obj_size < sizeof(uint32_t)) {
+        obj_size = sizeof(uint32_t);
+    }
+    obj_size = (obj_size + MEM_CACHE_LINE - 1) & ~(size_t)(MEM_CACHE_LINE - 1);
+
+    mempool_t *pool = &pools[num_pools];
+    uint8_t *base = mem_carve(name, obj_size * count, pool);
+    if (!base) {
+        return NULL;
+    }
+    num_pools++;
+
+    memset(pool, 0, sizeof(*pool));
+    pool->name = name;
+    pool->base = base;
+    pool->obj_size = obj_size;
+    pool->capacity = count;
+
+    for (uint32_t i = 0; i < count; i++) {
+        *(uint32_t *)(base + (size_t)i * obj_size) = (i + 1 < count) ? i + 2 : 0;
+    }
+    pool->free_head = 1;
+
+    printf("[MEM] Pool %s: %u x %zu B\n", name, count, obj_size);
+    return pool;
+}
+
+int mempool_get_stats(int index, mempool_t *out)
+{
+    if (index < 0 || index >= num_pools) {
+        return -1;
+    }
+
+    const mempool_t *pool = &pools[index];
+    *out = *pool;
+    out->in_use = __atomic_load_n(&pool->in_use, __ATOMIC_RELAXED);
+    out->allocs = __atomic_load_n(&pool->allocs, __ATOMIC_RELAXED);
+    out->failed = __atomic_load_n(&pool->failed, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void mem_arena_usage(size_t *used, size_t *size)
+{
+    *used = arena_used;
+    *size = arena_size;
+}
+
+int mem_format_stats(char *buf, size_t len)
+{
+    size_t used = 0;
+    int n;
+
+#define MEM_STATS_APPEND(...) \
+    do { \
+        n = snprintf(buf + used, len - used, __VA_ARGS__); \
+        if (n < 0 || (size_t)n >= len - used) { \
+            goto out; \
+        } \
+        used += n; \
+    } while (0)
+
+    if (len == 0) {
+        return 0;
+    }
+    buf[0] = '\0';
+
+    MEM_STATS_APPEND("\n=== Memory ===\n");
+    MEM_STATS_APPEND("Arena: %zu KiB used of %zu KiB%s\n",
+                     arena_used >> 10, arena_size >> 10,
+                     arena_huge ? " (huge pages)" : "");
+
+    for (int i = 0; i < num_regions; i++) {
+        const mem_region_t *region = &regions[i];
+        const mempool_t *pool = region->pool;
+
+        if (!pool) {
+            MEM_STATS_APPEND("%-12s %8zu KiB reserved\n",
+                             region->name, region->size >> 10);
+            continue;
+        }
+
+        MEM_STATS_APPEND("%-12s %8zu KiB, %u x %zu B: in use %u, peak %u, "
+                         "allocs %llu, failed %llu\n",
+                         region->name, region->size >> 10,
+                         pool->capacity, pool->obj_size,
+                         __atomic_load_n(&pool->in_use, __ATOMIC_RELAXED),
+                         pool->peak,
+                         (unsigned long long)pool->allocs,
+                         (unsigned long long)pool->failed);
+    }
+
+    MEM_STATS_APPEND("==============\n");
+
+#undef MEM_STATS_APPEND
+
+out:
+    return (int)used;
+}
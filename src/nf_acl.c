@@ -0,0 +1,311 @@
+#include "loom/nf_acl.h"
+#include "loom/lpm.h"
+#include "loom/rcu.h"
+#include "loom/event_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lwip/def.h"
+#include "lwip/sys.h"
+
+/* Compiled rule, parent is the next less specific rule index + 1 */
+typedef struct {
+    acl_rule_t rule;
+    uint16_t parent;
+} acl_entry_t;
+
+typedef struct {
+    lpm_t src;
+    lpm_t dst;
+    uint32_t num_rules;
+    acl_entry_t entries[];
+} acl_table_t;
+
+static acl_table_t *active_table = NULL;
+static uint8_t default_action = ACL_ALLOW;
+
+/* Control-plane staging area, guarded by acl_lock */
+static acl_rule_t *staged = NULL;
+static uint32_t num_staged = 0;
+static uint32_t max_staged = 0;
+static sys_mutex_t acl_lock;
+
+void nf_acl_init(void)
+{
+    if (sys_mutex_new(&acl_lock) != ERR_OK) {
+        printf("[ACL] ERROR: Failed to create ACL lock\n");
+    }
+    active_table = NULL;
+    default_action = ACL_ALLOW;
+}
+
+static inline bool acl_rule_matches(const acl_rule_t *rule, const pkt_meta_t *meta)
+{
+    if (rule->proto != 0 && rule->proto != meta->proto) {
+        return false;
+    }
+    if (rule->port_lo == 0 && rule->port_hi == 0xffff) {
+        return true;
+    }
+    return (meta->flags & PKT_F_L4) &&
+           meta->dst_port >= rule->port_lo && meta->dst_port <= rule->port_hi;
+}
+
+/* Returns the index of the deciding rule + 1, or 0 for the default */
+static inline uint16_t acl_walk(const acl_table_t *table, uint16_t index,
+                                const pkt_meta_t *meta)
+{
+    while (index != 0) {
+        const acl_entry_t *entry = &table->entries[index - 1];
+        if (acl_rule_matches(&entry->rule, meta)) {
+            return index;
+        }
+        index = entry->parent;
+    }
+    return 0;
+}
+
+/* With no committed table every packet gets the default action */
+static inline bool acl_check(const acl_table_t *table, const pkt_meta_t *meta)
+{
+    uint16_t index = 0;
+
+    if (table) {
+        index = acl_walk(table, lpm_lookup(&table->src, lwip_ntohl(meta->src_ip)), meta);
+        if (index == 0) {
+            index = acl_walk(table, lpm_lookup(&table->dst, lwip_ntohl(meta->dst_ip)), meta);
+        }
+    }
+
+    uint8_t action = index ? table->entries[index - 1].rule.action : default_action;
+    if (action == ACL_DENY) {
+        event_log_record(EVENT_DROP_ACL, NULL, 0, index);
+        return false;
+    }
+    return true;
+}
+
+bool nf_acl(struct pbuf *p, pkt_meta_t *meta)
+{
+    if (!(meta->flags & PKT_F_IPV4)) {
+        return true;
+    }
+
+    bool allow = true;
+    unsigned int epoch = rcu_read_lock();
+    const acl_table_t *table = rcu_dereference(active_table);
+
+    if (table || default_action == ACL_DENY) {
+        allow = acl_check(table, meta);
+    }
+
+    rcu_read_unlock(epoch);
+    return allow;
+}
+
+void nf_acl_batch(struct pbuf **pkts, pkt_meta_t *meta,
+                  uint16_t count, uint64_t *pass_mask)
+{
+    unsigned int epoch = rcu_read_lock();
+    const acl_table_t *table = rcu_dereference(active_table);
+
+    if (table || default_action == ACL_DENY) {
+        uint64_t todo = *pass_mask;
+
+        while (todo) {
+            int i = __builtin_ctzll(todo);
+            todo &= todo - 1;
+
+            if ((meta[i].flags & PKT_F_IPV4) && !acl_check(table, &meta[i])) {
+                *pass_mask &= ~(1ULL << i);
+            }
+        }
+    }
+
+    rcu_read_unlock(epoch);
+}
+
+static bool acl_rule_valid(const acl_rule_t *rule)
+{
+    return rule->depth <= 32 && rule->port_lo <= rule->port_hi;
+}
+
+int nf_acl_stage_add(const acl_rule_t *rule)
+{
+    if (!acl_rule_valid(rule)) {
+        return -1;
+    }
+
+    sys_mutex_lock(&acl_lock);
+
+    if (num_staged >= ACL_MAX_RULES) {
+        sys_mutex_unlock(&acl_lock);
+        printf("[ACL] ERROR: Max rules reached\n");
+        return -1;
+    }
+
+    if (num_staged == max_staged) {
+        uint32_t max = max_staged ? max_staged * 2 : 256;
+        acl_rule_t *rules = realloc(staged, max * sizeof(*rules));
+        if (!rules) {
+            sys_mutex_unlock(&acl_lock);
+            printf("[ACL] ERROR: Failed to allocate memory for rules\n");
+            return -1;
+        }
+        staged = rules;
+        max_staged = max;
+    }
+
+    staged[num_staged++] = *rule;
+    sys_mutex_unlock(&acl_lock);
+    return 0;
+}
+
+void nf_acl_stage_clear(void)
+{
+    sys_mutex_lock(&acl_lock);
+    num_staged = 0;
+    sys_mutex_unlock(&acl_lock);
+}
+
+/* Ascending prefix length, insertion order among equal lengths */
+static int acl_depth_cmp(const void *a, const void *b)
+{
+    const acl_entry_t *x = a;
+    const acl_entry_t *y = b;
+
+    if (x->rule.depth != y->rule.depth) {
+        return (int)x->rule.depth - (int)y->rule.depth;
+    }
+    return (int)x->parent - (int)y->parent;
+}
+
+static void acl_table_free(acl_table_t *table)
+{
+    if (table) {
+        lpm_free(&table->src);
+        lpm_free(&table->dst);
+        free(table);
+    }
+}
+
+/* Compiles rules, in priority order, and swaps them in; acl_lock held */
+static int acl_install(const acl_rule_t *rules, uint32_t count)
+{
+    acl_table_t *table = NULL;
+
+    if (count > 0) {
+        table = malloc(sizeof(acl_table_t) + count * sizeof(acl_entry_t));
+        if (!table) {
+            printf("[ACL] ERROR: Failed to allocate memory for table\n");
+            return -1;
+        }
+
+        lpm_init(&table->src);
+        lpm_init(&table->dst);
+        table->num_rules = count;
+
+        /* parent temporarily holds the staging order for a stable sort */
+        for (uint32_t i = 0; i < count; i++) {
+            table->entries[i].rule = rules[i];
+            table->entries[i].parent = (uint16_t)i;
+        }
+        qsort(table->entries, count, sizeof(acl_entry_t), acl_depth_cmp);
+
+        for (uint32_t i = 0; i < count; i++) {
+            acl_entry_t *entry = &table->entries[i];
+            lpm_t *lpm = (entry->rule.match == ACL_MATCH_DST) ? &table->dst
+                                                              : &table->src;
+            int parent = lpm_add(lpm, entry->rule.prefix, entry->rule.depth,
+                                 (uint16_t)(i + 1));
+            if (parent < 0) {
+                acl_table_free(table);
+                printf("[ACL] ERROR: Lookup table exhausted at rule %u\n", i);
+                return -1;
+            }
+            entry->parent = (uint16_t)parent;
+        }
+    }
+
+    acl_table_t *old = active_table;
+    rcu_assign_pointer(active_table, table);
+    rcu_synchronize();
+    acl_table_free(old);
+
+    printf("[ACL] Committed %u rule(s)\n", count);
+    return 0;
+}
+
+int nf_acl_commit(void)
+{
+    sys_mutex_lock(&acl_lock);
+    int ret = acl_install(staged, num_staged);
+    sys_mutex_unlock(&acl_lock);
+    return ret;
+}
+
+int nf_acl_commit_rules(const acl_rule_t *rules, uint32_t count, bool replace)
+{
+    sys_mutex_lock(&acl_lock);
+
+    /* The active table is already in priority order, new rules go last */
+    uint32_t base = (!replace && active_table) ? active_table->num_rules : 0;
+    acl_rule_t *all = NULL;
+    int ret = -1;
+
+    if (base + count > ACL_MAX_RULES) {
+        printf("[ACL] ERROR: Max rules reached\n");
+        goto out;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (!acl_rule_valid(&rules[i])) {
+            goto out;
+        }
+    }
+
+    if (base + count > 0) {
+        all = malloc((base + count) * sizeof(*all));
+        if (!all) {
+            printf("[ACL] ERROR: Failed to allocate memory for rules\n");
+            goto out;
+        }
+    }
+    for (uint32_t i = 0; i < base; i++) {
+        all[i] = active_table->entries[i].rule;
+    }
+    if (count > 0) {
+        memcpy(all + base, rules, count * sizeof(*all));
+    }
+
+    ret = acl_install(all, base + count);
+
+out:
+    sys_mutex_unlock(&acl_lock);
+    free(all);
+    return ret;
+}
+
+void nf_acl_set_default(acl_action_t action)
+{
+    default_action = (uint8_t)action;
+    printf("[ACL] Default action: %s\n", action == ACL_DENY ? "deny" : "allow");
+}
+
+acl_action_t nf_acl_get_default(void)
+{
+    return (acl_action_t)default_action;
+}
+
+uint32_t nf_acl_active_rules(void)
+{
+    unsigned int epoch = rcu_read_lock();
+    const acl_table_t *table = rcu_dereference(active_table);
+    uint32_t count = table ? table->num_rules : 0;
+    rcu_read_unlock(epoch);
+    return count;
+}
+
+uint32_t nf_acl_staged_rules(void)
+{
+    return num_staged;
+}
@@ -1,123 +1,577 @@
 #include "loom/nf_chain.h"
+#include "loom/classify.h"
+#include "loom/nf_conntrack.h"
+#include "loom/nf_src_limiter.h"
+#include "loom/nf_acl.h"
+#include "loom/nf_synproxy.h"
+#include "loom/rcu.h"
+#include "loom/clock.h"
+#include "loom/event_log.h"
+#include "loom/mempool.h"
+#include "loom/worker.h"
 #include <stdio.h>
 #include <string.h>
-#include <stdlib.h>
-#include <time.h>
-#include "lwip/prot/ethernet.h"
-#include "lwip/prot/ip4.h"
-#include "lwip/prot/tcp.h"
+#include "lwip/sys.h"
+#include "lwip/prot/ip.h"
 
-static nf_node_t *chain_head = NULL;
+#ifdef CONFIG_APPLOOM_POOL_CHAINS
+#define NF_CHAIN_POOL_SIZE CONFIG_APPLOOM_POOL_CHAINS
+#else
+#define NF_CHAIN_POOL_SIZE 4
+#endif
 
-#define MAX_RATE_LIMITS 32
+/*
+ * The control plane edits nodes[] under chain_lock and then publishes a
+ * fresh, compact nf_chain_t holding only the enabled NFs. The data path
+ * only ever sees active_chain, which is swapped with a single pointer store;
+ * the previous version goes back to chain_pool after an RCU grace period.
+ */
+static nf_node_t nodes[NF_CHAIN_MAX];
+static int num_nodes = 0;
+static sys_mutex_t chain_lock;
 
+/* One row per NF, one block per worker; nodes and entries point at [0] */
+static nf_stats_t nf_stats[NF_CHAIN_MAX][LOOM_MAX_WORKERS];
+static bool nf_stats_used[NF_CHAIN_MAX];
+
+static const nf_chain_t empty_chain = { .count = 0 };
+static const nf_chain_t *active_chain = &empty_chain;
+static mempool_t *chain_pool = NULL;
+
+/* One worker's share of a limit */
+typedef struct {
+    uint64_t rate;
+    uint64_t capacity;      /* burst share * LOOM_NSEC_PER_SEC */
+    uint64_t fill_ns;       /* time to refill an empty bucket */
+} rate_share_t;
+
+/*
+ * The control plane never touches the buckets. It writes the shares under
+ * gen, a per-slot sequence count that is odd while they change, and each
+ * worker copies its own share into its bucket when it sees a new even gen.
+ * gen keeps counting across reuse of the slot; buckets last applied before
+ * created_gen belong to a removed limit and start full.
+ */
 typedef struct {
     uint16_t port;
-    uint32_t limit;
-    uint32_t count;
-    time_t last_reset;
+    bool in_use;
+    rate_limit_mode_t mode;
+    uint32_t rate;
+    uint32_t burst;
+    uint64_t gen;
+    uint64_t created_gen;
+    rate_share_t shares[LOOM_MAX_WORKERS];
 } rate_limit_t;
 
+/*
+ * Token bucket per port and worker. The configured rate and burst are split
+ * across the workers so each one only ever writes its own bucket. Tokens
+ * are kept in units * LOOM_NSEC_PER_SEC so refilling is a single multiply
+ * of the elapsed nanoseconds by the rate.
+ */
+typedef struct {
+    uint64_t rate;          /* this worker's share */
+    uint64_t capacity;      /* burst share * LOOM_NSEC_PER_SEC */
+    uint64_t fill_ns;       /* time to refill an empty bucket */
+    uint64_t tokens;
+    uint64_t last_ns;
+    uint64_t gen;           /* rate_limit_t gen last applied */
+    bool bps;
+} rate_bucket_t;
+
 static rate_limit_t rate_limits[MAX_RATE_LIMITS];
 static int num_rate_limits = 0;
 
-#define MAX_ALLOWED_PORTS 64
+static rate_bucket_t rate_buckets[LOOM_MAX_WORKERS][MAX_RATE_LIMITS]
+    __attribute__((aligned(64)));
+
+/* Direct port -> slot index (slot + 1, 0 means no limit) */
+static uint8_t rate_limit_slot[65536];
+
+/* One bit per port, [0] for TCP and [1] for UDP (8 KiB each) */
+#define ALLOW_WORDS (65536 / 64)
+
+/* Runs shown by ALLOW LIST, the rest is only counted */
+#define ALLOW_FORMAT_MAX_RANGES 256
+
+typedef struct {
+    uint32_t num_ports;
+    uint64_t bitmap[2][ALLOW_WORDS];
+} allowlist_t;
+
+/*
+ * Double buffered: edits go to the table that is not active_allowlist and
+ * are published with one pointer swap, so a rule set never shows up half
+ * applied. After the grace period the old table becomes the staging one.
+ */
+static allowlist_t allow_tables[2];
+static allowlist_t *active_allowlist = &allow_tables[0];
+static allowlist_t *staged_allowlist = &allow_tables[1];
+
+#ifdef LOOM_STATIC_CHAIN
+/*
+ * Build-time chain (CONFIG_APPLOOM_STATIC_CHAIN_SPEC). A published chain
+ * whose entries are exactly these NFs, in this order, is run by the
+ * straight-line expansion below instead of the loop over entries.
+ */
+#define NF_STATIC_ENTRY(nf) { nf_##nf, nf_##nf##_batch },
+
+static const struct {
+    nf_func_t func;
+    nf_batch_func_t batch_func;
+} static_chain[] = { LOOM_STATIC_CHAIN(NF_STATIC_ENTRY) };
 
-static uint16_t allowed_ports[MAX_ALLOWED_PORTS];
-static int num_allowed_ports = 0;
+#undef NF_STATIC_ENTRY
+
+#define NF_STATIC_COUNT (sizeof(static_chain) / sizeof(static_chain[0]))
+
+static bool nf_chain_matches_static(const nf_chain_t *chain)
+{
+    if (chain->count != NF_STATIC_COUNT) {
+        return false;
+    }
+
+    for (uint16_t i = 0; i < chain->count; i++) {
+        if (chain->entries[i].func != static_chain[i].func ||
+            chain->entries[i].batch_func != static_chain[i].batch_func) {
+            return false;
+        }
+    }
+    return true;
+}
+#else
+static bool nf_chain_matches_static(const nf_chain_t *chain)
+{
+    return false;
+}
+#endif
 
 void nf_chain_init(void)
 {
     printf("[NF_CHAIN] Initializing NF chain\n");
-    chain_head = NULL;
+
+    if (sys_mutex_new(&chain_lock) != ERR_OK) {
+        printf("[NF_CHAIN] ERROR: Failed to create chain lock\n");
+    }
+    num_nodes = 0;
+
+    /* Chains are sized for NF_CHAIN_MAX entries, at most two are live */
+    chain_pool = mempool_create("nf_chain", sizeof(nf_chain_t) +
+                                NF_CHAIN_MAX * sizeof(nf_entry_t),
+                                NF_CHAIN_POOL_SIZE);
     
     memset(rate_limits, 0, sizeof(rate_limits));
+    memset(rate_limit_slot, 0, sizeof(rate_limit_slot));
+    memset(rate_buckets, 0, sizeof(rate_buckets));
     num_rate_limits = 0;
     
-    memset(allowed_ports, 0, sizeof(allowed_ports));
-    num_allowed_ports = 0;
+    memset(allow_tables, 0, sizeof(allow_tables));
+    active_allowlist = &allow_tables[0];
+    staged_allowlist = &allow_tables[1];
     
-    nf_chain_add("rate_limiter", nf_rate_limiter);
-    nf_chain_add("allowlist", nf_allowlist);
+    nf_src_limiter_init();
+    nf_acl_init();
+
+#ifdef LOOM_STATIC_CHAIN
+#define NF_STATIC_REGISTER(nf) nf_chain_add_batch(#nf, nf_##nf, nf_##nf##_batch);
+    LOOM_STATIC_CHAIN(NF_STATIC_REGISTER)
+#undef NF_STATIC_REGISTER
+
+    printf("[NF_CHAIN] Build-time chain registered (%s)\n",
+           nf_chain_is_specialized() ? "specialized" : "dynamic");
+#else
+    nf_chain_add_batch("acl", nf_acl, nf_acl_batch);
+    nf_chain_add_batch("conntrack", nf_conntrack, nf_conntrack_batch);
+    nf_chain_add_batch("src_limiter", nf_src_limiter, nf_src_limiter_batch);
+    nf_chain_add_batch("rate_limiter", nf_rate_limiter, nf_rate_limiter_batch);
+    nf_chain_add_batch("allowlist", nf_allowlist, nf_allowlist_batch);
+    /* Last: it hands lwIP rebuilt SYNs, so everything else must have passed */
+    nf_chain_add_batch("synproxy", nf_synproxy, nf_synproxy_batch);
     
     printf("[NF_CHAIN] Default NFs registered\n");
+#endif
 }
 
-bool nf_chain_process(struct pbuf *p)
+/* Must be called with chain_lock held */
+static int nf_chain_publish(void)
 {
-    nf_node_t *current = chain_head;
-    
-    while (current != NULL) {
-        if (current->enabled) {
-            if (!current->func(p)) {
-                printf("[NF_CHAIN] Packet dropped by NF: %s\n", current->name);
-                return false;
+    nf_chain_t *chain = chain_pool ? (nf_chain_t *)mempool_get(chain_pool) : NULL;
+    if (!chain) {
+        printf("[NF_CHAIN] ERROR: Failed to allocate memory for chain\n");
+        return -1;
+    }
+
+    chain->count = 0;
+    for (int i = 0; i < num_nodes; i++) {
+        if (nodes[i].enabled) {
+            nf_entry_t *entry = &chain->entries[chain->count++];
+            entry->name = nodes[i].name;
+            entry->func = nodes[i].func;
+            entry->batch_func = nodes[i].batch_func;
+            entry->stats = nodes[i].stats;
+            entry->drop_reason = nodes[i].drop_reason;
+        }
+    }
+    chain->specialized = nf_chain_matches_static(chain);
+
+    const nf_chain_t *old = active_chain;
+    rcu_assign_pointer(active_chain, (const nf_chain_t *)chain);
+    rcu_synchronize();
+
+    if (old != &empty_chain) {
+        mempool_put(chain_pool, (void *)old);
+    }
+    return 0;
+}
+
+static nf_stats_t *nf_stats_alloc(void)
+{
+    for (int i = 0; i < NF_CHAIN_MAX; i++) {
+        if (!nf_stats_used[i]) {
+            nf_stats_used[i] = true;
+            memset(nf_stats[i], 0, sizeof(nf_stats[i]));
+            return nf_stats[i];
+        }
+    }
+    return NULL;
+}
+
+/* Only once no published chain references the block any more */
+static void nf_stats_free(nf_stats_t *stats)
+{
+    nf_stats_used[(stats - &nf_stats[0][0]) / LOOM_MAX_WORKERS] = false;
+}
+
+static void nf_stats_merge(const nf_stats_t *shards, nf_stats_t *out)
+{
+    memset(out, 0, sizeof(*out));
+
+    for (int w = 0; w < LOOM_MAX_WORKERS; w++) {
+        const nf_stats_t *s = &shards[w];
+        out->packets_in += s->packets_in;
+        out->packets_dropped += s->packets_dropped;
+        out->invocations += s->invocations;
+        out->cycles += s->cycles;
+        for (int b = 0; b < NF_HIST_BUCKETS; b++) {
+            out->cycles_hist[b] += s->cycles_hist[b];
+        }
+    }
+}
+
+/* Packets dropped by reason, one line per worker */
+typedef struct {
+    uint64_t packets[PKT_DROP_MAX];
+} __attribute__((aligned(64))) nf_drop_counts_t;
+
+static nf_drop_counts_t drop_counts[LOOM_MAX_WORKERS];
+
+void nf_chain_count_drops(pkt_drop_t reason, uint32_t packets)
+{
+    drop_counts[loom_worker()].packets[reason] += packets;
+}
+
+void nf_chain_get_drops(uint64_t out[PKT_DROP_MAX])
+{
+    memset(out, 0, PKT_DROP_MAX * sizeof(uint64_t));
+
+    for (int w = 0; w < LOOM_MAX_WORKERS; w++) {
+        for (int r = 0; r < PKT_DROP_MAX; r++) {
+            out[r] += __atomic_load_n(&drop_counts[w].packets[r], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static inline void nf_stats_account(nf_stats_t *stats, uint64_t cycles,
+                                    uint32_t in, uint32_t dropped)
+{
+    int bucket = 63 - __builtin_clzll(cycles | 1);
+    if (bucket >= NF_HIST_BUCKETS) {
+        bucket = NF_HIST_BUCKETS - 1;
+    }
+
+    stats += loom_worker();
+    stats->packets_in += in;
+    stats->packets_dropped += dropped;
+    stats->invocations++;
+    stats->cycles += cycles;
+    stats->cycles_hist[bucket]++;
+}
+
+static int nf_chain_find(const char *name)
+{
+    for (int i = 0; i < num_nodes; i++) {
+        if (strcmp(nodes[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Run one NF and account for it. Always inlined, so that with func and
+ * batch_func passed as constants (the build-time chain) the NF is called
+ * directly rather than through the entry.
+ */
+static inline __attribute__((always_inline))
+bool nf_entry_run(const nf_entry_t *entry, nf_func_t func,
+                  struct pbuf *p, pkt_meta_t *meta)
+{
+    uint64_t start = loom_cycles();
+    bool pass = func(p, meta);
+
+    nf_stats_account(entry->stats, loom_cycles() - start, 1, !pass);
+
+    if (!pass) {
+        meta->drop_reason = entry->drop_reason;
+        nf_chain_count_drops(entry->drop_reason, 1);
+        event_log_record(EVENT_DROP_NF, entry->name, 1, 0);
+    }
+    return pass;
+}
+
+static inline __attribute__((always_inline))
+uint64_t nf_entry_run_batch(const nf_entry_t *entry, nf_func_t func,
+                            nf_batch_func_t batch_func, struct pbuf **pkts,
+                            pkt_meta_t *meta, uint16_t count,
+                            uint64_t pass_mask)
+{
+    uint64_t before = pass_mask;
+    uint64_t start = loom_cycles();
+
+    if (batch_func) {
+        batch_func(pkts, meta, count, &pass_mask);
+    } else {
+        uint64_t todo = pass_mask;
+        while (todo) {
+            int i = __builtin_ctzll(todo);
+            todo &= todo - 1;
+            if (!func(pkts[i], &meta[i])) {
+                pass_mask &= ~(1ULL << i);
             }
         }
-        current = current->next;
     }
-    
+
+    uint64_t drop_mask = before & ~pass_mask;
+    uint32_t dropped = __builtin_popcountll(drop_mask);
+    nf_stats_account(entry->stats, loom_cycles() - start,
+                     __builtin_popcountll(before), dropped);
+
+    if (dropped) {
+        while (drop_mask) {
+            meta[__builtin_ctzll(drop_mask)].drop_reason = entry->drop_reason;
+            drop_mask &= drop_mask - 1;
+        }
+        nf_chain_count_drops(entry->drop_reason, dropped);
+        event_log_record(EVENT_DROP_NF, entry->name, dropped, 0);
+    }
+    return pass_mask;
+}
+
+#ifdef LOOM_STATIC_CHAIN
+/* Straight-line expansions of LOOM_STATIC_CHAIN, entry k is its k'th NF */
+static bool nf_static_process(const nf_chain_t *chain, struct pbuf *p,
+                              pkt_meta_t *meta)
+{
+    const nf_entry_t *entry = chain->entries;
+
+#define NF_STATIC_STEP(nf) \
+    if (!nf_entry_run(entry++, nf_##nf, p, meta)) { \
+        return false; \
+    }
+
+    LOOM_STATIC_CHAIN(NF_STATIC_STEP)
+
+#undef NF_STATIC_STEP
+
     return true;
 }
 
+static uint64_t nf_static_process_batch(const nf_chain_t *chain,
+                                        struct pbuf **pkts, pkt_meta_t *meta,
+                                        uint16_t count, uint64_t pass_mask)
+{
+    const nf_entry_t *entry = chain->entries;
+
+#define NF_STATIC_BATCH_STEP(nf) \
+    if (pass_mask == 0) { \
+        return 0; \
+    } \
+    pass_mask = nf_entry_run_batch(entry++, nf_##nf, nf_##nf##_batch, \
+                                   pkts, meta, count, pass_mask);
+
+    LOOM_STATIC_CHAIN(NF_STATIC_BATCH_STEP)
+
+#undef NF_STATIC_BATCH_STEP
+
+    return pass_mask;
+}
+#else
+/* Never reached: without a build-time chain nothing is specialized */
+static inline bool nf_static_process(const nf_chain_t *chain, struct pbuf *p,
+                                     pkt_meta_t *meta)
+{
+    return true;
+}
+
+static inline uint64_t nf_static_process_batch(const nf_chain_t *chain,
+                                               struct pbuf **pkts,
+                                               pkt_meta_t *meta,
+                                               uint16_t count,
+                                               uint64_t pass_mask)
+{
+    return pass_mask;
+}
+#endif
+
+bool nf_chain_process(struct pbuf *p, pkt_meta_t *meta)
+{
+    bool allow = true;
+    unsigned int epoch = rcu_read_lock();
+    const nf_chain_t *chain = rcu_dereference(active_chain);
+
+    if (chain->specialized) {
+        allow = nf_static_process(chain, p, meta);
+    } else {
+        for (uint16_t i = 0; i < chain->count; i++) {
+            const nf_entry_t *entry = &chain->entries[i];
+            if (!nf_entry_run(entry, entry->func, p, meta)) {
+                allow = false;
+                break;
+            }
+        }
+    }
+
+    if (allow && (meta->flags & PKT_F_CT_NEW)) {
+        nf_conntrack_confirm(meta);
+    }
+
+    rcu_read_unlock(epoch);
+    return allow;
+}
+
+uint64_t nf_chain_process_batch(struct pbuf **pkts, pkt_meta_t *meta,
+                                uint16_t count)
+{
+    uint64_t pass_mask = (count >= NF_BATCH_MAX) ? ~0ULL : (1ULL << count) - 1;
+    unsigned int epoch = rcu_read_lock();
+    const nf_chain_t *chain = rcu_dereference(active_chain);
+
+    if (chain->specialized) {
+        pass_mask = nf_static_process_batch(chain, pkts, meta, count, pass_mask);
+    } else {
+        for (uint16_t n = 0; n < chain->count && pass_mask != 0; n++) {
+            const nf_entry_t *entry = &chain->entries[n];
+            pass_mask = nf_entry_run_batch(entry, entry->func, entry->batch_func,
+                                           pkts, meta, count, pass_mask);
+        }
+    }
+
+    nf_conntrack_confirm_batch(meta, pass_mask);
+
+    rcu_read_unlock(epoch);
+    return pass_mask;
+}
+
+bool nf_chain_is_specialized(void)
+{
+    unsigned int epoch = rcu_read_lock();
+    bool specialized = rcu_dereference(active_chain)->specialized;
+    rcu_read_unlock(epoch);
+    return specialized;
+}
+
+/* Built-in NFs have their own code, anything else is PKT_DROP_OTHER */
+static uint8_t nf_drop_reason(const char *name)
+{
+    for (int r = PKT_DROP_NONE + 1; r < PKT_DROP_OTHER; r++) {
+        if (strcmp(name, pkt_drop_name(r)) == 0) {
+            return r;
+        }
+    }
+    return PKT_DROP_OTHER;
+}
+
 int nf_chain_add(const char *name, nf_func_t func)
+{
+    return nf_chain_add_batch(name, func, NULL);
+}
+
+int nf_chain_add_batch(const char *name, nf_func_t func,
+                       nf_batch_func_t batch_func)
 {
     if (!name || !func) {
         return -1;
     }
     
-    nf_node_t *new_node = (nf_node_t *)malloc(sizeof(nf_node_t));
-    if (!new_node) {
-        printf("[NF_CHAIN] ERROR: Failed to allocate memory for NF\n");
+    sys_mutex_lock(&chain_lock);
+
+    if (num_nodes >= NF_CHAIN_MAX) {
+        sys_mutex_unlock(&chain_lock);
+        printf("[NF_CHAIN] ERROR: Max NFs reached\n");
         return -1;
     }
     
-    new_node->name = name;
-    new_node->func = func;
-    new_node->enabled = true;
-    new_node->next = NULL;
-    
-    if (chain_head == NULL) {
-        chain_head = new_node;
-    } else {
-        nf_node_t *current = chain_head;
-        while (current->next != NULL) {
-            current = current->next;
-        }
-        current->next = new_node;
+    nf_stats_t *stats = nf_stats_alloc();
+    if (!stats) {
+        sys_mutex_unlock(&chain_lock);
+        return -1;
     }
+
+    nodes[num_nodes].name = name;
+    nodes[num_nodes].func = func;
+    nodes[num_nodes].batch_func = batch_func;
+    nodes[num_nodes].stats = stats;
+    nodes[num_nodes].drop_reason = nf_drop_reason(name);
+    nodes[num_nodes].enabled = true;
+    num_nodes++;
     
+    if (nf_chain_publish() < 0) {
+        num_nodes--;
+        nf_stats_free(stats);
+        sys_mutex_unlock(&chain_lock);
+        return -1;
+    }
+
+    sys_mutex_unlock(&chain_lock);
     printf("[NF_CHAIN] Added NF: %s\n", name);
     return 0;
 }
 
 int nf_chain_remove(const char *name)
 {
-    if (!name || chain_head == NULL) {
+    if (!name) {
         return -1;
     }
     
-    nf_node_t *current = chain_head;
-    nf_node_t *prev = NULL;
-    
-    while (current != NULL) {
-        if (strcmp(current->name, name) == 0) {
-            if (prev == NULL) {
-                chain_head = current->next;
-            } else {
-                prev->next = current->next;
-            }
-            
-            printf("[NF_CHAIN] Removed NF: %s\n", name);
-            free(current);
-            return 0;
+    sys_mutex_lock(&chain_lock);
+
+    int index = nf_chain_find(name);
+    if (index < 0) {
+        sys_mutex_unlock(&chain_lock);
+        printf("[NF_CHAIN] NF not found: %s\n", name);
+        return -1;
+    }
+
+    nf_node_t removed = nodes[index];
+    for (int i = index; i < num_nodes - 1; i++) {
+        nodes[i] = nodes[i + 1];
+    }
+    num_nodes--;
+
+    if (nf_chain_publish() < 0) {
+        for (int i = num_nodes; i > index; i--) {
+            nodes[i] = nodes[i - 1];
         }
-        prev = current;
-        current = current->next;
+        nodes[index] = removed;
+        num_nodes++;
+        sys_mutex_unlock(&chain_lock);
+        return -1;
     }
-    
-    printf("[NF_CHAIN] NF not found: %s\n", name);
-    return -1;
+
+    nf_stats_free(removed.stats);
+    sys_mutex_unlock(&chain_lock);
+    printf("[NF_CHAIN] Removed NF: %s\n", name);
+    return 0;
 }
 
 int nf_chain_set_enabled(const char *name, bool enabled)
@@ -126,252 +580,759 @@ int nf_chain_set_enabled(const char *name, bool enabled)
         return -1;
     }
     
-    nf_node_t *current = chain_head;
-    
-    while (current != NULL) {
-        if (strcmp(current->name, name) == 0) {
-            current->enabled = enabled;
-            printf("[NF_CHAIN] NF %s: %s\n", name, enabled ? "enabled" : "disabled");
-            return 0;
-        } else {
-            printf("[NF_CHAIN - Testing] current nf name = %s", current->name);
-        }
-        current = current->next;
+    sys_mutex_lock(&chain_lock);
+
+    int index = nf_chain_find(name);
+    if (index < 0) {
+        sys_mutex_unlock(&chain_lock);
+        printf("[NF_CHAIN] NF not found: %s\n", name);
+        return -1;
     }
-    
-    printf("[NF_CHAIN] NF not found: %s\n", name);
-    return -1;
+
+    bool was_enabled = nodes[index].enabled;
+    nodes[index].enabled = enabled;
+
+    if (was_enabled != enabled && nf_chain_publish() < 0) {
+        nodes[index].enabled = was_enabled;
+        sys_mutex_unlock(&chain_lock);
+        return -1;
+    }
+
+    sys_mutex_unlock(&chain_lock);
+    printf("[NF_CHAIN] NF %s: %s\n", name, enabled ? "enabled" : "disabled");
+    return 0;
 }
 
-void nf_chain_list(void)
+int nf_chain_format_list(char *buf, size_t len)
 {
-    printf("\n=== NF Chain ===\n");
-    
-    if (chain_head == NULL) {
-        printf("(empty)\n");
-    } else {
-        nf_node_t *current = chain_head;
-        int index = 0;
-        while (current != NULL) {
-            printf("[%d] %s - %s\n", 
-                   index, 
-                   current->name, 
-                   current->enabled ? "enabled" : "disabled");
-            current = current->next;
-            index++;
+    size_t used = 0;
+    int n;
+
+#define NF_LIST_APPEND(...) \
+    do { \
+        n = snprintf(buf + used, len - used, __VA_ARGS__); \
+        if (n < 0 || (size_t)n >= len - used) { \
+            goto out; \
+        } \
+        used += n; \
+    } while (0)
+
+    if (len == 0) {
+        return 0;
+    }
+    buf[0] = '\0';
+
+    sys_mutex_lock(&chain_lock);
+
+    NF_LIST_APPEND("\n=== NF Chain (%s) ===\n",
+                   nf_chain_is_specialized() ? "compiled" : "dynamic");
+
+    if (num_nodes == 0) {
+        NF_LIST_APPEND("(empty)\n");
+    }
+    for (int i = 0; i < num_nodes; i++) {
+        NF_LIST_APPEND("[%d] %s - %s\n", i, nodes[i].name,
+                       nodes[i].enabled ? "enabled" : "disabled");
+    }
+
+    NF_LIST_APPEND("================\n");
+
+#undef NF_LIST_APPEND
+
+out:
+    sys_mutex_unlock(&chain_lock);
+    return (int)used;
+}
+
+int nf_chain_format_stats(char *buf, size_t len)
+{
+    size_t used = 0;
+    int n;
+
+#define NF_STATS_APPEND(...) \
+    do { \
+        n = snprintf(buf + used, len - used, __VA_ARGS__); \
+        if (n < 0 || (size_t)n >= len - used) { \
+            goto out; \
+        } \
+        used += n; \
+    } while (0)
+
+    if (len == 0) {
+        return 0;
+    }
+    buf[0] = '\0';
+
+    sys_mutex_lock(&chain_lock);
+
+    NF_STATS_APPEND("\n=== NF Statistics ===\n");
+
+    for (int i = 0; i < num_nodes; i++) {
+        nf_stats_t merged;
+        const nf_stats_t *stats = &merged;
+        nf_stats_merge(nodes[i].stats, &merged);
+
+        uint64_t invocations = stats->invocations;
+        uint64_t packets = stats->packets_in;
+
+        NF_STATS_APPEND("[%d] %s%s: in %llu, dropped %llu, calls %llu, "
+                        "%llu cycles/pkt\n",
+                        i, nodes[i].name,
+                        nodes[i].enabled ? "" : " (disabled)",
+                        (unsigned long long)packets,
+                        (unsigned long long)stats->packets_dropped,
+                        (unsigned long long)invocations,
+                        (unsigned long long)(packets ? stats->cycles / packets : 0));
+
+        if (invocations == 0) {
+            continue;
+        }
+
+        NF_STATS_APPEND("    cycles/call log2 histogram:");
+        for (int b = 0; b < NF_HIST_BUCKETS; b++) {
+            if (stats->cycles_hist[b]) {
+                NF_STATS_APPEND(" 2^%d:%llu", b,
+                                (unsigned long long)stats->cycles_hist[b]);
+            }
         }
+        NF_STATS_APPEND("\n");
     }
-    
-    printf("================\n\n");
+
+    uint64_t drops[PKT_DROP_MAX];
+    nf_chain_get_drops(drops);
+
+    NF_STATS_APPEND("Dropped packets by reason:\n");
+    for (int r = PKT_DROP_NONE + 1; r < PKT_DROP_MAX; r++) {
+        NF_STATS_APPEND("  %s: %llu\n", pkt_drop_name(r),
+                        (unsigned long long)drops[r]);
+    }
+
+    NF_STATS_APPEND("=====================\n");
+
+#undef NF_STATS_APPEND
+
+out:
+    sys_mutex_unlock(&chain_lock);
+    return (int)used;
+}
+
+int nf_chain_get_stats(int index, const char **name, nf_stats_t *out)
+{
+    int ret = -1;
+
+    sys_mutex_lock(&chain_lock);
+
+    if (index >= 0 && index < num_nodes) {
+        *name = nodes[index].name;
+        nf_stats_merge(nodes[index].stats, out);
+        ret = 0;
+    }
+
+    sys_mutex_unlock(&chain_lock);
+    return ret;
+}
+
+int nf_chain_get_info(int index, const char **name, bool *enabled)
+{
+    int ret = -1;
+
+    sys_mutex_lock(&chain_lock);
+
+    if (index >= 0 && index < num_nodes) {
+        *name = nodes[index].name;
+        *enabled = nodes[index].enabled;
+        ret = 0;
+    }
+
+    sys_mutex_unlock(&chain_lock);
+    return ret;
+}
+
+void nf_chain_reset_stats(void)
+{
+    sys_mutex_lock(&chain_lock);
+
+    for (int i = 0; i < num_nodes; i++) {
+        memset(nodes[i].stats, 0, sizeof(nf_stats_t) * LOOM_MAX_WORKERS);
+    }
+    memset(drop_counts, 0, sizeof(drop_counts));
+
+    sys_mutex_unlock(&chain_lock);
 }
 
 void nf_chain_clear(void)
 {
-    nf_node_t *current = chain_head;
-    
-    while (current != NULL) {
-        nf_node_t *next = current->next;
-        free(current);
-        current = next;
+    sys_mutex_lock(&chain_lock);
+
+    const nf_chain_t *old = active_chain;
+    rcu_assign_pointer(active_chain, &empty_chain);
+    rcu_synchronize();
+
+    if (old != &empty_chain) {
+        mempool_put(chain_pool, (void *)old);
     }
-    
-    chain_head = NULL;
+
+    for (int i = 0; i < num_nodes; i++) {
+        nf_stats_free(nodes[i].stats);
+    }
+    num_nodes = 0;
+
+    sys_mutex_unlock(&chain_lock);
     printf("[NF_CHAIN] Chain cleared\n");
 }
 
-static uint16_t get_dst_port(struct pbuf *p)
+/* Takes this worker's share of a newly published gen, see rate_limit_t */
+static void rate_bucket_apply(rate_bucket_t *b, const rate_limit_t *rl,
+                              uint64_t gen, uint64_t now)
 {
-    if (p->tot_len < sizeof(struct eth_hdr) + sizeof(struct ip_hdr)) {
-        return 0;
+    if (gen & 1) {
+        return;  // Being written, keep the old share for now
     }
 
-    struct eth_hdr *eth = (struct eth_hdr *)p->payload;
-    uint16_t eth_type = lwip_ntohs(eth->type);
-    
-    if (eth_type != ETHTYPE_IP) {
-        return 0;
+    rate_share_t share = rl->shares[loom_worker()];
+    bool bps = (rl->mode == RATE_LIMIT_BPS);
+    bool fill = b->gen < rl->created_gen;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&rl->gen, __ATOMIC_RELAXED) != gen) {
+        return;  // Republished while copying, retried on the next packet
     }
 
-    struct ip_hdr *ip = (struct ip_hdr *)((uint8_t *)p->payload + sizeof(struct eth_hdr));
-    uint8_t proto = IPH_PROTO(ip);
-    
-    if (proto != 6 && proto != 17) {  // TCP or UDP
-        return 0;
+    b->rate = share.rate;
+    b->capacity = share.capacity;
+    b->fill_ns = share.fill_ns;
+    b->bps = bps;
+    if (fill || b->tokens > b->capacity) {
+        b->tokens = b->capacity;
+    }
+    if (fill) {
+        b->last_ns = now;
+    }
+    b->gen = gen;
+}
+
+static bool rate_limiter_check(uint16_t port, uint16_t pkt_len, uint64_t now)
+{
+    uint8_t slot = __atomic_load_n(&rate_limit_slot[port], __ATOMIC_ACQUIRE);
+    if (slot == 0) {
+        return true;
+    }
+
+    const rate_limit_t *rl = &rate_limits[slot - 1];
+    rate_bucket_t *b = &rate_buckets[loom_worker()][slot - 1];
+    uint64_t gen = __atomic_load_n(&rl->gen, __ATOMIC_ACQUIRE);
+
+    if (gen != b->gen) {
+        rate_bucket_apply(b, rl, gen, now);
+    }
+
+    if (now > b->last_ns) {
+        uint64_t elapsed = now - b->last_ns;
+        b->last_ns = now;
+
+        if (elapsed >= b->fill_ns) {
+            b->tokens = b->capacity;
+        } else {
+            b->tokens += elapsed * b->rate;
+            if (b->tokens > b->capacity) {
+                b->tokens = b->capacity;
+            }
+        }
+    }
+
+    uint64_t cost = b->bps ? pkt_len : 1;
+    cost *= LOOM_NSEC_PER_SEC;
+
+    if (b->tokens < cost) {
+        event_log_record(EVENT_DROP_RATE_LIMIT, NULL, port, rl->rate);
+        return false;
     }
 
-    struct tcp_hdr *tcp = (struct tcp_hdr *)((uint8_t *)ip + (IPH_HL(ip) * 4));
-    return lwip_ntohs(tcp->dest);
+    b->tokens -= cost;
+    return true;
 }
 
-bool nf_rate_limiter(struct pbuf *p)
+bool nf_rate_limiter(struct pbuf *p, pkt_meta_t *meta)
 {
-    uint16_t port = get_dst_port(p);
-    if (port == 0) {
+    if (!(meta->flags & PKT_F_L4)) {
         return true;  // Not TCP/UDP, allow it
     }
-    
-    time_t now = time(NULL);
-    
-    for (int i = 0; i < num_rate_limits; i++) {
-        if (rate_limits[i].port == port) {
-            if (now > rate_limits[i].last_reset) {
-                rate_limits[i].count = 0;
-                rate_limits[i].last_reset = now;
-            }
-            
-            /* Check if we're over the limit */
-            if (rate_limits[i].count >= rate_limits[i].limit) {
-                printf("[RATE_LIMITER] Port %u exceeded limit (%u pps)\n", 
-                       port, rate_limits[i].limit);
-                return false;
+
+    return rate_limiter_check(meta->dst_port, meta->pkt_len, loom_now_ns());
+}
+
+void nf_rate_limiter_batch(struct pbuf **pkts, pkt_meta_t *meta,
+                           uint16_t count, uint64_t *pass_mask)
+{
+    if (num_rate_limits == 0) {
+        return;
+    }
+
+    /* One clock read for the whole batch */
+    uint64_t now = loom_now_ns();
+    uint64_t todo = *pass_mask;
+
+    while (todo) {
+        int i = __builtin_ctzll(todo);
+        todo &= todo - 1;
+
+        if ((meta[i].flags & PKT_F_L4) &&
+            !rate_limiter_check(meta[i].dst_port, meta[i].pkt_len, now)) {
+            *pass_mask &= ~(1ULL << i);
+        }
+    }
+}
+
+/*
+ * Split rate and burst evenly, the remainder goes to the lowest workers,
+ * and publish the shares. fill: the slot is new, buckets start full.
+ */
+static void rate_limit_configure(int slot, uint32_t rate, uint32_t burst,
+                                 rate_limit_mode_t mode, bool fill)
+{
+    rate_limit_t *rl = &rate_limits[slot];
+    unsigned int workers = loom_num_workers;
+    uint64_t gen = rl->gen + 2;
+
+    __atomic_store_n(&rl->gen, gen - 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    rl->mode = mode;
+    rl->rate = rate;
+    rl->burst = burst;
+    if (fill) {
+        rl->created_gen = gen;
+    }
+
+    for (unsigned int w = 0; w < LOOM_MAX_WORKERS; w++) {
+        rate_share_t *share = &rl->shares[w];
+        uint64_t share_rate = 0;
+        uint64_t share_burst = 0;
+
+        if (w < workers) {
+            share_rate = rate / workers + (w < rate % workers);
+            share_burst = burst / workers + (w < burst % workers);
+            if (share_burst == 0) {
+                share_burst = 1;
             }
-            
-            rate_limits[i].count++;
-            return true;
         }
+
+        share->rate = share_rate;
+        share->capacity = share_burst * LOOM_NSEC_PER_SEC;
+        share->fill_ns = share_rate ? share->capacity / share_rate : UINT64_MAX;
     }
-    
-    return true;
+
+    __atomic_store_n(&rl->gen, gen, __ATOMIC_RELEASE);
 }
 
-int nf_rate_limiter_set_limit(uint16_t port, uint32_t packets_per_sec)
+void nf_rate_limiter_rebalance(void)
 {
-    for (int i = 0; i < num_rate_limits; i++) {
-        if (rate_limits[i].port == port) {
-            rate_limits[i].limit = packets_per_sec;
-            printf("[RATE_LIMITER] Updated port %u: %u pps\n", port, packets_per_sec);
-            return 0;
+    for (int i = 0; i < MAX_RATE_LIMITS; i++) {
+        rate_limit_t *rl = &rate_limits[i];
+        if (rl->in_use) {
+            rate_limit_configure(i, rl->rate, rl->burst, rl->mode, false);
         }
     }
-    
-    if (num_rate_limits >= MAX_RATE_LIMITS) {
+}
+
+int nf_rate_limiter_set_limit(uint16_t port, uint32_t rate, uint32_t burst,
+                              rate_limit_mode_t mode)
+{
+    /* Default burst: one second worth of traffic */
+    if (burst == 0) {
+        burst = rate;
+    }
+
+    const char *unit = (mode == RATE_LIMIT_BPS) ? "Bps" : "pps";
+    uint8_t slot = rate_limit_slot[port];
+
+    if (slot != 0) {
+        rate_limit_configure(slot - 1, rate, burst, mode, false);
+        printf("[RATE_LIMITER] Updated port %u: %u %s (burst %u)\n",
+               port, rate, unit, burst);
+        return 0;
+    }
+
+    int free_slot = -1;
+    for (int i = 0; i < MAX_RATE_LIMITS; i++) {
+        if (!rate_limits[i].in_use) {
+            free_slot = i;
+            break;
+        }
+    }
+
+    if (free_slot < 0) {
         printf("[RATE_LIMITER] ERROR: Max limits reached\n");
         return -1;
     }
-    
-    rate_limits[num_rate_limits].port = port;
-    rate_limits[num_rate_limits].limit = packets_per_sec;
-    rate_limits[num_rate_limits].count = 0;
-    rate_limits[num_rate_limits].last_reset = time(NULL);
+
+    rate_limit_t *rl = &rate_limits[free_slot];
+    rl->port = port;
+    rl->in_use = true;
+    rate_limit_configure(free_slot, rate, burst, mode, true);
     num_rate_limits++;
-    
-    printf("[RATE_LIMITER] Added port %u: %u pps\n", port, packets_per_sec);
+
+    __atomic_store_n(&rate_limit_slot[port], (uint8_t)(free_slot + 1),
+                     __ATOMIC_RELEASE);
+
+    printf("[RATE_LIMITER] Added port %u: %u %s (burst %u)\n",
+           port, rate, unit, burst);
     return 0;
 }
 
 int nf_rate_limiter_remove_limit(uint16_t port)
 {
-    for (int i = 0; i < num_rate_limits; i++) {
-        if (rate_limits[i].port == port) {
-            /* Shift remaining limits down */
-            for (int j = i; j < num_rate_limits - 1; j++) {
-                rate_limits[j] = rate_limits[j + 1];
+    uint8_t slot = rate_limit_slot[port];
+
+    if (slot == 0) {
+        printf("[RATE_LIMITER] No limit found for port %u\n", port);
+        return -1;
+    }
+
+    /* Workers may still charge the slot, wait for them before reusing it */
+    __atomic_store_n(&rate_limit_slot[port], 0, __ATOMIC_RELEASE);
+    rcu_synchronize();
+    rate_limits[slot - 1].in_use = false;
+    num_rate_limits--;
+
+    printf("[RATE_LIMITER] Removed limit for port %u\n", port);
+    return 0;
+}
+
+int nf_rate_limiter_snapshot(rate_limit_info_t *out, int max)
+{
+    int count = 0;
+
+    for (int i = 0; i < MAX_RATE_LIMITS; i++) {
+        const rate_limit_t *rl = &rate_limits[i];
+        if (!rl->in_use) {
+            continue;
+        }
+
+        if (count < max) {
+            rate_limit_info_t *info = &out[count];
+            uint64_t tokens = 0;
+
+            /* Buckets a worker has not taken its new share into are full */
+            for (int w = 0; w < LOOM_MAX_WORKERS; w++) {
+                const rate_bucket_t *b = &rate_buckets[w][i];
+                tokens += (__atomic_load_n(&b->gen, __ATOMIC_RELAXED) < rl->created_gen)
+                          ? rl->shares[w].capacity
+                          : __atomic_load_n(&b->tokens, __ATOMIC_RELAXED);
             }
-            num_rate_limits--;
-            printf("[RATE_LIMITER] Removed limit for port %u\n", port);
-            return 0;
+            info->port = rl->port;
+            info->mode = rl->mode;
+            info->rate = rl->rate;
+            info->burst = rl->burst;
+            info->tokens = tokens / LOOM_NSEC_PER_SEC;
         }
+        count++;
     }
-    
-    printf("[RATE_LIMITER] No limit found for port %u\n", port);
-    return -1;
+
+    return count;
 }
 
-void nf_rate_limiter_list(void)
+int nf_rate_limiter_format(char *buf, size_t len)
 {
-    printf("\n=== Rate Limiter ===\n");
-    
-    if (num_rate_limits == 0) {
-        printf("(no limits configured)\n");
-    } else {
-        for (int i = 0; i < num_rate_limits; i++) {
-            printf("Port %u: %u pps (current: %u)\n",
-                   rate_limits[i].port,
-                   rate_limits[i].limit,
-                   rate_limits[i].count);
-        }
+    rate_limit_info_t limits[MAX_RATE_LIMITS];
+    int count = nf_rate_limiter_snapshot(limits, MAX_RATE_LIMITS);
+    size_t used = 0;
+    int n;
+
+#define RL_APPEND(...) \
+    do { \
+        n = snprintf(buf + used, len - used, __VA_ARGS__); \
+        if (n < 0 || (size_t)n >= len - used) { \
+            goto out; \
+        } \
+        used += n; \
+    } while (0)
+
+    if (len == 0) {
+        return 0;
     }
-    
-    printf("====================\n\n");
+    buf[0] = '\0';
+
+    RL_APPEND("\n=== Rate Limiter ===\n");
+
+    if (count == 0) {
+        RL_APPEND("(no limits configured)\n");
+    }
+    for (int i = 0; i < count; i++) {
+        RL_APPEND("Port %u: %u %s, burst %u (tokens: %llu)\n",
+                  limits[i].port, limits[i].rate,
+                  limits[i].mode == RATE_LIMIT_BPS ? "Bps" : "pps",
+                  limits[i].burst, (unsigned long long)limits[i].tokens);
+    }
+
+    RL_APPEND("====================\n");
+
+#undef RL_APPEND
+
+out:
+    return (int)used;
 }
 
-bool nf_allowlist(struct pbuf *p)
+static inline bool allowlist_check(const allowlist_t *allow, uint8_t proto,
+                                   uint16_t port)
 {
-    if (num_allowed_ports == 0) {
+    const uint64_t *map = allow->bitmap[proto == IP_PROTO_UDP];
+
+    if ((map[port >> 6] >> (port & 63)) & 1) {
         return true;
     }
-    
-    uint16_t port = get_dst_port(p);
-    if (port == 0) {
+
+    event_log_record(EVENT_DROP_ALLOWLIST, NULL, port, proto);
+    return false;
+}
+
+bool nf_allowlist(struct pbuf *p, pkt_meta_t *meta)
+{
+    if (!(meta->flags & PKT_F_L4)) {
         return true;  // Not TCP/UDP, allow it
     }
-    
-    for (int i = 0; i < num_allowed_ports; i++) {
-        if (allowed_ports[i] == port) {
-            return true;
+
+    if (meta->flags & PKT_F_CT_EST) {
+        return true;  // Return traffic of a tracked flow
+    }
+
+    unsigned int epoch = rcu_read_lock();
+    const allowlist_t *allow = rcu_dereference(active_allowlist);
+    bool pass = allow->num_ports == 0 ||
+                allowlist_check(allow, meta->proto, meta->dst_port);
+    rcu_read_unlock(epoch);
+
+    return pass;
+}
+
+void nf_allowlist_batch(struct pbuf **pkts, pkt_meta_t *meta,
+                        uint16_t count, uint64_t *pass_mask)
+{
+    unsigned int epoch = rcu_read_lock();
+    const allowlist_t *allow = rcu_dereference(active_allowlist);
+
+    if (allow->num_ports != 0) {
+        uint64_t todo = *pass_mask;
+        uint64_t check = 0;
+
+        while (todo) {
+            int i = __builtin_ctzll(todo);
+            todo &= todo - 1;
+
+            if ((meta[i].flags & (PKT_F_L4 | PKT_F_CT_EST)) == PKT_F_L4) {
+                check |= 1ULL << i;
+            }
+        }
+
+        /* All bitmap lookups of the batch at once, misses logged after */
+        uint64_t miss = check & ~classify_port_lookup(meta, count, check,
+                                                      &allow->bitmap[0][0]);
+        *pass_mask &= ~miss;
+
+        while (miss) {
+            int i = __builtin_ctzll(miss);
+            miss &= miss - 1;
+            event_log_record(EVENT_DROP_ALLOWLIST, NULL, meta[i].dst_port,
+                             meta[i].proto);
         }
     }
-    
-    printf("[ALLOWLIST] Port %u not in allowlist, dropping\n", port);
-    return false;
+
+    rcu_read_unlock(epoch);
 }
 
-int nf_allowlist_add_port(uint16_t port)
+void nf_allowlist_stage_reset(bool from_active)
 {
-    for (int i = 0; i < num_allowed_ports; i++) {
-        if (allowed_ports[i] == port) {
-            printf("[ALLOWLIST] Port %u already in allowlist\n", port);
-            return 0;
+    if (from_active) {
+        memcpy(staged_allowlist, active_allowlist, sizeof(allowlist_t));
+    } else {
+        memset(staged_allowlist, 0, sizeof(allowlist_t));
+    }
+}
+
+/* Returns the number of (port, protocol) bits that changed */
+static uint32_t allowlist_stage_update(uint16_t first, uint16_t last,
+                                       uint8_t protos, bool add)
+{
+    uint32_t changed = 0;
+
+    for (int map = 0; map < 2; map++) {
+        if (!(protos & (1 << map))) {
+            continue;
+        }
+        for (uint32_t port = first; port <= last; port++) {
+            uint64_t bit = 1ULL << (port & 63);
+            uint64_t *word = &staged_allowlist->bitmap[map][port >> 6];
+            if (!(*word & bit) == add) {
+                *word ^= bit;
+                changed++;
+            }
         }
     }
-    
-    if (num_allowed_ports >= MAX_ALLOWED_PORTS) {
-        printf("[ALLOWLIST] ERROR: Max ports reached\n");
+
+    if (add) {
+        staged_allowlist->num_ports += changed;
+    } else {
+        staged_allowlist->num_ports -= changed;
+    }
+    return changed;
+}
+
+int nf_allowlist_stage_add(uint16_t first, uint16_t last, uint8_t protos)
+{
+    if (first > last || !(protos & ALLOW_PROTO_ANY)) {
         return -1;
     }
-    
-    allowed_ports[num_allowed_ports] = port;
-    num_allowed_ports++;
-    
-    printf("[ALLOWLIST] Added port %u\n", port);
+
+    allowlist_stage_update(first, last, protos, true);
+    return 0;
+}
+
+int nf_allowlist_stage_remove(uint16_t first, uint16_t last, uint8_t protos)
+{
+    if (first > last || !(protos & ALLOW_PROTO_ANY)) {
+        return -1;
+    }
+
+    return allowlist_stage_update(first, last, protos, false) ? 0 : -1;
+}
+
+void nf_allowlist_commit(void)
+{
+    allowlist_t *old = active_allowlist;
+
+    rcu_assign_pointer(active_allowlist, staged_allowlist);
+    rcu_synchronize();
+    staged_allowlist = old;
+}
+
+int nf_allowlist_add_range(uint16_t first, uint16_t last, uint8_t protos)
+{
+    nf_allowlist_stage_reset(true);
+    if (nf_allowlist_stage_add(first, last, protos) < 0) {
+        return -1;
+    }
+    nf_allowlist_commit();
+
+    printf("[ALLOWLIST] Added ports %u-%u%s\n", first, last,
+           protos == ALLOW_PROTO_TCP ? " (TCP)" :
+           protos == ALLOW_PROTO_UDP ? " (UDP)" : "");
+    return 0;
+}
+
+int nf_allowlist_remove_range(uint16_t first, uint16_t last, uint8_t protos)
+{
+    nf_allowlist_stage_reset(true);
+    if (nf_allowlist_stage_remove(first, last, protos) < 0) {
+        printf("[ALLOWLIST] Ports %u-%u not in allowlist\n", first, last);
+        return -1;
+    }
+    nf_allowlist_commit();
+
+    printf("[ALLOWLIST] Removed ports %u-%u\n", first, last);
     return 0;
 }
 
-int nf_allowlist_remove_port(uint16_t port)
+uint32_t nf_allowlist_active_ports(void)
 {
-    for (int i = 0; i < num_allowed_ports; i++) {
-        if (allowed_ports[i] == port) {
-            for (int j = i; j < num_allowed_ports - 1; j++) {
-                allowed_ports[j] = allowed_ports[j + 1];
+    return active_allowlist->num_ports;
+}
+
+/*
+ * The active table is only modified after it has been swapped out and a
+ * grace period has passed, so an RCU read section is enough to walk it.
+ */
+int nf_allowlist_snapshot(allow_range_t *out, int max)
+{
+    int count = 0;
+    unsigned int epoch = rcu_read_lock();
+    const allowlist_t *allow = rcu_dereference(active_allowlist);
+
+    for (int map = 0; map < 2 && allow->num_ports; map++) {
+        const uint64_t *bitmap = allow->bitmap[map];
+        uint32_t port = 0;
+
+        while (port < 65536) {
+            uint64_t word = bitmap[port >> 6] >> (port & 63);
+
+            if (word == 0) {
+                port = (port | 63) + 1;
+                continue;
+            }
+            port += __builtin_ctzll(word);
+
+            uint32_t first = port;
+            while (port < 65536) {
+                word = ~bitmap[port >> 6] >> (port & 63);
+                if (word != 0) {
+                    port += __builtin_ctzll(word);
+                    break;
+                }
+                port = (port | 63) + 1;
+            }
+
+            if (count < max) {
+                out[count].first = (uint16_t)first;
+                out[count].last = (uint16_t)(port - 1);
+                out[count].protos = map == 0 ? ALLOW_PROTO_TCP : ALLOW_PROTO_UDP;
             }
-            num_allowed_ports--;
-            printf("[ALLOWLIST] Removed port %u\n", port);
-            return 0;
+            count++;
         }
     }
-    
-    printf("[ALLOWLIST] Port %u not in allowlist\n", port);
-    return -1;
+
+    rcu_read_unlock(epoch);
+    return count;
 }
 
-void nf_allowlist_list(void)
+/* Console only, serialized by control_lock() */
+int nf_allowlist_format(char *buf, size_t len)
 {
-    printf("\n=== Allowlist ===\n");
-    
-    if (num_allowed_ports == 0) {
-        printf("(empty - all ports allowed)\n");
-    } else {
-        for (int i = 0; i < num_allowed_ports; i++) {
-            printf("Port %u\n", allowed_ports[i]);
+    static allow_range_t ranges[ALLOW_FORMAT_MAX_RANGES];
+    int count = nf_allowlist_snapshot(ranges, ALLOW_FORMAT_MAX_RANGES);
+    size_t used = 0;
+    int n;
+
+#define ALLOW_APPEND(...) \
+    do { \
+        n = snprintf(buf + used, len - used, __VA_ARGS__); \
+        if (n < 0 || (size_t)n >= len - used) { \
+            goto out; \
+        } \
+        used += n; \
+    } while (0)
+
+    if (len == 0) {
+        return 0;
+    }
+    buf[0] = '\0';
+
+    ALLOW_APPEND("\n=== Allowlist ===\n");
+
+    if (count == 0) {
+        ALLOW_APPEND("(empty - all ports allowed)\n");
+    }
+    for (int i = 0; i < count && i < ALLOW_FORMAT_MAX_RANGES; i++) {
+        const char *proto = ranges[i].protos == ALLOW_PROTO_TCP ? "TCP" : "UDP";
+        if (ranges[i].first == ranges[i].last) {
+            ALLOW_APPEND("%s %u\n", proto, ranges[i].first);
+        } else {
+            ALLOW_APPEND("%s %u-%u\n", proto, ranges[i].first, ranges[i].last);
         }
     }
-    
-    printf("=================\n\n");
+    if (count > ALLOW_FORMAT_MAX_RANGES) {
+        ALLOW_APPEND("... %d more\n", count - ALLOW_FORMAT_MAX_RANGES);
+    }
+
+    ALLOW_APPEND("=================\n");
+
+#undef ALLOW_APPEND
+
+out:
+    return (int)used;
 }
 
 void nf_allowlist_clear(void)
 {
-    num_allowed_ports = 0;
-    memset(allowed_ports, 0, sizeof(allowed_ports));
+    nf_allowlist_stage_reset(false);
+    nf_allowlist_commit();
     printf("[ALLOWLIST] Cleared all ports\n");
-}
\ No newline at end of file
+}
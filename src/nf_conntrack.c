@@ -0,0 +1,499 @@
+#include "loom/nf_conntrack.h"
+#include "loom/clock.h"
+#include "loom/event_log.h"
+#include "loom/mempool.h"
+#include "loom/nf_synproxy.h"
+#include <stdio.h>
+#include <string.h>
+#include "lwip/netif.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/tcp.h"
+
+#define CT_BUCKET_ENTRIES 2     /* 2 x 32 B entries per cache line */
+#define CT_MAX_PROBE 4          /* Buckets probed per lookup/insert */
+#define CT_SWEEP_BUCKETS 8      /* Buckets checked for expiry per batch */
+
+typedef enum {
+    CT_STATE_NONE = 0,
+    CT_STATE_SYN_SENT,
+    CT_STATE_SYN_RECV,
+    CT_STATE_ESTABLISHED,
+    CT_STATE_FIN_WAIT,
+    CT_STATE_CLOSE,
+    CT_STATE_UDP,
+} ct_state_t;
+
+/* Entry flags */
+#define CT_F_ORIG_IS_A  0x01    /* Originator is endpoint a of the key */
+#define CT_F_SEEN_REPLY 0x02
+#define CT_F_FIN_ORIG   0x04
+#define CT_F_FIN_REPLY  0x08
+#define CT_F_ORIG_LOCAL 0x10    /* Opened by lwIP, not from the network */
+
+/*
+ * Keys are direction independent: endpoint a is the numerically smaller
+ * (address, port) pair so both directions of a flow hash to one entry.
+ * proto == 0 marks a free slot.
+ */
+typedef struct {
+    uint32_t ip_a;
+    uint32_t ip_b;
+    uint16_t port_a;
+    uint16_t port_b;
+    uint8_t proto;
+    uint8_t state;
+    uint8_t flags;
+    uint8_t reserved;
+    uint32_t expires_ms;
+    uint32_t hash;
+    uint64_t packets;
+} ct_entry_t;
+
+typedef struct {
+    ct_entry_t entries[CT_BUCKET_ENTRIES];
+} __attribute__((aligned(64))) ct_bucket_t;
+
+/* Lookup key of a packet, see ct_entry_t */
+typedef struct {
+    uint32_t ip_a;
+    uint32_t ip_b;
+    uint16_t port_a;
+    uint16_t port_b;
+    uint8_t proto;
+    bool src_is_a;
+    uint32_t hash;
+} ct_key_t;
+
+static ct_bucket_t *ct_table = NULL;
+static uint32_t ct_bucket_mask = 0;
+static uint32_t ct_sweep_cursor = 0;
+static bool ct_strict = false;
+
+static uint32_t ct_timeouts_ms[CT_TIMEOUT_MAX] = {
+    [CT_TIMEOUT_TCP_EST] = 300 * 1000,
+    [CT_TIMEOUT_UDP] = 120 * 1000,
+};
+
+#define CT_TIMEOUT_SYN_MS       30000
+#define CT_TIMEOUT_FIN_MS       60000
+#define CT_TIMEOUT_CLOSE_MS     10000
+#define CT_TIMEOUT_UDP_NEW_MS   30000
+
+static ct_stats_t ct_stats;
+
+static netif_linkoutput_fn original_linkoutput = NULL;
+
+static inline uint32_t ct_now_ms(void)
+{
+    return (uint32_t)(loom_now_ns() / 1000000ULL);
+}
+
+static inline bool ct_expired(const ct_entry_t *e, uint32_t now)
+{
+    return (int32_t)(e->expires_ms - now) <= 0;
+}
+
+static inline uint32_t ct_hash(uint32_t ip_a, uint32_t ip_b,
+                               uint16_t port_a, uint16_t port_b, uint8_t proto)
+{
+    uint64_t h = ((uint64_t)ip_a << 32) | ip_b;
+    h ^= ((uint64_t)port_a << 24) ^ ((uint64_t)port_b << 8) ^ proto;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
+
+int nf_conntrack_init(uint32_t capacity)
+{
+    uint32_t buckets = 1;
+
+    if (capacity < CT_BUCKET_ENTRIES) {
+        capacity = CT_BUCKET_ENTRIES;
+    }
+    while (buckets * CT_BUCKET_ENTRIES < capacity) {
+        buckets <<= 1;
+    }
+
+    if (ct_table) {
+        printf("[CONNTRACK] ERROR: Table already initialized\n");
+        return -1;
+    }
+
+    void *table = mem_reserve("conntrack", buckets * sizeof(ct_bucket_t));
+    if (!table) {
+        printf("[CONNTRACK] ERROR: Failed to allocate %u buckets\n", buckets);
+        return -1;
+    }
+
+    memset(table, 0, buckets * sizeof(ct_bucket_t));
+    memset(&ct_stats, 0, sizeof(ct_stats));
+
+    ct_table = (ct_bucket_t *)table;
+    ct_bucket_mask = buckets - 1;
+    ct_sweep_cursor = 0;
+    ct_stats.capacity = buckets * CT_BUCKET_ENTRIES;
+
+    printf("[CONNTRACK] Table initialized: %u entries (%u KiB)\n",
+           ct_stats.capacity,
+           (unsigned)(buckets * sizeof(ct_bucket_t) / 1024));
+    return 0;
+}
+
+/* Reclaim expired entries a few buckets at a time, never a full sweep */
+static void ct_sweep(uint32_t now)
+{
+    for (int i = 0; i < CT_SWEEP_BUCKETS; i++) {
+        ct_bucket_t *bucket = &ct_table[ct_sweep_cursor & ct_bucket_mask];
+        ct_sweep_cursor++;
+
+        for (int j = 0; j < CT_BUCKET_ENTRIES; j++) {
+            ct_entry_t *e = &bucket->entries[j];
+            if (e->proto != 0 && ct_expired(e, now)) {
+                e->proto = 0;
+                ct_stats.active--;
+                ct_stats.expired++;
+            }
+        }
+    }
+}
+
+/* A fresh bare SYN reopens a closed flow, originated by whoever sent it */
+static void ct_update_tcp(ct_entry_t *e, bool *reply, bool egress,
+                          uint8_t tcp_flags, uint32_t now)
+{
+    uint32_t timeout;
+
+    if (e->state == CT_STATE_CLOSE &&
+        (tcp_flags & (TCP_SYN | TCP_ACK | TCP_RST)) == TCP_SYN) {
+        uint8_t orig_is_a = (e->flags & CT_F_ORIG_IS_A) ^ (*reply ? CT_F_ORIG_IS_A : 0);
+
+        e->flags = orig_is_a | (egress ? CT_F_ORIG_LOCAL : 0);
+        e->state = CT_STATE_SYN_SENT;
+        *reply = false;
+    } else if (tcp_flags & TCP_RST) {
+        e->state = CT_STATE_CLOSE;
+    } else if (tcp_flags & TCP_FIN) {
+        e->flags |= *reply ? CT_F_FIN_REPLY : CT_F_FIN_ORIG;
+        e->state = ((e->flags & (CT_F_FIN_ORIG | CT_F_FIN_REPLY)) ==
+                    (CT_F_FIN_ORIG | CT_F_FIN_REPLY)) ? CT_STATE_CLOSE
+                                                      : CT_STATE_FIN_WAIT;
+    } else {
+        switch (e->state) {
+        case CT_STATE_SYN_SENT:
+            if (*reply && (tcp_flags & (TCP_SYN | TCP_ACK)) == (TCP_SYN | TCP_ACK)) {
+                e->state = CT_STATE_SYN_RECV;
+            }
+            break;
+        case CT_STATE_SYN_RECV:
+            if (!*reply && (tcp_flags & TCP_ACK)) {
+                e->state = CT_STATE_ESTABLISHED;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    switch (e->state) {
+    case CT_STATE_ESTABLISHED:
+        timeout = ct_timeouts_ms[CT_TIMEOUT_TCP_EST];
+        break;
+    case CT_STATE_FIN_WAIT:
+        timeout = CT_TIMEOUT_FIN_MS;
+        break;
+    case CT_STATE_CLOSE:
+        timeout = CT_TIMEOUT_CLOSE_MS;
+        break;
+    default:
+        timeout = CT_TIMEOUT_SYN_MS;
+        break;
+    }
+
+    e->expires_ms = now + timeout;
+}
+
+static void ct_key(const pkt_meta_t *meta, ct_key_t *key)
+{
+    key->src_is_a = (meta->src_ip < meta->dst_ip) ||
+                    (meta->src_ip == meta->dst_ip && meta->src_port <= meta->dst_port);
+    key->ip_a = key->src_is_a ? meta->src_ip : meta->dst_ip;
+    key->ip_b = key->src_is_a ? meta->dst_ip : meta->src_ip;
+    key->port_a = key->src_is_a ? meta->src_port : meta->dst_port;
+    key->port_b = key->src_is_a ? meta->dst_port : meta->src_port;
+    key->proto = meta->proto;
+    key->hash = ct_hash(key->ip_a, key->ip_b, key->port_a, key->port_b, key->proto);
+}
+
+/* Reclaims expired entries on the way, *free_slot is the first usable one */
+static ct_entry_t *ct_lookup(const ct_key_t *key, uint32_t now,
+                             ct_entry_t **free_slot)
+{
+    *free_slot = NULL;
+
+    for (uint32_t probe = 0; probe < CT_MAX_PROBE; probe++) {
+        ct_bucket_t *bucket = &ct_table[(key->hash + probe) & ct_bucket_mask];
+
+        for (int j = 0; j < CT_BUCKET_ENTRIES; j++) {
+            ct_entry_t *e = &bucket->entries[j];
+
+            if (e->proto == 0) {
+                if (!*free_slot) {
+                    *free_slot = e;
+                }
+                continue;
+            }
+
+            if (ct_expired(e, now)) {
+                e->proto = 0;
+                ct_stats.active--;
+                ct_stats.expired++;
+                if (!*free_slot) {
+                    *free_slot = e;
+                }
+                continue;
+            }
+
+            if (e->hash == key->hash && e->proto == key->proto &&
+                e->ip_a == key->ip_a && e->ip_b == key->ip_b &&
+                e->port_a == key->port_a && e->port_b == key->port_b) {
+                return e;
+            }
+        }
+    }
+    return NULL;
+}
+
+static ct_entry_t *ct_insert(const ct_key_t *key, ct_entry_t *slot, bool egress,
+                             uint32_t now)
+{
+    bool is_tcp = (key->proto == IP_PROTO_TCP);
+
+    if (!slot) {
+        ct_stats.table_full++;
+        return NULL;
+    }
+
+    slot->ip_a = key->ip_a;
+    slot->ip_b = key->ip_b;
+    slot->port_a = key->port_a;
+    slot->port_b = key->port_b;
+    slot->hash = key->hash;
+    slot->flags = (key->src_is_a ? CT_F_ORIG_IS_A : 0) |
+                  (egress ? CT_F_ORIG_LOCAL : 0);
+    slot->packets = 1;
+    slot->state = is_tcp ? CT_STATE_SYN_SENT : CT_STATE_UDP;
+    slot->expires_ms = now + (is_tcp ? CT_TIMEOUT_SYN_MS : CT_TIMEOUT_UDP_NEW_MS);
+    slot->proto = key->proto;
+
+    ct_stats.active++;
+    ct_stats.created++;
+    return slot;
+}
+
+/*
+ * egress: sent by lwIP, never dropped and never counted invalid. Ingress
+ * packets that may open a flow are only marked PKT_F_CT_NEW, the entry is
+ * created by nf_conntrack_confirm() once the whole chain has passed them.
+ */
+static bool ct_track(pkt_meta_t *meta, uint32_t now, bool egress)
+{
+    if (!(meta->flags & PKT_F_L4)) {
+        return true;  // Only TCP/UDP flows are tracked
+    }
+
+    ct_key_t key;
+    ct_entry_t *free_slot;
+
+    ct_key(meta, &key);
+    ct_entry_t *found = ct_lookup(&key, now, &free_slot);
+    bool is_tcp = (meta->proto == IP_PROTO_TCP);
+
+    if (found) {
+        bool reply = (key.src_is_a != !!(found->flags & CT_F_ORIG_IS_A));
+
+        if (is_tcp) {
+            ct_update_tcp(found, &reply, egress, meta->tcp_flags, now);
+        }
+
+        /*
+         * A reply only counts from the other side of loom: lwIP's own
+         * segments for flows opened from the network and the other way
+         * round. Both directions arriving from the wire prove nothing.
+         */
+        if (reply && egress != !!(found->flags & CT_F_ORIG_LOCAL)) {
+            found->flags |= CT_F_SEEN_REPLY;
+        }
+        if (reply) {
+            meta->flags |= PKT_F_CT_REPLY;
+        }
+        found->packets++;
+
+        if (!is_tcp) {
+            found->expires_ms = now + ((found->flags & CT_F_SEEN_REPLY)
+                                       ? ct_timeouts_ms[CT_TIMEOUT_UDP]
+                                       : CT_TIMEOUT_UDP_NEW_MS);
+        }
+
+        if ((found->flags & CT_F_SEEN_REPLY) && found->state != CT_STATE_CLOSE) {
+            meta->flags |= PKT_F_CT_EST;
+        }
+        return true;
+    }
+
+    /* Only a bare SYN may open a TCP flow */
+    uint8_t syn_flags = meta->tcp_flags & (TCP_SYN | TCP_ACK | TCP_RST);
+
+    if (is_tcp && syn_flags != TCP_SYN) {
+        /* lwIP answering a SYN conntrack never saw, one the SYN proxy replayed */
+        if (egress && syn_flags == (TCP_SYN | TCP_ACK)) {
+            ct_entry_t *e = ct_insert(&key, free_slot, false, now);
+            if (e) {
+                e->flags = (key.src_is_a ? 0 : CT_F_ORIG_IS_A) | CT_F_SEEN_REPLY;
+                e->state = CT_STATE_SYN_RECV;
+            }
+            return true;
+        }
+        if (egress) {
+            return true;
+        }
+        ct_stats.invalid++;
+        return !ct_strict;
+    }
+
+    /* Answered with a stateless cookie, a flood must not fill the table */
+    if (is_tcp && !egress && nf_synproxy_answers(meta)) {
+        return true;
+    }
+
+    if (egress) {
+        ct_insert(&key, free_slot, true, now);
+    } else {
+        meta->flags |= PKT_F_CT_NEW;
+    }
+    return true;
+}
+
+bool nf_conntrack(struct pbuf *p, pkt_meta_t *meta)
+{
+    if (!ct_table) {
+        return true;
+    }
+
+    uint32_t now = ct_now_ms();
+    ct_sweep(now);
+    return ct_track(meta, now, false);
+}
+
+void nf_conntrack_batch(struct pbuf **pkts, pkt_meta_t *meta,
+                        uint16_t count, uint64_t *pass_mask)
+{
+    if (!ct_table) {
+        return;
+    }
+
+    uint32_t now = ct_now_ms();
+    uint64_t todo = *pass_mask;
+
+    ct_sweep(now);
+
+    while (todo) {
+        int i = __builtin_ctzll(todo);
+        todo &= todo - 1;
+
+        if (!ct_track(&meta[i], now, false)) {
+            *pass_mask &= ~(1ULL << i);
+        }
+    }
+}
+
+void nf_conntrack_confirm(const pkt_meta_t *meta)
+{
+    ct_key_t key;
+    ct_entry_t *free_slot;
+    uint32_t now = ct_now_ms();
+
+    ct_key(meta, &key);
+
+    /* An earlier packet of the flow may have been confirmed since */
+    if (!ct_lookup(&key, now, &free_slot)) {
+        ct_insert(&key, free_slot, false, now);
+    }
+}
+
+void nf_conntrack_confirm_batch(const pkt_meta_t *meta, uint64_t pass_mask)
+{
+    while (pass_mask) {
+        int i = __builtin_ctzll(pass_mask);
+        pass_mask &= pass_mask - 1;
+
+        if (meta[i].flags & PKT_F_CT_NEW) {
+            nf_conntrack_confirm(&meta[i]);
+        }
+    }
+}
+
+/* lwIP's own segments, so flows it terminates see both directions */
+static err_t ct_linkoutput(struct netif *netif, struct pbuf *p)
+{
+    if (ct_table) {
+        pkt_meta_t meta;
+
+        pkt_parse(p, &meta);
+        ct_track(&meta, ct_now_ms(), true);
+    }
+    return original_linkoutput(netif, p);
+}
+
+int nf_conntrack_attach(struct netif *netif)
+{
+    if (!netif || !netif->linkoutput) {
+        printf("[CONNTRACK] ERROR: netif has no linkoutput\n");
+        return -1;
+    }
+    if (original_linkoutput) {
+        printf("[CONNTRACK] ERROR: Already attached\n");
+        return -1;
+    }
+
+    original_linkoutput = netif->linkoutput;
+    netif->linkoutput = ct_linkoutput;
+    printf("[CONNTRACK] Tracking egress on %c%c\n", netif->name[0], netif->name[1]);
+    return 0;
+}
+
+int nf_conntrack_set_timeout(ct_timeout_t which, uint32_t seconds)
+{
+    if (which >= CT_TIMEOUT_MAX || seconds == 0 || seconds > 86400) {
+        return -1;
+    }
+
+    ct_timeouts_ms[which] = seconds * 1000;
+    printf("[CONNTRACK] %s timeout set to %u s\n",
+           which == CT_TIMEOUT_TCP_EST ? "TCP" : "UDP", seconds);
+    return 0;
+}
+
+void nf_conntrack_set_strict(bool strict)
+{
+    ct_strict = strict;
+    printf("[CONNTRACK] Strict mode %s\n", strict ? "on" : "off");
+}
+
+void nf_conntrack_flush(void)
+{
+    if (!ct_table) {
+        return;
+    }
+
+    memset(ct_table, 0, (ct_bucket_mask + 1) * sizeof(ct_bucket_t));
+    ct_stats.active = 0;
+    printf("[CONNTRACK] Table flushed\n");
+}
+
+ct_stats_t nf_conntrack_get_stats(void)
+{
+    return ct_stats;
+}
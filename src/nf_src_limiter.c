@@ -0,0 +1,244 @@
+#include "loom/nf_src_limiter.h"
+#include "loom/clock.h"
+#include "loom/event_log.h"
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Per-source packet counts are kept in a count-min sketch so memory stays
+ * fixed no matter how many (possibly spoofed) sources show up. Two sketches
+ * cover the current and the previous one-second window; the rate of a
+ * source is estimated as current + previous weighted by how much of the
+ * previous window still overlaps a sliding one-second view.
+ */
+#define CMS_DEPTH 4
+#define CMS_WIDTH 4096          /* Must be a power of two */
+#define CMS_MASK (CMS_WIDTH - 1)
+
+#define SRC_WINDOW_NS LOOM_NSEC_PER_SEC
+
+typedef struct {
+    uint32_t counters[CMS_DEPTH][CMS_WIDTH];
+} cms_t;
+
+static cms_t sketches[2];
+static int current = 0;
+static uint64_t window_start_ns = 0;
+
+static uint32_t limit_pps = 0;
+static uint64_t dropped = 0;
+
+static const uint64_t row_seeds[CMS_DEPTH] = {
+    0x9e3779b97f4a7c15ULL,
+    0xc2b2ae3d27d4eb4fULL,
+    0x165667b19e3779f9ULL,
+    0xd6e8feb86659fd93ULL,
+};
+
+/* Heavy hitters of the window in progress and of the last complete one */
+static src_heavy_hitter_t topk[SRC_LIMITER_TOPK];
+static int topk_count = 0;
+static uint32_t topk_min = 0;
+static src_heavy_hitter_t topk_prev[SRC_LIMITER_TOPK];
+static int topk_prev_count = 0;
+
+static inline uint32_t cms_index(int row, uint32_t ip)
+{
+    return (uint32_t)(((uint64_t)ip * row_seeds[row]) >> 40) & CMS_MASK;
+}
+
+void nf_src_limiter_init(void)
+{
+    memset(sketches, 0, sizeof(sketches));
+    memset(topk, 0, sizeof(topk));
+    memset(topk_prev, 0, sizeof(topk_prev));
+    current = 0;
+    window_start_ns = loom_now_ns();
+    topk_count = 0;
+    topk_min = 0;
+    topk_prev_count = 0;
+    dropped = 0;
+}
+
+static void src_window_rotate(uint64_t now)
+{
+    uint64_t elapsed = now - window_start_ns;
+
+    if (elapsed < SRC_WINDOW_NS) {
+        return;
+    }
+
+    memcpy(topk_prev, topk, sizeof(topk));
+    topk_prev_count = topk_count;
+    topk_count = 0;
+    topk_min = 0;
+
+    current ^= 1;
+    if (elapsed >= 2 * SRC_WINDOW_NS) {
+        /* Idle for more than a window: nothing left to carry over */
+        memset(&sketches[current ^ 1], 0, sizeof(cms_t));
+    }
+    memset(&sketches[current], 0, sizeof(cms_t));
+    window_start_ns = now - (elapsed % SRC_WINDOW_NS);
+}
+
+static void topk_update(uint32_t ip, uint32_t estimate)
+{
+    int min_index = 0;
+
+    for (int i = 0; i < topk_count; i++) {
+        if (topk[i].ip == ip) {
+            topk[i].estimate = estimate;
+            return;
+        }
+        if (topk[i].estimate < topk[min_index].estimate) {
+            min_index = i;
+        }
+    }
+
+    if (topk_count < SRC_LIMITER_TOPK) {
+        topk[topk_count].ip = ip;
+        topk[topk_count].estimate = estimate;
+        topk_count++;
+    } else {
+        topk[min_index].ip = ip;
+        topk[min_index].estimate = estimate;
+    }
+
+    if (topk_count == SRC_LIMITER_TOPK) {
+        topk_min = topk[0].estimate;
+        for (int i = 1; i < topk_count; i++) {
+            if (topk[i].estimate < topk_min) {
+                topk_min = topk[i].estimate;
+            }
+        }
+    }
+}
+
+/* prev_weight is the overlap of the previous window, scaled by 2^16 */
+static bool src_check(uint32_t ip, uint32_t prev_weight)
+{
+    cms_t *cur = &sketches[current];
+    cms_t *prev = &sketches[current ^ 1];
+    uint32_t *cells[CMS_DEPTH];
+    uint32_t cur_min = UINT32_MAX;
+    uint32_t prev_min = UINT32_MAX;
+
+    for (int row = 0; row < CMS_DEPTH; row++) {
+        uint32_t index = cms_index(row, ip);
+        cells[row] = &cur->counters[row][index];
+        if (*cells[row] < cur_min) {
+            cur_min = *cells[row];
+        }
+        if (prev->counters[row][index] < prev_min) {
+            prev_min = prev->counters[row][index];
+        }
+    }
+
+    /* Conservative update: only raise the counters that hold the minimum */
+    uint32_t count = cur_min + 1;
+    for (int row = 0; row < CMS_DEPTH; row++) {
+        if (*cells[row] < count) {
+            *cells[row] = count;
+        }
+    }
+
+    if (count > topk_min) {
+        topk_update(ip, count);
+    }
+
+    uint64_t rate = count + (((uint64_t)prev_min * prev_weight) >> 16);
+    if (rate > limit_pps) {
+        dropped++;
+        event_log_record(EVENT_DROP_SRC_LIMIT, NULL, 0, ip);
+        return false;
+    }
+    return true;
+}
+
+static uint32_t src_prev_weight(uint64_t now)
+{
+    uint64_t elapsed = now - window_start_ns;
+    if (elapsed >= SRC_WINDOW_NS) {
+        return 0;
+    }
+    return (uint32_t)(((SRC_WINDOW_NS - elapsed) << 16) / SRC_WINDOW_NS);
+}
+
+bool nf_src_limiter(struct pbuf *p, pkt_meta_t *meta)
+{
+    if (limit_pps == 0 || !(meta->flags & PKT_F_IPV4)) {
+        return true;
+    }
+
+    uint64_t now = loom_now_ns();
+    src_window_rotate(now);
+    return src_check(meta->src_ip, src_prev_weight(now));
+}
+
+void nf_src_limiter_batch(struct pbuf **pkts, pkt_meta_t *meta,
+                          uint16_t count, uint64_t *pass_mask)
+{
+    if (limit_pps == 0) {
+        return;
+    }
+
+    /* One clock read and one window check for the whole batch */
+    uint64_t now = loom_now_ns();
+    src_window_rotate(now);
+    uint32_t prev_weight = src_prev_weight(now);
+    uint64_t todo = *pass_mask;
+
+    while (todo) {
+        int i = __builtin_ctzll(todo);
+        todo &= todo - 1;
+
+        if ((meta[i].flags & PKT_F_IPV4) &&
+            !src_check(meta[i].src_ip, prev_weight)) {
+            *pass_mask &= ~(1ULL << i);
+        }
+    }
+}
+
+void nf_src_limiter_set_limit(uint32_t packets_per_sec)
+{
+    limit_pps = packets_per_sec;
+
+    if (packets_per_sec == 0) {
+        printf("[SRC_LIMITER] Disabled\n");
+    } else {
+        printf("[SRC_LIMITER] Limit set to %u pps per source\n", packets_per_sec);
+    }
+}
+
+uint32_t nf_src_limiter_get_limit(void)
+{
+    return limit_pps;
+}
+
+uint64_t nf_src_limiter_dropped(void)
+{
+    return dropped;
+}
+
+int nf_src_limiter_top(src_heavy_hitter_t *out, int max)
+{
+    int n = topk_prev_count < max ? topk_prev_count : max;
+    src_heavy_hitter_t sorted[SRC_LIMITER_TOPK];
+
+    memcpy(sorted, topk_prev, sizeof(sorted));
+
+    /* Tiny array, insertion sort by estimate descending */
+    for (int i = 1; i < topk_prev_count; i++) {
+        src_heavy_hitter_t key = sorted[i];
+        int j = i - 1;
+        while (j >= 0 && sorted[j].estimate < key.estimate) {
+            sorted[j + 1] = sorted[j];
+            j--;
+        }
+        sorted[j + 1] = key;
+    }
+
+    memcpy(out, sorted, n * sizeof(*out));
+    return n;
+}
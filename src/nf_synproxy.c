@@ -0,0 +1,901 @@
+#include "loom/nf_synproxy.h"
+#include "loom/capture.h"
+#include "loom/clock.h"
+#include "loom/mempool.h"
+#include "loom/nf_chain.h"
+#include "loom/worker.h"
+#include <stdio.h>
+#include <string.h>
+#include "lwip/prot/ethernet.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+
+#define SP_MAX_PROBE 8          /* Slots probed per lookup/insert */
+#define SP_SWEEP_SLOTS 8        /* Slots checked for expiry per batch */
+#define SP_LANE_GROUP 8         /* Cookies hashed per vector, divides NF_BATCH_MAX */
+
+/*
+ * Cookie layout: 6 bits of epoch, 2 bits of MSS index and 24 bits of
+ * HalfSipHash over the 4-tuple and the client's ISN, keyed per epoch.
+ * Cookies from the current and the previous epoch are accepted. The MSS
+ * bits are not covered by the hash; a client can only pick another entry
+ * of the table, which its own SYN could have asked for anyway.
+ */
+#define SP_EPOCH_SHIFT 36       /* 2^36 ns, about 69 s */
+#define SP_EPOCH_MASK 0x3fU
+#define SP_HASH_MASK 0x00ffffffU
+#define SP_COOKIE_EPOCH(c) ((c) >> 26)
+#define SP_COOKIE_MSS(c) (((c) >> 24) & 3)
+
+#define SP_TIMEOUT_REPLAY_MS 5000
+#define SP_TIMEOUT_EST_MS (3600 * 1000)
+#define SP_TIMEOUT_CLOSE_MS 60000
+
+/* Advertised until lwIP's first segment carries its own window */
+#define SP_SYNACK_WND 8192
+
+static const uint16_t sp_mss_table[4] = { 536, 1220, 1440, 1460 };
+
+typedef enum {
+    SP_FREE = 0,
+    SP_REPLAYED,                /* SYN handed to lwIP, waiting for its SYN-ACK */
+    SP_ESTABLISHED,
+    SP_CLOSING,
+} sp_state_t;
+
+/* Flow flags */
+#define SP_F_FIN_IN     0x01
+#define SP_F_FIN_OUT    0x02
+
+typedef struct {
+    uint32_t client_ip;         /* Network byte order */
+    uint32_t local_ip;
+    uint16_t client_port;       /* Host byte order */
+    uint16_t local_port;
+    uint8_t state;
+    uint8_t flags;
+    uint16_t client_wnd;        /* Host byte order, from the client's ACK */
+    uint32_t client_isn;
+    uint32_t cookie;            /* Our ISN as the client knows it */
+    uint32_t delta;             /* cookie - lwIP's ISN */
+    uint32_t expires_ms;
+} sp_flow_t;
+
+typedef struct {
+    uint64_t epoch;
+    uint32_t k0;
+    uint32_t k1;
+} sp_key_t;
+
+/* Verdicts of sp_classify() */
+typedef enum {
+    SP_DROP = 0,
+    SP_PASS,
+    SP_SYN,                     /* Answer with a cookie, then drop */
+} sp_verdict_t;
+
+/* SYNs of one batch, one array per hash input for sp_hash_lanes() */
+typedef struct {
+    uint32_t src_ip[NF_BATCH_MAX];
+    uint32_t dst_ip[NF_BATCH_MAX];
+    uint32_t ports[NF_BATCH_MAX];
+    uint32_t isn[NF_BATCH_MAX];
+    uint32_t hash[NF_BATCH_MAX];
+    uint16_t index[NF_BATCH_MAX];
+} sp_lanes_t;
+
+/* Frame built by sp_build(): Ethernet, IPv4 and a TCP header, no payload */
+typedef struct {
+    const uint8_t *eth_dst;
+    const uint8_t *eth_src;
+    uint32_t src_ip;            /* Network byte order */
+    uint32_t dst_ip;
+    uint16_t src_port;          /* Host byte order */
+    uint16_t dst_port;
+    uint32_t seq;
+    uint32_t ack;
+    uint16_t wnd;
+    uint16_t mss;               /* MSS option when non-zero */
+    uint8_t flags;
+} sp_segment_t;
+
+static struct netif *sp_netif = NULL;
+static netif_linkoutput_fn original_linkoutput = NULL;
+
+static sp_flow_t *flows = NULL;
+static uint32_t flow_mask = 0;
+static uint32_t sweep_cursor = 0;
+
+static bool sp_enabled = false;
+static uint64_t protected_ports[65536 / 64];
+static uint32_t num_protected = 0;
+
+static uint32_t boot_key[2];
+static sp_key_t epoch_keys[2];
+
+static sp_lanes_t lanes[LOOM_MAX_WORKERS];
+
+static synproxy_stats_t sp_stats;
+
+static inline uint32_t sp_ms(uint64_t now_ns)
+{
+    return (uint32_t)(now_ns / 1000000ULL);
+}
+
+static inline bool sp_expired(const sp_flow_t *f, uint32_t now)
+{
+    return (int32_t)(f->expires_ms - now) <= 0;
+}
+
+static inline bool sp_is_protected(uint16_t port)
+{
+    return (protected_ports[port / 64] >> (port % 64)) & 1;
+}
+
+#define SP_ROTL(x, b) (((x) << (b)) | ((x) >> (32 - (b))))
+
+#define SP_HSIP_ROUND() do {                                        \
+        v0 += v1; v1 = SP_ROTL(v1, 5); v1 ^= v0; v0 = SP_ROTL(v0, 16); \
+        v2 += v3; v3 = SP_ROTL(v3, 8); v3 ^= v2;                    \
+        v0 += v3; v3 = SP_ROTL(v3, 7); v3 ^= v0;                    \
+        v2 += v1; v1 = SP_ROTL(v1, 13); v1 ^= v2; v2 = SP_ROTL(v2, 16); \
+    } while (0)
+
+#define SP_HSIP_WORD(m) do { v3 ^= (m); SP_HSIP_ROUND(); v0 ^= (m); } while (0)
+
+/*
+ * HalfSipHash-1-3 of four words. T is uint32_t or a GCC vector of them:
+ * only add, xor and shifts, so the same code hashes one cookie or a
+ * whole lane group at once.
+ */
+#define SP_HALFSIPHASH(T, out, k0, k1, a, b, c, d) do {              \
+        T v0 = (T){0} + (k0);                                       \
+        T v1 = (T){0} + (k1);                                       \
+        T v2 = v0 ^ 0x6c796765U;                                    \
+        T v3 = v1 ^ 0x74656462U;                                    \
+        SP_HSIP_WORD(a);                                            \
+        SP_HSIP_WORD(b);                                            \
+        SP_HSIP_WORD(c);                                            \
+        SP_HSIP_WORD(d);                                            \
+        SP_HSIP_WORD(16U << 24);        /* Message length */        \
+        v2 ^= 0xff;                                                 \
+        SP_HSIP_ROUND();                                            \
+        SP_HSIP_ROUND();                                            \
+        SP_HSIP_ROUND();                                            \
+        (out) = v1 ^ v3;                                            \
+    } while (0)
+
+typedef uint32_t sp_vec_t __attribute__((vector_size(SP_LANE_GROUP * 4)));
+
+static inline uint32_t sp_hash4(uint32_t k0, uint32_t k1, uint32_t a,
+                                uint32_t b, uint32_t c, uint32_t d)
+{
+    uint32_t hash;
+
+    SP_HALFSIPHASH(uint32_t, hash, k0, k1, a, b, c, d);
+    return hash;
+}
+
+/* Whole groups, lanes past count are hashed and ignored */
+static void sp_hash_lanes(const sp_key_t *key, sp_lanes_t *l, uint16_t count)
+{
+    for (uint32_t base = 0; base < count; base += SP_LANE_GROUP) {
+        sp_vec_t a, b, c, d, hash;
+
+        memcpy(&a, &l->src_ip[base], sizeof(a));
+        memcpy(&b, &l->dst_ip[base], sizeof(b));
+        memcpy(&c, &l->ports[base], sizeof(c));
+        memcpy(&d, &l->isn[base], sizeof(d));
+        SP_HALFSIPHASH(sp_vec_t, hash, key->k0, key->k1, a, b, c, d);
+        memcpy(&l->hash[base], &hash, sizeof(hash));
+    }
+}
+
+/* Derived from the boot key once per epoch, not per cookie */
+static const sp_key_t *sp_epoch_key(uint64_t epoch)
+{
+    sp_key_t *key = &epoch_keys[epoch & 1];
+
+    if (__atomic_load_n(&key->epoch, __ATOMIC_ACQUIRE) != epoch) {
+        key->k0 = sp_hash4(boot_key[0], boot_key[1], (uint32_t)epoch,
+                           (uint32_t)(epoch >> 32), 0, 0);
+        key->k1 = sp_hash4(boot_key[0], boot_key[1], (uint32_t)epoch,
+                           (uint32_t)(epoch >> 32), 1, 0);
+        __atomic_store_n(&key->epoch, epoch, __ATOMIC_RELEASE);
+    }
+    return key;
+}
+
+static inline uint32_t sp_ports(const pkt_meta_t *meta)
+{
+    return ((uint32_t)meta->src_port << 16) | meta->dst_port;
+}
+
+static bool sp_cookie_check(const pkt_meta_t *meta, uint32_t isn,
+                            uint32_t cookie, uint64_t now_ns)
+{
+    uint64_t epoch = now_ns >> SP_EPOCH_SHIFT;
+    uint32_t age = ((uint32_t)epoch - SP_COOKIE_EPOCH(cookie)) & SP_EPOCH_MASK;
+
+    if (age > 1 || age > epoch) {
+        return false;
+    }
+
+    const sp_key_t *key = sp_epoch_key(epoch - age);
+    uint32_t hash = sp_hash4(key->k0, key->k1, meta->src_ip, meta->dst_ip,
+                             sp_ports(meta), isn);
+
+    return ((hash ^ cookie) & SP_HASH_MASK) == 0;
+}
+
+static uint32_t sp_csum_add(uint32_t sum, const void *data, uint16_t len)
+{
+    const uint8_t *b = data;
+
+    for (; len > 1; b += 2, len -= 2) {
+        sum += ((uint32_t)b[0] << 8) | b[1];
+    }
+    if (len) {
+        sum += (uint32_t)b[0] << 8;
+    }
+    return sum;
+}
+
+static uint16_t sp_csum_fold(uint32_t sum)
+{
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+/* RFC 1624 update for a 32-bit field, all values as stored in the header */
+static inline uint16_t sp_csum_update4(uint16_t csum, uint32_t from, uint32_t to)
+{
+    uint32_t sum = (uint16_t)~csum;
+
+    sum += (uint16_t)~from + (uint16_t)~(from >> 16);
+    sum += (to & 0xffff) + (to >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+static inline struct tcp_hdr *sp_tcp(struct pbuf *p, const pkt_meta_t *meta)
+{
+    return (struct tcp_hdr *)((uint8_t *)p->payload + meta->l4_offset);
+}
+
+static uint16_t sp_syn_mss(const struct tcp_hdr *tcp, uint16_t avail)
+{
+    const uint8_t *opt = (const uint8_t *)tcp + TCP_HLEN;
+    int len = TCPH_HDRLEN_BYTES(tcp) - TCP_HLEN;
+
+    if (len > avail - TCP_HLEN) {
+        len = avail - TCP_HLEN;
+    }
+
+    for (int i = 0; i < len;) {
+        if (opt[i] == 0) {
+            break;
+        }
+        if (opt[i] == 1) {
+            i++;
+            continue;
+        }
+        if (i + 1 >= len || opt[i + 1] < 2) {
+            break;
+        }
+        if (opt[i] == 2 && opt[i + 1] == 4 && i + 4 <= len) {
+            return ((uint16_t)opt[i + 2] << 8) | opt[i + 3];
+        }
+        i += opt[i + 1];
+    }
+
+    return sp_mss_table[0];
+}
+
+static uint32_t sp_mss_index(uint16_t mss)
+{
+    uint32_t idx = 0;
+
+    while (idx < 3 && sp_mss_table[idx + 1] <= mss) {
+        idx++;
+    }
+    return idx;
+}
+
+static uint16_t sp_local_mss(void)
+{
+    return sp_netif->mtu > 40 ? sp_netif->mtu - 40 : 1460;
+}
+
+static struct pbuf *sp_build(const sp_segment_t *seg)
+{
+    uint16_t tcp_len = TCP_HLEN + (seg->mss ? 4 : 0);
+    uint16_t ip_len = IP_HLEN + tcp_len;
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, SIZEOF_ETH_HDR + ip_len, PBUF_RAM);
+
+    if (!p) {
+        sp_stats.tx_failed++;
+        return NULL;
+    }
+
+    uint8_t *data = (uint8_t *)p->payload;
+
+    struct eth_hdr *eth = (struct eth_hdr *)data;
+    memcpy(eth->dest.addr, seg->eth_dst, ETH_HWADDR_LEN);
+    memcpy(eth->src.addr, seg->eth_src, ETH_HWADDR_LEN);
+    eth->type = PP_HTONS(ETHTYPE_IP);
+
+    struct ip_hdr *ip = (struct ip_hdr *)(data + SIZEOF_ETH_HDR);
+    memset(ip, 0, IP_HLEN);
+    IPH_VHL_SET(ip, 4, IP_HLEN / 4);
+    IPH_LEN(ip) = lwip_htons(ip_len);
+    IPH_OFFSET(ip) = PP_HTONS(IP_DF);
+    IPH_TTL(ip) = 64;
+    IPH_PROTO(ip) = IP_PROTO_TCP;
+    ip->src.addr = seg->src_ip;
+    ip->dest.addr = seg->dst_ip;
+    IPH_CHKSUM(ip) = lwip_htons(sp_csum_fold(sp_csum_add(0, ip, IP_HLEN)));
+
+    struct tcp_hdr *tcp = (struct tcp_hdr *)((uint8_t *)ip + IP_HLEN);
+    memset(tcp, 0, tcp_len);
+    tcp->src = lwip_htons(seg->src_port);
+    tcp->dest = lwip_htons(seg->dst_port);
+    tcp->seqno = lwip_htonl(seg->seq);
+    tcp->ackno = lwip_htonl(seg->ack);
+    TCPH_HDRLEN_FLAGS_SET(tcp, tcp_len / 4, seg->flags);
+    tcp->wnd = lwip_htons(seg->wnd);
+
+    if (seg->mss) {
+        uint8_t *opt = (uint8_t *)tcp + TCP_HLEN;
+        opt[0] = 2;
+        opt[1] = 4;
+        opt[2] = (uint8_t)(seg->mss >> 8);
+        opt[3] = (uint8_t)seg->mss;
+    }
+
+    /* Pseudo header: both addresses, protocol and TCP length */
+    uint32_t sum = sp_csum_add(IP_PROTO_TCP + tcp_len, &ip->src, 8);
+    tcp->chksum = lwip_htons(sp_csum_fold(sp_csum_add(sum, tcp, tcp_len)));
+
+    return p;
+}
+
+static void sp_transmit(struct pbuf *p)
+{
+    if (!p) {
+        return;
+    }
+    if (original_linkoutput(sp_netif, p) != ERR_OK) {
+        sp_stats.tx_failed++;
+    }
+    pbuf_free(p);
+}
+
+/* Into lwIP past the capture hook, as if it had come off the wire */
+static void sp_deliver(struct pbuf *p)
+{
+    if (p && capture_deliver(p) != ERR_OK) {
+        sp_stats.tx_failed++;
+    }
+}
+
+static inline uint32_t sp_flow_hash(uint32_t client_ip, uint16_t client_port,
+                                    uint16_t local_port)
+{
+    uint64_t h = ((uint64_t)client_ip << 32) |
+                 ((uint32_t)client_port << 16) | local_port;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
+
+static sp_flow_t *sp_lookup(uint32_t client_ip, uint16_t client_port,
+                            uint32_t local_ip, uint16_t local_port, uint32_t now)
+{
+    uint32_t hash = sp_flow_hash(client_ip, client_port, local_port);
+
+    for (uint32_t i = 0; i < SP_MAX_PROBE; i++) {
+        sp_flow_t *f = &flows[(hash + i) & flow_mask];
+
+        if (f->state != SP_FREE && f->client_ip == client_ip &&
+            f->client_port == client_port && f->local_port == local_port &&
+            f->local_ip == local_ip && !sp_expired(f, now)) {
+            return f;
+        }
+    }
+    return NULL;
+}
+
+static void sp_free(sp_flow_t *f)
+{
+    f->state = SP_FREE;
+    sp_stats.active--;
+}
+
+static void sp_sweep(uint32_t now)
+{
+    for (int i = 0; i < SP_SWEEP_SLOTS; i++) {
+        sp_flow_t *f = &flows[sweep_cursor++ & flow_mask];
+
+        if (f->state != SP_FREE && sp_expired(f, now)) {
+            sp_free(f);
+        }
+    }
+}
+
+static sp_flow_t *sp_insert(const pkt_meta_t *meta, uint32_t now)
+{
+    uint32_t hash = sp_flow_hash(meta->src_ip, meta->src_port, meta->dst_port);
+
+    sp_sweep(now);
+
+    for (uint32_t i = 0; i < SP_MAX_PROBE; i++) {
+        sp_flow_t *f = &flows[(hash + i) & flow_mask];
+
+        if (f->state != SP_FREE && !sp_expired(f, now)) {
+            continue;
+        }
+        if (f->state == SP_FREE) {
+            sp_stats.active++;
+        }
+
+        memset(f, 0, sizeof(*f));
+        f->client_ip = meta->src_ip;
+        f->local_ip = meta->dst_ip;
+        f->client_port = meta->src_port;
+        f->local_port = meta->dst_port;
+        return f;
+    }
+
+    sp_stats.table_full++;
+    return NULL;
+}
+
+static void sp_track_close(sp_flow_t *f, uint8_t tcp_flags, uint8_t fin_flag,
+                           uint32_t now)
+{
+    if (tcp_flags & TCP_FIN) {
+        f->flags |= fin_flag;
+    }
+    if ((tcp_flags & TCP_RST) ||
+        (f->flags & (SP_F_FIN_IN | SP_F_FIN_OUT)) == (SP_F_FIN_IN | SP_F_FIN_OUT)) {
+        f->state = SP_CLOSING;
+    }
+
+    /* Still translated while closing, lwIP may not agree the flow is over */
+    f->expires_ms = now + (f->state == SP_CLOSING ? SP_TIMEOUT_CLOSE_MS
+                                                  : SP_TIMEOUT_EST_MS);
+}
+
+/* A packet of a proxied flow on its way to lwIP */
+static bool sp_inbound(sp_flow_t *f, struct pbuf *p, pkt_meta_t *meta,
+                       uint32_t now)
+{
+    /* The client retransmits whatever it sent before lwIP caught up */
+    if (f->state == SP_REPLAYED) {
+        if (meta->tcp_flags & TCP_RST) {
+            sp_free(f);
+        }
+        return false;
+    }
+
+    if (meta->tcp_flags & TCP_ACK) {
+        struct tcp_hdr *tcp = sp_tcp(p, meta);
+        uint32_t from = tcp->ackno;
+        uint32_t to = lwip_htonl(lwip_ntohl(from) - f->delta);
+
+        tcp->ackno = to;
+        tcp->chksum = sp_csum_update4(tcp->chksum, from, to);
+    }
+
+    meta->flags |= PKT_F_PROXIED;
+    sp_track_close(f, meta->tcp_flags, SP_F_FIN_IN, now);
+    return true;
+}
+
+/*
+ * The ACK completing a cookie handshake: lwIP gets the client's SYN
+ * rebuilt from it, the ACK itself is dropped and sent again once lwIP
+ * has answered. Data riding on it is retransmitted by the client.
+ */
+static bool sp_handshake(struct pbuf *p, const pkt_meta_t *meta,
+                         uint64_t now_ns)
+{
+    const struct tcp_hdr *tcp = sp_tcp(p, meta);
+    uint32_t isn = lwip_ntohl(tcp->seqno) - 1;
+    uint32_t cookie = lwip_ntohl(tcp->ackno) - 1;
+
+    if (!sp_cookie_check(meta, isn, cookie, now_ns)) {
+        sp_stats.invalid++;
+        return false;
+    }
+    if (meta->flags & PKT_F_GENERATED) {
+        return true;
+    }
+
+    sp_flow_t *f = sp_insert(meta, sp_ms(now_ns));
+    if (!f) {
+        return true;
+    }
+
+    f->state = SP_REPLAYED;
+    f->client_isn = isn;
+    f->cookie = cookie;
+    f->client_wnd = lwip_ntohs(tcp->wnd);
+    f->expires_ms = sp_ms(now_ns) + SP_TIMEOUT_REPLAY_MS;
+    sp_stats.valid++;
+
+    const uint8_t *eth = (const uint8_t *)p->payload;
+    sp_segment_t syn = {
+        .eth_dst = eth,
+        .eth_src = eth + ETH_HWADDR_LEN,
+        .src_ip = meta->src_ip,
+        .dst_ip = meta->dst_ip,
+        .src_port = meta->src_port,
+        .dst_port = meta->dst_port,
+        .seq = isn,
+        .wnd = f->client_wnd,
+        .mss = sp_mss_table[SP_COOKIE_MSS(cookie)],
+        .flags = TCP_SYN,
+    };
+    sp_deliver(sp_build(&syn));
+    return true;
+}
+
+static void sp_send_cookie(struct pbuf *p, const pkt_meta_t *meta,
+                           uint32_t hash, uint64_t now_ns)
+{
+    const struct tcp_hdr *tcp = sp_tcp(p, meta);
+    uint32_t isn = lwip_ntohl(tcp->seqno);
+    uint32_t mss = sp_mss_index(sp_syn_mss(tcp, p->len - meta->l4_offset));
+    uint32_t epoch = (uint32_t)(now_ns >> SP_EPOCH_SHIFT) & SP_EPOCH_MASK;
+    const uint8_t *eth = (const uint8_t *)p->payload;
+
+    sp_segment_t synack = {
+        .eth_dst = eth + ETH_HWADDR_LEN,
+        .eth_src = sp_netif->hwaddr,
+        .src_ip = meta->dst_ip,
+        .dst_ip = meta->src_ip,
+        .src_port = meta->dst_port,
+        .dst_port = meta->src_port,
+        .seq = (epoch << 26) | (mss << 24) | (hash & SP_HASH_MASK),
+        .ack = isn + 1,
+        .wnd = SP_SYNACK_WND,
+        .mss = sp_local_mss(),
+        .flags = TCP_SYN | TCP_ACK,
+    };
+    struct pbuf *q = sp_build(&synack);
+
+    /* Built all the same, so generated floods cost what real ones do */
+    if (q && (meta->flags & PKT_F_GENERATED)) {
+        pbuf_free(q);
+    } else {
+        sp_transmit(q);
+    }
+    sp_stats.syns++;
+}
+
+static sp_verdict_t sp_classify(struct pbuf *p, pkt_meta_t *meta,
+                                uint64_t now_ns)
+{
+    if ((meta->flags & (PKT_F_L4 | PKT_F_FRAG)) != PKT_F_L4 ||
+        meta->proto != IP_PROTO_TCP ||
+        meta->dst_ip != netif_ip4_addr(sp_netif)->addr) {
+        return SP_PASS;
+    }
+
+    bool protect = sp_enabled && sp_is_protected(meta->dst_port);
+
+    if (sp_stats.active) {
+        sp_flow_t *f = sp_lookup(meta->src_ip, meta->src_port, meta->dst_ip,
+                                 meta->dst_port, sp_ms(now_ns));
+        if (f) {
+            return sp_inbound(f, p, meta, sp_ms(now_ns)) ? SP_PASS : SP_DROP;
+        }
+    }
+
+    if (!protect) {
+        return SP_PASS;
+    }
+
+    /* Anything else without a flow is left to lwIP, which resets it */
+    switch (meta->tcp_flags & (TCP_SYN | TCP_ACK | TCP_RST | TCP_FIN)) {
+    case TCP_SYN:
+        return SP_SYN;
+    case TCP_ACK:
+        return sp_handshake(p, meta, now_ns) ? SP_DROP : SP_PASS;
+    default:
+        return SP_PASS;
+    }
+}
+
+bool nf_synproxy(struct pbuf *p, pkt_meta_t *meta)
+{
+    if (!sp_netif || (!sp_enabled && sp_stats.active == 0)) {
+        return true;
+    }
+
+    uint64_t now_ns = loom_now_ns();
+    sp_verdict_t verdict = sp_classify(p, meta, now_ns);
+
+    if (verdict == SP_SYN) {
+        const sp_key_t *key = sp_epoch_key(now_ns >> SP_EPOCH_SHIFT);
+        const struct tcp_hdr *tcp = sp_tcp(p, meta);
+        uint32_t hash = sp_hash4(key->k0, key->k1, meta->src_ip, meta->dst_ip,
+                                 sp_ports(meta), lwip_ntohl(tcp->seqno));
+        sp_send_cookie(p, meta, hash, now_ns);
+        return false;
+    }
+    return verdict == SP_PASS;
+}
+
+void nf_synproxy_batch(struct pbuf **pkts, pkt_meta_t *meta,
+                       uint16_t count, uint64_t *pass_mask)
+{
+    if (!sp_netif || (!sp_enabled && sp_stats.active == 0)) {
+        return;
+    }
+
+    uint64_t now_ns = loom_now_ns();
+    sp_lanes_t *l = &lanes[loom_worker()];
+    uint16_t syns = 0;
+
+    for (uint16_t i = 0; i < count; i++) {
+        if (!(*pass_mask & (1ULL << i))) {
+            continue;
+        }
+
+        switch (sp_classify(pkts[i], &meta[i], now_ns)) {
+        case SP_PASS:
+            continue;
+        case SP_SYN: {
+            const struct tcp_hdr *tcp = sp_tcp(pkts[i], &meta[i]);
+            l->src_ip[syns] = meta[i].src_ip;
+            l->dst_ip[syns] = meta[i].dst_ip;
+            l->ports[syns] = sp_ports(&meta[i]);
+            l->isn[syns] = lwip_ntohl(tcp->seqno);
+            l->index[syns] = i;
+            syns++;
+            break;
+        }
+        case SP_DROP:
+            break;
+        }
+        *pass_mask &= ~(1ULL << i);
+    }
+
+    if (syns) {
+        sp_hash_lanes(sp_epoch_key(now_ns >> SP_EPOCH_SHIFT), l, syns);
+        for (uint16_t j = 0; j < syns; j++) {
+            uint16_t i = l->index[j];
+            sp_send_cookie(pkts[i], &meta[i], l->hash[j], now_ns);
+        }
+    }
+
+    if (sp_stats.active) {
+        sp_sweep(sp_ms(now_ns));
+    }
+}
+
+/* lwIP answered the replayed SYN: take its ISN and finish the handshake */
+static void sp_established(sp_flow_t *f, struct pbuf *p, const pkt_meta_t *meta,
+                           uint32_t now)
+{
+    const struct tcp_hdr *tcp = sp_tcp(p, meta);
+    uint32_t isn = lwip_ntohl(tcp->seqno);
+    const uint8_t *eth = (const uint8_t *)p->payload;
+
+    f->delta = f->cookie - isn;
+    f->state = SP_ESTABLISHED;
+    f->expires_ms = now + SP_TIMEOUT_EST_MS;
+    sp_stats.established++;
+
+    sp_segment_t ack = {
+        .eth_dst = eth + ETH_HWADDR_LEN,
+        .eth_src = eth,
+        .src_ip = f->client_ip,
+        .dst_ip = f->local_ip,
+        .src_port = f->client_port,
+        .dst_port = f->local_port,
+        .seq = f->client_isn + 1,
+        .ack = isn + 1,
+        .wnd = f->client_wnd,
+        .flags = TCP_ACK,
+    };
+    sp_deliver(sp_build(&ack));
+}
+
+/* lwIP refused the replayed SYN, the client already thinks it is connected */
+static void sp_refused(sp_flow_t *f, struct pbuf *p)
+{
+    const uint8_t *eth = (const uint8_t *)p->payload;
+
+    sp_segment_t rst = {
+        .eth_dst = eth,
+        .eth_src = eth + ETH_HWADDR_LEN,
+        .src_ip = f->local_ip,
+        .dst_ip = f->client_ip,
+        .src_port = f->local_port,
+        .dst_port = f->client_port,
+        .seq = f->cookie + 1,
+        .flags = TCP_RST,
+    };
+    sp_transmit(sp_build(&rst));
+    sp_free(f);
+}
+
+/*
+ * lwIP keeps its segments for retransmission, so the sequence number is
+ * rewritten in a copy rather than in the frame lwIP handed us.
+ */
+static err_t sp_outbound(sp_flow_t *f, struct netif *netif, struct pbuf *p,
+                         const pkt_meta_t *meta, uint32_t now)
+{
+    struct pbuf *q = pbuf_alloc(PBUF_RAW, p->tot_len, PBUF_RAM);
+
+    if (!q) {
+        sp_stats.tx_failed++;
+        return ERR_MEM;
+    }
+    pbuf_copy_partial(p, q->payload, p->tot_len, 0);
+
+    struct tcp_hdr *tcp = sp_tcp(q, meta);
+    uint32_t from = tcp->seqno;
+    uint32_t to = lwip_htonl(lwip_ntohl(from) + f->delta);
+
+    tcp->seqno = to;
+    tcp->chksum = sp_csum_update4(tcp->chksum, from, to);
+    sp_track_close(f, meta->tcp_flags, SP_F_FIN_OUT, now);
+
+    err_t err = original_linkoutput(netif, q);
+    pbuf_free(q);
+    return err;
+}
+
+static err_t sp_linkoutput(struct netif *netif, struct pbuf *p)
+{
+    if (sp_stats.active == 0) {
+        return original_linkoutput(netif, p);
+    }
+
+    pkt_meta_t meta;
+    pkt_parse(p, &meta);
+
+    if ((meta.flags & (PKT_F_L4 | PKT_F_FRAG)) != PKT_F_L4 ||
+        meta.proto != IP_PROTO_TCP ||
+        meta.src_ip != netif_ip4_addr(sp_netif)->addr) {
+        return original_linkoutput(netif, p);
+    }
+
+    uint32_t now = sp_ms(loom_now_ns());
+    sp_flow_t *f = sp_lookup(meta.dst_ip, meta.dst_port, meta.src_ip,
+                             meta.src_port, now);
+
+    if (!f) {
+        return original_linkoutput(netif, p);
+    }
+
+    if (f->state == SP_REPLAYED) {
+        if ((meta.tcp_flags & (TCP_SYN | TCP_ACK)) == (TCP_SYN | TCP_ACK)) {
+            sp_established(f, p, &meta, now);
+        } else if (meta.tcp_flags & TCP_RST) {
+            sp_refused(f, p);
+        }
+        return ERR_OK;
+    }
+
+    return sp_outbound(f, netif, p, &meta, now);
+}
+
+int nf_synproxy_init(struct netif *netif, uint32_t capacity)
+{
+    uint32_t slots = 1;
+
+    if (!netif || !netif->linkoutput) {
+        printf("[SYNPROXY] ERROR: netif has no linkoutput\n");
+        return -1;
+    }
+
+    if (flows) {
+        printf("[SYNPROXY] ERROR: Already initialized\n");
+        return -1;
+    }
+
+    while (slots < capacity) {
+        slots <<= 1;
+    }
+
+    void *table = mem_reserve("synproxy", slots * sizeof(sp_flow_t));
+    if (!table) {
+        printf("[SYNPROXY] ERROR: Failed to allocate %u flows\n", slots);
+        return -1;
+    }
+
+    memset(table, 0, slots * sizeof(sp_flow_t));
+    memset(&sp_stats, 0, sizeof(sp_stats));
+
+    flows = (sp_flow_t *)table;
+    flow_mask = slots - 1;
+    sweep_cursor = 0;
+    sp_stats.capacity = slots;
+
+    uint64_t t0 = loom_cycles();
+    uint32_t r0 = 0, r1 = 0;
+#ifdef LWIP_RAND
+    r0 = LWIP_RAND();
+    r1 = LWIP_RAND();
+#endif
+    uint64_t t1 = loom_now_ns();
+    boot_key[0] = sp_hash4(r0, r1, (uint32_t)t0, (uint32_t)(t0 >> 32),
+                           (uint32_t)t1, (uint32_t)(uintptr_t)table);
+    boot_key[1] = sp_hash4(r1, r0, (uint32_t)t1, (uint32_t)(t1 >> 32),
+                           (uint32_t)loom_cycles(), boot_key[0]);
+    epoch_keys[0].epoch = epoch_keys[1].epoch = UINT64_MAX;
+
+    sp_netif = netif;
+    original_linkoutput = netif->linkoutput;
+    netif->linkoutput = sp_linkoutput;
+
+    printf("[SYNPROXY] Initialized: %u flows (%u KiB)\n", slots,
+           (unsigned)(slots * sizeof(sp_flow_t) / 1024));
+    return 0;
+}
+
+void nf_synproxy_set_enabled(bool enabled)
+{
+    sp_enabled = enabled;
+    printf("[SYNPROXY] %s\n", enabled ? "Enabled" : "Disabled");
+}
+
+int nf_synproxy_protect(uint16_t port, bool protect)
+{
+    uint64_t bit = 1ULL << (port % 64);
+
+    if (port == 0) {
+        return -1;
+    }
+
+    if (protect && !sp_is_protected(port)) {
+        protected_ports[port / 64] |= bit;
+        num_protected++;
+    } else if (!protect && sp_is_protected(port)) {
+        protected_ports[port / 64] &= ~bit;
+        num_protected--;
+    }
+    return 0;
+}
+
+int nf_synproxy_ports(uint16_t *out, int max)
+{
+    int count = 0;
+
+    for (uint32_t w = 0; w < 65536 / 64; w++) {
+        for (uint64_t bits = protected_ports[w]; bits; bits &= bits - 1) {
+            if (count < max) {
+                out[count] = (uint16_t)(w * 64 + __builtin_ctzll(bits));
+            }
+            count++;
+        }
+    }
+    return count;
+}
+
+bool nf_synproxy_answers(const pkt_meta_t *meta)
+{
+    return sp_netif && sp_enabled && sp_is_protected(meta->dst_port) &&
+           meta->dst_ip == netif_ip4_addr(sp_netif)->addr;
+}
+
+synproxy_stats_t nf_synproxy_get_stats(void)
+{
+    synproxy_stats_t stats = sp_stats;
+
+    stats.enabled = sp_enabled;
+    stats.ports = num_protected;
+    return stats;
+}
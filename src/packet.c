@@ -0,0 +1,105 @@
+#include "loom/packet.h"
+#include "lwip/def.h"
+#include "lwip/prot/ethernet.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+#include "lwip/prot/udp.h"
+
+void pkt_parse(const struct pbuf *p, pkt_meta_t *meta)
+{
+    /* Only the first pbuf segment is inspected, headers never straddle it */
+    pkt_parse_buf((const uint8_t *)p->payload, p->len, p->tot_len, meta);
+}
+
+void pkt_parse_buf(const uint8_t *data, uint16_t len, uint16_t tot_len,
+                   pkt_meta_t *meta)
+{
+    meta->ethertype = 0;
+    meta->pkt_len = tot_len;
+    meta->l3_offset = SIZEOF_ETH_HDR;
+    meta->l4_offset = 0;
+    meta->l4_len = 0;
+    meta->proto = 0;
+    meta->flags = 0;
+    meta->tcp_flags = 0;
+    meta->drop_reason = PKT_DROP_NONE;
+    meta->src_ip = 0;
+    meta->dst_ip = 0;
+    meta->src_port = 0;
+    meta->dst_port = 0;
+
+    if (len < SIZEOF_ETH_HDR) {
+        return;
+    }
+
+    const struct eth_hdr *eth = (const struct eth_hdr *)data;
+    meta->ethertype = lwip_ntohs(eth->type);
+
+    if (meta->ethertype != ETHTYPE_IP || len < SIZEOF_ETH_HDR + IP_HLEN) {
+        return;
+    }
+
+    const struct ip_hdr *ip = (const struct ip_hdr *)(data + SIZEOF_ETH_HDR);
+    uint16_t ip_hlen = IPH_HL(ip) * 4;
+
+    if (IPH_V(ip) != 4 || ip_hlen < IP_HLEN || len < SIZEOF_ETH_HDR + ip_hlen) {
+        return;
+    }
+
+    uint16_t ip_len = lwip_ntohs(IPH_LEN(ip));
+    uint16_t frag = lwip_ntohs(IPH_OFFSET(ip));
+
+    meta->flags |= PKT_F_IPV4;
+    meta->proto = IPH_PROTO(ip);
+    meta->src_ip = ip->src.addr;
+    meta->dst_ip = ip->dest.addr;
+    meta->l4_offset = SIZEOF_ETH_HDR + ip_hlen;
+    meta->l4_len = ip_len > ip_hlen ? ip_len - ip_hlen : 0;
+
+    if (frag & (IP_MF | IP_OFFMASK)) {
+        meta->flags |= PKT_F_FRAG;
+    }
+
+    /* Non-first fragments carry no L4 header */
+    if (frag & IP_OFFMASK) {
+        return;
+    }
+
+    const uint8_t *l4 = data + meta->l4_offset;
+
+    if (meta->proto == IP_PROTO_TCP) {
+        if (len < meta->l4_offset + TCP_HLEN) {
+            return;
+        }
+        const struct tcp_hdr *tcp = (const struct tcp_hdr *)l4;
+        meta->src_port = lwip_ntohs(tcp->src);
+        meta->dst_port = lwip_ntohs(tcp->dest);
+        meta->tcp_flags = TCPH_FLAGS(tcp);
+        meta->flags |= PKT_F_L4;
+    } else if (meta->proto == IP_PROTO_UDP) {
+        if (len < meta->l4_offset + UDP_HLEN) {
+            return;
+        }
+        const struct udp_hdr *udp = (const struct udp_hdr *)l4;
+        meta->src_port = lwip_ntohs(udp->src);
+        meta->dst_port = lwip_ntohs(udp->dest);
+        meta->flags |= PKT_F_L4;
+    }
+}
+
+const char *pkt_drop_name(pkt_drop_t reason)
+{
+    static const char *names[PKT_DROP_MAX] = {
+        [PKT_DROP_NONE] = "none",
+        [PKT_DROP_ACL] = "acl",
+        [PKT_DROP_SYNPROXY] = "synproxy",
+        [PKT_DROP_CONNTRACK] = "conntrack",
+        [PKT_DROP_SRC_LIMIT] = "src_limiter",
+        [PKT_DROP_RATE_LIMIT] = "rate_limiter",
+        [PKT_DROP_ALLOWLIST] = "allowlist",
+        [PKT_DROP_OTHER] = "other",
+    };
+
+    return reason < PKT_DROP_MAX ? names[reason] : "unknown";
+}
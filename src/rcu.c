@@ -0,0 +1,33 @@
+#include "loom/rcu.h"
+#include <uk/sched.h>
+
+unsigned int rcu_epoch = 0;
+unsigned long rcu_readers[2] = {0, 0};
+
+static int rcu_writer = 0;
+
+static void rcu_wait_readers(unsigned int epoch)
+{
+    while (__atomic_load_n(&rcu_readers[epoch], __ATOMIC_SEQ_CST) != 0) {
+        uk_sched_yield();
+    }
+}
+
+void rcu_synchronize(void)
+{
+    while (__atomic_exchange_n(&rcu_writer, 1, __ATOMIC_ACQUIRE)) {
+        uk_sched_yield();
+    }
+
+    /*
+     * Flip twice: a reader may have sampled the epoch just before the first
+     * flip and only registered itself afterwards, so both counters have to
+     * drain once before every pre-existing reader is known to be gone.
+     */
+    for (int phase = 0; phase < 2; phase++) {
+        unsigned int old = __atomic_fetch_add(&rcu_epoch, 1, __ATOMIC_SEQ_CST) & 1;
+        rcu_wait_readers(old);
+    }
+
+    __atomic_store_n(&rcu_writer, 0, __ATOMIC_RELEASE);
+}
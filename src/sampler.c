@@ -0,0 +1,345 @@
+#include "loom/sampler.h"
+#include "loom/clock.h"
+#include "loom/control.h"
+#include "loom/mempool.h"
+#include "loom/worker.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "lwip/sys.h"
+
+#ifdef CONFIG_APPLOOM_SAMPLE_RING_SIZE
+#define SAMPLE_RING_SIZE CONFIG_APPLOOM_SAMPLE_RING_SIZE
+#else
+#define SAMPLE_RING_SIZE 1024
+#endif
+#define SAMPLE_RING_MASK (SAMPLE_RING_SIZE - 1)
+
+_Static_assert((SAMPLE_RING_SIZE & SAMPLE_RING_MASK) == 0,
+               "SAMPLE_RING_SIZE must be a power of two");
+
+/* How often an idle stream looks at the ring and the client */
+#define SAMPLE_POLL_MS 20
+
+/* Frames per send() */
+#define SAMPLE_SEND_BATCH 32
+
+/* pcap with nanosecond timestamps, Ethernet link type */
+#define PCAP_MAGIC_NSEC 0xa1b23c4dU
+#define PCAP_LINKTYPE_ETHERNET 1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+} pcap_file_hdr_t;
+
+typedef struct {
+    uint32_t ts_sec;
+    uint32_t ts_nsec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+} pcap_rec_hdr_t;
+
+typedef struct {
+    uint64_t seq;               /* position + 1 once the frame is written */
+    uint64_t timestamp_ns;
+    uint16_t orig_len;
+    uint16_t cap_len;
+    uint8_t data[SAMPLER_SNAPLEN];
+} sample_slot_t;
+
+/* Per worker so the 1-in-N countdown never bounces between cores */
+typedef struct {
+    uint32_t skip;
+} __attribute__((aligned(64))) sample_worker_t;
+
+bool sampler_armed = false;
+
+static sample_slot_t *ring = NULL;
+static uint64_t ring_head = 0;
+
+static sample_worker_t workers[LOOM_MAX_WORKERS];
+
+static bool enabled = false;
+static bool streaming = false;
+static sampler_filter_t filter;
+
+static uint64_t streamed = 0;
+static uint64_t lost = 0;
+
+static void sampler_update_armed(void)
+{
+    __atomic_store_n(&sampler_armed, ring && enabled && streaming,
+                     __ATOMIC_RELEASE);
+}
+
+static bool sampler_match(const sampler_filter_t *f, const pkt_meta_t *meta,
+                          bool passed)
+{
+    if (f->drops_only && passed) {
+        return false;
+    }
+    if (f->proto && meta->proto != f->proto) {
+        return false;
+    }
+    if (f->port && (!(meta->flags & PKT_F_L4) ||
+                    (meta->src_port != f->port && meta->dst_port != f->port))) {
+        return false;
+    }
+    if (f->host && (!(meta->flags & PKT_F_IPV4) ||
+                    (meta->src_ip != f->host && meta->dst_ip != f->host))) {
+        return false;
+    }
+    return true;
+}
+
+void sampler_offer_batch(struct pbuf **pkts, const pkt_meta_t *meta,
+                         uint16_t count, uint64_t pass_mask)
+{
+    sample_worker_t *w = &workers[loom_worker()];
+    sampler_filter_t f = filter;
+    uint16_t keep[64];
+    uint16_t n = 0;
+
+    for (uint16_t i = 0; i < count && i < 64; i++) {
+        if (!sampler_match(&f, &meta[i], pass_mask & (1ULL << i))) {
+            continue;
+        }
+        if (f.every > 1) {
+            if (w->skip > 0) {
+                w->skip--;
+                continue;
+            }
+            w->skip = f.every - 1;
+        }
+        keep[n++] = i;
+    }
+
+    if (n == 0) {
+        return;
+    }
+
+    /* One reservation for the whole batch */
+    uint64_t pos = __atomic_fetch_add(&ring_head, n, __ATOMIC_RELAXED);
+    uint64_t now = loom_now_ns();
+
+    for (uint16_t k = 0; k < n; k++, pos++) {
+        struct pbuf *p = pkts[keep[k]];
+        sample_slot_t *slot = &ring[pos & SAMPLE_RING_MASK];
+        uint16_t cap = p->tot_len < SAMPLER_SNAPLEN ? p->tot_len : SAMPLER_SNAPLEN;
+
+        __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        slot->timestamp_ns = now;
+        slot->orig_len = p->tot_len;
+        slot->cap_len = pbuf_copy_partial(p, slot->data, cap, 0);
+        __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    }
+}
+
+static int send_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *ptr = buf;
+
+    while (len > 0) {
+        ssize_t n = send(fd, ptr, len, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        ptr += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Appends the frames from *cursor on to out as pcap records */
+static size_t sampler_format(uint64_t *cursor, uint8_t *out, size_t len,
+                             uint64_t *frames)
+{
+    uint64_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+    size_t used = 0;
+
+    if (head - *cursor > SAMPLE_RING_SIZE) {
+        __atomic_fetch_add(&lost, head - *cursor - SAMPLE_RING_SIZE,
+                           __ATOMIC_RELAXED);
+        *cursor = head - SAMPLE_RING_SIZE;
+    }
+
+    while (*cursor < head &&
+           len - used >= sizeof(pcap_rec_hdr_t) + SAMPLER_SNAPLEN) {
+        sample_slot_t *slot = &ring[*cursor & SAMPLE_RING_MASK];
+        pcap_rec_hdr_t *rec = (pcap_rec_hdr_t *)(out + used);
+
+        /* Still being written: try again on the next pass */
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != *cursor + 1) {
+            break;
+        }
+        uint64_t ts = slot->timestamp_ns;
+        uint16_t cap = slot->cap_len;
+        rec->orig_len = slot->orig_len;
+        memcpy(rec + 1, slot->data, cap);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        /* Overwritten while we copied it */
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != *cursor + 1) {
+            __atomic_fetch_add(&lost, 1, __ATOMIC_RELAXED);
+            (*cursor)++;
+            continue;
+        }
+
+        rec->ts_sec = (uint32_t)(ts / LOOM_NSEC_PER_SEC);
+        rec->ts_nsec = (uint32_t)(ts % LOOM_NSEC_PER_SEC);
+        rec->incl_len = cap;
+        used += sizeof(*rec) + cap;
+        (*frames)++;
+        (*cursor)++;
+    }
+
+    return used;
+}
+
+/* True once the client has closed its side or the connection failed */
+static bool sampler_client_gone(int fd)
+{
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_DONTWAIT);
+
+    return n == 0 || (n < 0 && errno != EWOULDBLOCK && errno != EAGAIN);
+}
+
+static void sampler_stream(int fd)
+{
+    static uint8_t out[SAMPLE_SEND_BATCH * (sizeof(pcap_rec_hdr_t) + SAMPLER_SNAPLEN)];
+    pcap_file_hdr_t hdr = {
+        .magic = PCAP_MAGIC_NSEC,
+        .version_major = 2,
+        .version_minor = 4,
+        .snaplen = SAMPLER_SNAPLEN,
+        .network = PCAP_LINKTYPE_ETHERNET,
+    };
+
+    if (send_all(fd, &hdr, sizeof(hdr)) < 0) {
+        return;
+    }
+
+    /* Only what is sampled from now on */
+    uint64_t cursor = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+
+    streaming = true;
+    sampler_update_armed();
+
+    while (1) {
+        uint64_t frames = 0;
+        size_t len = sampler_format(&cursor, out, sizeof(out), &frames);
+
+        if (len > 0) {
+            if (send_all(fd, out, len) < 0) {
+                break;
+            }
+            __atomic_fetch_add(&streamed, frames, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if (sampler_client_gone(fd)) {
+            break;
+        }
+        sys_msleep(SAMPLE_POLL_MS);
+    }
+
+    streaming = false;
+    sampler_update_armed();
+}
+
+/* One client at a time, the next one waits in the listen backlog */
+static void sampler_thread(void *arg)
+{
+    int port = (int)(intptr_t)arg;
+    int server_fd = control_listen(port);
+
+    if (server_fd < 0) {
+        return;
+    }
+
+    printf("[SAMPLER] pcap stream listening on port %d\n", port);
+
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_fd = accept(server_fd, (struct sockaddr *)&client_addr,
+                               &client_len);
+
+        if (client_fd < 0) {
+            printf("[SAMPLER] ERROR: Could not accept connection\n");
+            continue;
+        }
+
+        printf("[SAMPLER] Streaming to a client\n");
+        sampler_stream(client_fd);
+        close(client_fd);
+        printf("[SAMPLER] Client gone\n");
+    }
+}
+
+int sampler_init(uint16_t port)
+{
+    ring = mem_reserve("sampler", SAMPLE_RING_SIZE * sizeof(sample_slot_t));
+    if (!ring) {
+        printf("[SAMPLER] ERROR: Could not reserve the ring\n");
+        return -1;
+    }
+    memset(ring, 0, SAMPLE_RING_SIZE * sizeof(sample_slot_t));
+    ring_head = 0;
+
+    sys_thread_t thread = sys_thread_new("sampler",
+                                          sampler_thread,
+                                          (void *)(intptr_t)port,
+                                          4096,
+                                          3);
+
+    if (thread == NULL) {
+        printf("[SAMPLER] ERROR: Could not create stream thread\n");
+        return -1;
+    }
+
+    printf("[SAMPLER] Initialized: %d frames of %d bytes (%zu KiB)\n",
+           SAMPLE_RING_SIZE, SAMPLER_SNAPLEN,
+           SAMPLE_RING_SIZE * sizeof(sample_slot_t) / 1024);
+    return 0;
+}
+
+void sampler_set_enabled(bool on)
+{
+    enabled = on;
+    sampler_update_armed();
+    printf("[SAMPLER] %s\n", on ? "Enabled" : "Disabled");
+}
+
+void sampler_set_filter(const sampler_filter_t *f)
+{
+    for (unsigned int i = 0; i < LOOM_MAX_WORKERS; i++) {
+        workers[i].skip = 0;
+    }
+    filter = *f;
+}
+
+sampler_stats_t sampler_get_stats(void)
+{
+    sampler_stats_t stats = {
+        .enabled = enabled,
+        .streaming = streaming,
+        .filter = filter,
+        .ring_size = ring ? SAMPLE_RING_SIZE : 0,
+        .sampled = __atomic_load_n(&ring_head, __ATOMIC_RELAXED),
+        .streamed = __atomic_load_n(&streamed, __ATOMIC_RELAXED),
+        .lost = __atomic_load_n(&lost, __ATOMIC_RELAXED),
+    };
+    return stats;
+}
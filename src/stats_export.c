@@ -0,0 +1,910 @@
+#include "loom/stats_export.h"
+#include "loom/capture.h"
+#include "loom/classify.h"
+#include "loom/clock.h"
+#include "loom/control.h"
+#include "loom/event_log.h"
+#include "loom/fastpath.h"
+#include "loom/mempool.h"
+#include "loom/nf_acl.h"
+#include "loom/nf_chain.h"
+#include "loom/nf_conntrack.h"
+#include "loom/nf_src_limiter.h"
+#include "loom/nf_synproxy.h"
+#include "loom/sampler.h"
+#include "loom/flow_export.h"
+#include "loom/traffic_gen.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include "lwip/sys.h"
+
+#define STATS_HTTP_REQ_MAX 512
+
+/* A client gets this long to send its request, in total */
+#define STATS_HTTP_TIMEOUT_MS 1500
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t used;
+    bool overflow;
+} stats_buf_t;
+
+static void sb_printf(stats_buf_t *sb, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void sb_printf(stats_buf_t *sb, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (sb->overflow) {
+        return;
+    }
+
+    va_start(ap, fmt);
+    n = vsnprintf(sb->buf + sb->used, sb->len - sb->used, fmt, ap);
+    va_end(ap);
+
+    if (n < 0 || (size_t)n >= sb->len - sb->used) {
+        sb->overflow = true;
+        return;
+    }
+    sb->used += n;
+}
+
+static int sb_finish(stats_buf_t *sb)
+{
+    if (sb->overflow) {
+        sb->buf[0] = '\0';
+        return -1;
+    }
+    return (int)sb->used;
+}
+
+static const char *rate_mode_name(rate_limit_mode_t mode)
+{
+    return mode == RATE_LIMIT_BPS ? "bps" : "pps";
+}
+
+/* JSON */
+
+static void json_capture(stats_buf_t *sb)
+{
+    capture_stats_t cap = capture_get_stats();
+    capture_rates_t rates = capture_get_rates();
+
+    sb_printf(sb, "\"capture\":{\"classify\":\"%s\",\"packets\":%llu,"
+              "\"bytes\":%llu,"
+              "\"passed\":%llu,\"dropped\":%llu,\"forwarded\":%llu,"
+              "\"rates\":{\"window_ns\":%llu,\"pps\":%llu,\"bps\":%llu,"
+              "\"passed_pps\":%llu,\"dropped_pps\":%llu}}",
+              classify_impl_name(),
+              (unsigned long long)cap.total_packets,
+              (unsigned long long)cap.total_bytes,
+              (unsigned long long)cap.passed_packets,
+              (unsigned long long)cap.dropped_packets,
+              (unsigned long long)cap.forwarded_packets,
+              (unsigned long long)rates.window_ns,
+              (unsigned long long)rates.pps,
+              (unsigned long long)rates.bps,
+              (unsigned long long)rates.passed_pps,
+              (unsigned long long)rates.dropped_pps);
+}
+
+static void json_fastpath(stats_buf_t *sb)
+{
+    fastpath_stats_t fp = fastpath_get_stats();
+
+    sb_printf(sb, ",\"fastpath\":{\"running\":%s", fp.running ? "true" : "false");
+    if (fp.running) {
+        sb_printf(sb, ",\"ports\":%u,\"workers\":%u,\"poll_mode\":\"%s\","
+                  "\"idle_us\":%u,\"rx_intr\":%s,\"rx_packets\":%llu,"
+                  "\"rx_bursts\":%llu,\"passed\":%llu,\"dropped\":%llu,"
+                  "\"local\":%llu,\"local_failed\":%llu,\"transit\":%llu,"
+                  "\"forwarded\":%llu,\"tx_packets\":%llu,\"tx_dropped\":%llu,"
+                  "\"tx_no_port\":%llu,\"ttl_expired\":%llu,"
+                  "\"alloc_failed\":%llu,"
+                  "\"empty_polls\":%llu,\"sleeps\":%llu,\"wakeups\":%llu",
+                  fp.num_ports, fp.num_workers,
+                  fastpath_poll_mode_name(fp.poll_mode), fp.idle_us,
+                  fp.rx_intr ? "true" : "false",
+                  (unsigned long long)fp.rx_packets,
+                  (unsigned long long)fp.rx_bursts,
+                  (unsigned long long)fp.passed,
+                  (unsigned long long)fp.dropped,
+                  (unsigned long long)fp.local,
+                  (unsigned long long)fp.local_failed,
+                  (unsigned long long)fp.transit,
+                  (unsigned long long)fp.forwarded,
+                  (unsigned long long)fp.tx_packets,
+                  (unsigned long long)fp.tx_dropped,
+                  (unsigned long long)fp.tx_no_port,
+                  (unsigned long long)fp.ttl_expired,
+                  (unsigned long long)fp.alloc_failed,
+                  (unsigned long long)fp.empty_polls,
+                  (unsigned long long)fp.sleeps,
+                  (unsigned long long)fp.wakeups);
+    }
+    sb_printf(sb, "}");
+}
+
+static void json_nf(stats_buf_t *sb)
+{
+    const char *name;
+    bool enabled;
+    nf_stats_t stats;
+
+    sb_printf(sb, ",\"nf\":[");
+
+    for (int i = 0; nf_chain_get_info(i, &name, &enabled) == 0; i++) {
+        if (nf_chain_get_stats(i, &name, &stats) < 0) {
+            break;
+        }
+
+        sb_printf(sb, "%s{\"name\":\"%s\",\"enabled\":%s,\"packets\":%llu,"
+                  "\"dropped\":%llu,\"calls\":%llu,\"cycles\":%llu,"
+                  "\"cycles_log2_hist\":[",
+                  i ? "," : "", name, enabled ? "true" : "false",
+                  (unsigned long long)stats.packets_in,
+                  (unsigned long long)stats.packets_dropped,
+                  (unsigned long long)stats.invocations,
+                  (unsigned long long)stats.cycles);
+        for (int b = 0; b < NF_HIST_BUCKETS; b++) {
+            sb_printf(sb, "%s%llu", b ? "," : "",
+                      (unsigned long long)stats.cycles_hist[b]);
+        }
+        sb_printf(sb, "]}");
+    }
+
+    sb_printf(sb, "]");
+}
+
+static void json_drops(stats_buf_t *sb)
+{
+    uint64_t drops[PKT_DROP_MAX];
+
+    nf_chain_get_drops(drops);
+    sb_printf(sb, ",\"drops\":{");
+    for (int r = PKT_DROP_NONE + 1; r < PKT_DROP_MAX; r++) {
+        sb_printf(sb, "%s\"%s\":%llu", r > PKT_DROP_NONE + 1 ? "," : "",
+                  pkt_drop_name(r), (unsigned long long)drops[r]);
+    }
+    sb_printf(sb, "},\"drop_events\":{");
+    for (int r = 0; r < EVENT_REASON_MAX; r++) {
+        event_counters_t counters = event_log_counters(r);
+        sb_printf(sb, "%s\"%s\":{\"logged\":%llu,\"suppressed\":%llu}",
+                  r ? "," : "", event_reason_name(r),
+                  (unsigned long long)counters.recorded,
+                  (unsigned long long)counters.suppressed);
+    }
+    sb_printf(sb, "}");
+}
+
+static void json_conntrack(stats_buf_t *sb)
+{
+    ct_stats_t ct = nf_conntrack_get_stats();
+
+    sb_printf(sb, ",\"conntrack\":{\"active\":%u,\"capacity\":%u,"
+              "\"created\":%llu,\"expired\":%llu,\"table_full\":%llu,"
+              "\"invalid\":%llu}",
+              ct.active, ct.capacity,
+              (unsigned long long)ct.created,
+              (unsigned long long)ct.expired,
+              (unsigned long long)ct.table_full,
+              (unsigned long long)ct.invalid);
+}
+
+static void json_synproxy(stats_buf_t *sb)
+{
+    synproxy_stats_t sp = nf_synproxy_get_stats();
+    uint16_t ports[64];
+    int n = nf_synproxy_ports(ports, 64);
+
+    sb_printf(sb, ",\"synproxy\":{\"enabled\":%s,\"ports\":[",
+              sp.enabled ? "true" : "false");
+    for (int i = 0; i < n && i < 64; i++) {
+        sb_printf(sb, "%s%u", i ? "," : "", ports[i]);
+    }
+    sb_printf(sb, "],\"active\":%u,\"capacity\":%u,\"syns\":%llu,"
+              "\"valid\":%llu,\"invalid\":%llu,\"established\":%llu,"
+              "\"table_full\":%llu,\"tx_failed\":%llu}",
+              sp.active, sp.capacity,
+              (unsigned long long)sp.syns,
+              (unsigned long long)sp.valid,
+              (unsigned long long)sp.invalid,
+              (unsigned long long)sp.established,
+              (unsigned long long)sp.table_full,
+              (unsigned long long)sp.tx_failed);
+}
+
+static void json_sampler(stats_buf_t *sb)
+{
+    sampler_stats_t st = sampler_get_stats();
+
+    sb_printf(sb, ",\"sampler\":{\"enabled\":%s,\"streaming\":%s,"
+              "\"every\":%u,\"drops_only\":%s,\"proto\":%u,\"port\":%u,"
+              "\"ring\":%u,\"sampled\":%llu,\"streamed\":%llu,\"lost\":%llu}",
+              st.enabled ? "true" : "false",
+              st.streaming ? "true" : "false",
+              st.filter.every > 1 ? st.filter.every : 1,
+              st.filter.drops_only ? "true" : "false",
+              st.filter.proto, st.filter.port, st.ring_size,
+              (unsigned long long)st.sampled,
+              (unsigned long long)st.streamed,
+              (unsigned long long)st.lost);
+}
+
+static void json_flows(stats_buf_t *sb)
+{
+    flow_stats_t st = flow_export_get_stats();
+
+    sb_printf(sb, ",\"flows\":{\"enabled\":%s,\"collector_port\":%u,"
+              "\"capacity\":%u,\"active\":%u,\"created\":%llu,"
+              "\"evicted\":%llu,\"exported\":%llu,\"datagrams\":%llu,"
+              "\"lost\":%llu,\"send_failed\":%llu}",
+              st.enabled ? "true" : "false", st.collector_port,
+              st.capacity, st.active,
+              (unsigned long long)st.created,
+              (unsigned long long)st.evicted,
+              (unsigned long long)st.exported,
+              (unsigned long long)st.datagrams,
+              (unsigned long long)st.lost,
+              (unsigned long long)st.send_failed);
+}
+
+static void json_src_limiter(stats_buf_t *sb)
+{
+    src_heavy_hitter_t top[SRC_LIMITER_TOPK];
+    int n = nf_src_limiter_top(top, SRC_LIMITER_TOPK);
+
+    sb_printf(sb, ",\"src_limiter\":{\"limit_pps\":%u,\"dropped\":%llu,\"top\":[",
+              nf_src_limiter_get_limit(),
+              (unsigned long long)nf_src_limiter_dropped());
+    for (int i = 0; i < n; i++) {
+        const uint8_t *ip = (const uint8_t *)&top[i].ip;
+        sb_printf(sb, "%s{\"ip\":\"%u.%u.%u.%u\",\"packets\":%u}",
+                  i ? "," : "", ip[0], ip[1], ip[2], ip[3], top[i].estimate);
+    }
+    sb_printf(sb, "]}");
+}
+
+static void json_acl(stats_buf_t *sb)
+{
+    sb_printf(sb, ",\"acl\":{\"active_rules\":%u,\"staged_rules\":%u,"
+              "\"default\":\"%s\"}",
+              nf_acl_active_rules(), nf_acl_staged_rules(),
+              nf_acl_get_default() == ACL_DENY ? "deny" : "allow");
+}
+
+static void json_rate_limits(stats_buf_t *sb)
+{
+    rate_limit_info_t limits[MAX_RATE_LIMITS];
+    int count = nf_rate_limiter_snapshot(limits, MAX_RATE_LIMITS);
+
+    sb_printf(sb, ",\"rate_limits\":[");
+    for (int i = 0; i < count && i < MAX_RATE_LIMITS; i++) {
+        sb_printf(sb, "%s{\"port\":%u,\"mode\":\"%s\",\"rate\":%u,"
+                  "\"burst\":%u,\"tokens\":%llu}",
+                  i ? "," : "", limits[i].port, rate_mode_name(limits[i].mode),
+                  limits[i].rate, limits[i].burst,
+                  (unsigned long long)limits[i].tokens);
+    }
+    sb_printf(sb, "]");
+}
+
+static void json_allowlist(stats_buf_t *sb, allow_range_t *ranges)
+{
+    int count = nf_allowlist_snapshot(ranges, STATS_EXPORT_MAX_RANGES);
+
+    sb_printf(sb, ",\"allowlist\":{\"ports\":%u,\"ranges_total\":%d,\"ranges\":[",
+              nf_allowlist_active_ports(), count);
+    for (int i = 0; i < count && i < STATS_EXPORT_MAX_RANGES; i++) {
+        sb_printf(sb, "%s{\"proto\":\"%s\",\"first\":%u,\"last\":%u}",
+                  i ? "," : "",
+                  ranges[i].protos == ALLOW_PROTO_TCP ? "tcp" : "udp",
+                  ranges[i].first, ranges[i].last);
+    }
+    sb_printf(sb, "]}");
+}
+
+static void json_traffic_gen(stats_buf_t *sb)
+{
+    traffic_gen_stats_t gen = traffic_gen_get_stats();
+
+    sb_printf(sb, ",\"traffic_gen\":{\"running\":%s,\"sent\":%llu,"
+              "\"passed\":%llu,\"bytes\":%llu,\"alloc_failed\":%llu,"
+              "\"elapsed_ns\":%llu}",
+              gen.running ? "true" : "false",
+              (unsigned long long)gen.sent,
+              (unsigned long long)gen.passed,
+              (unsigned long long)gen.bytes,
+              (unsigned long long)gen.alloc_failed,
+              (unsigned long long)gen.elapsed_ns);
+}
+
+static void json_memory(stats_buf_t *sb)
+{
+    size_t used, size;
+    mempool_t pool;
+
+    mem_arena_usage(&used, &size);
+    sb_printf(sb, ",\"memory\":{\"arena_used\":%zu,\"arena_size\":%zu,\"pools\":[",
+              used, size);
+    for (int i = 0; mempool_get_stats(i, &pool) == 0; i++) {
+        sb_printf(sb, "%s{\"name\":\"%s\",\"capacity\":%u,\"obj_size\":%zu,"
+                  "\"in_use\":%u,\"peak\":%u,\"allocs\":%llu,\"failed\":%llu}",
+                  i ? "," : "", pool.name, pool.capacity, pool.obj_size,
+                  pool.in_use, pool.peak,
+                  (unsigned long long)pool.allocs,
+                  (unsigned long long)pool.failed);
+    }
+    sb_printf(sb, "]}");
+}
+
+int stats_format_json(char *buf, size_t len)
+{
+    stats_buf_t sb = { .buf = buf, .len = len };
+    allow_range_t *ranges;
+
+    if (len == 0) {
+        return -1;
+    }
+
+    ranges = malloc(STATS_EXPORT_MAX_RANGES * sizeof(*ranges));
+    if (!ranges) {
+        buf[0] = '\0';
+        return -1;
+    }
+
+    sb_printf(&sb, "{");
+    json_capture(&sb);
+    json_fastpath(&sb);
+    json_nf(&sb);
+    json_drops(&sb);
+    json_conntrack(&sb);
+    json_synproxy(&sb);
+    json_sampler(&sb);
+    json_flows(&sb);
+    json_src_limiter(&sb);
+    json_acl(&sb);
+    json_rate_limits(&sb);
+    json_allowlist(&sb, ranges);
+    json_traffic_gen(&sb);
+    json_memory(&sb);
+    sb_printf(&sb, "}");
+
+    free(ranges);
+    return sb_finish(&sb);
+}
+
+/* Prometheus */
+
+#define PROM_METRIC(sb, name, type, help) \
+    sb_printf(sb, "# HELP loom_" name " " help "\n# TYPE loom_" name " " type "\n")
+
+static void prom_capture(stats_buf_t *sb)
+{
+    capture_stats_t cap = capture_get_stats();
+    capture_rates_t rates = capture_get_rates();
+
+    PROM_METRIC(sb, "packets_total", "counter",
+                "Packets seen by the capture hook, by verdict.");
+    sb_printf(sb, "loom_packets_total{verdict=\"passed\"} %llu\n",
+              (unsigned long long)cap.passed_packets);
+    sb_printf(sb, "loom_packets_total{verdict=\"dropped\"} %llu\n",
+              (unsigned long long)cap.dropped_packets);
+    sb_printf(sb, "loom_packets_total{verdict=\"forwarded\"} %llu\n",
+              (unsigned long long)cap.forwarded_packets);
+
+    PROM_METRIC(sb, "bytes_total", "counter", "Bytes seen by the capture hook.");
+    sb_printf(sb, "loom_bytes_total %llu\n", (unsigned long long)cap.total_bytes);
+
+    /* Prefer rate() over the counters; these are for one-shot readers */
+    PROM_METRIC(sb, "packet_rate_pps", "gauge",
+                "Packets per second over the last sampling window.");
+    sb_printf(sb, "loom_packet_rate_pps %llu\n", (unsigned long long)rates.pps);
+    PROM_METRIC(sb, "bit_rate_bps", "gauge",
+                "Bits per second over the last sampling window.");
+    sb_printf(sb, "loom_bit_rate_bps %llu\n", (unsigned long long)rates.bps);
+}
+
+static void prom_fastpath(stats_buf_t *sb)
+{
+    fastpath_stats_t fp = fastpath_get_stats();
+
+    PROM_METRIC(sb, "fastpath_running", "gauge",
+                "Whether the uknetdev fast path owns a device.");
+    sb_printf(sb, "loom_fastpath_running %d\n", fp.running);
+    if (!fp.running) {
+        return;
+    }
+
+    PROM_METRIC(sb, "fastpath_workers", "gauge", "Fast path worker threads.");
+    sb_printf(sb, "loom_fastpath_workers %u\n", fp.num_workers);
+
+    PROM_METRIC(sb, "fastpath_poll_mode", "gauge", "Current RX poll mode.");
+    sb_printf(sb, "loom_fastpath_poll_mode{mode=\"%s\",idle_us=\"%u\"} 1\n",
+              fastpath_poll_mode_name(fp.poll_mode), fp.idle_us);
+
+    PROM_METRIC(sb, "fastpath_packets_total", "counter",
+                "Fast path packets, by stage.");
+    sb_printf(sb,
+              "loom_fastpath_packets_total{stage=\"rx\"} %llu\n"
+              "loom_fastpath_packets_total{stage=\"passed\"} %llu\n"
+              "loom_fastpath_packets_total{stage=\"dropped\"} %llu\n"
+              "loom_fastpath_packets_total{stage=\"local\"} %llu\n"
+              "loom_fastpath_packets_total{stage=\"local_failed\"} %llu\n"
+              "loom_fastpath_packets_total{stage=\"transit\"} %llu\n"
+              "loom_fastpath_packets_total{stage=\"forwarded\"} %llu\n"
+              "loom_fastpath_packets_total{stage=\"tx\"} %llu\n"
+              "loom_fastpath_packets_total{stage=\"tx_ring_full\"} %llu\n"
+              "loom_fastpath_packets_total{stage=\"tx_no_port\"} %llu\n"
+              "loom_fastpath_packets_total{stage=\"ttl_expired\"} %llu\n"
+              "loom_fastpath_packets_total{stage=\"rx_no_buffer\"} %llu\n",
+              (unsigned long long)fp.rx_packets,
+              (unsigned long long)fp.passed,
+              (unsigned long long)fp.dropped,
+              (unsigned long long)fp.local,
+              (unsigned long long)fp.local_failed,
+              (unsigned long long)fp.transit,
+              (unsigned long long)fp.forwarded,
+              (unsigned long long)fp.tx_packets,
+              (unsigned long long)fp.tx_dropped,
+              (unsigned long long)fp.tx_no_port,
+              (unsigned long long)fp.ttl_expired,
+              (unsigned long long)fp.alloc_failed);
+
+    PROM_METRIC(sb, "fastpath_polls_total", "counter",
+                "RX polls, by outcome.");
+    sb_printf(sb,
+              "loom_fastpath_polls_total{outcome=\"burst\"} %llu\n"
+              "loom_fastpath_polls_total{outcome=\"empty\"} %llu\n",
+              (unsigned long long)fp.rx_bursts,
+              (unsigned long long)fp.empty_polls);
+
+    PROM_METRIC(sb, "fastpath_sleeps_total", "counter",
+                "Switches to interrupt mode, by how they ended.");
+    sb_printf(sb,
+              "loom_fastpath_sleeps_total{woken_by=\"rx\"} %llu\n"
+              "loom_fastpath_sleeps_total{woken_by=\"timeout\"} %llu\n",
+              (unsigned long long)fp.wakeups,
+              (unsigned long long)(fp.sleeps - fp.wakeups));
+}
+
+static void prom_nf(stats_buf_t *sb)
+{
+    const char *name;
+    bool enabled;
+    nf_stats_t stats;
+    int count = 0;
+
+    while (nf_chain_get_info(count, &name, &enabled) == 0) {
+        count++;
+    }
+
+    PROM_METRIC(sb, "nf_enabled", "gauge", "Whether the NF is in the active chain.");
+    for (int i = 0; i < count && nf_chain_get_info(i, &name, &enabled) == 0; i++) {
+        sb_printf(sb, "loom_nf_enabled{nf=\"%s\"} %d\n", name, enabled);
+    }
+
+    PROM_METRIC(sb, "nf_packets_total", "counter", "Packets handed to the NF.");
+    for (int i = 0; i < count && nf_chain_get_stats(i, &name, &stats) == 0; i++) {
+        sb_printf(sb, "loom_nf_packets_total{nf=\"%s\"} %llu\n",
+                  name, (unsigned long long)stats.packets_in);
+    }
+
+    PROM_METRIC(sb, "nf_dropped_total", "counter", "Packets dropped by the NF.");
+    for (int i = 0; i < count && nf_chain_get_stats(i, &name, &stats) == 0; i++) {
+        sb_printf(sb, "loom_nf_dropped_total{nf=\"%s\"} %llu\n",
+                  name, (unsigned long long)stats.packets_dropped);
+    }
+
+    /* Bucket b of cycles_hist holds [2^b, 2^(b+1)) cycles */
+    PROM_METRIC(sb, "nf_call_cycles", "histogram",
+                "TSC cycles per NF invocation (one batch or one packet).");
+    for (int i = 0; i < count && nf_chain_get_stats(i, &name, &stats) == 0; i++) {
+        uint64_t cumulative = 0;
+
+        for (int b = 0; b < NF_HIST_BUCKETS - 1; b++) {
+            cumulative += stats.cycles_hist[b];
+            sb_printf(sb, "loom_nf_call_cycles_bucket{nf=\"%s\",le=\"%llu\"} %llu\n",
+                      name, (unsigned long long)((2ULL << b) - 1),
+                      (unsigned long long)cumulative);
+        }
+        sb_printf(sb,
+                  "loom_nf_call_cycles_bucket{nf=\"%s\",le=\"+Inf\"} %llu\n"
+                  "loom_nf_call_cycles_sum{nf=\"%s\"} %llu\n"
+                  "loom_nf_call_cycles_count{nf=\"%s\"} %llu\n",
+                  name, (unsigned long long)stats.invocations,
+                  name, (unsigned long long)stats.cycles,
+                  name, (unsigned long long)stats.invocations);
+    }
+}
+
+static void prom_drops(stats_buf_t *sb)
+{
+    uint64_t drops[PKT_DROP_MAX];
+
+    nf_chain_get_drops(drops);
+    PROM_METRIC(sb, "dropped_packets_total", "counter",
+                "Packets dropped, by the NF that dropped them.");
+    for (int r = PKT_DROP_NONE + 1; r < PKT_DROP_MAX; r++) {
+        sb_printf(sb, "loom_dropped_packets_total{reason=\"%s\"} %llu\n",
+                  pkt_drop_name(r), (unsigned long long)drops[r]);
+    }
+    PROM_METRIC(sb, "drop_events_total", "counter",
+                "Drop events, by reason and whether they made it into the log.");
+    for (int r = 0; r < EVENT_REASON_MAX; r++) {
+        event_counters_t counters = event_log_counters(r);
+        sb_printf(sb,
+                  "loom_drop_events_total{reason=\"%s\",logged=\"true\"} %llu\n"
+                  "loom_drop_events_total{reason=\"%s\",logged=\"false\"} %llu\n",
+                  event_reason_name(r), (unsigned long long)counters.recorded,
+                  event_reason_name(r), (unsigned long long)counters.suppressed);
+    }
+}
+
+static void prom_tables(stats_buf_t *sb)
+{
+    ct_stats_t ct = nf_conntrack_get_stats();
+    synproxy_stats_t sp = nf_synproxy_get_stats();
+    rate_limit_info_t limits[MAX_RATE_LIMITS];
+    int count = nf_rate_limiter_snapshot(limits, MAX_RATE_LIMITS);
+
+    PROM_METRIC(sb, "conntrack_entries", "gauge", "Tracked flows.");
+    sb_printf(sb, "loom_conntrack_entries %u\n", ct.active);
+    PROM_METRIC(sb, "conntrack_capacity", "gauge", "Conntrack table size.");
+    sb_printf(sb, "loom_conntrack_capacity %u\n", ct.capacity);
+    PROM_METRIC(sb, "conntrack_events_total", "counter", "Conntrack events.");
+    sb_printf(sb,
+              "loom_conntrack_events_total{event=\"created\"} %llu\n"
+              "loom_conntrack_events_total{event=\"expired\"} %llu\n"
+              "loom_conntrack_events_total{event=\"table_full\"} %llu\n"
+              "loom_conntrack_events_total{event=\"invalid\"} %llu\n",
+              (unsigned long long)ct.created,
+              (unsigned long long)ct.expired,
+              (unsigned long long)ct.table_full,
+              (unsigned long long)ct.invalid);
+
+    PROM_METRIC(sb, "synproxy_flows", "gauge", "Flows opened through the SYN proxy.");
+    sb_printf(sb, "loom_synproxy_flows %u\n", sp.active);
+    PROM_METRIC(sb, "synproxy_events_total", "counter", "SYN proxy events.");
+    sb_printf(sb,
+              "loom_synproxy_events_total{event=\"syn\"} %llu\n"
+              "loom_synproxy_events_total{event=\"valid\"} %llu\n"
+              "loom_synproxy_events_total{event=\"invalid\"} %llu\n"
+              "loom_synproxy_events_total{event=\"established\"} %llu\n"
+              "loom_synproxy_events_total{event=\"table_full\"} %llu\n"
+              "loom_synproxy_events_total{event=\"tx_failed\"} %llu\n",
+              (unsigned long long)sp.syns,
+              (unsigned long long)sp.valid,
+              (unsigned long long)sp.invalid,
+              (unsigned long long)sp.established,
+              (unsigned long long)sp.table_full,
+              (unsigned long long)sp.tx_failed);
+
+    PROM_METRIC(sb, "src_limiter_limit_pps", "gauge",
+                "Per-source packet rate limit, 0 when disabled.");
+    sb_printf(sb, "loom_src_limiter_limit_pps %u\n", nf_src_limiter_get_limit());
+    PROM_METRIC(sb, "src_limiter_dropped_total", "counter",
+                "Packets dropped by the source limiter.");
+    sb_printf(sb, "loom_src_limiter_dropped_total %llu\n",
+              (unsigned long long)nf_src_limiter_dropped());
+
+    PROM_METRIC(sb, "acl_rules", "gauge", "ACL rules, active and staged.");
+    sb_printf(sb,
+              "loom_acl_rules{state=\"active\"} %u\n"
+              "loom_acl_rules{state=\"staged\"} %u\n",
+              nf_acl_active_rules(), nf_acl_staged_rules());
+    PROM_METRIC(sb, "acl_default_deny", "gauge",
+                "Whether packets matching no ACL rule are dropped.");
+    sb_printf(sb, "loom_acl_default_deny %d\n", nf_acl_get_default() == ACL_DENY);
+
+    PROM_METRIC(sb, "allowlist_ports", "gauge",
+                "Allowed (port, protocol) pairs, 0 allows everything.");
+    sb_printf(sb, "loom_allowlist_ports %u\n", nf_allowlist_active_ports());
+
+    PROM_METRIC(sb, "rate_limit", "gauge", "Configured per-port rate.");
+    for (int i = 0; i < count && i < MAX_RATE_LIMITS; i++) {
+        sb_printf(sb, "loom_rate_limit{port=\"%u\",mode=\"%s\"} %u\n",
+                  limits[i].port, rate_mode_name(limits[i].mode), limits[i].rate);
+    }
+    PROM_METRIC(sb, "rate_limit_tokens", "gauge",
+                "Tokens left in the port's buckets, summed over workers.");
+    for (int i = 0; i < count && i < MAX_RATE_LIMITS; i++) {
+        sb_printf(sb, "loom_rate_limit_tokens{port=\"%u\"} %llu\n",
+                  limits[i].port, (unsigned long long)limits[i].tokens);
+    }
+}
+
+static void prom_sampler(stats_buf_t *sb)
+{
+    sampler_stats_t st = sampler_get_stats();
+
+    PROM_METRIC(sb, "sampler_armed", "gauge",
+                "Whether frames are being sampled for a pcap client.");
+    sb_printf(sb, "loom_sampler_armed %d\n", st.enabled && st.streaming);
+    PROM_METRIC(sb, "sampler_frames_total", "counter",
+                "Sampled frames, by what became of them.");
+    sb_printf(sb,
+              "loom_sampler_frames_total{outcome=\"sampled\"} %llu\n"
+              "loom_sampler_frames_total{outcome=\"streamed\"} %llu\n"
+              "loom_sampler_frames_total{outcome=\"lost\"} %llu\n",
+              (unsigned long long)st.sampled,
+              (unsigned long long)st.streamed,
+              (unsigned long long)st.lost);
+}
+
+static void prom_flows(stats_buf_t *sb)
+{
+    flow_stats_t st = flow_export_get_stats();
+
+    PROM_METRIC(sb, "flows_active", "gauge",
+                "Flows held in the export tables.");
+    sb_printf(sb, "loom_flows_active %u\n", st.active);
+    PROM_METRIC(sb, "flows_total", "counter",
+                "Flows by lifecycle event.");
+    sb_printf(sb,
+              "loom_flows_total{event=\"created\"} %llu\n"
+              "loom_flows_total{event=\"evicted\"} %llu\n",
+              (unsigned long long)st.created,
+              (unsigned long long)st.evicted);
+    PROM_METRIC(sb, "flow_records_total", "counter",
+                "Flow records, by what became of them.");
+    sb_printf(sb,
+              "loom_flow_records_total{outcome=\"exported\"} %llu\n"
+              "loom_flow_records_total{outcome=\"lost\"} %llu\n",
+              (unsigned long long)st.exported,
+              (unsigned long long)st.lost);
+    PROM_METRIC(sb, "flow_datagrams_total", "counter",
+                "Datagrams sent to the flow collector.");
+    sb_printf(sb,
+              "loom_flow_datagrams_total{outcome=\"sent\"} %llu\n"
+              "loom_flow_datagrams_total{outcome=\"failed\"} %llu\n",
+              (unsigned long long)st.datagrams,
+              (unsigned long long)st.send_failed);
+}
+
+static void prom_memory(stats_buf_t *sb)
+{
+    size_t used, size;
+    mempool_t pool;
+
+    mem_arena_usage(&used, &size);
+    PROM_METRIC(sb, "arena_bytes", "gauge", "Boot arena size and usage.");
+    sb_printf(sb,
+              "loom_arena_bytes{state=\"used\"} %zu\n"
+              "loom_arena_bytes{state=\"total\"} %zu\n",
+              used, size);
+
+    PROM_METRIC(sb, "mempool_objects", "gauge", "Pool objects, by state.");
+    for (int i = 0; mempool_get_stats(i, &pool) == 0; i++) {
+        sb_printf(sb,
+                  "loom_mempool_objects{pool=\"%s\",state=\"in_use\"} %u\n"
+                  "loom_mempool_objects{pool=\"%s\",state=\"peak\"} %u\n"
+                  "loom_mempool_objects{pool=\"%s\",state=\"capacity\"} %u\n",
+                  pool.name, pool.in_use, pool.name, pool.peak,
+                  pool.name, pool.capacity);
+    }
+
+    PROM_METRIC(sb, "mempool_allocs_total", "counter",
+                "Pool allocations, by outcome.");
+    for (int i = 0; mempool_get_stats(i, &pool) == 0; i++) {
+        sb_printf(sb,
+                  "loom_mempool_allocs_total{pool=\"%s\",outcome=\"ok\"} %llu\n"
+                  "loom_mempool_allocs_total{pool=\"%s\",outcome=\"failed\"} %llu\n",
+                  pool.name, (unsigned long long)pool.allocs,
+                  pool.name, (unsigned long long)pool.failed);
+    }
+}
+
+static void prom_traffic_gen(stats_buf_t *sb)
+{
+    traffic_gen_stats_t gen = traffic_gen_get_stats();
+
+    PROM_METRIC(sb, "traffic_gen_running", "gauge",
+                "Whether the in-guest generator is running.");
+    sb_printf(sb, "loom_traffic_gen_running %d\n", gen.running);
+    PROM_METRIC(sb, "traffic_gen_packets_total", "counter",
+                "Generated packets, by verdict.");
+    sb_printf(sb,
+              "loom_traffic_gen_packets_total{verdict=\"passed\"} %llu\n"
+              "loom_traffic_gen_packets_total{verdict=\"dropped\"} %llu\n",
+              (unsigned long long)gen.passed,
+              (unsigned long long)(gen.sent - gen.passed));
+}
+
+int stats_format_prometheus(char *buf, size_t len)
+{
+    stats_buf_t sb = { .buf = buf, .len = len };
+
+    if (len == 0) {
+        return -1;
+    }
+    buf[0] = '\0';
+
+    prom_capture(&sb);
+    prom_fastpath(&sb);
+    prom_nf(&sb);
+    prom_drops(&sb);
+    prom_tables(&sb);
+    prom_sampler(&sb);
+    prom_flows(&sb);
+    prom_memory(&sb);
+    prom_traffic_gen(&sb);
+
+    return sb_finish(&sb);
+}
+
+#undef PROM_METRIC
+
+/* HTTP */
+
+/* SO_SNDTIMEO bounds each send, the deadline a client reading slowly */
+static int send_all(int fd, const char *buf, size_t len, uint64_t deadline)
+{
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, 0);
+        if (n <= 0 || (len > (size_t)n && loom_now_ns() >= deadline)) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void http_reply(int fd, const char *status, const char *type,
+                       const char *body, size_t body_len)
+{
+    char hdr[192];
+    int n = snprintf(hdr, sizeof(hdr),
+                     "HTTP/1.0 %s\r\n"
+                     "Content-Type: %s\r\n"
+                     "Content-Length: %zu\r\n"
+                     "Connection: close\r\n\r\n",
+                     status, type, body_len);
+    uint64_t deadline = loom_now_ns() + STATS_HTTP_TIMEOUT_MS * 1000000ULL;
+
+    if (send_all(fd, hdr, n, deadline) == 0) {
+        send_all(fd, body, body_len, deadline);
+    }
+}
+
+static void http_handle(int fd, char *out)
+{
+    char req[STATS_HTTP_REQ_MAX];
+    size_t used = 0;
+    ssize_t n = 0;
+    struct timeval tv = {
+        .tv_sec = STATS_HTTP_TIMEOUT_MS / 1000,
+        .tv_usec = (STATS_HTTP_TIMEOUT_MS % 1000) * 1000,
+    };
+    uint64_t deadline = loom_now_ns() + STATS_HTTP_TIMEOUT_MS * 1000000ULL;
+
+    /* The server is single threaded, a silent client must not hold it */
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    /* Only the request line matters, headers are read and ignored */
+    while (used < sizeof(req) - 1 &&
+           (n = recv(fd, req + used, sizeof(req) - 1 - used, 0)) > 0) {
+        used += n;
+        req[used] = '\0';
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) {
+            break;
+        }
+        /* Trickling bytes does not extend it */
+        if (loom_now_ns() >= deadline) {
+            return;
+        }
+    }
+    if (n < 0) {
+        return;
+    }
+    req[used] = '\0';
+
+    char *eol = strpbrk(req, "\r\n");
+    if (eol) {
+        *eol = '\0';
+    }
+
+    char method[8], path[64];
+    if (sscanf(req, "%7s %63s", method, path) != 2) {
+        const char *msg = "bad request\n";
+        http_reply(fd, "400 Bad Request", "text/plain", msg, strlen(msg));
+        return;
+    }
+    char *query = strchr(path, '?');
+    if (query) {
+        *query = '\0';
+    }
+
+    if (strcmp(method, "GET") != 0) {
+        const char *msg = "only GET is supported\n";
+        http_reply(fd, "405 Method Not Allowed", "text/plain", msg, strlen(msg));
+        return;
+    }
+
+    int len;
+    const char *type;
+    if (strcmp(path, "/metrics") == 0) {
+        len = stats_format_prometheus(out, STATS_EXPORT_BUF_SIZE);
+        type = "text/plain; version=0.0.4";
+    } else if (strcmp(path, "/stats") == 0) {
+        len = stats_format_json(out, STATS_EXPORT_BUF_SIZE);
+        type = "application/json";
+    } else {
+        const char *msg = "try /metrics or /stats\n";
+        http_reply(fd, "404 Not Found", "text/plain", msg, strlen(msg));
+        return;
+    }
+
+    if (len < 0) {
+        const char *msg = "statistics do not fit the response buffer\n";
+        http_reply(fd, "500 Internal Server Error", "text/plain", msg, strlen(msg));
+        return;
+    }
+    http_reply(fd, "200 OK", type, out, len);
+}
+
+/* Requests are served one at a time, a scrape is a few milliseconds */
+static void stats_http_thread(void *arg)
+{
+    int port = (int)(intptr_t)arg;
+    int server_fd = control_listen(port);
+    char *out;
+
+    if (server_fd < 0) {
+        return;
+    }
+
+    out = malloc(STATS_EXPORT_BUF_SIZE);
+    if (!out) {
+        printf("[STATS] ERROR: Could not allocate response buffer\n");
+        close(server_fd);
+        return;
+    }
+
+    printf("[STATS] HTTP endpoint listening on port %d\n", port);
+
+    while (1) {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_fd = accept(server_fd, (struct sockaddr *)&client_addr,
+                               &client_len);
+
+        if (client_fd < 0) {
+            printf("[STATS] ERROR: Could not accept connection\n");
+            continue;
+        }
+
+        http_handle(client_fd, out);
+        close(client_fd);
+    }
+}
+
+int stats_http_init(int port)
+{
+    sys_thread_t thread = sys_thread_new("stats_http",
+                                          stats_http_thread,
+                                          (void *)(intptr_t)port,
+                                          4096,
+                                          3);
+
+    if (thread == NULL) {
+        printf("[STATS] ERROR: Could not create HTTP thread\n");
+        return -1;
+    }
+
+    return 0;
+}
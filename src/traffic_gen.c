@@ -0,0 +1,260 @@
+#include "loom/traffic_gen.h"
+#include "loom/capture.h"
+#include "loom/clock.h"
+#include "loom/nf_chain.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uk/sched.h>
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/sys.h"
+#include "lwip/prot/ethernet.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+#include "lwip/prot/udp.h"
+
+#define GEN_MIN_FRAME (SIZEOF_ETH_HDR + IP_HLEN + TCP_HLEN)
+#define GEN_MAX_FRAME 1514
+
+typedef enum {
+    GEN_IDLE = 0,
+    GEN_RUNNING,
+    GEN_STOPPING,
+} gen_state_t;
+
+typedef struct {
+    uint32_t src_ip;            /* Network byte order */
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t proto;
+    bool started;               /* TCP flows open with a SYN */
+} gen_flow_t;
+
+static volatile gen_state_t state = GEN_IDLE;
+static traffic_gen_config_t config;
+static gen_flow_t *flows = NULL;
+static traffic_gen_stats_t stats;
+
+static struct pbuf *burst_pkts[NF_BATCH_MAX];
+
+static uint32_t rng_state = 1;
+
+static uint32_t gen_rand(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+void traffic_gen_default_config(traffic_gen_config_t *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->flows = 1024;
+    cfg->pkt_size = 64;
+    cfg->proto = IP_PROTO_UDP;
+    cfg->port_lo = 80;
+    cfg->port_hi = 80;
+    cfg->src_net = 0x0a000000;  /* 10.0.0.0/8 */
+    cfg->src_depth = 8;
+    cfg->dist = GEN_DIST_UNIFORM;
+    cfg->burst = 32;
+
+    if (netif_default) {
+        cfg->dst_ip = netif_ip4_addr(netif_default)->addr;
+    }
+}
+
+static void gen_build_flows(void)
+{
+    uint32_t host_mask = config.src_depth >= 32 ? 0 :
+                         0xffffffffU >> config.src_depth;
+    uint32_t ports = (uint32_t)config.port_hi - config.port_lo + 1;
+
+    rng_state = (uint32_t)loom_now_ns() | 1;
+
+    for (uint32_t i = 0; i < config.flows; i++) {
+        gen_flow_t *flow = &flows[i];
+        uint32_t src = (config.src_net & ~host_mask) | (gen_rand() & host_mask);
+
+        flow->src_ip = lwip_htonl(src);
+        flow->src_port = 1024 + (gen_rand() % 64512);
+        flow->dst_port = config.port_lo + (i % ports);
+        flow->proto = config.proto ? config.proto :
+                      ((i & 1) ? IP_PROTO_UDP : IP_PROTO_TCP);
+        flow->started = false;
+    }
+}
+
+static gen_flow_t *gen_next_flow(uint32_t *cursor)
+{
+    if (config.dist == GEN_DIST_HOT && config.flows >= 5 && gen_rand() % 10 < 8) {
+        return &flows[gen_rand() % (config.flows / 5)];
+    }
+
+    gen_flow_t *flow = &flows[*cursor];
+    if (++*cursor == config.flows) {
+        *cursor = 0;
+    }
+    return flow;
+}
+
+/* Only the headers are written, the payload is whatever the pool holds */
+static void gen_fill(struct pbuf *p, gen_flow_t *flow)
+{
+    uint8_t *data = (uint8_t *)p->payload;
+    uint16_t size = p->len;
+
+    struct eth_hdr *eth = (struct eth_hdr *)data;
+    memset(eth->dest.addr, 0x02, ETH_HWADDR_LEN);
+    memset(eth->src.addr, 0x04, ETH_HWADDR_LEN);
+    eth->type = PP_HTONS(ETHTYPE_IP);
+
+    struct ip_hdr *ip = (struct ip_hdr *)(data + SIZEOF_ETH_HDR);
+    memset(ip, 0, IP_HLEN);
+    IPH_VHL_SET(ip, 4, IP_HLEN / 4);
+    IPH_LEN(ip) = lwip_htons(size - SIZEOF_ETH_HDR);
+    IPH_TTL(ip) = 64;
+    IPH_PROTO(ip) = flow->proto;
+    ip->src.addr = flow->src_ip;
+    ip->dest.addr = config.dst_ip;
+
+    uint8_t *l4 = data + SIZEOF_ETH_HDR + IP_HLEN;
+    if (flow->proto == IP_PROTO_TCP) {
+        struct tcp_hdr *tcp = (struct tcp_hdr *)l4;
+        memset(tcp, 0, TCP_HLEN);
+        tcp->src = lwip_htons(flow->src_port);
+        tcp->dest = lwip_htons(flow->dst_port);
+        TCPH_HDRLEN_FLAGS_SET(tcp, TCP_HLEN / 4,
+                              flow->started ? TCP_ACK : TCP_SYN);
+        tcp->wnd = PP_HTONS(65535);
+        flow->started = true;
+    } else {
+        struct udp_hdr *udp = (struct udp_hdr *)l4;
+        udp->src = lwip_htons(flow->src_port);
+        udp->dest = lwip_htons(flow->dst_port);
+        udp->len = lwip_htons(size - SIZEOF_ETH_HDR - IP_HLEN);
+        udp->chksum = 0;
+    }
+}
+
+static void traffic_gen_thread(void *arg)
+{
+    uint32_t cursor = 0;
+    uint64_t start = loom_now_ns();
+    uint64_t duration_ns = (uint64_t)config.duration_ms * 1000000ULL;
+
+    printf("[GEN] Started: %u flows, %u B frames, burst %u\n",
+           config.flows, config.pkt_size, config.burst);
+
+    while (state == GEN_RUNNING) {
+        uint64_t elapsed = loom_now_ns() - start;
+
+        if (duration_ns && elapsed >= duration_ns) {
+            break;
+        }
+
+        /* Pace in whole bursts against the configured rate */
+        if (config.rate_pps &&
+            stats.sent + config.burst >
+            (uint64_t)config.rate_pps * elapsed / LOOM_NSEC_PER_SEC) {
+            uk_sched_yield();
+            continue;
+        }
+
+        uint16_t n = 0;
+        while (n < config.burst) {
+            struct pbuf *p = pbuf_alloc(PBUF_RAW, config.pkt_size, PBUF_POOL);
+            if (!p) {
+                stats.alloc_failed++;
+                break;
+            }
+            gen_fill(p, gen_next_flow(&cursor));
+            burst_pkts[n++] = p;
+        }
+
+        if (n > 0) {
+            stats.passed += capture_inject_burst(burst_pkts, n);
+            stats.sent += n;
+            stats.bytes += (uint64_t)n * config.pkt_size;
+        }
+        stats.elapsed_ns = loom_now_ns() - start;
+
+        /* Cooperative scheduler: let lwIP and the control server run */
+        uk_sched_yield();
+    }
+
+    stats.elapsed_ns = loom_now_ns() - start;
+    stats.running = false;
+
+    printf("[GEN] Stopped: %llu packets, %llu passed in %llu ms\n",
+           (unsigned long long)stats.sent,
+           (unsigned long long)stats.passed,
+           (unsigned long long)(stats.elapsed_ns / 1000000));
+
+    free(flows);
+    flows = NULL;
+    state = GEN_IDLE;
+}
+
+int traffic_gen_start(const traffic_gen_config_t *cfg)
+{
+    if (state != GEN_IDLE) {
+        printf("[GEN] ERROR: Generator already running\n");
+        return -1;
+    }
+
+    if (cfg->flows == 0 || cfg->flows > TRAFFIC_GEN_MAX_FLOWS ||
+        cfg->pkt_size < GEN_MIN_FRAME || cfg->pkt_size > GEN_MAX_FRAME ||
+        cfg->burst == 0 || cfg->burst > NF_BATCH_MAX ||
+        cfg->port_lo > cfg->port_hi || cfg->src_depth > 32 ||
+        (cfg->proto != 0 && cfg->proto != IP_PROTO_TCP &&
+         cfg->proto != IP_PROTO_UDP)) {
+        printf("[GEN] ERROR: Invalid configuration\n");
+        return -1;
+    }
+
+    flows = malloc((size_t)cfg->flows * sizeof(gen_flow_t));
+    if (!flows) {
+        printf("[GEN] ERROR: Could not allocate %u flows\n", cfg->flows);
+        return -1;
+    }
+
+    config = *cfg;
+    gen_build_flows();
+
+    memset(&stats, 0, sizeof(stats));
+    stats.running = true;
+    state = GEN_RUNNING;
+
+    sys_thread_t thread = sys_thread_new("traffic_gen",
+                                          traffic_gen_thread,
+                                          NULL,
+                                          4096,
+                                          1);
+
+    if (thread == NULL) {
+        printf("[GEN] ERROR: Could not create generator thread\n");
+        free(flows);
+        flows = NULL;
+        stats.running = false;
+        state = GEN_IDLE;
+        return -1;
+    }
+
+    return 0;
+}
+
+void traffic_gen_stop(void)
+{
+    if (state == GEN_RUNNING) {
+        state = GEN_STOPPING;
+    }
+}
+
+traffic_gen_stats_t traffic_gen_get_stats(void)
+{
+    return stats;
+}
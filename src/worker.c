@@ -0,0 +1,19 @@
+#include "loom/worker.h"
+
+__thread unsigned int loom_worker_id = 0;
+unsigned int loom_num_workers = 1;
+
+void loom_worker_register(unsigned int id)
+{
+    loom_worker_id = id < LOOM_MAX_WORKERS ? id : 0;
+}
+
+void loom_set_num_workers(unsigned int count)
+{
+    if (count == 0) {
+        count = 1;
+    } else if (count > LOOM_MAX_WORKERS) {
+        count = LOOM_MAX_WORKERS;
+    }
+    loom_num_workers = count;
+}